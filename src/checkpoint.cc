@@ -54,6 +54,8 @@ public:
             config.setCheckpointMaxItems(value);
         } else if (key.compare("max_checkpoints") == 0) {
             config.setMaxCheckpoints(value);
+        } else if (key.compare("chk_max_size") == 0) {
+            config.setCheckpointMaxSize(value);
         }
     }
 
@@ -64,6 +66,8 @@ public:
             config.allowKeepClosedCheckpoints(value);
         } else if (key.compare("enable_chk_merge") == 0) {
             config.allowCheckpointMerge(value);
+        } else if (key.compare("chk_expel_enabled") == 0) {
+            config.allowCheckpointExpel(value);
         }
     }
 
@@ -112,6 +116,7 @@ Checkpoint::~Checkpoint() {
         "Checkpoint %" PRIu64 " for vbucket %d is purged from memory",
         checkpointId, vbucketId);
     stats.memOverhead->fetch_sub(memorySize());
+    stats.checkpointMemUsage->fetch_sub(getTotalMemConsumption());
     if (stats.memOverhead->load() >= GIGANTOR) {
         LOG(EXTENSION_LOG_WARNING,
             "Checkpoint::~Checkpoint: stats.memOverhead (which is %" PRId64
@@ -131,8 +136,23 @@ void Checkpoint::setState(checkpoint_state state) {
 void Checkpoint::popBackCheckpointEndItem() {
     if (!toWrite.empty() &&
         toWrite.back()->getOperation() == queue_op::checkpoint_end) {
+        const size_t queueMemory = toWrite.getMemorySize();
         metaKeyIndex.erase(toWrite.back()->getKey());
         toWrite.pop_back();
+        updateQueueMemOverhead(queueMemory);
+    }
+}
+
+void Checkpoint::updateQueueMemOverhead(size_t prevQueueMemory) {
+    const size_t queueMemory = toWrite.getMemorySize();
+    if (queueMemory > prevQueueMemory) {
+        memOverhead += queueMemory - prevQueueMemory;
+        stats.memOverhead->fetch_add(queueMemory - prevQueueMemory);
+        stats.checkpointMemUsage->fetch_add(queueMemory - prevQueueMemory);
+    } else {
+        memOverhead -= prevQueueMemory - queueMemory;
+        stats.memOverhead->fetch_sub(prevQueueMemory - queueMemory);
+        stats.checkpointMemUsage->fetch_sub(prevQueueMemory - queueMemory);
     }
 }
 
@@ -148,6 +168,7 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
                         ") is not OPEN");
     }
     queue_dirty_t rv;
+    const size_t queueMemory = toWrite.getMemorySize();
     checkpoint_index::iterator it = keyIndex.find(qi->getKey());
     // Check if the item is a meta item
     if (qi->isCheckPointMetaItem()) {
@@ -174,9 +195,9 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
             // iterated over.
             for (auto& cursor : checkpointManager->connCursors) {
 
-                if (*(cursor.second.currentCheckpoint) == this) {
+                if (*(cursor.second->currentCheckpoint) == this) {
 
-                    queued_item& cursor_item = *(cursor.second.currentPos);
+                    queued_item& cursor_item = *(cursor.second->currentPos);
 
                     auto& index =
                             cursor_item->isCheckPointMetaItem() ? metaKeyIndex
@@ -207,20 +228,22 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
                         // this key - need to logically move the cursor
                         // backwards one so it will pick up the new value for
                         // this key.
-                        cursor.second.decrOffset(1);
-                        if (cursor.second.name == CheckpointManager::pCursorName) {
+                        cursor.second->decrOffset(1);
+                        if (cursor.second == checkpointManager->persistenceCursor) {
                             rv = PERSIST_AGAIN;
                         }
                     }
                     /* If an TAP cursor points to the existing item for the same
                        key, shift it left by 1 */
-                    if (cursor.second.currentPos == currPos) {
-                        cursor.second.decrPos();
+                    if (cursor.second->currentPos == currPos) {
+                        cursor.second->decrPos();
                     }
                 }
             }
 
             toWrite.push_back(qi);
+            // The new revision replaces the existing one in the memory usage.
+            decrementMemConsumption((*currPos)->size());
             // Remove the existing item for the same key from the list.
             toWrite.erase(currPos);
         } else {
@@ -244,10 +267,12 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
             keyIndex[qi->getKey()] = entry;
         }
         if (rv == NEW_ITEM) {
-            size_t newEntrySize = qi->getKey().size() +
-                                  sizeof(index_entry) + sizeof(queued_item);
+            // The queue's own memory is accounted as its chunks are
+            // allocated, see updateQueueMemOverhead().
+            size_t newEntrySize = qi->getKey().size() + sizeof(index_entry);
             memOverhead += newEntrySize;
             stats.memOverhead->fetch_add(newEntrySize);
+            stats.checkpointMemUsage->fetch_add(newEntrySize);
             if (stats.memOverhead->load() >= GIGANTOR) {
                 LOG(EXTENSION_LOG_WARNING,
                     "Checkpoint::queueDirty: stats.memOverhead (which is %" PRId64
@@ -256,6 +281,8 @@ queue_dirty_t Checkpoint::queueDirty(const queued_item &qi,
             }
         }
     }
+    updateQueueMemOverhead(queueMemory);
+    incrementMemConsumption(qi->size());
 
     // Notify flusher if in case queued item is a checkpoint meta item or
     // vbpersist state.
@@ -292,8 +319,10 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
     ++itr;
     (*itr)->setBySeqno(seqno);
 
-    // Iterate in reverse over the previous checkpoints' items, inserting them
-    // into the current checkpoint as necessary.
+    // Iterate in reverse over the previous checkpoints' items, selecting the
+    // ones to insert into the current checkpoint (newest first). Their index
+    // entries are positioned once the queue has been rebuilt below.
+    std::vector<queued_item> prevItems;
     for (auto rit = pPrevCheckpoint->rbegin(); rit != pPrevCheckpoint->rend();
             ++rit) {
         const auto key = (*rit)->getKey();
@@ -305,10 +334,9 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
                 // present then it must be an older revision and hence we can
                 // safely discard it).
                 if (keyIndex.find(key) == keyIndex.end()) {
-                    // Skip the first two meta items (empty & checkpoint start).
-                    auto pos = std::next(toWrite.begin(), 2);
-                    toWrite.insert(pos, *rit);
-                    index_entry entry = {--pos, static_cast<int64_t>(pPrevCheckpoint->
+                    prevItems.push_back(*rit);
+                    index_entry entry = {CheckpointQueue::iterator(),
+                                         static_cast<int64_t>(pPrevCheckpoint->
                                                     getMutationIdForKey(key, false))};
                     keyIndex[key] = entry;
                     newEntryMemOverhead += key.size() + sizeof(index_entry);
@@ -343,12 +371,11 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
             case queue_op::system_event:
                 // Need to re-insert these into the correct place in the index.
                 if (metaKeyIndex.find(key) == metaKeyIndex.end()) {
-                    // Skip the first two meta items (empty & checkpoint start).
-                    auto pos = std::next(toWrite.begin(), 2);
-                    toWrite.insert(pos, *rit);
+                    prevItems.push_back(*rit);
                     auto mutationId = static_cast<int64_t>(
                             pPrevCheckpoint->getMutationIdForKey(key, true));
-                    metaKeyIndex[key] = {--pos, mutationId};
+                    metaKeyIndex[key] = {CheckpointQueue::iterator(),
+                                         mutationId};
                     newEntryMemOverhead += key.size() + sizeof(index_entry);
                     ++numMetaItems;
                     ++numNewItems;
@@ -360,6 +387,37 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
         }
     }
 
+    // Insert the selected items (in their original order) after the first
+    // two meta items (empty & checkpoint start). Elements are only ever
+    // appended to the queue, so the two meta items are moved to a new queue
+    // followed by the selected items, which is then spliced in front of the
+    // existing items. The existing items stay where they are: the positions
+    // of the cursors in this checkpoint and of its index entries remain
+    // valid.
+    if (!prevItems.empty()) {
+        const size_t queueMemory = toWrite.getMemorySize();
+        CheckpointQueue front;
+        auto pos = toWrite.begin();
+        front.push_back(*pos);
+        pos = toWrite.erase(pos);
+        front.push_back(*pos);
+        toWrite.erase(pos);
+        for (auto rit = prevItems.rbegin(); rit != prevItems.rend(); ++rit) {
+            front.push_back(*rit);
+        }
+
+        for (pos = front.begin(); pos != front.end(); ++pos) {
+            auto& index =
+                    (*pos)->isCheckPointMetaItem() ? metaKeyIndex : keyIndex;
+            auto entry = index.find((*pos)->getKey());
+            if (entry != index.end()) {
+                entry->second.position = pos;
+            }
+        }
+        toWrite.splice_front(front);
+        updateQueueMemOverhead(queueMemory);
+    }
+
     /**
      * Update snapshot start of current checkpoint to the first
      * item's sequence number, after merge completed, as items
@@ -367,9 +425,14 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
      * checkpoint.
      */
     setSnapshotStartSeqno(getLowSeqno());
+    // The items expelled from the previous checkpoint can't be read from
+    // this one either.
+    highestExpelledSeqno = std::max(highestExpelledSeqno,
+                                    pPrevCheckpoint->highestExpelledSeqno);
 
     memOverhead += newEntryMemOverhead;
     stats.memOverhead->fetch_add(newEntryMemOverhead);
+    stats.checkpointMemUsage->fetch_add(newEntryMemOverhead);
     LOG(EXTENSION_LOG_WARNING,
         "Checkpoint::mergePrevCheckpoint: stats.memOverhead (which is %" PRId64
         ") is greater than %" PRId64, uint64_t(stats.memOverhead->load()),
@@ -377,6 +440,46 @@ size_t Checkpoint::mergePrevCheckpoint(Checkpoint *pPrevCheckpoint) {
     return numNewItems;
 }
 
+size_t Checkpoint::expelItems(CheckpointQueue::iterator last,
+                              size_t& memoryFreed) {
+    const size_t queueMemory = toWrite.getMemorySize();
+    size_t expelled = 0;
+    size_t itemsMemory = 0;
+    size_t indexMemory = 0;
+    auto pos = toWrite.begin();
+    while (pos != last) {
+        const queued_item& qi = *pos;
+        if (qi->isCheckPointMetaItem()) {
+            // Meta items (the dummy item, checkpoint_start, ...) are kept: the
+            // cursors and the merging of checkpoints rely on them.
+            ++pos;
+            continue;
+        }
+        auto entry = keyIndex.find(qi->getKey());
+        if (entry != keyIndex.end()) {
+            indexMemory += qi->getKey().size() + sizeof(index_entry);
+            keyIndex.erase(entry);
+        }
+        highestExpelledSeqno = std::max(highestExpelledSeqno,
+                                        uint64_t(qi->getBySeqno()));
+        itemsMemory += qi->size();
+        --numItems;
+        ++expelled;
+        pos = toWrite.erase(pos);
+    }
+
+    itemsMemory = std::min(effectiveMemUsage, itemsMemory);
+    effectiveMemUsage -= itemsMemory;
+    memOverhead -= indexMemory;
+    stats.memOverhead->fetch_sub(indexMemory);
+    stats.checkpointMemUsage->fetch_sub(itemsMemory + indexMemory);
+    updateQueueMemOverhead(queueMemory);
+
+    memoryFreed = itemsMemory + indexMemory +
+                  (queueMemory - toWrite.getMemorySize());
+    return expelled;
+}
+
 uint64_t Checkpoint::getMutationIdForKey(const DocKey& key, bool isMeta) {
     uint64_t mid = 0;
     checkpoint_index& chkIdx = isMeta ? metaKeyIndex : keyIndex;
@@ -394,18 +497,6 @@ uint64_t Checkpoint::getMutationIdForKey(const DocKey& key, bool isMeta) {
     return mid;
 }
 
-bool Checkpoint::isEligibleToBeUnreferenced() {
-    const std::set<std::string> &cursors = getCursorNameList();
-    std::set<std::string>::const_iterator cit = cursors.begin();
-    for (; cit != cursors.end(); ++cit) {
-        if ((*cit).compare(CheckpointManager::pCursorName) == 0) {
-            // Persistence cursor is on current checkpoint
-            return false;
-        }
-    }
-    return true;
-}
-
 std::ostream& operator <<(std::ostream& os, const Checkpoint& c) {
     os << "Checkpoint[" << &c << "] with"
        << " seqno:{" << c.getLowSeqno() << "," << c.getHighSeqno() << "}"
@@ -435,6 +526,8 @@ CheckpointManager::CheckpointManager(EPStats& st,
       lastClosedChkBySeqno(lastSeqno),
       isCollapsedCheckpoint(false),
       pCursorPreCheckpointId(0),
+      lockFreeReaders(0),
+      hasRetiredCheckpoints(false),
       flusherCB(cb) {
     LockHolder lh(queueLock);
     addNewCheckpoint_UNLOCKED(1, lastSnapStart, lastSnapEnd);
@@ -450,6 +543,9 @@ CheckpointManager::~CheckpointManager() {
         delete *it;
         ++it;
     }
+    for (auto* chk : retiredCheckpoints) {
+        delete chk;
+    }
 }
 
 uint64_t CheckpointManager::getOpenCheckpointId_UNLOCKED() {
@@ -554,7 +650,7 @@ bool CheckpointManager::addNewCheckpoint_UNLOCKED(uint64_t id,
        remover can remove the closed checkpoints and hence reduce the memory
        usage */
     for (auto& cur_it : connCursors) {
-        CheckpointCursor &cursor = cur_it.second;
+        CheckpointCursor &cursor = *cur_it.second;
         ++(cursor.currentPos);
         if ((cursor.shouldSendCheckpointEndMetaItem() ==
              MustSendCheckpointEnd::NO) &&
@@ -659,11 +755,10 @@ CursorRegResult CheckpointManager::registerCursorBySeqno(
         if (startBySeqno < st) {
             // Requested sequence number is before the start of this
             // checkpoint, position cursor at the checkpoint start.
-            connCursors[name] = CheckpointCursor(name, itr, (*itr)->begin(),
-                                                 skipped, /*meta_offset*/0,
-                                                 false,
-                                                 needsCheckPointEndMetaItem);
-            (*itr)->registerCursorName(name);
+            setCursor_UNLOCKED(CheckpointCursor(name, itr, (*itr)->begin(),
+                                                skipped, /*meta_offset*/0,
+                                                false,
+                                                needsCheckPointEndMetaItem));
             result.first = (*itr)->getLowSeqno();
             break;
         } else if (startBySeqno <= en) {
@@ -688,10 +783,9 @@ CursorRegResult CheckpointManager::registerCursorBySeqno(
                 --iitr;
             }
 
-            connCursors[name] = CheckpointCursor(name, itr, iitr, skipped,
-                                                 ckpt_meta_skipped, false,
-                                                 needsCheckPointEndMetaItem);
-            (*itr)->registerCursorName(name);
+            setCursor_UNLOCKED(CheckpointCursor(name, itr, iitr, skipped,
+                                                ckpt_meta_skipped, false,
+                                                needsCheckPointEndMetaItem));
             break;
         } else {
             // Whole (closed) checkpoint skipped, increment by it's number
@@ -745,12 +839,7 @@ bool CheckpointManager::registerCursor_UNLOCKED(
         "Register the cursor with name \"%s\" for vbucket %d",
         name.c_str(), vbucketId);
 
-    // If the cursor exists, remove its name from the checkpoint that is
-    // currently referenced by it.
     cursor_index::iterator map_it = connCursors.find(name);
-    if (map_it != connCursors.end()) {
-        (*(map_it->second.currentCheckpoint))->removeCursorName(name);
-    }
 
     if (!found) {
         for (it = checkpointList.begin(); it != checkpointList.end(); ++it) {
@@ -779,11 +868,10 @@ bool CheckpointManager::registerCursor_UNLOCKED(
             offset += (*pos)->getNumItems() + (*pos)->getNumMetaItems();
         }
 
-        connCursors[name] = CheckpointCursor(name, it, (*it)->begin(), offset,
-                                             /*meta_offset*/0,
-                                             resetOnCollapse,
-                                             needsCheckpointEndMetaItem);
-        (*it)->registerCursorName(name);
+        setCursor_UNLOCKED(CheckpointCursor(name, it, (*it)->begin(), offset,
+                                            /*meta_offset*/0,
+                                            resetOnCollapse,
+                                            needsCheckpointEndMetaItem));
     } else {
         size_t offset = 0, meta_offset = 0;
         CheckpointQueue::iterator curr;
@@ -795,13 +883,13 @@ bool CheckpointManager::registerCursor_UNLOCKED(
 
         if (!alwaysFromBeginning &&
             map_it != connCursors.end() &&
-            (*(map_it->second.currentCheckpoint))->getId() == (*it)->getId()) {
+            (*(map_it->second->currentCheckpoint))->getId() == (*it)->getId()) {
             // If the cursor is currently in the checkpoint to start with,
             // simply start from
             // its current position.
-            curr = map_it->second.currentPos;
-            offset = map_it->second.offset;
-            meta_offset = map_it->second.ckptMetaItemsRead;
+            curr = map_it->second->currentPos;
+            offset = map_it->second->offset;
+            meta_offset = map_it->second->ckptMetaItemsRead;
         } else {
             // Set the cursor's position to the beginning of the checkpoint to
             // start with
@@ -814,12 +902,10 @@ bool CheckpointManager::registerCursor_UNLOCKED(
             }
         }
 
-        connCursors[name] = CheckpointCursor(name, it, curr, offset,
-                                             meta_offset,
-                                             resetOnCollapse,
-                                             needsCheckpointEndMetaItem);
-        // Register the cursor's name to the checkpoint.
-        (*it)->registerCursorName(name);
+        setCursor_UNLOCKED(CheckpointCursor(name, it, curr, offset,
+                                            meta_offset,
+                                            resetOnCollapse,
+                                            needsCheckpointEndMetaItem));
     }
 
     return found;
@@ -840,23 +926,50 @@ bool CheckpointManager::removeCursor_UNLOCKED(const std::string &name) {
         "Remove the checkpoint cursor with the name \"%s\" from vbucket %d",
         name.c_str(), vbucketId);
 
-    // We can simply remove the cursor's name from the checkpoint to which it
-    // currently belongs,
-    // by calling
-    // (*(it->second.currentCheckpoint))->removeCursorName(name);
-    // However, we just want to do more sanity checks by looking at each
-    // checkpoint. This won't
-    // cause much overhead because the max number of checkpoints allowed per
-    // vbucket is small.
-    std::list<Checkpoint*>::iterator cit = checkpointList.begin();
-    for (; cit != checkpointList.end(); ++cit) {
-        (*cit)->removeCursorName(name);
+    (*(it->second->currentCheckpoint))->decNumOfCursors();
+    if (it->second == persistenceCursor) {
+        persistenceCursor.reset();
     }
-
+    // Any handle to the cursor expires with it.
     connCursors.erase(it);
     return true;
 }
 
+void CheckpointManager::setCursor_UNLOCKED(const CheckpointCursor& position) {
+    auto& cursor = connCursors[position.name];
+    if (cursor) {
+        // Keep the same cursor object so that existing handles to it
+        // remain valid.
+        (*(cursor->currentCheckpoint))->decNumOfCursors();
+        *cursor = position;
+    } else {
+        cursor = std::make_shared<CheckpointCursor>(position);
+        if (position.name == pCursorName) {
+            persistenceCursor = cursor;
+        }
+    }
+    (*(cursor->currentCheckpoint))->incNumOfCursors();
+}
+
+void CheckpointManager::recountCursors_UNLOCKED() {
+    for (auto* chk : checkpointList) {
+        chk->resetNumOfCursors();
+    }
+    for (auto& cursor : connCursors) {
+        (*(cursor.second->currentCheckpoint))->incNumOfCursors();
+    }
+}
+
+CheckpointCursorHandle CheckpointManager::getCursorHandle(
+        const std::string& name) const {
+    LockHolder lh(queueLock);
+    auto it = connCursors.find(name);
+    if (it == connCursors.end()) {
+        return CheckpointCursorHandle();
+    }
+    return it->second;
+}
+
 uint64_t CheckpointManager::getCheckpointIdForCursor(const std::string &name) {
     LockHolder lh(queueLock);
     cursor_index::iterator it = connCursors.find(name);
@@ -864,7 +977,7 @@ uint64_t CheckpointManager::getCheckpointIdForCursor(const std::string &name) {
         return 0;
     }
 
-    return (*(it->second.currentCheckpoint))->getId();
+    return (*(it->second->currentCheckpoint))->getId();
 }
 
 size_t CheckpointManager::getNumOfCursors() {
@@ -883,7 +996,7 @@ checkpointCursorInfoList CheckpointManager::getAllCursors() {
     for (auto& cur_it : connCursors) {
         cursorInfo.push_back(std::make_pair(
                         (cur_it.first),
-                        (cur_it.second.shouldSendCheckpointEndMetaItem())));
+                        (cur_it.second->shouldSendCheckpointEndMetaItem())));
     }
     return cursorInfo;
 }
@@ -896,7 +1009,12 @@ bool CheckpointManager::isCheckpointCreationForHighMemUsage(
     bool allCursorsInOpenCheckpoint =
         (connCursors.size() + 1) == checkpointList.back()->getNumberOfCursors();
 
-    if (memoryUsed > stats.mem_high_wat && allCursorsInOpenCheckpoint &&
+    // The checkpoints exceeding their memory quota is treated like a high
+    // memory usage of the bucket.
+    bool highMemUsage = memoryUsed > stats.mem_high_wat ||
+                        stats.isCheckpointMemQuotaExceeded();
+
+    if (highMemUsage && allCursorsInOpenCheckpoint &&
         (checkpointList.back()->getNumItems() >= MIN_CHECKPOINT_ITEMS ||
          checkpointList.back()->getNumItems() ==
                  vbucket.ht.getNumInMemoryItems())) {
@@ -945,8 +1063,6 @@ size_t CheckpointManager::removeClosedUnrefCheckpoints(
          it != checkpointList.end() && std::next(it) != checkpointList.end();
          ++it) {
 
-        removeInvalidCursorsOnCheckpoint(*it);
-
         // When we encounter the first checkpoint which has cursor(s) in it,
         // or if the persistence cursor is still operating, stop.
         if ((*it)->getNumberOfCursors() > 0 ||
@@ -972,7 +1088,7 @@ size_t CheckpointManager::removeClosedUnrefCheckpoints(
     numItems.fetch_sub(total_items);
     if (total_items > 0) {
         for (auto& cursor : connCursors) {
-            cursor.second.decrOffset(total_items);
+            cursor.second->decrOffset(total_items);
         }
     }
     unrefCheckpointList.splice(unrefCheckpointList.begin(), checkpointList,
@@ -991,6 +1107,7 @@ size_t CheckpointManager::removeClosedUnrefCheckpoints(
         size_t new_remains = getNumItemsForCursor_UNLOCKED(pCursorName);
         updateDiskQueueStats(vbucket, curr_remains, new_remains);
     }
+    retireCheckpoints_UNLOCKED(unrefCheckpointList);
     lh.unlock();
 
     std::list<Checkpoint*>::iterator chkpoint_it = unrefCheckpointList.begin();
@@ -1001,23 +1118,63 @@ size_t CheckpointManager::removeClosedUnrefCheckpoints(
     return numUnrefItems;
 }
 
-void CheckpointManager::removeInvalidCursorsOnCheckpoint(
-                                                     Checkpoint *pCheckpoint) {
-    std::list<std::string> invalidCursorNames;
-    const std::set<std::string> &cursors = pCheckpoint->getCursorNameList();
-    std::set<std::string>::const_iterator cit = cursors.begin();
-    for (; cit != cursors.end(); ++cit) {
-        cursor_index::iterator mit = connCursors.find(*cit);
-        if (mit == connCursors.end() ||
-            pCheckpoint != *(mit->second.currentCheckpoint)) {
-            invalidCursorNames.push_back(*cit);
+size_t CheckpointManager::expelUnreferencedCheckpointItems(
+        VBucket& vbucket, size_t& memoryFreed) {
+    memoryFreed = 0;
+    LockHolder lh(queueLock);
+    // Readers may be copying items without the queueLock (see
+    // getItemsForCursor()); leave the checkpoints alone meanwhile.
+    if (!checkpointConfig.isCheckpointExpelEnabled() ||
+        lockFreeReaders.load() > 0) {
+        return 0;
+    }
+
+    // Only the oldest checkpoint is considered. If there is no cursor in it,
+    // removeClosedUnrefCheckpoints() will free it altogether.
+    Checkpoint* oldest = checkpointList.front();
+    if (oldest->getNumberOfCursors() == 0) {
+        return 0;
+    }
+
+    // Order of the items within a checkpoint: by seqno, a meta item coming
+    // before the non-meta item sharing its seqno.
+    auto itemOrder = [](const queued_item& qi) {
+        return 2 * uint64_t(qi->getBySeqno()) +
+               (qi->isCheckPointMetaItem() ? 0 : 1);
+    };
+
+    // Items before the earliest cursor of the checkpoint were read by all
+    // cursors. The item a cursor is at (the last one it read) is kept.
+    uint64_t earliestCursor = std::numeric_limits<uint64_t>::max();
+    for (const auto& cursor : connCursors) {
+        if (*(cursor.second->currentCheckpoint) == oldest) {
+            earliestCursor = std::min(earliestCursor,
+                                      itemOrder(*(cursor.second->currentPos)));
         }
     }
 
-    std::list<std::string>::iterator it = invalidCursorNames.begin();
-    for (; it != invalidCursorNames.end(); ++it) {
-        pCheckpoint->removeCursorName(*it);
+    // Items which aren't persisted yet may still be needed by a DCP
+    // backfill from disk for a stream starting before them.
+    uint64_t persistedSeqno = std::numeric_limits<uint64_t>::max();
+    if (checkpointConfig.isPersistenceEnabled()) {
+        persistedSeqno = vbucket.getPersistenceSeqno();
+    }
+
+    auto last = oldest->begin();
+    while (last != oldest->end() && itemOrder(*last) < earliestCursor &&
+           ((*last)->isCheckPointMetaItem() ||
+            uint64_t((*last)->getBySeqno()) <= persistedSeqno)) {
+        ++last;
+    }
+
+    size_t expelled = oldest->expelItems(last, memoryFreed);
+    if (expelled > 0) {
+        numItems.fetch_sub(expelled);
+        for (auto& cursor : connCursors) {
+            cursor.second->decrOffset(expelled);
+        }
     }
+    return expelled;
 }
 
 void CheckpointManager::collapseClosedCheckpoints(
@@ -1025,72 +1182,68 @@ void CheckpointManager::collapseClosedCheckpoints(
     // If there are one open checkpoint and more than one closed checkpoint,
     // collapse those
     // closed checkpoints into one checkpoint to reduce the memory overhead.
-    if (checkpointList.size() > 2) {
-        CursorIdToPositionMap slowCursors;
-        std::set<std::string> fastCursors;
+    // Merging rewrites the last closed checkpoint, which readers may be
+    // copying without the queueLock (see getItemsForCursor()); leave it
+    // for a later pass in that case.
+    if (checkpointList.size() > 2 && lockFreeReaders.load() == 0) {
         std::list<Checkpoint*>::iterator lastClosedChk = checkpointList.end();
         --lastClosedChk; --lastClosedChk; // Move to the last closed chkpt.
-        std::set<std::string>::iterator nitr =
-                (*lastClosedChk)->getCursorNameList().begin();
+        Checkpoint* pLastClosedCheckpoint = *lastClosedChk;
+        Checkpoint* pOpenCheckpoint = checkpointList.back();
         // Check if there are any cursors in the last closed checkpoint, which
         // haven't yet visited any regular items belonging to the last closed
         // checkpoint. If so, then we should skip collapsing checkpoints until
         // those cursors move to the first regular item. Otherwise, those cursors will
         // visit old items from collapsed checkpoints again.
-        for (; nitr != (*lastClosedChk)->getCursorNameList().end(); ++nitr) {
-            cursor_index::iterator cc = connCursors.find(*nitr);
-            if (cc == connCursors.end()) {
+        for (const auto& cc : connCursors) {
+            const CheckpointCursor& cursor = *cc.second;
+            if (*(cursor.currentCheckpoint) != pLastClosedCheckpoint) {
                 continue;
             }
-            queue_op qop = (*(cc->second.currentPos))->getOperation();
+            queue_op qop = (*(cursor.currentPos))->getOperation();
             if (qop ==  queue_op::empty || qop == queue_op::checkpoint_start) {
                 return;
             }
         }
 
-        fastCursors.insert((*lastClosedChk)->getCursorNameList().begin(),
-                           (*lastClosedChk)->getCursorNameList().end());
+        // Cursors in the last closed or the open checkpoint stay where they
+        // are; the others are repositioned in the collapsed checkpoint.
+        CursorIdToPositionMap slowCursors;
+        std::vector<CheckpointCursor*> fastCursors;
+        for (auto& cc : connCursors) {
+            CheckpointCursor& cursor = *cc.second;
+            Checkpoint* chk = *(cursor.currentCheckpoint);
+            if (chk == pLastClosedCheckpoint || chk == pOpenCheckpoint) {
+                fastCursors.push_back(&cursor);
+                continue;
+            }
+            const auto key = (*(cursor.currentPos))->getKey();
+            bool isMetaItem = (*(cursor.currentPos))->isCheckPointMetaItem();
+            bool cursor_on_chk_start = false;
+            if ((*(cursor.currentPos))->getOperation() ==
+                queue_op::checkpoint_start) {
+                cursor_on_chk_start = true;
+            }
+            slowCursors[cc.first] =
+                CursorPosition{chk->getMutationIdForKey(key, isMetaItem),
+                               cursor_on_chk_start};
+        }
+
         std::list<Checkpoint*>::reverse_iterator rit = checkpointList.rbegin();
         ++rit; ++rit; //Move to the second last closed checkpoint.
         size_t numDuplicatedItems = 0, numMetaItems = 0;
         for (; rit != checkpointList.rend(); ++rit) {
-            size_t numAddedItems = (*lastClosedChk)->mergePrevCheckpoint(*rit);
+            size_t numAddedItems = pLastClosedCheckpoint->mergePrevCheckpoint(*rit);
             numDuplicatedItems += ((*rit)->getNumItems() - numAddedItems);
             numMetaItems += (*rit)->getNumMetaItems();
-
-            std::set<std::string>::iterator nameItr =
-                (*rit)->getCursorNameList().begin();
-            for (; nameItr != (*rit)->getCursorNameList().end(); ++nameItr) {
-                cursor_index::iterator cc = connCursors.find(*nameItr);
-                const auto key = (*(cc->second.currentPos))->getKey();
-                bool isMetaItem =
-                            (*(cc->second.currentPos))->isCheckPointMetaItem();
-                bool cursor_on_chk_start = false;
-                if ((*(cc->second.currentPos))->getOperation() ==
-                    queue_op::checkpoint_start) {
-                    cursor_on_chk_start = true;
-                }
-                slowCursors[*nameItr] =
-                    CursorPosition{(*rit)->getMutationIdForKey(key, isMetaItem),
-                                   cursor_on_chk_start};
-            }
         }
         putCursorsInCollapsedChk(slowCursors, lastClosedChk);
 
         size_t total_items = numDuplicatedItems + numMetaItems;
         numItems.fetch_sub(total_items);
-        Checkpoint *pOpenCheckpoint = checkpointList.back();
-        const std::set<std::string> &openCheckpointCursors =
-                                    pOpenCheckpoint->getCursorNameList();
-        fastCursors.insert(openCheckpointCursors.begin(),
-                           openCheckpointCursors.end());
-        std::set<std::string>::const_iterator cit = fastCursors.begin();
         // Update the offset of each fast cursor.
-        for (; cit != fastCursors.end(); ++cit) {
-            cursor_index::iterator mit = connCursors.find(*cit);
-            if (mit != connCursors.end()) {
-                mit->second.decrOffset(total_items);
-            }
+        for (auto* cursor : fastCursors) {
+            cursor->decrOffset(total_items);
         }
         collapsedChks.splice(collapsedChks.end(), checkpointList,
                              checkpointList.begin(),  lastClosedChk);
@@ -1113,17 +1266,27 @@ std::vector<std::string> CheckpointManager::getListOfCursorsToDrop() {
         num_checkpoints_to_unref = 2;
     }
 
+    // Checkpoints whose cursors are to be dropped; stop at the one the
+    // persistence cursor is in.
+    std::set<const Checkpoint*> checkpointsToUnref;
     std::list<Checkpoint*>::const_iterator it = checkpointList.begin();
     while (num_checkpoints_to_unref != 0 && it != checkpointList.end()) {
-        if ((*it)->isEligibleToBeUnreferenced()) {
-            const std::set<std::string> &cursors = (*it)->getCursorNameList();
-            cursorsToDrop.insert(cursorsToDrop.end(), cursors.begin(), cursors.end());
-        } else {
+        if (persistenceCursor &&
+            *(persistenceCursor->currentCheckpoint) == *it) {
             break;
         }
+        checkpointsToUnref.insert(*it);
         --num_checkpoints_to_unref;
         ++it;
     }
+
+    if (!checkpointsToUnref.empty()) {
+        for (const auto& cursor : connCursors) {
+            if (checkpointsToUnref.count(*(cursor.second->currentCheckpoint))) {
+                cursorsToDrop.push_back(cursor.first);
+            }
+        }
+    }
     return cursorsToDrop;
 }
 
@@ -1135,8 +1298,6 @@ void CheckpointManager::updateStatsForNewQueuedItem_UNLOCKED(const LockHolder&,
         ++stats.diskQueueSize;
     }
     vb.doStatsForQueueing(*qi, qi->size());
-    // Update the checkpoint's memory usage
-    checkpointList.back()->incrementMemConsumption(qi->size());
 }
 
 bool CheckpointManager::queueDirty(VBucket& vb, queued_item& qi,
@@ -1239,41 +1400,161 @@ void CheckpointManager::queueSetVBState(VBucket& vb) {
 snapshot_range_t CheckpointManager::getAllItemsForCursor(
                                              const std::string& name,
                                              std::vector<queued_item> &items) {
-    LockHolder lh(queueLock);
-    snapshot_range_t range;
+    bool moreAvailable;
+    return getItemsForCursor(name, items, 0, 0, moreAvailable);
+}
+
+snapshot_range_t CheckpointManager::getAllItemsForCursor(
+        const CheckpointCursorHandle& cursor, std::vector<queued_item>& items) {
+    std::unique_lock<std::mutex> lh(queueLock);
+    // The cursor can only be removed with the queueLock held.
+    auto c = cursor.lock();
+    if (!c) {
+        return snapshot_range_t{0, 0};
+    }
+    bool moreAvailable;
+    return getItemsForCursor(lh, *c, items, 0, 0, moreAvailable);
+}
+
+snapshot_range_t CheckpointManager::getItemsForCursor(
+        const std::string& name,
+        std::vector<queued_item>& items,
+        size_t approxLimitItems,
+        size_t approxLimitBytes,
+        bool& moreAvailable) {
+    std::unique_lock<std::mutex> lh(queueLock);
+    moreAvailable = false;
     cursor_index::iterator it = connCursors.find(name);
     if (it == connCursors.end()) {
-        range.start = 0;
-        range.end = 0;
-        return range;
-    }
+        return snapshot_range_t{0, 0};
+    }
+    return getItemsForCursor(lh,
+                             *it->second,
+                             items,
+                             approxLimitItems,
+                             approxLimitBytes,
+                             moreAvailable);
+}
+
+snapshot_range_t CheckpointManager::getItemsForCursor(
+        std::unique_lock<std::mutex>& lh,
+        CheckpointCursor& cursor,
+        std::vector<queued_item>& items,
+        size_t approxLimitItems,
+        size_t approxLimitBytes,
+        bool& moreAvailable) {
+    snapshot_range_t range;
+    // What has been read so far, checked against the limits.
+    size_t numItems = 0;
+    size_t numBytes = 0;
+    auto limitReached = [&]() {
+        return (approxLimitItems != 0 && numItems >= approxLimitItems) ||
+               (approxLimitBytes != 0 && numBytes >= approxLimitBytes);
+    };
+    // Closed checkpoints to copy in their entirety once the lock is
+    // released, and the items following them.
+    std::vector<Checkpoint*> closedChks;
+    std::vector<queued_item> lastItems;
+    std::vector<queued_item>* out = &items;
+
+    bool moreItems = true;
+    range.start = (*cursor.currentCheckpoint)->getSnapshotStartSeqno();
+    range.end = (*cursor.currentCheckpoint)->getSnapshotEndSeqno();
+    while (true) {
+        Checkpoint* chk = *cursor.currentCheckpoint;
+        if (cursor.currentPos == chk->begin() &&
+            chk->getState() == CHECKPOINT_CLOSED &&
+            std::next(cursor.currentCheckpoint) != checkpointList.end()) {
+            // Move the cursor onto the checkpoint_end item in one go, as
+            // incrCursor() would have done item by item (the empty item
+            // isn't counted in the offset).
+            cursor.currentPos = --chk->end();
+            cursor.offset.fetch_add(chk->getQueueSize() - 1);
+            closedChks.push_back(chk);
+            out = &lastItems;
+            range.end = chk->getSnapshotEndSeqno();
+            numItems += chk->getQueueSize() - 1;
+            numBytes += chk->getMemConsumption();
+            moveCursorToNextCheckpoint(cursor);
+            // Only stop between checkpoints, so that the items read always
+            // make up whole snapshots.
+            if (limitReached()) {
+                break;
+            }
+            continue;
+        }
 
-    bool moreItems;
-    range.start = (*it->second.currentCheckpoint)->getSnapshotStartSeqno();
-    range.end = (*it->second.currentCheckpoint)->getSnapshotEndSeqno();
-    while ((moreItems = incrCursor(it->second))) {
-        queued_item& qi = *(it->second.currentPos);
-        items.push_back(qi);
+        if (!(moreItems = incrCursor(cursor))) {
+            break;
+        }
+        queued_item& qi = *(cursor.currentPos);
+        out->push_back(qi);
+        ++numItems;
+        numBytes += qi->size();
 
         if (qi->getOperation() == queue_op::checkpoint_end) {
-            range.end = (*it->second.currentCheckpoint)->getSnapshotEndSeqno();
-            moveCursorToNextCheckpoint(it->second);
+            range.end = (*cursor.currentCheckpoint)->getSnapshotEndSeqno();
+            moveCursorToNextCheckpoint(cursor);
+            if (limitReached()) {
+                break;
+            }
         }
     }
 
     if (!moreItems) {
-        range.end = (*it->second.currentCheckpoint)->getSnapshotEndSeqno();
+        range.end = (*cursor.currentCheckpoint)->getSnapshotEndSeqno();
     }
+    moreAvailable = moreItems;
+
+    LOG(EXTENSION_LOG_DEBUG, "CheckpointManager::getItemsForCursor() "
+            "cursor:%s range:{%" PRIu64 ", %" PRIu64 "} more:%s",
+            cursor.name.c_str(), range.start, range.end,
+            moreAvailable ? "true" : "false");
 
-    LOG(EXTENSION_LOG_DEBUG, "CheckpointManager::getAllItemsForCursor() "
-            "cursor:%s range:{%" PRIu64 ", %" PRIu64 "}",
-            name.c_str(), range.start, range.end);
+    cursor.numVisits++;
+
+    if (closedChks.empty()) {
+        return range;
+    }
 
-    it->second.numVisits++;
+    ++lockFreeReaders;
+    lh.unlock();
+    for (auto* chk : closedChks) {
+        auto pos = chk->begin();
+        for (++pos; pos != chk->end(); ++pos) {
+            items.push_back(*pos);
+        }
+    }
+    items.insert(items.end(), lastItems.begin(), lastItems.end());
+    releaseLockFreeReader();
 
     return range;
 }
 
+void CheckpointManager::retireCheckpoints_UNLOCKED(
+        std::list<Checkpoint*>& chks) {
+    if (lockFreeReaders.load() > 0) {
+        retiredCheckpoints.splice(retiredCheckpoints.end(), chks);
+        hasRetiredCheckpoints = true;
+    } else if (hasRetiredCheckpoints) {
+        chks.splice(chks.end(), retiredCheckpoints);
+        hasRetiredCheckpoints = false;
+    }
+}
+
+void CheckpointManager::releaseLockFreeReader() {
+    if (--lockFreeReaders == 0 && hasRetiredCheckpoints) {
+        std::list<Checkpoint*> toDelete;
+        {
+            LockHolder lh(queueLock);
+            retireCheckpoints_UNLOCKED(toDelete);
+        }
+        for (auto* chk : toDelete) {
+            delete chk;
+        }
+    }
+}
+
 queued_item CheckpointManager::nextItem(const std::string &name,
                                         bool &isLastMutationItem) {
     LockHolder lh(queueLock);
@@ -1296,7 +1577,7 @@ queued_item CheckpointManager::nextItem(const std::string &name,
         return qi;
     }
 
-    CheckpointCursor &cursor = it->second;
+    CheckpointCursor &cursor = *it->second;
     if (incrCursor(cursor)) {
         isLastMutationItem = isLastMutationItemInCheckpoint(cursor);
         return *(cursor.currentPos);
@@ -1337,13 +1618,13 @@ void CheckpointManager::clear(RCPtr<VBucket> &vb, uint64_t seqno) {
 }
 
 void CheckpointManager::clear_UNLOCKED(vbucket_state_t vbState, uint64_t seqno) {
-    std::list<Checkpoint*>::iterator it = checkpointList.begin();
     // Remove all the checkpoints.
-    while(it != checkpointList.end()) {
-        delete *it;
-        ++it;
+    std::list<Checkpoint*> removed;
+    removed.swap(checkpointList);
+    retireCheckpoints_UNLOCKED(removed);
+    for (auto* chk : removed) {
+        delete chk;
     }
-    checkpointList.clear();
     numItems = 0;
     lastBySeqno = seqno;
     pCursorPreCheckpointId = 0;
@@ -1356,7 +1637,8 @@ void CheckpointManager::clear_UNLOCKED(vbucket_state_t vbState, uint64_t seqno)
 
 void CheckpointManager::resetCursors(bool resetPersistenceCursor) {
     for (auto& cit : connCursors) {
-        if (cit.second.name.compare(pCursorName) == 0) {
+        CheckpointCursor& cursor = *cit.second;
+        if (cit.second == persistenceCursor) {
             if (!resetPersistenceCursor) {
                 continue;
             } else {
@@ -1364,12 +1646,12 @@ void CheckpointManager::resetCursors(bool resetPersistenceCursor) {
                 pCursorPreCheckpointId = chkid ? chkid - 1 : 0;
             }
         }
-        cit.second.currentCheckpoint = checkpointList.begin();
-        cit.second.currentPos = checkpointList.front()->begin();
-        cit.second.offset = 0;
-        cit.second.setMetaItemOffset(0);
-        checkpointList.front()->registerCursorName(cit.second.name);
+        cursor.currentCheckpoint = checkpointList.begin();
+        cursor.currentPos = checkpointList.front()->begin();
+        cursor.offset = 0;
+        cursor.setMetaItemOffset(0);
     }
+    recountCursors_UNLOCKED();
 }
 
 void CheckpointManager::resetCursors(checkpointCursorInfoList &cursors) {
@@ -1393,13 +1675,11 @@ bool CheckpointManager::moveCursorToNextCheckpoint(CheckpointCursor &cursor) {
         }
     }
 
-    // Remove the cursor's name from its current checkpoint.
-    (*(cursor.currentCheckpoint))->removeCursorName(cursor.name);
     // Move the cursor to the next checkpoint.
+    (*(cursor.currentCheckpoint))->decNumOfCursors();
     ++(cursor.currentCheckpoint);
     cursor.currentPos = (*(cursor.currentCheckpoint))->begin();
-    // Register the cursor's name to its new current checkpoint.
-    (*(cursor.currentCheckpoint))->registerCursorName(cursor.name);
+    (*(cursor.currentCheckpoint))->incNumOfCursors();
 
     // Reset metaItemOffset as we're entering a new checkpoint.
     cursor.setMetaItemOffset(0);
@@ -1426,12 +1706,16 @@ uint64_t CheckpointManager::checkOpenCheckpoint_UNLOCKED(bool forceCreation,
     // satisfied:
     // (1) force creation due to online update or high memory usage
     // (2) current checkpoint is reached to the max number of items allowed.
-    // (3) time elapsed since the creation of the current checkpoint is greater
+    // (3) current checkpoint is reached to the max memory allowed.
+    // (4) time elapsed since the creation of the current checkpoint is greater
     //     than the threshold
+    const size_t maxSize = checkpointConfig.getCheckpointMaxSize();
     if (forceCreation ||
         (checkpointConfig.isItemNumBasedNewCheckpoint() &&
          checkpointList.back()->getNumItems() >=
          checkpointConfig.getCheckpointMaxItems()) ||
+        (maxSize > 0 && checkpointList.back()->getNumItems() > 0 &&
+         checkpointList.back()->getTotalMemConsumption() >= maxSize) ||
         (checkpointList.back()->getNumItems() > 0 && timeBound)) {
 
         checkpoint_id = checkpointList.back()->getId();
@@ -1445,15 +1729,26 @@ size_t CheckpointManager::getNumItemsForCursor(const std::string &name) const {
     return getNumItemsForCursor_UNLOCKED(name);
 }
 
+size_t CheckpointManager::getNumItemsForCursor(
+        const CheckpointCursorHandle& cursor) const {
+    LockHolder lh(queueLock);
+    auto c = cursor.lock();
+    return c ? getNumItemsForCursor_UNLOCKED(*c) : 0;
+}
+
 size_t CheckpointManager::getNumItemsForCursor_UNLOCKED(
                                                 const std::string &name) const {
-    size_t remains = 0;
     cursor_index::const_iterator it = connCursors.find(name);
-    if (it != connCursors.end()) {
-        size_t offset = it->second.offset + getNumOfMetaItemsFromCursor(it->second);
-        remains = (numItems > offset) ? numItems - offset : 0;
+    if (it == connCursors.end()) {
+        return 0;
     }
-    return remains;
+    return getNumItemsForCursor_UNLOCKED(*it->second);
+}
+
+size_t CheckpointManager::getNumItemsForCursor_UNLOCKED(
+        const CheckpointCursor& cursor) const {
+    size_t offset = cursor.offset + getNumOfMetaItemsFromCursor(cursor);
+    return (numItems > offset) ? numItems - offset : 0;
 }
 
 size_t CheckpointManager::getNumOfMetaItemsFromCursor(const CheckpointCursor &cursor) const {
@@ -1483,9 +1778,9 @@ void CheckpointManager::decrCursorFromCheckpointEnd(const std::string &name) {
     LockHolder lh(queueLock);
     cursor_index::iterator it = connCursors.find(name);
     if (it != connCursors.end() &&
-        (*(it->second.currentPos))->getOperation() ==
+        (*(it->second->currentPos))->getOperation() ==
         queue_op::checkpoint_end) {
-        it->second.decrPos();
+        it->second->decrPos();
     }
 }
 
@@ -1641,14 +1936,14 @@ void CheckpointManager::checkAndAddNewCheckpoint(uint64_t id,
             // Reposition all the cursors in the open checkpoint to the
             // begining position so that a checkpoint_start message can be
             // sent again with the correct id.
-            for (const auto& cit : checkpointList.back()->getCursorNameList()) {
-                if (cit == pCursorName) {
-                    // Persistence cursor
+            for (auto& cit : connCursors) {
+                CheckpointCursor& cursor = *cit.second;
+                if (*(cursor.currentCheckpoint) != checkpointList.back() ||
+                    cit.second == persistenceCursor) {
                     continue;
-                } else { // Dcp/Tap cursors
-                    cursor_index::iterator mit = connCursors.find(cit);
-                    mit->second.currentPos = checkpointList.back()->begin();
                 }
+                // Dcp/Tap cursors
+                cursor.currentPos = checkpointList.back()->begin();
             }
         } else {
             addNewCheckpoint_UNLOCKED(id);
@@ -1668,13 +1963,14 @@ void CheckpointManager::collapseCheckpoints(uint64_t id) {
     }
 
     CursorIdToPositionMap cursorMap;
-    for (const auto itr : connCursors) {
-        const bool isMetaItem = (*(itr.second.currentPos))->isCheckPointMetaItem();
-        const bool cursor_on_chk_start = (*(itr.second.currentPos))->getOperation() ==
+    for (const auto& itr : connCursors) {
+        const CheckpointCursor& cursor = *itr.second;
+        const bool isMetaItem = (*(cursor.currentPos))->isCheckPointMetaItem();
+        const bool cursor_on_chk_start = (*(cursor.currentPos))->getOperation() ==
                 queue_op::checkpoint_start;
 
-        Checkpoint* chk = *(itr.second.currentCheckpoint);
-        auto key = (*(itr.second.currentPos))->getKey();
+        Checkpoint* chk = *(cursor.currentCheckpoint);
+        auto key = (*(cursor.currentPos))->getKey();
         cursorMap[itr.first] = CursorPosition{chk->getMutationIdForKey(key, isMetaItem),
                                               cursor_on_chk_start};
     }
@@ -1690,12 +1986,17 @@ void CheckpointManager::collapseCheckpoints(uint64_t id) {
                                mergePrevCheckpoint(*rit);
         numDuplicatedItems += ((*rit)->getNumItems() - numAddedItems);
         numMetaItems += (*rit)->getNumMetaItems();
-        delete *rit;
     }
     numItems.fetch_sub(numDuplicatedItems + numMetaItems);
 
     if (checkpointList.size() > 1) {
-        checkpointList.erase(checkpointList.begin(), --checkpointList.end());
+        std::list<Checkpoint*> merged;
+        merged.splice(merged.begin(), checkpointList, checkpointList.begin(),
+                      --checkpointList.end());
+        retireCheckpoints_UNLOCKED(merged);
+        for (auto* chk : merged) {
+            delete chk;
+        }
     }
 
     if (checkpointList.size() != 1) {
@@ -1738,16 +2039,15 @@ putCursorsInCollapsedChk(CursorIdToPositionMap& cursors,
 
                 cursor_index::iterator cc = connCursors.find(mit->first);
                 if (cc == connCursors.end() ||
-                    cc->second.fromBeginningOnChkCollapse) {
+                    cc->second->fromBeginningOnChkCollapse) {
                     ++mit;
                     continue;
                 }
-                cc->second.currentCheckpoint = chkItr;
-                cc->second.currentPos = last;
-                cc->second.offset = (i > 0) ? i - 1 : 0;
-                cc->second.setMetaItemOffset(last_meta_item_count);
+                cc->second->currentCheckpoint = chkItr;
+                cc->second->currentPos = last;
+                cc->second->offset = (i > 0) ? i - 1 : 0;
+                cc->second->setMetaItemOffset(last_meta_item_count);
 
-                chk->registerCursorName(cc->second.name);
                 cursors.erase(mit++);
             } else {
                 ++mit;
@@ -1772,18 +2072,18 @@ putCursorsInCollapsedChk(CursorIdToPositionMap& cursors,
         if (cc == connCursors.end()) {
             continue;
         }
-        cc->second.currentCheckpoint = chkItr;
-        if (cc->second.fromBeginningOnChkCollapse) {
-            cc->second.currentPos = chk->begin();
-            cc->second.offset = 0;
-            cc->second.setMetaItemOffset(0);
+        cc->second->currentCheckpoint = chkItr;
+        if (cc->second->fromBeginningOnChkCollapse) {
+            cc->second->currentPos = chk->begin();
+            cc->second->offset = 0;
+            cc->second->setMetaItemOffset(0);
         } else {
-            cc->second.currentPos = last;
-            cc->second.offset = (i > 0) ? i - 1 : 0;
-            cc->second.setMetaItemOffset(chk->getNumMetaItems());
+            cc->second->currentPos = last;
+            cc->second->offset = (i > 0) ? i - 1 : 0;
+            cc->second->setMetaItemOffset(chk->getNumMetaItems());
         }
-        chk->registerCursorName(cc->second.name);
     }
+    recountCursors_UNLOCKED();
 }
 
 bool CheckpointManager::hasNext(const std::string &name) {
@@ -1794,10 +2094,10 @@ bool CheckpointManager::hasNext(const std::string &name) {
     }
 
     bool hasMore = true;
-    CheckpointQueue::iterator curr = it->second.currentPos;
+    CheckpointQueue::iterator curr = it->second->currentPos;
     ++curr;
-    if (curr == (*(it->second.currentCheckpoint))->end() &&
-        (*(it->second.currentCheckpoint)) == checkpointList.back()) {
+    if (curr == (*(it->second->currentCheckpoint))->end() &&
+        (*(it->second->currentCheckpoint)) == checkpointList.back()) {
         hasMore = false;
     }
     return hasMore;
@@ -1854,9 +2154,8 @@ uint64_t CheckpointManager::getPersistenceCursorPreChkId() {
 
 void CheckpointManager::itemsPersisted() {
     LockHolder lh(queueLock);
-    auto persistenceCursor = connCursors.find(pCursorName);
-    if (persistenceCursor != connCursors.end()) {
-        auto itr = persistenceCursor->second.currentCheckpoint;
+    if (persistenceCursor) {
+        auto itr = persistenceCursor->currentCheckpoint;
         pCursorPreCheckpointId = ((*itr)->getId() > 0) ? (*itr)->getId() - 1 : 0;
     }
 }
@@ -1913,6 +2212,10 @@ void CheckpointConfig::addConfigChangeListener(
              new CheckpointConfigChangeListener(engine.getCheckpointConfig()));
     configuration.addValueChangedListener("enable_chk_merge",
              new CheckpointConfigChangeListener(engine.getCheckpointConfig()));
+    configuration.addValueChangedListener("chk_expel_enabled",
+             new CheckpointConfigChangeListener(engine.getCheckpointConfig()));
+    configuration.addValueChangedListener("chk_max_size",
+             new CheckpointConfigChangeListener(engine.getCheckpointConfig()));
 }
 
 CheckpointConfig::CheckpointConfig(EventuallyPersistentEngine &e) {
@@ -1923,6 +2226,8 @@ CheckpointConfig::CheckpointConfig(EventuallyPersistentEngine &e) {
     itemNumBasedNewCheckpoint = config.isItemNumBasedNewChk();
     keepClosedCheckpoints = config.isKeepClosedChks();
     enableChkMerge = config.isEnableChkMerge();
+    expelEnabled = config.isChkExpelEnabled();
+    checkpointMaxSize = config.getChkMaxSize();
     persistenceEnabled = config.getBucketType() == "persistent";
 }
 
@@ -2027,17 +2332,17 @@ void CheckpointManager::addStats(ADD_STAT add_stat, const void *cookie) {
             checked_snprintf(buf, sizeof(buf),
                              "vb_%d:%s:cursor_checkpoint_id", vbucketId,
                              cur_it->first.c_str());
-            add_casted_stat(buf, (*(cur_it->second.currentCheckpoint))->getId(),
+            add_casted_stat(buf, (*(cur_it->second->currentCheckpoint))->getId(),
                             add_stat, cookie);
             checked_snprintf(buf, sizeof(buf), "vb_%d:%s:cursor_seqno",
                              vbucketId,
                              cur_it->first.c_str());
-            add_casted_stat(buf, (*(cur_it->second.currentPos))->getBySeqno(),
+            add_casted_stat(buf, (*(cur_it->second->currentPos))->getBySeqno(),
                             add_stat, cookie);
             checked_snprintf(buf, sizeof(buf), "vb_%d:%s:num_visits",
                              vbucketId,
                              cur_it->first.c_str());
-            add_casted_stat(buf, cur_it->second.numVisits.load(),
+            add_casted_stat(buf, cur_it->second->numVisits.load(),
                             add_stat, cookie);
         }
     } catch (std::exception& error) {
@@ -2055,8 +2360,8 @@ std::ostream& operator <<(std::ostream& os, const CheckpointManager& m) {
         os << "    " << *c << std::endl;
     }
     os << "    connCursors:[" << std::endl;
-    for (const auto cur : m.connCursors) {
-        os << "        " << cur.first << ": " << cur.second << std::endl;
+    for (const auto& cur : m.connCursors) {
+        os << "        " << cur.first << ": " << *cur.second << std::endl;
     }
     os << "    ]" << std::endl;
     return os;
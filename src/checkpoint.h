@@ -20,14 +20,18 @@
 
 #include "config.h"
 
+#include <algorithm>
 #include <list>
 #include <map>
+#include <memory>
 #include <set>
+#include <stdexcept>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 #include <atomic>
+#include "chunked_queue.h"
 #include "ep_types.h"
 #include "item.h"
 #include "locks.h"
@@ -46,6 +50,8 @@
 #define DEFAULT_MAX_CHECKPOINTS 2
 #define MAX_CHECKPOINTS_UPPER_BOUND 5
 
+#define DEFAULT_CHECKPOINT_MAX_SIZE (10 * 1024 * 1024) // 10 MB.
+
 /**
  * The state of a given checkpoint.
  */
@@ -56,9 +62,10 @@ enum checkpoint_state {
 
 const char* to_string(enum checkpoint_state);
 
-// List is used for queueing mutations as vector incurs shift operations for
-// deduplication.
-typedef std::list<queued_item> CheckpointQueue;
+// A ChunkedQueue is used for queueing mutations: it has the stable positions
+// needed by the keyIndex and cursors across deduplication (like a std::list),
+// without allocating a node per item.
+typedef ChunkedQueue<queued_item> CheckpointQueue;
 
 /**
  * A checkpoint index entry.
@@ -241,9 +248,19 @@ private:
 std::ostream& operator<<(std::ostream& os, const CheckpointCursor& c);
 
 /**
- * The cursor index maps checkpoint cursor names to checkpoint cursors
+ * The cursor index maps checkpoint cursor names to checkpoint cursors. The
+ * CheckpointManager owns the cursors; users of a cursor may hold a
+ * CheckpointCursorHandle to it.
  */
-typedef std::map<const std::string, CheckpointCursor> cursor_index;
+typedef std::unordered_map<std::string, std::shared_ptr<CheckpointCursor>>
+        cursor_index;
+
+/**
+ * A handle to a cursor, letting its user (e.g. a DCP stream) access the
+ * cursor directly rather than looking it up by name. It expires once the
+ * cursor is removed from its CheckpointManager.
+ */
+typedef std::weak_ptr<CheckpointCursor> CheckpointCursorHandle;
 
 /**
  * Result from invoking queueDirty in the current open checkpoint.
@@ -349,9 +366,12 @@ public:
         checkpointState(CHECKPOINT_OPEN),
         numItems(0),
         numMetaItems(0),
-        memOverhead(0),
-        effectiveMemUsage(0) {
+        numCursors(0),
+        memOverhead(toWrite.getMemorySize()),
+        effectiveMemUsage(0),
+        highestExpelledSeqno(0) {
         stats.memOverhead->fetch_add(memorySize());
+        stats.checkpointMemUsage->fetch_add(memorySize());
         if (stats.memOverhead->load() >= GIGANTOR) {
             LOG(EXTENSION_LOG_WARNING,
                 "Checkpoint::Checkpoint: stats.memOverhead (which is %" PRId64
@@ -397,6 +417,14 @@ public:
      */
     size_t getNumMetaItems() const;
 
+    /**
+     * Return the number of entries in the queue of this checkpoint: all
+     * items and meta items, including the initial empty item.
+     */
+    size_t getQueueSize() const {
+        return toWrite.size();
+    }
+
     /**
      * Return the current state of this checkpoint.
      */
@@ -416,35 +444,30 @@ public:
      * Return the number of cursors that are currently walking through this checkpoint.
      */
     size_t getNumberOfCursors() const {
-        return cursors.size();
+        return numCursors;
     }
 
     /**
-     * Register a cursor's name to this checkpoint
+     * Account a cursor moving into this checkpoint
      */
-    void registerCursorName(const std::string &name) {
-        cursors.insert(name);
+    void incNumOfCursors() {
+        ++numCursors;
     }
 
     /**
-     * Remove a cursor's name from this checkpoint
+     * Account a cursor moving out of this checkpoint
      */
-    void removeCursorName(const std::string &name) {
-        cursors.erase(name);
-    }
-
-    /**
-     * Return true if the cursor with a given name exists in this checkpoint
-     */
-    bool hasCursorName(const std::string &name) const {
-        return cursors.find(name) != cursors.end();
+    void decNumOfCursors() {
+        if (numCursors == 0) {
+            throw std::logic_error("Checkpoint::decNumOfCursors: no cursor "
+                                   "in checkpoint " +
+                                   std::to_string(checkpointId));
+        }
+        --numCursors;
     }
 
-    /**
-     * Return the list of all cursor names in this checkpoint
-     */
-    const std::set<std::string> &getCursorNameList() const {
-        return cursors;
+    void resetNumOfCursors() {
+        numCursors = 0;
     }
 
     /**
@@ -457,10 +480,15 @@ public:
     queue_dirty_t queueDirty(const queued_item &qi,
                              CheckpointManager *checkpointManager);
 
+    /**
+     * Return the lowest seqno which can be read from this checkpoint; items
+     * expelled from it (see expelItems()) can no longer be.
+     */
     uint64_t getLowSeqno() const {
         auto pos = toWrite.begin();
         pos++;
-        return (*pos)->getBySeqno();
+        return std::max(uint64_t((*pos)->getBySeqno()),
+                        highestExpelledSeqno + 1);
     }
 
     uint64_t getHighSeqno() const {
@@ -537,19 +565,12 @@ public:
     uint64_t getMutationIdForKey(const DocKey& key, bool isMetaKey);
 
     /**
-     * Function invoked by the cursor-dropper which checks if the
-     * peristence cursor is currently in the given checkpoint, in
-     * which case returns false, otherwise true.
-     */
-    bool isEligibleToBeUnreferenced();
-
-    /**
-     * Invoked by the checkpoint manager whenever an item is queued
-     * into the given checkpoint.
+     * Invoked whenever an item is queued (or merged) into this checkpoint.
      * @param Amount of memory being added to current usage
      */
     void incrementMemConsumption(size_t by) {
         effectiveMemUsage += by;
+        stats.checkpointMemUsage->fetch_add(by);
     }
 
     /**
@@ -560,6 +581,26 @@ public:
         return effectiveMemUsage;
     }
 
+    /**
+     * Returns the memory held by the queued items plus the overhead of this
+     * checkpoint (see memorySize()).
+     */
+    size_t getTotalMemConsumption() {
+        return effectiveMemUsage + memorySize();
+    }
+
+    /**
+     * Remove the (non-meta) items before the given position from this
+     * checkpoint, along with their key index entries: a later mutation of
+     * one of their keys is then queued as a new item. The caller must make
+     * sure that no cursor still has to read them.
+     *
+     * @param last position up to which (exclusive) to expel items
+     * @param[out] memoryFreed bytes of items and overhead released
+     * @return the number of items expelled
+     */
+    size_t expelItems(CheckpointQueue::iterator last, size_t& memoryFreed);
+
     static const StoredDocKey DummyKey;
     static const StoredDocKey CheckpointStartKey;
     static const StoredDocKey CheckpointEndKey;
@@ -577,7 +618,8 @@ private:
     size_t                         numItems;
     /// Number of meta items (see Item::isCheckPointMetaItem).
     size_t numMetaItems;
-    std::set<std::string>          cursors; // List of cursors with their unique names.
+    // Number of cursors currently walking through this checkpoint.
+    size_t                         numCursors;
     CheckpointQueue                toWrite;
     checkpoint_index               keyIndex;
     /* Index for meta keys like "dummy_key" */
@@ -587,6 +629,20 @@ private:
     // The following stat is to contain the memory consumption of all
     // the queued items in the given checkpoint.
     size_t                         effectiveMemUsage;
+    // Seqno of the last item expelled from this checkpoint, if any.
+    uint64_t                       highestExpelledSeqno;
+
+    /**
+     * Account the change in the memory used by toWrite since it used the
+     * given number of bytes.
+     */
+    void updateQueueMemOverhead(size_t prevQueueMemory);
+
+    void decrementMemConsumption(size_t by) {
+        by = std::min(effectiveMemUsage, by);
+        effectiveMemUsage -= by;
+        stats.checkpointMemUsage->fetch_sub(by);
+    }
 
     friend std::ostream& operator <<(std::ostream& os, const Checkpoint& m);
 };
@@ -639,6 +695,17 @@ public:
     size_t removeClosedUnrefCheckpoints(VBucket& vbucket,
                                         bool& newOpenCheckpointCreated);
 
+    /**
+     * Free the items of the oldest checkpoint which every cursor has already
+     * read (and which have been persisted), even if the checkpoint is still
+     * open or referenced by cursors.
+     * @param vbucket the vbucket that this checkpoint manager belongs to.
+     * @param[out] memoryFreed bytes released by the checkpoint
+     * @return the number of items expelled
+     */
+    size_t expelUnreferencedCheckpointItems(VBucket& vbucket,
+                                            size_t& memoryFreed);
+
     /**
      * Register the cursor for getting items whose bySeqno values are between
      * startBySeqno and endBySeqno, and close the open checkpoint if endBySeqno
@@ -724,9 +791,44 @@ public:
      */
     queued_item nextItem(const std::string &name, bool &isLastMutationItem);
 
+    /**
+     * Append all the items from the given cursor's position onwards to
+     * items, moving the cursor to the end.
+     *
+     * The items of closed checkpoints which the cursor reads in their
+     * entirety (other than the last checkpoint) are copied after releasing
+     * the queueLock: such checkpoints are no longer modified, and are kept
+     * alive until the copy is done (see retireCheckpoints_UNLOCKED()), so
+     * a lagging cursor does not hold up queueDirty() while it copies them.
+     *
+     * @return the snapshot range of the items read
+     */
     snapshot_range_t getAllItemsForCursor(const std::string& name,
                                           std::vector<queued_item> &items);
 
+    /**
+     * As getAllItemsForCursor(name, items), for the cursor the given handle
+     * refers to. Nothing is read if the cursor no longer exists.
+     */
+    snapshot_range_t getAllItemsForCursor(const CheckpointCursorHandle& cursor,
+                                          std::vector<queued_item>& items);
+
+    /**
+     * As getAllItemsForCursor(name, items), but stop reading once
+     * approximately the given number of items or bytes (0: no limit) has
+     * been read. The read only stops at the end of a checkpoint, so the
+     * returned range is always a whole snapshot; the limits may therefore
+     * be exceeded by up to a checkpoint's worth of items.
+     *
+     * @param moreAvailable set to true if the read stopped at the limits,
+     *        in which case the cursor may have more items to read.
+     */
+    snapshot_range_t getItemsForCursor(const std::string& name,
+                                       std::vector<queued_item>& items,
+                                       size_t approxLimitItems,
+                                       size_t approxLimitBytes,
+                                       bool& moreAvailable);
+
     /**
      * Return the total number of items (including meta items) that belong to
      * this checkpoint manager.
@@ -745,6 +847,14 @@ public:
      */
     size_t getNumItemsForCursor(const std::string &name) const;
 
+    size_t getNumItemsForCursor(const CheckpointCursorHandle& cursor) const;
+
+    /**
+     * Return a handle to the cursor with the given name, which is empty if
+     * there is no such cursor.
+     */
+    CheckpointCursorHandle getCursorHandle(const std::string& name) const;
+
     void clear(vbucket_state_t vbState) {
         LockHolder lh(queueLock);
         clear_UNLOCKED(vbState, lastBySeqno);
@@ -912,6 +1022,27 @@ private:
 
     size_t getNumItemsForCursor_UNLOCKED(const std::string &name) const;
 
+    size_t getNumItemsForCursor_UNLOCKED(const CheckpointCursor& cursor) const;
+
+    /**
+     * Set the named cursor to the given position (creating it if needed),
+     * moving it from the checkpoint it was in to its new one.
+     */
+    void setCursor_UNLOCKED(const CheckpointCursor& position);
+
+    /**
+     * Recompute the number of cursors in each checkpoint, after cursors
+     * were repositioned in bulk (e.g. when collapsing checkpoints).
+     */
+    void recountCursors_UNLOCKED();
+
+    snapshot_range_t getItemsForCursor(std::unique_lock<std::mutex>& lh,
+                                       CheckpointCursor& cursor,
+                                       std::vector<queued_item>& items,
+                                       size_t approxLimitItems,
+                                       size_t approxLimitBytes,
+                                       bool& moreAvailable);
+
     void clear_UNLOCKED(vbucket_state_t vbState, uint64_t seqno);
 
     /**
@@ -925,8 +1056,6 @@ private:
                                    uint64_t snapStartSeqno,
                                    uint64_t snapEndSeqno);
 
-    void removeInvalidCursorsOnCheckpoint(Checkpoint *pCheckpoint);
-
     bool moveCursorToNextCheckpoint(CheckpointCursor &cursor);
 
     /**
@@ -968,6 +1097,19 @@ private:
      */
     size_t getNumOfMetaItemsFromCursor(const CheckpointCursor &cursor) const;
 
+    /**
+     * Dispose of checkpoints removed from checkpointList (queueLock held).
+     * If getItemsForCursor() calls are copying items outside of the
+     * queueLock the checkpoints are kept aside until they have all
+     * finished. On return chks holds the checkpoints (possibly retired
+     * earlier) which the caller must delete, which it may do after
+     * releasing the queueLock.
+     */
+    void retireCheckpoints_UNLOCKED(std::list<Checkpoint*>& chks);
+
+    /// Called by getItemsForCursor() once it has copied its items.
+    void releaseLockFreeReader();
+
     EPStats                 &stats;
     CheckpointConfig        &checkpointConfig;
     mutable std::mutex       queueLock;
@@ -983,6 +1125,17 @@ private:
     uint64_t                 lastClosedCheckpointId;
     uint64_t                 pCursorPreCheckpointId;
     cursor_index             connCursors;
+    // The persistence cursor (also in connCursors), if registered.
+    std::shared_ptr<CheckpointCursor> persistenceCursor;
+
+    // Number of getItemsForCursor() calls copying items of closed
+    // checkpoints without holding the queueLock. Only incremented with the
+    // queueLock held.
+    std::atomic<size_t>      lockFreeReaders;
+    // Checkpoints removed while lockFreeReaders was non-zero; freed once it
+    // drops to zero.
+    std::list<Checkpoint*>   retiredCheckpoints;
+    std::atomic<bool>        hasRetiredCheckpoints;
 
     FlusherCallback          flusherCB;
 
@@ -1005,6 +1158,8 @@ public:
           itemNumBasedNewCheckpoint(true),
           keepClosedCheckpoints(false),
           enableChkMerge(false),
+          expelEnabled(true),
+          checkpointMaxSize(DEFAULT_CHECKPOINT_MAX_SIZE),
           persistenceEnabled(true)
     { /* empty */ }
 
@@ -1017,6 +1172,8 @@ public:
           itemNumBasedNewCheckpoint(item_based_new_ckpt),
           keepClosedCheckpoints(keep_closed_ckpts),
           enableChkMerge(enable_ckpt_merge),
+          expelEnabled(true),
+          checkpointMaxSize(DEFAULT_CHECKPOINT_MAX_SIZE),
           persistenceEnabled(persistence_enabled) {}
 
     CheckpointConfig(EventuallyPersistentEngine &e);
@@ -1045,6 +1202,14 @@ public:
         return enableChkMerge;
     }
 
+    bool isCheckpointExpelEnabled() const {
+        return expelEnabled;
+    }
+
+    size_t getCheckpointMaxSize() const {
+        return checkpointMaxSize;
+    }
+
     bool isPersistenceEnabled() const {
         return persistenceEnabled;
     }
@@ -1061,6 +1226,10 @@ protected:
     void setCheckpointMaxItems(size_t value);
     void setMaxCheckpoints(size_t value);
 
+    void setCheckpointMaxSize(size_t value) {
+        checkpointMaxSize = value;
+    }
+
     void allowItemNumBasedNewCheckpoint(bool value) {
         itemNumBasedNewCheckpoint = value;
     }
@@ -1073,6 +1242,10 @@ protected:
         enableChkMerge = value;
     }
 
+    void allowCheckpointExpel(bool value) {
+        expelEnabled = value;
+    }
+
     static void addConfigChangeListener(EventuallyPersistentEngine &engine);
 
 private:
@@ -1090,6 +1263,12 @@ private:
     bool keepClosedCheckpoints;
     // Flag indicating if merging closed checkpoints is enabled or not.
     bool enableChkMerge;
+    // Flag indicating if items already read by all cursors may be expelled
+    // from checkpoints.
+    bool expelEnabled;
+    // Memory (in bytes) of the open checkpoint above which a new checkpoint
+    // is created; 0 if only the number of items and time apply.
+    size_t checkpointMaxSize;
 
     // Flag indicating if persistence is enabled.
     bool persistenceEnabled;
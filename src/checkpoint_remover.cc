@@ -17,6 +17,8 @@
 
 #include "config.h"
 
+#include <algorithm>
+
 #include <phosphor/phosphor.h>
 #include <platform/make_unique.h>
 
@@ -63,6 +65,19 @@ public:
                 removed, vb->getId());
         }
         removed = 0;
+
+        size_t memoryFreed = 0;
+        size_t expelled =
+                vb->checkpointManager.expelUnreferencedCheckpointItems(
+                        *vb, memoryFreed);
+        stats.itemsExpelledFromCheckpoints.fetch_add(expelled);
+        stats.memExpelledFromCheckpoints.fetch_add(memoryFreed);
+        if (expelled > 0) {
+            LOG(EXTENSION_LOG_INFO,
+                "Expelled %" PRIu64 " items (%" PRIu64 " bytes) from the "
+                "oldest checkpoint of VBucket %d",
+                uint64_t(expelled), uint64_t(memoryFreed), vb->getId());
+        }
     }
 
     void complete() override {
@@ -95,10 +110,23 @@ void ClosedUnrefCheckpointRemoverTask::cursorDroppingIfNeeded(void) {
      * dropping starts, it will continue until memory usage is projected
      * to go under the lower threshold which is a percentage of the quota,
      * specified by cursor_dropping_lower_mark.
+     * Cursors are also dropped while the checkpoints use more memory than
+     * their quota (see chk_mem_quota_percent), until they are projected to
+     * fit within it.
      */
+    size_t amountOfMemoryToClear = 0;
     if (stats.getTotalMemoryUsed() > stats.cursorDroppingUThreshold.load()) {
-        size_t amountOfMemoryToClear = stats.getTotalMemoryUsed() -
+        amountOfMemoryToClear = stats.getTotalMemoryUsed() -
                                           stats.cursorDroppingLThreshold.load();
+    }
+    const size_t checkpointMemUsage = stats.checkpointMemUsage->load();
+    const size_t checkpointMemQuota = stats.checkpointMemQuota.load();
+    if (checkpointMemUsage > checkpointMemQuota) {
+        amountOfMemoryToClear = std::max(amountOfMemoryToClear,
+                                         checkpointMemUsage -
+                                         checkpointMemQuota);
+    }
+    if (amountOfMemoryToClear > 0) {
         size_t memoryCleared = 0;
         KVBucketIface* kvBucket = engine->getKVBucket();
         // Get a list of active vbuckets sorted by memory usage
@@ -0,0 +1,315 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include <bitset>
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+/**
+ * An append-only sequence with stable positions, storing its elements in
+ * fixed size chunks of ChunkSize elements.
+ *
+ * Compared to a std::list, appending an element only allocates once per
+ * chunk and iterating walks contiguous memory, while iterators (positions)
+ * behave the same: an iterator to an element stays valid until that element
+ * is erased, whatever is appended or erased elsewhere. This is achieved by
+ * never moving elements: erasing one resets it and marks its slot dead,
+ * iteration skipping dead slots. Once all the slots of a chunk (other than
+ * the last one) are dead the chunk is freed.
+ *
+ * Elements can only be added at the back, or another queue spliced in at
+ * the front; there is no insertion in the middle of the sequence.
+ */
+template <typename T, size_t ChunkSize = 64>
+class ChunkedQueue {
+    struct Chunk {
+        Chunk* prev = nullptr;
+        Chunk* next = nullptr;
+        //! Number of slots filled so far (live or dead).
+        size_t used = 0;
+        //! Number of live slots.
+        size_t live = 0;
+        std::bitset<ChunkSize> alive;
+        T slots[ChunkSize];
+    };
+
+public:
+    /**
+     * Bidirectional iterator over the live elements; V is T or const T.
+     */
+    template <typename V>
+    class Iterator {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef typename std::remove_const<V>::type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef V* pointer;
+        typedef V& reference;
+
+        Iterator() : chunk(nullptr), slot(0) {
+        }
+
+        // An iterator converts to a const_iterator.
+        template <typename U,
+                  typename = typename std::enable_if<
+                          std::is_convertible<U*, V*>::value>::type>
+        Iterator(const Iterator<U>& other)
+            : chunk(other.chunk), slot(other.slot) {
+        }
+
+        reference operator*() const {
+            return chunk->slots[slot];
+        }
+
+        pointer operator->() const {
+            return &chunk->slots[slot];
+        }
+
+        Iterator& operator++() {
+            ++slot;
+            skipDead();
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            Iterator tmp(*this);
+            ++*this;
+            return tmp;
+        }
+
+        Iterator& operator--() {
+            do {
+                if (slot == 0) {
+                    chunk = chunk->prev;
+                    slot = chunk->used;
+                }
+                --slot;
+            } while (!chunk->alive[slot]);
+            return *this;
+        }
+
+        Iterator operator--(int) {
+            Iterator tmp(*this);
+            --*this;
+            return tmp;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return chunk == other.chunk && slot == other.slot;
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        friend class ChunkedQueue;
+        template <typename>
+        friend class Iterator;
+
+        Iterator(Chunk* c, size_t s) : chunk(c), slot(s) {
+        }
+
+        /// Move forward to the next live slot, or to end().
+        void skipDead() {
+            while (true) {
+                if (slot == chunk->used) {
+                    if (!chunk->next) {
+                        return;
+                    }
+                    chunk = chunk->next;
+                    slot = 0;
+                } else if (chunk->alive[slot]) {
+                    return;
+                } else {
+                    ++slot;
+                }
+            }
+        }
+
+        Chunk* chunk;
+        size_t slot;
+    };
+
+    typedef Iterator<T> iterator;
+    typedef Iterator<const T> const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    ChunkedQueue() : head(new Chunk), tail(head), count(0), numChunks(1) {
+    }
+
+    ChunkedQueue(const ChunkedQueue&) = delete;
+    ChunkedQueue& operator=(const ChunkedQueue&) = delete;
+
+    ~ChunkedQueue() {
+        while (head) {
+            Chunk* next = head->next;
+            delete head;
+            head = next;
+        }
+    }
+
+    iterator begin() {
+        iterator it(head, 0);
+        it.skipDead();
+        return it;
+    }
+
+    const_iterator begin() const {
+        return const_cast<ChunkedQueue*>(this)->begin();
+    }
+
+    iterator end() {
+        return iterator(tail, tail->used);
+    }
+
+    const_iterator end() const {
+        return const_iterator(tail, tail->used);
+    }
+
+    reverse_iterator rbegin() {
+        return reverse_iterator(end());
+    }
+
+    const_reverse_iterator rbegin() const {
+        return const_reverse_iterator(end());
+    }
+
+    reverse_iterator rend() {
+        return reverse_iterator(begin());
+    }
+
+    const_reverse_iterator rend() const {
+        return const_reverse_iterator(begin());
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    /// Number of (live) elements.
+    size_t size() const {
+        return count;
+    }
+
+    T& back() {
+        return *(--end());
+    }
+
+    void push_back(const T& value) {
+        if (tail->used == ChunkSize) {
+            Chunk* full = tail;
+            Chunk* chunk = new Chunk;
+            chunk->prev = tail;
+            tail->next = chunk;
+            tail = chunk;
+            ++numChunks;
+            if (full->live == 0) {
+                // Every element of it was erased while it was the last one.
+                unlink(full);
+            }
+        }
+        tail->slots[tail->used] = value;
+        tail->alive.set(tail->used);
+        ++tail->used;
+        ++tail->live;
+        ++count;
+    }
+
+    void pop_back() {
+        erase(--end());
+    }
+
+    /**
+     * Erase the element at the given position; other iterators remain valid.
+     *
+     * @return the position of the element following the erased one
+     */
+    iterator erase(iterator pos) {
+        iterator next(pos);
+        ++next;
+
+        Chunk* chunk = pos.chunk;
+        chunk->slots[pos.slot] = T();
+        chunk->alive.reset(pos.slot);
+        --chunk->live;
+        --count;
+        if (chunk->live == 0 && chunk != tail) {
+            // No iterator can refer to it any more (next is in a later
+            // chunk as this one has no live slot left).
+            unlink(chunk);
+        }
+        return next;
+    }
+
+    /**
+     * Move the elements of other in front of the elements of this queue,
+     * leaving other empty. No element is moved: iterators to the elements of
+     * both queues remain valid (those of other now referring to this queue).
+     */
+    void splice_front(ChunkedQueue& other) {
+        if (other.empty()) {
+            return;
+        }
+        other.tail->next = head;
+        head->prev = other.tail;
+        head = other.head;
+        count += other.count;
+        numChunks += other.numChunks;
+
+        other.head = other.tail = new Chunk;
+        other.count = 0;
+        other.numChunks = 1;
+    }
+
+    void swap(ChunkedQueue& other) {
+        std::swap(head, other.head);
+        std::swap(tail, other.tail);
+        std::swap(count, other.count);
+        std::swap(numChunks, other.numChunks);
+    }
+
+    /// Bytes allocated for the chunks of the queue.
+    size_t getMemorySize() const {
+        return numChunks * sizeof(Chunk);
+    }
+
+private:
+    void unlink(Chunk* chunk) {
+        if (chunk->prev) {
+            chunk->prev->next = chunk->next;
+        } else {
+            head = chunk->next;
+        }
+        // Never the tail, so there is a next chunk.
+        chunk->next->prev = chunk->prev;
+        delete chunk;
+        --numChunks;
+    }
+
+    Chunk* head;
+    Chunk* tail;
+    size_t count;
+    size_t numChunks;
+};
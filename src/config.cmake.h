@@ -31,6 +31,7 @@
 #cmakedefine HAVE_MACH_ABSOLUTE_TIME ${HAVE_MACH_ABSOLUTE_TIME}
 #cmakedefine HAVE_GETTIMEOFDAY ${GETTIMEOFDAY}
 #cmakedefine HAVE_GETOPT_LONG ${HAVE_GETOPT_LONG}
+#cmakedefine HAVE_IO_URING ${HAVE_IO_URING}
 
 /* various */
 #define VERSION "${EP_ENGINE_VERSION}"
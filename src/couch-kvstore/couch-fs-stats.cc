@@ -62,6 +62,7 @@ ssize_t StatsOps::pread(couchstore_error_info_t* errinfo,
                         size_t sz,
                         cs_off_t off) {
     StatFile* sf = reinterpret_cast<StatFile*>(h);
+    ++stats.totalReads;
     stats.readSizeHisto.add(sz);
     if(sf->last_offs) {
         stats.readSeekHisto.add(std::abs(off - sf->last_offs));
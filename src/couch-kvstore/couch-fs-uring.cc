@@ -0,0 +1,1213 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "couch-kvstore/couch-fs-uring.h"
+
+#ifdef HAVE_IO_URING
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+/* The io_uring syscalls have the same numbers on all the architectures we
+ * build for; older C libraries do not define them. */
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+
+/* Alignment of the offsets, lengths and buffers of direct I/O. */
+static const size_t blockSize = 4096;
+
+/* Appends are staged, and submitted, in writes of this size. */
+static const size_t stagingSize = 256 * 1024;
+
+/* Queued writes are submitted to the kernel by batches of this many. */
+static const unsigned submitBatch = 4;
+
+/* A write further than this past the end of the file is not an append: it
+ * is written synchronously rather than zero-filling the gap. */
+static const size_t maxAppendGap = 1024 * 1024;
+
+/* Readahead ranges are merged into reads of up to this size. */
+static const size_t readaheadMaxRead = 1024 * 1024;
+
+static size_t alignDown(size_t value) {
+    return value & ~(blockSize - 1);
+}
+
+static size_t alignUp(size_t value) {
+    return alignDown(value + blockSize - 1);
+}
+
+namespace {
+
+struct FreeDeleter {
+    void operator()(char* ptr) const {
+        free(ptr);
+    }
+};
+
+/**
+ * Heap buffer aligned (and sized) for direct I/O.
+ */
+class AlignedBuffer {
+public:
+    AlignedBuffer() : length(0) {
+    }
+
+    explicit AlignedBuffer(size_t size) : length(size) {
+        void* ptr = nullptr;
+        if (posix_memalign(&ptr, blockSize, std::max(alignUp(size),
+                                                     blockSize)) != 0) {
+            throw std::bad_alloc();
+        }
+        buffer.reset(static_cast<char*>(ptr));
+    }
+
+    char* data() const {
+        return buffer.get();
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+    /// Give up the ownership of the memory (leaking it).
+    char* release() {
+        length = 0;
+        return buffer.release();
+    }
+
+private:
+    std::unique_ptr<char, FreeDeleter> buffer;
+    size_t length;
+};
+
+/* Read up to nbytes, stopping short at the end of the file.
+ * Returns the bytes read, or -1 (errno set). */
+ssize_t readFully(int fd, char* buf, size_t nbytes, cs_off_t offset,
+                  bool direct) {
+    size_t done = 0;
+    while (done < nbytes) {
+        ssize_t rv = ::pread(fd, buf + done, nbytes - done, offset + done);
+        if (rv < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += rv;
+        // A short direct read is at the end of the file, and leaves us
+        // unaligned anyway.
+        if (rv == 0 || direct) {
+            break;
+        }
+    }
+    return done;
+}
+
+/* Returns false (errno set) on failure. */
+bool writeFully(int fd, const char* buf, size_t nbytes, cs_off_t offset) {
+    size_t done = 0;
+    while (done < nbytes) {
+        ssize_t rv = ::pwrite(fd, buf + done, nbytes - done, offset + done);
+        if (rv < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        done += rv;
+    }
+    return true;
+}
+
+/* A contiguous part of a file read ahead. */
+struct ReadaheadExtent {
+    cs_off_t offset;
+    size_t length; // bytes read
+    AlignedBuffer buffer;
+};
+
+/* The calling thread's readahead data. */
+struct ReadaheadCache {
+    const IoUringFileOps* owner = nullptr;
+    std::string path;
+    std::vector<ReadaheadExtent> extents; // by offset
+
+    void clear() {
+        owner = nullptr;
+        path.clear();
+        extents.clear();
+    }
+
+    /* Copy [offset, offset + nbytes) to buf if it was read ahead. */
+    bool lookup(const IoUringFileOps* ops, const std::string& file,
+                char* buf, size_t nbytes, cs_off_t offset) const {
+        if (extents.empty() || owner != ops || path != file) {
+            return false;
+        }
+        auto it = std::upper_bound(extents.begin(), extents.end(), offset,
+                                   [](cs_off_t off, const ReadaheadExtent& e) {
+                                       return off < e.offset;
+                                   });
+        if (it == extents.begin()) {
+            return false;
+        }
+        --it;
+        if (offset + nbytes > it->offset + it->length) {
+            return false;
+        }
+        std::memcpy(buf, it->buffer.data() + (offset - it->offset), nbytes);
+        return true;
+    }
+};
+
+thread_local ReadaheadCache readaheadCache;
+
+} // anonymous namespace
+
+/**
+ * An io_uring instance, driven through the raw syscalls: one submission and
+ * one completion queue shared with the kernel.
+ */
+struct IoUringFileOps::Ring {
+    ~Ring() {
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, sqesSize);
+        }
+        if (cqRing != MAP_FAILED && cqRing != sqRing) {
+            munmap(cqRing, cqRingSize);
+        }
+        if (sqRing != MAP_FAILED) {
+            munmap(sqRing, sqRingSize);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    /// Set up the ring; returns 0 or an errno.
+    int init(unsigned depth) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        fd = int(syscall(__NR_io_uring_setup, depth, &params));
+        if (fd < 0) {
+            return errno;
+        }
+        entries = params.sq_entries;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes +
+                     params.cq_entries * sizeof(io_uring_cqe);
+        const bool singleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMap) {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) {
+            return errno;
+        }
+        if (singleMap) {
+            cqRing = sqRing;
+        } else {
+            cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cqRing == MAP_FAILED) {
+                return errno;
+            }
+        }
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqesMap = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqesMap == MAP_FAILED) {
+            return errno;
+        }
+        sqes = static_cast<io_uring_sqe*>(sqesMap);
+
+        char* sq = static_cast<char*>(sqRing);
+        sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        char* cq = static_cast<char*>(cqRing);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        sqLocalTail = *sqTail;
+        return 0;
+    }
+
+    /// True if the kernel supports the operations we use.
+    bool supportsOps() {
+        const unsigned maxOps = 256;
+        std::vector<uint64_t> mem((sizeof(io_uring_probe) +
+                                   maxOps * sizeof(io_uring_probe_op)) /
+                                          sizeof(uint64_t) + 1);
+        auto* probe = reinterpret_cast<io_uring_probe*>(mem.data());
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE,
+                    probe, maxOps) < 0) {
+            return false;
+        }
+        for (unsigned op : {unsigned(IORING_OP_READ),
+                            unsigned(IORING_OP_WRITE),
+                            unsigned(IORING_OP_FSYNC)}) {
+            if (op > probe->last_op ||
+                !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// A cleared submission entry to fill, queued for the next submit().
+    io_uring_sqe* getSqe() {
+        const unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        if (sqLocalTail - head >= entries) {
+            return nullptr;
+        }
+        const unsigned index = sqLocalTail & sqMask;
+        io_uring_sqe* sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqArray[index] = index;
+        ++sqLocalTail;
+        return sqe;
+    }
+
+    /// Entries queued but not submitted yet.
+    unsigned getQueued() const {
+        return sqLocalTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    }
+
+    /// Submit the queued entries; returns 0 or -errno.
+    int submit() {
+        return enter(0);
+    }
+
+    /// Submit the queued entries and wait for a completion; returns 0 or
+    /// -errno.
+    int wait(uint64_t& userData, int32_t& result) {
+        for (;;) {
+            const unsigned head = *cqHead;
+            if (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+                const io_uring_cqe& cqe = cqes[head & cqMask];
+                userData = cqe.user_data;
+                result = cqe.res;
+                __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+            int rv = enter(1);
+            if (rv < 0) {
+                return rv;
+            }
+        }
+    }
+
+    int fd = -1;
+    unsigned entries = 0;
+
+private:
+    int enter(unsigned minComplete) {
+        __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+        for (;;) {
+            const unsigned queued = getQueued();
+            if (queued == 0 && minComplete == 0) {
+                return 0;
+            }
+            long rv = syscall(__NR_io_uring_enter, fd, queued, minComplete,
+                              minComplete ? IORING_ENTER_GETEVENTS : 0,
+                              nullptr, 0);
+            if (rv >= 0) {
+                return 0;
+            }
+            if (errno != EINTR) {
+                return -errno;
+            }
+        }
+    }
+
+    void* sqRing = MAP_FAILED;
+    size_t sqRingSize = 0;
+    void* cqRing = MAP_FAILED;
+    size_t cqRingSize = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqesSize = 0;
+
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned* sqArray = nullptr;
+    unsigned sqLocalTail = 0;
+
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+};
+
+/**
+ * State of an open file (a couch_file_handle).
+ */
+struct IoUringFileOps::File {
+    /// A write submitted to the ring, owning its data until completed.
+    struct Write {
+        AlignedBuffer buffer;
+        cs_off_t offset = 0;
+        size_t length = 0;
+        bool inFlight = false;
+    };
+
+    ~File() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        if (ringFailed) {
+            abandonRing();
+        }
+    }
+
+    /// Wait for one in-flight write; false if the ring failed.
+    bool reapWrite();
+
+    /// Wait for all the in-flight writes; false on error.
+    bool drainWrites();
+
+    bool overlapsInFlight(cs_off_t offset, size_t length) const;
+
+    /// Write length bytes of buffer at offset, asynchronously if there is a
+    /// ring. Failures are recorded in error.
+    void submitWrite(AlignedBuffer buffer, cs_off_t offset, size_t length);
+
+    /// Submit the staged appends. Unless final, with direct I/O only the
+    /// whole blocks are; if final the last block is zero-padded, and stays
+    /// staged as the next appends will rewrite it.
+    void submitStaging(bool final);
+
+    /// Start staging at the end of the file if nothing is staged.
+    bool prepareAppend();
+
+    /// Append nbytes of data (zeros if data is nullptr).
+    void append(const char* data, size_t nbytes);
+
+    /// Read from the file itself, not from the staged data. Returns the
+    /// bytes read, or -1 (errno set).
+    ssize_t read(char* buf, size_t nbytes, cs_off_t offset);
+
+    /// Write anywhere but at the end of the file: synchronously, once the
+    /// staged and in-flight writes are done.
+    void overwrite(const char* buf, size_t nbytes, cs_off_t offset);
+
+    /// Make the file on disk match what couchstore wrote, bar the fsync.
+    bool flush();
+
+    /// Leak the failed ring and the buffers it may still write from, rather
+    /// than have the kernel use freed memory.
+    void abandonRing() {
+        ring.release();
+        for (auto& write : writes) {
+            if (write.inFlight) {
+                write.buffer.release();
+            }
+        }
+    }
+
+    int fd = -1;
+    std::string path;
+    bool writable = false;
+    bool direct = false;
+
+    //! Size of the file as seen by couchstore, including staged writes.
+    cs_off_t logicalSize = 0;
+    //! Direct I/O padding was written past logicalSize.
+    bool needsTruncate = false;
+
+    //! Appended data not submitted yet, from stagingOffset to logicalSize.
+    //! With direct I/O stagingOffset is block aligned: the staging buffer
+    //! starts with the file's partial last block.
+    AlignedBuffer staging;
+    cs_off_t stagingOffset = 0;
+    size_t stagingLength = 0;
+
+    //! Only for writable files (nullptr if no ring could be set up: the
+    //! writes are then synchronous).
+    std::unique_ptr<Ring> ring;
+    std::vector<Write> writes; // indexed by the entries' user_data
+    size_t inFlight = 0;
+    //! The ring failed: in-flight writes cannot be reaped.
+    bool ringFailed = false;
+
+    //! errno of the first write which failed. Every later write, sync and
+    //! close of the file fails too, couchstore having to reopen it.
+    int error = 0;
+
+    //! For unaligned direct reads.
+    AlignedBuffer bounce;
+};
+
+bool IoUringFileOps::File::reapWrite() {
+    uint64_t id;
+    int32_t result;
+    int rv = ring->wait(id, result);
+    if (rv < 0) {
+        ringFailed = true;
+        if (error == 0) {
+            error = -rv;
+        }
+        return false;
+    }
+
+    auto& write = writes.at(id);
+    if (result < 0) {
+        if (error == 0) {
+            error = -result;
+        }
+    } else if (size_t(result) < write.length &&
+               !writeFully(fd, write.buffer.data() + result,
+                           write.length - result, write.offset + result) &&
+               error == 0) {
+        error = errno;
+    }
+    write.buffer = AlignedBuffer();
+    write.inFlight = false;
+    --inFlight;
+    return true;
+}
+
+bool IoUringFileOps::File::drainWrites() {
+    while (inFlight > 0 && !ringFailed) {
+        reapWrite();
+    }
+    return error == 0;
+}
+
+bool IoUringFileOps::File::overlapsInFlight(cs_off_t offset,
+                                              size_t length) const {
+    if (inFlight == 0) {
+        return false;
+    }
+    for (const auto& write : writes) {
+        if (write.inFlight && offset < cs_off_t(write.offset + write.length) &&
+            write.offset < cs_off_t(offset + length)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void IoUringFileOps::File::submitWrite(AlignedBuffer buffer,
+                                       cs_off_t offset,
+                                       size_t length) {
+    if (error != 0) {
+        return;
+    }
+    if (!ring || ringFailed) {
+        if (!writeFully(fd, buffer.data(), length, offset)) {
+            error = errno;
+        }
+        return;
+    }
+
+    if (inFlight == writes.size() && !reapWrite()) {
+        return;
+    }
+    size_t id = 0;
+    while (writes[id].inFlight) {
+        ++id;
+    }
+
+    // inFlight < writes.size() <= ring entries: there is room in the ring.
+    io_uring_sqe* sqe = ring->getSqe();
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = reinterpret_cast<uintptr_t>(buffer.data());
+    sqe->len = length;
+    sqe->user_data = id;
+
+    auto& write = writes[id];
+    write.buffer = std::move(buffer);
+    write.offset = offset;
+    write.length = length;
+    write.inFlight = true;
+    ++inFlight;
+
+    if (ring->getQueued() >= submitBatch) {
+        int rv = ring->submit();
+        if (rv < 0) {
+            ringFailed = true;
+            error = -rv;
+        }
+    }
+}
+
+void IoUringFileOps::File::submitStaging(bool final) {
+    if (stagingLength == 0) {
+        return;
+    }
+
+    size_t length = stagingLength;
+    size_t keep = 0;
+    if (direct) {
+        keep = length - alignDown(length);
+        if (final) {
+            length = alignUp(length);
+            if (keep > 0) {
+                std::memset(staging.data() + stagingLength, 0,
+                            length - stagingLength);
+                needsTruncate = true;
+            }
+        } else {
+            length -= keep;
+        }
+    }
+    if (length == 0) {
+        return;
+    }
+
+    AlignedBuffer next(stagingSize);
+    if (keep > 0) {
+        std::memcpy(next.data(),
+                    staging.data() + stagingLength - keep,
+                    keep);
+    }
+    const cs_off_t offset = stagingOffset;
+    stagingOffset += stagingLength - keep;
+    stagingLength = keep;
+    submitWrite(std::move(staging), offset, length);
+    staging = std::move(next);
+}
+
+bool IoUringFileOps::File::prepareAppend() {
+    if (stagingLength > 0) {
+        return true;
+    }
+    if (staging.size() == 0) {
+        staging = AlignedBuffer(stagingSize);
+    }
+    if (!direct) {
+        stagingOffset = logicalSize;
+        return true;
+    }
+
+    // Direct I/O writes whole blocks: start from the partial last block.
+    stagingOffset = alignDown(logicalSize);
+    const size_t tail = logicalSize - stagingOffset;
+    if (tail > 0) {
+        if (overlapsInFlight(stagingOffset, tail) &&
+            !drainWrites()) {
+            return false;
+        }
+        ssize_t rv = readFully(fd, staging.data(), blockSize,
+                               stagingOffset, true);
+        if (rv < ssize_t(tail)) {
+            error = rv < 0 ? errno : EIO;
+            return false;
+        }
+    }
+    stagingLength = tail;
+    return true;
+}
+
+void IoUringFileOps::File::append(const char* data, size_t nbytes) {
+    while (nbytes > 0 && error == 0) {
+        const size_t chunk = std::min(nbytes,
+                                      stagingSize - stagingLength);
+        char* dest = staging.data() + stagingLength;
+        if (data) {
+            std::memcpy(dest, data, chunk);
+            data += chunk;
+        } else {
+            std::memset(dest, 0, chunk);
+        }
+        stagingLength += chunk;
+        logicalSize += chunk;
+        nbytes -= chunk;
+        if (stagingLength == stagingSize) {
+            submitStaging(false);
+        }
+    }
+}
+
+ssize_t IoUringFileOps::File::read(char* buf, size_t nbytes, cs_off_t offset) {
+    if (!direct) {
+        return readFully(fd, buf, nbytes, offset, false);
+    }
+
+    const size_t start = alignDown(offset);
+    const size_t length = alignUp(offset + nbytes) - start;
+    if (bounce.size() < length) {
+        bounce = AlignedBuffer(length);
+    }
+    ssize_t rv = readFully(fd, bounce.data(), length, start, true);
+    if (rv < 0) {
+        return -1;
+    }
+    const size_t skip = offset - start;
+    if (size_t(rv) <= skip) {
+        return 0;
+    }
+    const size_t available = std::min(nbytes, size_t(rv) - skip);
+    std::memcpy(buf, bounce.data() + skip, available);
+    return available;
+}
+
+void IoUringFileOps::File::overwrite(const char* buf,
+                                     size_t nbytes,
+                                     cs_off_t offset) {
+    submitStaging(true);
+    if (!drainWrites()) {
+        return;
+    }
+    // The staged last block may be overwritten: reload it if needed.
+    stagingLength = 0;
+
+    if (!direct) {
+        if (!writeFully(fd, buf, nbytes, offset)) {
+            error = errno;
+        }
+    } else {
+        const size_t start = alignDown(offset);
+        const size_t length = alignUp(offset + nbytes) - start;
+        AlignedBuffer block(length);
+        std::memset(block.data(), 0, length);
+        if (cs_off_t(start) < logicalSize &&
+            readFully(fd, block.data(), length, start, true) < 0) {
+            error = errno;
+            return;
+        }
+        std::memcpy(block.data() + (offset - start), buf, nbytes);
+        if (!writeFully(fd, block.data(), length, start)) {
+            error = errno;
+            return;
+        }
+        if (cs_off_t(start + length) >
+            std::max(logicalSize, cs_off_t(offset + nbytes))) {
+            needsTruncate = true;
+        }
+    }
+    logicalSize = std::max(logicalSize, cs_off_t(offset + nbytes));
+}
+
+bool IoUringFileOps::File::flush() {
+    submitStaging(true);
+    if (!drainWrites()) {
+        return false;
+    }
+    if (needsTruncate) {
+        if (ftruncate(fd, logicalSize) != 0) {
+            error = errno;
+            return false;
+        }
+        needsTruncate = false;
+    }
+    return true;
+}
+
+std::shared_ptr<IoUringFileOps> IoUringFileOps::create(size_t queueDepth,
+                                                       bool direct) {
+    std::shared_ptr<IoUringFileOps> ops(
+            new IoUringFileOps(std::max(queueDepth, size_t(1)), direct));
+    auto ring = ops->acquireRing();
+    if (!ring || !ring->supportsOps()) {
+        return nullptr;
+    }
+    ops->releaseRing(std::move(ring));
+    return ops;
+}
+
+IoUringFileOps::IoUringFileOps(size_t queueDepth, bool direct)
+    : queueDepth(queueDepth), direct(direct) {
+}
+
+IoUringFileOps::~IoUringFileOps() {
+}
+
+std::unique_ptr<IoUringFileOps::Ring> IoUringFileOps::acquireRing() {
+    {
+        std::lock_guard<std::mutex> lh(ringsMutex);
+        if (!idleRings.empty()) {
+            auto ring = std::move(idleRings.back());
+            idleRings.pop_back();
+            return ring;
+        }
+    }
+    std::unique_ptr<Ring> ring(new Ring);
+    if (ring->init(unsigned(queueDepth)) != 0) {
+        return nullptr;
+    }
+    return ring;
+}
+
+void IoUringFileOps::releaseRing(std::unique_ptr<Ring> ring) {
+    std::lock_guard<std::mutex> lh(ringsMutex);
+    idleRings.push_back(std::move(ring));
+}
+
+couch_file_handle IoUringFileOps::constructor(
+        couchstore_error_info_t* errinfo) {
+    return reinterpret_cast<couch_file_handle>(new File);
+}
+
+couchstore_error_t IoUringFileOps::open(couchstore_error_info_t* errinfo,
+                                        couch_file_handle* handle,
+                                        const char* path,
+                                        int oflag) {
+    File* file = reinterpret_cast<File*>(*handle);
+    file->writable = (oflag & O_ACCMODE) != O_RDONLY;
+    file->direct = direct;
+
+    int fd;
+    do {
+        fd = ::open(path, oflag | O_CLOEXEC | (file->direct ? O_DIRECT : 0),
+                    0666);
+    } while (fd < 0 && errno == EINTR);
+    if (fd < 0 && file->direct && errno == EINVAL) {
+        // The filesystem does not support direct I/O.
+        file->direct = false;
+        fd = ::open(path, oflag | O_CLOEXEC, 0666);
+    }
+    if (fd < 0) {
+        errinfo->error = errno;
+        return errno == ENOENT ? COUCHSTORE_ERROR_NO_SUCH_FILE
+                               : COUCHSTORE_ERROR_OPEN_FILE;
+    }
+    file->fd = fd;
+    file->path = path;
+
+    if (file->writable) {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            errinfo->error = errno;
+            ::close(fd);
+            file->fd = -1;
+            return COUCHSTORE_ERROR_OPEN_FILE;
+        }
+        file->logicalSize = st.st_size;
+        file->ring = acquireRing();
+        file->writes.resize(queueDepth);
+    }
+    return COUCHSTORE_SUCCESS;
+}
+
+couchstore_error_t IoUringFileOps::close(couchstore_error_info_t* errinfo,
+                                         couch_file_handle handle) {
+    File* file = reinterpret_cast<File*>(handle);
+    if (file->fd < 0) {
+        return COUCHSTORE_SUCCESS;
+    }
+
+    couchstore_error_t rv = COUCHSTORE_SUCCESS;
+    if (file->writable) {
+        if (!file->flush()) {
+            errinfo->error = file->error;
+            rv = COUCHSTORE_ERROR_WRITE;
+        }
+        if (!file->ringFailed) {
+            if (file->ring) {
+                releaseRing(std::move(file->ring));
+            }
+            file->writes.clear();
+        }
+        file->staging = AlignedBuffer();
+        file->stagingLength = 0;
+    }
+
+    int fd = file->fd;
+    file->fd = -1;
+    if (::close(fd) != 0 && rv == COUCHSTORE_SUCCESS) {
+        errinfo->error = errno;
+        rv = COUCHSTORE_ERROR_FILE_CLOSE;
+    }
+    return rv;
+}
+
+ssize_t IoUringFileOps::pread(couchstore_error_info_t* errinfo,
+                              couch_file_handle handle,
+                              void* buf,
+                              size_t nbytes,
+                              cs_off_t offset) {
+    File* file = reinterpret_cast<File*>(handle);
+    char* dest = static_cast<char*>(buf);
+
+    if (!file->writable) {
+        if (readaheadCache.lookup(this, file->path, dest, nbytes, offset)) {
+            return nbytes;
+        }
+        ssize_t rv = file->read(dest, nbytes, offset);
+        if (rv < 0) {
+            errinfo->error = errno;
+            return COUCHSTORE_ERROR_READ;
+        }
+        return rv;
+    }
+
+    if (offset >= file->logicalSize) {
+        return 0;
+    }
+    nbytes = std::min(nbytes, size_t(file->logicalSize - offset));
+
+    // The part of the range which is staged is read from memory.
+    size_t fromFile = nbytes;
+    if (file->stagingLength > 0 &&
+        cs_off_t(offset + nbytes) > file->stagingOffset) {
+        const cs_off_t start = std::max(offset, file->stagingOffset);
+        std::memcpy(dest + (start - offset),
+                    file->staging.data() + (start - file->stagingOffset),
+                    offset + nbytes - start);
+        fromFile = start - offset;
+    }
+    if (fromFile > 0) {
+        if (file->overlapsInFlight(offset, fromFile) && !file->drainWrites()) {
+            errinfo->error = file->error;
+            return COUCHSTORE_ERROR_READ;
+        }
+        ssize_t rv = file->read(dest, fromFile, offset);
+        if (rv < 0) {
+            errinfo->error = errno;
+            return COUCHSTORE_ERROR_READ;
+        }
+        if (size_t(rv) < fromFile) {
+            return rv;
+        }
+    }
+    return nbytes;
+}
+
+ssize_t IoUringFileOps::pwrite(couchstore_error_info_t* errinfo,
+                               couch_file_handle handle,
+                               const void* buf,
+                               size_t nbytes,
+                               cs_off_t offset) {
+    File* file = reinterpret_cast<File*>(handle);
+    const char* data = static_cast<const char*>(buf);
+
+    if (file->error == 0) {
+        if (offset >= file->logicalSize &&
+            size_t(offset - file->logicalSize) <= maxAppendGap) {
+            if (file->prepareAppend()) {
+                file->append(nullptr, offset - file->logicalSize);
+                file->append(data, nbytes);
+            }
+        } else {
+            file->overwrite(data, nbytes, offset);
+        }
+    }
+    if (file->error != 0) {
+        errinfo->error = file->error;
+        return COUCHSTORE_ERROR_WRITE;
+    }
+    return nbytes;
+}
+
+cs_off_t IoUringFileOps::goto_eof(couchstore_error_info_t* errinfo,
+                                  couch_file_handle handle) {
+    File* file = reinterpret_cast<File*>(handle);
+    if (file->writable) {
+        return file->logicalSize;
+    }
+    struct stat st;
+    if (fstat(file->fd, &st) != 0) {
+        errinfo->error = errno;
+        return COUCHSTORE_ERROR_READ;
+    }
+    return st.st_size;
+}
+
+couchstore_error_t IoUringFileOps::sync(couchstore_error_info_t* errinfo,
+                                        couch_file_handle handle) {
+    File* file = reinterpret_cast<File*>(handle);
+    if (file->writable && !file->flush()) {
+        errinfo->error = file->error;
+        return COUCHSTORE_ERROR_WRITE;
+    }
+
+    int rv = 0;
+    if (file->ring && !file->ringFailed) {
+        io_uring_sqe* sqe = file->ring->getSqe();
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = file->fd;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        sqe->user_data = file->writes.size();
+        uint64_t id;
+        int32_t result;
+        rv = file->ring->wait(id, result);
+        if (rv < 0) {
+            file->ringFailed = true;
+        } else {
+            rv = result;
+        }
+        rv = -rv;
+    } else if (fdatasync(file->fd) != 0) {
+        rv = errno;
+    }
+    if (rv != 0) {
+        errinfo->error = rv;
+        return COUCHSTORE_ERROR_WRITE;
+    }
+    return COUCHSTORE_SUCCESS;
+}
+
+couchstore_error_t IoUringFileOps::advise(couchstore_error_info_t* errinfo,
+                                          couch_file_handle handle,
+                                          cs_off_t offset,
+                                          cs_off_t len,
+                                          couchstore_file_advice_t advice) {
+    File* file = reinterpret_cast<File*>(handle);
+    if (file->direct) {
+        // No page cache to advise.
+        return COUCHSTORE_SUCCESS;
+    }
+
+    int posixAdvice;
+    switch (advice) {
+    case COUCHSTORE_FILE_ADVICE_SEQUENTIAL:
+        posixAdvice = POSIX_FADV_SEQUENTIAL;
+        break;
+    case COUCHSTORE_FILE_ADVICE_RANDOM:
+        posixAdvice = POSIX_FADV_RANDOM;
+        break;
+    case COUCHSTORE_FILE_ADVICE_WILLNEED:
+        posixAdvice = POSIX_FADV_WILLNEED;
+        break;
+    case COUCHSTORE_FILE_ADVICE_DONTNEED:
+        posixAdvice = POSIX_FADV_DONTNEED;
+        break;
+    default:
+        posixAdvice = POSIX_FADV_NORMAL;
+        break;
+    }
+    int rv = posix_fadvise(file->fd, offset, len, posixAdvice);
+    if (rv != 0) {
+        errinfo->error = rv;
+        return COUCHSTORE_ERROR_READ;
+    }
+    return COUCHSTORE_SUCCESS;
+}
+
+void IoUringFileOps::destructor(couch_file_handle handle) {
+    delete reinterpret_cast<File*>(handle);
+}
+
+void IoUringFileOps::readahead(
+        const std::string& path,
+        const std::vector<std::pair<cs_off_t, size_t>>& ranges) {
+    clearReadahead();
+    if (ranges.empty()) {
+        return;
+    }
+
+    // Block aligned reads, merging the ranges which touch the same blocks.
+    std::vector<std::pair<size_t, size_t>> reads; // [start, end)
+    for (const auto& range : ranges) {
+        reads.emplace_back(alignDown(range.first),
+                           alignUp(range.first + range.second));
+    }
+    std::sort(reads.begin(), reads.end());
+    std::vector<std::pair<size_t, size_t>> merged;
+    for (const auto& read : reads) {
+        if (!merged.empty() && read.first <= merged.back().second &&
+            read.second - merged.back().first <= readaheadMaxRead) {
+            merged.back().second = std::max(merged.back().second,
+                                            read.second);
+        } else {
+            merged.push_back(read);
+        }
+    }
+
+    bool directRead = direct;
+    int fd = ::open(path.c_str(),
+                    O_RDONLY | O_CLOEXEC | (directRead ? O_DIRECT : 0));
+    if (fd < 0 && directRead && errno == EINVAL) {
+        directRead = false;
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        return;
+    }
+    auto ring = acquireRing();
+    if (!ring) {
+        ::close(fd);
+        return;
+    }
+
+    std::vector<ReadaheadExtent> extents(merged.size());
+    std::vector<bool> valid(merged.size(), false);
+    size_t next = 0;
+    size_t inFlight = 0;
+    bool failed = false;
+    while ((next < merged.size() || inFlight > 0) && !failed) {
+        // Keep up to queueDepth reads in flight.
+        while (next < merged.size() && inFlight < queueDepth) {
+            auto& extent = extents[next];
+            extent.offset = merged[next].first;
+            extent.length = merged[next].second - merged[next].first;
+            extent.buffer = AlignedBuffer(extent.length);
+            io_uring_sqe* sqe = ring->getSqe();
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = fd;
+            sqe->off = extent.offset;
+            sqe->addr = reinterpret_cast<uintptr_t>(extent.buffer.data());
+            sqe->len = extent.length;
+            sqe->user_data = next;
+            ++next;
+            ++inFlight;
+        }
+        uint64_t id;
+        int32_t result;
+        if (ring->wait(id, result) < 0) {
+            failed = true;
+            break;
+        }
+        --inFlight;
+        if (result > 0) {
+            extents[id].length = std::min(extents[id].length, size_t(result));
+            valid[id] = true;
+        }
+    }
+    ::close(fd);
+    if (failed) {
+        // The ring may still reference the buffers: leak it with them rather
+        // than have the kernel write to freed memory.
+        ring.release();
+        for (auto& extent : extents) {
+            extent.buffer.release();
+        }
+        return;
+    }
+    releaseRing(std::move(ring));
+
+    readaheadCache.owner = this;
+    readaheadCache.path = path;
+    for (size_t ii = 0; ii < extents.size(); ++ii) {
+        if (valid[ii]) {
+            readaheadCache.extents.push_back(std::move(extents[ii]));
+        }
+    }
+}
+
+void IoUringFileOps::clearReadahead() {
+    readaheadCache.clear();
+}
+
+#else // !HAVE_IO_URING
+
+struct IoUringFileOps::Ring {};
+
+std::shared_ptr<IoUringFileOps> IoUringFileOps::create(size_t queueDepth,
+                                                       bool direct) {
+    return nullptr;
+}
+
+IoUringFileOps::IoUringFileOps(size_t queueDepth, bool direct)
+    : queueDepth(queueDepth), direct(direct) {
+}
+
+IoUringFileOps::~IoUringFileOps() {
+}
+
+std::unique_ptr<IoUringFileOps::Ring> IoUringFileOps::acquireRing() {
+    return nullptr;
+}
+
+void IoUringFileOps::releaseRing(std::unique_ptr<Ring> ring) {
+}
+
+/* Never instantiated (create() returns nullptr). */
+
+couch_file_handle IoUringFileOps::constructor(
+        couchstore_error_info_t* errinfo) {
+    return nullptr;
+}
+
+couchstore_error_t IoUringFileOps::open(couchstore_error_info_t* errinfo,
+                                        couch_file_handle* handle,
+                                        const char* path,
+                                        int oflag) {
+    return COUCHSTORE_ERROR_OPEN_FILE;
+}
+
+couchstore_error_t IoUringFileOps::close(couchstore_error_info_t* errinfo,
+                                         couch_file_handle handle) {
+    return COUCHSTORE_ERROR_FILE_CLOSE;
+}
+
+ssize_t IoUringFileOps::pread(couchstore_error_info_t* errinfo,
+                              couch_file_handle handle,
+                              void* buf,
+                              size_t nbytes,
+                              cs_off_t offset) {
+    return COUCHSTORE_ERROR_READ;
+}
+
+ssize_t IoUringFileOps::pwrite(couchstore_error_info_t* errinfo,
+                               couch_file_handle handle,
+                               const void* buf,
+                               size_t nbytes,
+                               cs_off_t offset) {
+    return COUCHSTORE_ERROR_WRITE;
+}
+
+cs_off_t IoUringFileOps::goto_eof(couchstore_error_info_t* errinfo,
+                                  couch_file_handle handle) {
+    return COUCHSTORE_ERROR_READ;
+}
+
+couchstore_error_t IoUringFileOps::sync(couchstore_error_info_t* errinfo,
+                                        couch_file_handle handle) {
+    return COUCHSTORE_ERROR_WRITE;
+}
+
+couchstore_error_t IoUringFileOps::advise(couchstore_error_info_t* errinfo,
+                                          couch_file_handle handle,
+                                          cs_off_t offset,
+                                          cs_off_t len,
+                                          couchstore_file_advice_t advice) {
+    return COUCHSTORE_SUCCESS;
+}
+
+void IoUringFileOps::destructor(couch_file_handle handle) {
+}
+
+void IoUringFileOps::readahead(
+        const std::string& path,
+        const std::vector<std::pair<cs_off_t, size_t>>& ranges) {
+}
+
+void IoUringFileOps::clearReadahead() {
+}
+
+#endif // HAVE_IO_URING
@@ -0,0 +1,136 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include <libcouchstore/couch_db.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * FileOpsInterface implementation for couchstore doing its I/O through
+ * Linux io_uring (couchstore_io_backend=io_uring).
+ *
+ * couchstore's file ops are synchronous, so the asynchrony is found where
+ * couchstore does not need the result of an operation straight away:
+ *
+ * - Writes. couchstore only appends to its files (bar the odd header padding
+ *   gap, zero-filled here). Appends to a file opened for writing are staged
+ *   in memory, and submitted to the file's ring as large writes without
+ *   waiting for them; sync() waits for all the writes of the flush then
+ *   submits the fsync. Reads of a file being written are served from the
+ *   staged data, or wait for the in-flight writes they overlap.
+ * - BG fetches. readahead() reads a batch of document bodies in parallel
+ *   (up to the ring depth at once) before the documents are fetched one by
+ *   one, which then read from memory.
+ *
+ * With direct I/O (couchstore_io_uring_direct) files are opened with
+ * O_DIRECT, bypassing the page cache: the partial last block of a file is
+ * kept in memory and zero-padded when written, the padding being truncated
+ * at sync() or close(). Files on a filesystem not supporting O_DIRECT use
+ * buffered I/O.
+ *
+ * A file handle is used by a single thread at a time (as for the default
+ * file ops); the rings are pooled across the handles of the instance.
+ */
+class IoUringFileOps : public FileOpsInterface {
+public:
+    /**
+     * Create an instance, or return nullptr if io_uring is not available
+     * (not supported by this build or by the running kernel).
+     *
+     * @param queueDepth the number of I/Os a file (or a readahead) may have
+     *        in flight at once.
+     * @param direct true to open the files with O_DIRECT.
+     */
+    static std::shared_ptr<IoUringFileOps> create(size_t queueDepth,
+                                                  bool direct);
+
+    ~IoUringFileOps();
+
+    couch_file_handle constructor(couchstore_error_info_t* errinfo) override;
+    couchstore_error_t open(couchstore_error_info_t* errinfo,
+                            couch_file_handle* handle,
+                            const char* path,
+                            int oflag) override;
+    couchstore_error_t close(couchstore_error_info_t* errinfo,
+                             couch_file_handle handle) override;
+    ssize_t pread(couchstore_error_info_t* errinfo,
+                  couch_file_handle handle,
+                  void* buf,
+                  size_t nbytes,
+                  cs_off_t offset) override;
+    ssize_t pwrite(couchstore_error_info_t* errinfo,
+                   couch_file_handle handle,
+                   const void* buf,
+                   size_t nbytes,
+                   cs_off_t offset) override;
+    cs_off_t goto_eof(couchstore_error_info_t* errinfo,
+                      couch_file_handle handle) override;
+    couchstore_error_t sync(couchstore_error_info_t* errinfo,
+                            couch_file_handle handle) override;
+    couchstore_error_t advise(couchstore_error_info_t* errinfo,
+                              couch_file_handle handle,
+                              cs_off_t offset,
+                              cs_off_t len,
+                              couchstore_file_advice_t advice) override;
+    void destructor(couch_file_handle handle) override;
+
+    /**
+     * Read the given (offset, length) ranges of a file in parallel, for the
+     * calling thread's following preads of them, through any handle of this
+     * instance on the file, to be served from memory until clearReadahead().
+     *
+     * Best effort: ranges which cannot be read are read again by pread.
+     */
+    void readahead(const std::string& path,
+                   const std::vector<std::pair<cs_off_t, size_t>>& ranges);
+
+    /// Drop the calling thread's readahead data.
+    void clearReadahead();
+
+    size_t getQueueDepth() const {
+        return queueDepth;
+    }
+
+    bool isDirect() const {
+        return direct;
+    }
+
+private:
+    struct Ring;
+    struct File;
+
+    IoUringFileOps(size_t queueDepth, bool direct);
+
+    /// A ring from the pool, or a new one (nullptr if it cannot be set up).
+    std::unique_ptr<Ring> acquireRing();
+
+    void releaseRing(std::unique_ptr<Ring> ring);
+
+    const size_t queueDepth;
+    const bool direct;
+
+    std::mutex ringsMutex;
+    std::vector<std::unique_ptr<Ring>> idleRings;
+};
@@ -38,6 +38,7 @@
 #include <platform/cb_malloc.h>
 #include <platform/checked_snprintf.h>
 #include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 #include <cJSON.h>
@@ -170,6 +171,38 @@ struct GetMultiCbCtx {
     vb_bgfetch_queue_t &fetches;
 };
 
+/* Copy of a DocInfo owning its buffers. */
+struct OwnedDocInfo {
+    explicit OwnedDocInfo(const DocInfo& from)
+        : info(from),
+          id(from.id.buf, from.id.buf + from.id.size),
+          revMeta(from.rev_meta.buf, from.rev_meta.buf + from.rev_meta.size) {
+        info.id.buf = id.data();
+        info.rev_meta.buf = revMeta.data();
+    }
+
+    DocInfo info;
+    std::vector<char> id;
+    std::vector<char> revMeta;
+};
+
+extern "C" {
+    static int collectDocInfoC(Db *db, DocInfo *docinfo, void *ctx)
+    {
+        auto* infos = static_cast<std::vector<std::unique_ptr<OwnedDocInfo>>*>(
+                ctx);
+        infos->emplace_back(new OwnedDocInfo(*docinfo));
+        return 0;
+    }
+}
+
+/* Upper bound of the bytes a document body of the given size takes on disk:
+ * chunk header (length and CRC), and a block marker every 4096 bytes. */
+static size_t docBodyDiskSize(size_t size) {
+    const size_t chunk = size + 8;
+    return chunk + chunk / 4095 + 1;
+}
+
 struct StatResponseCtx {
 public:
     StatResponseCtx(std::map<std::pair<uint16_t, uint16_t>, vbucket_state> &sm,
@@ -272,9 +305,37 @@ CouchRequest::CouchRequest(const Item& it,
     dbDocInfo.content_meta = getContentMeta(it);
 }
 
+/* The io_uring fileops if the config asks for them, nullptr for couchstore's
+ * default ones (also when io_uring is not available). */
+static std::shared_ptr<IoUringFileOps> createIoUringOps(
+        KVStoreConfig& config) {
+    if (config.getIoBackend() != "io_uring") {
+        return nullptr;
+    }
+    auto ops = IoUringFileOps::create(config.getIoUringDepth(),
+                                      config.isIoUringDirect());
+    if (!ops) {
+        config.getLogger().log(EXTENSION_LOG_WARNING,
+                               "CouchKVStore: io_uring is not available, "
+                               "falling back to sync file I/O, shard:%" PRIu16,
+                               config.getShardId());
+    }
+    return ops;
+}
+
 CouchKVStore::CouchKVStore(KVStoreConfig &config, bool read_only)
-    : CouchKVStore(config, *couchstore_get_default_file_ops(), read_only) {
+    : CouchKVStore(config, createIoUringOps(config), read_only) {
+
+}
 
+CouchKVStore::CouchKVStore(KVStoreConfig& config,
+                           std::shared_ptr<IoUringFileOps> uringOps,
+                           bool read_only)
+    : CouchKVStore(config,
+                   uringOps ? static_cast<FileOpsInterface&>(*uringOps)
+                            : *couchstore_get_default_file_ops(),
+                   read_only) {
+    ioUringOps = std::move(uringOps);
 }
 
 CouchKVStore::CouchKVStore(KVStoreConfig &config, FileOpsInterface& ops,
@@ -314,7 +375,8 @@ CouchKVStore::CouchKVStore(const CouchKVStore &copyFrom)
       numDbFiles(copyFrom.numDbFiles),
       intransaction(false),
       logger(copyFrom.logger),
-      base_ops(copyFrom.base_ops)
+      base_ops(copyFrom.base_ops),
+      ioUringOps(copyFrom.ioUringOps)
 {
     createDataDir(dbname);
     statCollectingFileOps = getCouchstoreStatsOps(st.fsStats, base_ops);
@@ -539,8 +601,33 @@ void CouchKVStore::getMulti(uint16_t vb, vb_bgfetch_queue_t &itms) {
 
     GetMultiCbCtx ctx(*this, vb, itms);
 
-    errCode = couchstore_docinfos_by_id(db, ids, itms.size(),
-                                        0, getMultiCbC, &ctx);
+    if (ioUringOps) {
+        // Look all the documents up first, so that their bodies are read
+        // from disk in parallel before fetching them one by one.
+        std::vector<std::unique_ptr<OwnedDocInfo>> infos;
+        errCode = couchstore_docinfos_by_id(db, ids, itms.size(),
+                                            0, collectDocInfoC, &infos);
+        if (errCode == COUCHSTORE_SUCCESS) {
+            std::vector<std::pair<cs_off_t, size_t>> ranges;
+            for (const auto& owned : infos) {
+                const DocInfo& info = owned->info;
+                auto it = itms.find(makeDocKey(
+                        info.id, configuration.shouldPersistDocNamespace()));
+                if (info.size > 0 && it != itms.end() &&
+                    !it->second.isMetaOnly) {
+                    ranges.emplace_back(info.bp, docBodyDiskSize(info.size));
+                }
+            }
+            ioUringOps->readahead(couchstore_get_db_filename(db), ranges);
+            for (const auto& owned : infos) {
+                getMultiCb(db, &owned->info, &ctx);
+            }
+            ioUringOps->clearReadahead();
+        }
+    } else {
+        errCode = couchstore_docinfos_by_id(db, ids, itms.size(),
+                                            0, getMultiCbC, &ctx);
+    }
     if (errCode != COUCHSTORE_SUCCESS) {
         st.numGetFailure += numItems;
         logger.log(EXTENSION_LOG_WARNING, "CouchKVStore::getMulti: "
@@ -1834,24 +1921,43 @@ bool CouchKVStore::commit2couchstore() {
     return success;
 }
 
-static int readDocInfos(Db *db, DocInfo *docinfo, void *ctx) {
-    if (ctx == nullptr) {
-        throw std::invalid_argument("readDocInfos: ctx must be non-NULL");
-    }
-    kvstats_ctx* cbCtx = static_cast<kvstats_ctx*>(ctx);
-    if(docinfo) {
+// saveDocs needs the couchstore which passes to the save callback the
+// previous docinfo of each document, found while updating the by-id tree.
+// Older couchstores only pass the new docinfo, or have no save callback.
+static_assert(
+        std::is_same<save_callback_fn,
+                     void (*)(const DocInfo*, const DocInfo*, void*)>::value,
+              "couchstore too old: couchstore_save_documents_and_callback() "
+              "must pass (const DocInfo* oldInfo, const DocInfo* newInfo, "
+              "void* ctx) to its save_callback_fn");
+
+/**
+ * Called by couchstore_save_documents_and_callback() for each document as it
+ * is saved, with the document's previous docinfo (if any) found while
+ * updating the by-id tree.
+ */
+static void saveDocsCallback(const DocInfo* oldInfo,
+                             const DocInfo* newInfo,
+                             void* context) {
+    if (context == nullptr) {
+        throw std::invalid_argument(
+                "saveDocsCallback: context must be non-NULL");
+    }
+    if (newInfo == nullptr) {
+        throw std::invalid_argument(
+                "saveDocsCallback: newInfo must be non-NULL");
+    }
+    kvstats_ctx* cbCtx = static_cast<kvstats_ctx*>(context);
+    if (oldInfo && !oldInfo->deleted) {
         // An item exists in the VB DB file.
-        if (!docinfo->deleted) {
-            // Collections: TODO: Permanently restore to stored namespace
-            auto itr = cbCtx->keyStats.find(makeDocKey(
-                    docinfo->id,
-                    cbCtx->config.shouldPersistDocNamespace()));
-            if (itr != cbCtx->keyStats.end()) {
-                itr->second.first = true;
-            }
+        // Collections: TODO: Permanently restore to stored namespace
+        auto itr = cbCtx->keyStats.find(
+                makeDocKey(newInfo->id,
+                           cbCtx->config.shouldPersistDocNamespace()));
+        if (itr != cbCtx->keyStats.end()) {
+            itr->second.first = true;
         }
     }
-    return 0;
 }
 
 couchstore_error_t CouchKVStore::saveDocs(uint16_t vbid, uint64_t rev,
@@ -1883,24 +1989,29 @@ couchstore_error_t CouchKVStore::saveDocs(uint16_t vbid, uint64_t rev,
         }
 
         uint64_t maxDBSeqno = 0;
-        sized_buf *ids = new sized_buf[docCount];
         for (size_t idx = 0; idx < docCount; idx++) {
-            ids[idx] = docinfos[idx]->id;
             maxDBSeqno = std::max(maxDBSeqno, docinfos[idx]->db_seq);
-            DocKey key = makeDocKey(ids[idx],
+            DocKey key = makeDocKey(docinfos[idx]->id,
                                     configuration.shouldPersistDocNamespace());
             kvctx.keyStats[key] = std::make_pair(false,
                                                  !docinfos[idx]->deleted);
         }
-        couchstore_docinfos_by_id(db, ids, (unsigned) docCount, 0,
-                readDocInfos, &kvctx);
-        delete[] ids;
 
+        // Whether each document existed (kvctx.keyStats) is found while
+        // updating the by-id tree, rather than by looking the documents up
+        // beforehand: the tree is only walked once.
+        const size_t readsBefore = st.fsStats.totalReads;
         hrtime_t cs_begin = gethrtime();
         uint64_t flags = COMPRESS_DOC_BODIES | COUCHSTORE_SEQUENCE_AS_IS;
-        errCode = couchstore_save_documents(db, docs, docinfos,
-                (unsigned) docCount, flags);
+        errCode = couchstore_save_documents_and_callback(db,
+                                                         docs,
+                                                         docinfos,
+                                                         (unsigned)docCount,
+                                                         flags,
+                                                         saveDocsCallback,
+                                                         &kvctx);
         st.saveDocsHisto.add((gethrtime() - cs_begin) / 1000);
+        st.io_flush_reads += st.fsStats.totalReads - readsBefore;
         if (errCode != COUCHSTORE_SUCCESS) {
             logger.log(EXTENSION_LOG_WARNING,
                        "CouchKVStore::saveDocs: couchstore_save_documents "
@@ -1958,6 +2069,7 @@ couchstore_error_t CouchKVStore::saveDocs(uint16_t vbid, uint64_t rev,
     /* update stat */
     if(errCode == COUCHSTORE_SUCCESS) {
         st.docsCommitted = docCount;
+        st.io_flush_docs += docCount;
     }
 
     return errCode;
@@ -29,6 +29,7 @@
 
 #include "configuration.h"
 #include "couch-kvstore/couch-fs-stats.h"
+#include "couch-kvstore/couch-fs-uring.h"
 #include "couch-kvstore/couch-kvstore-metadata.h"
 #include <platform/histogram.h>
 #include <platform/strerror.h>
@@ -519,7 +520,21 @@ protected:
      */
     FileOpsInterface& base_ops;
 
+    /**
+     * The io_uring fileops, if in use (couchstore_io_backend=io_uring):
+     * base_ops then refers to them, and BG fetches read ahead through them.
+     */
+    std::shared_ptr<IoUringFileOps> ioUringOps;
+
 private:
+    /**
+     * Constructor selecting the base fileops: the given io_uring ones, or
+     * couchstore's default ones if nullptr.
+     */
+    CouchKVStore(KVStoreConfig& config,
+                 std::shared_ptr<IoUringFileOps> uringOps,
+                 bool read_only);
+
     class DbHolder {
     public:
         DbHolder(CouchKVStore* kvs) : kvstore(kvs), db(nullptr) {}
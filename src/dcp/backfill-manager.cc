@@ -24,6 +24,8 @@
 #include "dcp/dcpconnmap.h"
 #include "dcp/producer.h"
 
+#include <platform/make_unique.h>
+
 static const size_t sleepTime = 1;
 
 class BackfillManagerTask : public GlobalTask {
@@ -66,7 +68,7 @@ bool BackfillManagerTask::run() {
     if (status == backfill_finished) {
         return false;
     } else if (status == backfill_snooze) {
-        snooze(sleepTime);
+        snooze(manager->getSnoozeTime());
     }
 
     if (engine->getEpStats().isShutdown) {
@@ -91,11 +93,19 @@ BackfillManager::BackfillManager(EventuallyPersistentEngine* e)
     scanBuffer.itemsRead = 0;
     scanBuffer.maxBytes = config.getDcpScanByteLimit();
     scanBuffer.maxItems = config.getDcpScanItemLimit();
+    scanBuffer.batched = false;
+    scanBuffer.fromDisk = false;
 
     buffer.bytesRead = 0;
     buffer.maxBytes = config.getDcpBackfillByteLimit();
     buffer.nextReadSize = 0;
     buffer.full = false;
+
+    scheduler.priority = BackfillScheduler::Priority::Other;
+    scheduler.snoozeTime = sleepTime;
+    scheduler.waiting = false;
+    scheduler.numWaits = 0;
+    scheduler.waitTime = 0;
 }
 
 void BackfillManager::addStats(connection_t conn, ADD_STAT add_stat,
@@ -107,6 +117,13 @@ void BackfillManager::addStats(connection_t conn, ADD_STAT add_stat,
     conn->addStat("backfill_num_active", activeBackfills.size(), add_stat, c);
     conn->addStat("backfill_num_snoozing", snoozingBackfills.size(), add_stat, c);
     conn->addStat("backfill_num_pending", pendingBackfills.size(), add_stat, c);
+    conn->addStat("backfill_priority",
+                  scheduler.priority == BackfillScheduler::Priority::Replication
+                          ? "replication" : "other",
+                  add_stat, c);
+    conn->addStat("backfill_waiting", scheduler.waiting, add_stat, c);
+    conn->addStat("backfill_waits", scheduler.numWaits, add_stat, c);
+    conn->addStat("backfill_wait_us", scheduler.waitTime, add_stat, c);
 }
 
 BackfillManager::~BackfillManager() {
@@ -115,6 +132,8 @@ BackfillManager::~BackfillManager() {
         managerTask.reset();
     }
 
+    engine->getDcpConnMap().getBackfillScheduler().cancelWait(this);
+
     while (!activeBackfills.empty()) {
         DCPBackfill* backfill = activeBackfills.front();
         activeBackfills.pop_front();
@@ -141,11 +160,23 @@ BackfillManager::~BackfillManager() {
 
 
 void BackfillManager::schedule(const stream_t& stream, uint64_t start, uint64_t end) {
+    /* The vbucket decides how it is backfilled (e.g. from disk, or from
+       memory for ephemeral buckets) */
+    std::unique_ptr<DCPBackfill> backfill;
+    RCPtr<VBucket> vb = engine->getVBucket(stream->getVBucket());
+    if (vb) {
+        backfill = vb->createDCPBackfill(*engine, stream, start, end);
+    } else {
+        /* The backfill is cancelled when it finds the vbucket missing */
+        backfill = std::make_unique<DCPBackfillDisk>(engine, stream, start,
+                                                     end);
+    }
+
     LockHolder lh(lock);
     if (engine->getDcpConnMap().canAddBackfillToActiveQ()) {
-        activeBackfills.push_back(new DCPBackfill(engine, stream, start, end));
+        activeBackfills.push_back(backfill.release());
     } else {
-        pendingBackfills.push_back(new DCPBackfill(engine, stream, start, end));
+        pendingBackfills.push_back(backfill.release());
     }
 
     if (managerTask && !managerTask->isdead()) {
@@ -159,13 +190,15 @@ void BackfillManager::schedule(const stream_t& stream, uint64_t start, uint64_t
 
 bool BackfillManager::bytesRead(uint32_t bytes) {
     LockHolder lh(lock);
-    if (scanBuffer.itemsRead >= scanBuffer.maxItems) {
+    if (scanBuffer.batched && scanBuffer.itemsRead >= scanBuffer.maxItems) {
         return false;
     }
 
     // Always allow an item to be backfilled if the scan buffer is empty,
-    // otherwise check to see if there is room for the item.
-    if (scanBuffer.bytesRead + bytes <= scanBuffer.maxBytes ||
+    // otherwise check to see if there is room for the item. Items read by
+    // another connection's scan only honour the buffer below.
+    if (!scanBuffer.batched ||
+        scanBuffer.bytesRead + bytes <= scanBuffer.maxBytes ||
         scanBuffer.bytesRead == 0) {
         scanBuffer.bytesRead += bytes;
     } else {
@@ -182,6 +215,16 @@ bool BackfillManager::bytesRead(uint32_t bytes) {
         return false;
     }
 
+    // Disk reads are also charged to the bucket-wide read budget; if that is
+    // exhausted the item is read in a later run.
+    if (scanBuffer.fromDisk &&
+        !engine->getDcpConnMap().getBackfillScheduler().consumeBytes(
+                bytes, scheduler.priority)) {
+        scanBuffer.bytesRead -= bytes;
+        buffer.bytesRead -= bytes;
+        return false;
+    }
+
     scanBuffer.itemsRead++;
 
     return true;
@@ -213,9 +256,12 @@ void BackfillManager::bytesSent(uint32_t bytes) {
 backfill_status_t BackfillManager::backfill() {
     std::unique_lock<std::mutex> lh(lock);
 
+    scheduler.snoozeTime = sleepTime;
+
     if (activeBackfills.empty() && snoozingBackfills.empty()
         && pendingBackfills.empty()) {
         managerTask.reset();
+        engine->getDcpConnMap().getBackfillScheduler().cancelWait(this);
         return backfill_finished;
     }
 
@@ -239,7 +285,6 @@ backfill_status_t BackfillManager::backfill() {
         std::list<DCPBackfill*>::iterator a_itr = activeBackfills.begin();
         while (a_itr != activeBackfills.end()) {
             if ((*a_itr)->isDead()) {
-                (*a_itr)->cancel();
                 toDelete.push_back(*a_itr);
                 a_itr = activeBackfills.erase(a_itr);
                 engine->getDcpConnMap().decrNumActiveSnoozingBackfills();
@@ -248,25 +293,53 @@ backfill_status_t BackfillManager::backfill() {
             }
         }
 
+        // Not holding our lock when cancelling, as giving back a scan slot
+        // may wake other connections' tasks.
         lh.unlock();
         bool reschedule = !toDelete.empty();
         while (!toDelete.empty()) {
             DCPBackfill* backfill = toDelete.front();
             toDelete.pop_front();
+            backfill->cancel();
             delete backfill;
         }
         return reschedule ? backfill_success : backfill_snooze;
     }
 
     DCPBackfill* backfill = activeBackfills.front();
+    // Only disk backfills are subject to the bucket-wide scheduler: they take
+    // a scan slot before their first step and hold it until they complete.
+    const bool scheduled = backfill->readsFromDisk();
+    if (scheduled) {
+        if (backfill->holdsScanSlot()) {
+            if (!engine->getDcpConnMap().getBackfillScheduler().tryContinueScan(
+                        scheduler.priority, scheduler.snoozeTime)) {
+                return backfill_snooze;
+            }
+        } else if (startScan_UNLOCKED()) {
+            backfill->setScanSlot(std::make_unique<BackfillScheduler::ScanSlot>(
+                    engine->getDcpConnMap().getBackfillScheduler()));
+        } else {
+            return backfill_snooze;
+        }
+    }
     activeBackfills.pop_front();
+    // Items may reach our streams from a disk scan run by another
+    // connection (see SharedDiskScan); only those read by our own runs count
+    // towards the scan buffer.
+    scanBuffer.bytesRead = 0;
+    scanBuffer.itemsRead = 0;
+    scanBuffer.batched = true;
+    scanBuffer.fromDisk = scheduled;
 
+    // Not holding our lock, as completing the backfill gives back its scan
+    // slot, which may wake other connections' tasks.
     lh.unlock();
     backfill_status_t status = backfill->run();
     lh.lock();
 
-    scanBuffer.bytesRead = 0;
-    scanBuffer.itemsRead = 0;
+    scanBuffer.batched = false;
+    scanBuffer.fromDisk = false;
 
     switch (status) {
         case backfill_success:
@@ -320,9 +393,40 @@ void BackfillManager::moveToActiveQueue() {
     }
 }
 
+bool BackfillManager::startScan_UNLOCKED() {
+    if (!engine->getDcpConnMap().getBackfillScheduler().tryStartScan(
+                shared_from_this(), scheduler.priority, scheduler.snoozeTime)) {
+        if (!scheduler.waiting) {
+            scheduler.waiting = true;
+            scheduler.waitStart = ProcessClock::now();
+            ++scheduler.numWaits;
+        }
+        return false;
+    }
+
+    if (scheduler.waiting) {
+        scheduler.waiting = false;
+        scheduler.waitTime +=
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                        ProcessClock::now() - scheduler.waitStart).count();
+    }
+    return true;
+}
+
+double BackfillManager::getSnoozeTime() {
+    LockHolder lh(lock);
+    return scheduler.snoozeTime;
+}
+
 void BackfillManager::wakeUpTask() {
     LockHolder lh(lock);
     if (managerTask) {
         ExecutorPool::get()->wake(managerTask->getId());
     }
 }
+
+void BackfillManager::setSchedulerPriority(
+        BackfillScheduler::Priority priority) {
+    LockHolder lh(lock);
+    scheduler.priority = priority;
+}
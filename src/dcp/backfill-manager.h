@@ -36,10 +36,22 @@
  * sufficiently drained (by sending to the client), backfilling can be
  * resumed.
  *
+ * In-memory backfills (ephemeral buckets) are batched by the same limits;
+ * they copy the items of the vbucket one at a time, so a run ends as soon
+ * as either buffer is full.
+ *
+ * Disk backfills are additionally subject to the bucket-wide
+ * BackfillScheduler, which limits the concurrent scans and the disk read
+ * rate across all the connections. The items a disk backfill reads may also
+ * be handed to the streams of other connections (see SharedDiskScan).
+ *
  * Significant configuration parameters affecting backfill:
  * - dcp_scan_byte_limit
  * - dcp_scan_item_limit
  * - dcp_backfill_byte_limit
+ * - dcp_backfill_max_scans
+ * - dcp_backfill_bytes_per_sec
+ * - dcp_backfill_share_scans
  */
 
 #ifndef SRC_DCP_BACKFILL_MANAGER_H_
@@ -47,6 +59,7 @@
 
 #include "config.h"
 #include "connmap.h"
+#include "dcp/backfill-scheduler.h"
 #include "dcp/backfill.h"
 #include "dcp/producer.h"
 #include "dcp/stream.h"
@@ -71,12 +84,26 @@ public:
     // backfills between the different queues.
     backfill_status_t backfill();
 
+    /// How long (in seconds) the managerTask should snooze for after
+    /// backfill() returned backfill_snooze.
+    double getSnoozeTime();
+
     void wakeUpTask();
 
+    /// Set the priority of this connection's backfills in the bucket-wide
+    /// BackfillScheduler.
+    void setSchedulerPriority(BackfillScheduler::Priority priority);
+
 private:
 
     void moveToActiveQueue();
 
+    /**
+     * Ask the BackfillScheduler whether a disk backfill may run now,
+     * tracking how long this connection waits for it.
+     */
+    bool startScan_UNLOCKED();
+
     std::mutex lock;
     std::list<DCPBackfill*> activeBackfills;
     std::list<std::pair<rel_time_t, DCPBackfill*> > snoozingBackfills;
@@ -92,6 +119,12 @@ private:
         uint32_t itemsRead;
         uint32_t maxBytes;
         uint32_t maxItems;
+        //! True only while running one of our backfills (items read by
+        //! another connection's scan are not batched by the limits above)
+        bool batched;
+        //! True only while running a disk backfill, whose reads are charged
+        //! to the BackfillScheduler (see DCPBackfill::readsFromDisk())
+        bool fromDisk;
     } scanBuffer;
 
     //! The buffer is the total bytes used by all backfills for this connection
@@ -101,6 +134,19 @@ private:
         uint32_t nextReadSize;
         bool full;
     } buffer;
+
+    //! This connection's standing in the bucket-wide BackfillScheduler
+    struct {
+        BackfillScheduler::Priority priority;
+        //! Snooze time requested by the scheduler for the next snooze
+        double snoozeTime;
+        //! True (since waitStart) while refused by the scheduler
+        bool waiting;
+        ProcessClock::time_point waitStart;
+        //! Number of times, and total time (in µs), spent waiting
+        uint64_t numWaits;
+        uint64_t waitTime;
+    } scheduler;
 };
 
 #endif  // SRC_DCP_BACKFILL_MANAGER_H_
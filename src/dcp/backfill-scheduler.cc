@@ -0,0 +1,220 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "dcp/backfill-scheduler.h"
+#include "dcp/backfill-manager.h"
+
+#include <algorithm>
+
+/* Other (non replication) scans only restart once this fraction of a second
+ * worth of read budget is available, so they read in reasonable batches. */
+static const double otherScanMinBudget = 0.1;
+
+static size_t priorityIndex(BackfillScheduler::Priority priority) {
+    return priority == BackfillScheduler::Priority::Replication ? 0 : 1;
+}
+
+BackfillScheduler::BackfillScheduler(size_t maxScans, size_t bytesPerSec)
+    : maxScans(maxScans),
+      runningScans(0),
+      bytesPerSec(bytesPerSec),
+      tokens(bytesPerSec),
+      lastRefill(ProcessClock::now()) {
+}
+
+void BackfillScheduler::setMaxScans(size_t newMaxScans) {
+    std::vector<std::weak_ptr<BackfillManager>> wake;
+    {
+        std::lock_guard<std::mutex> lh(mutex);
+        maxScans = newMaxScans;
+        wake = toWake_UNLOCKED();
+    }
+    for (auto& handle : wake) {
+        auto manager = handle.lock();
+        if (manager) {
+            manager->wakeUpTask();
+        }
+    }
+}
+
+void BackfillScheduler::setBytesPerSecond(size_t newBytesPerSec) {
+    std::lock_guard<std::mutex> lh(mutex);
+    bytesPerSec = newBytesPerSec;
+    tokens = std::min(tokens, double(bytesPerSec));
+    lastRefill = ProcessClock::now();
+}
+
+bool BackfillScheduler::tryStartScan(
+        const std::shared_ptr<BackfillManager>& manager,
+        Priority priority,
+        double& snoozeTime) {
+    std::lock_guard<std::mutex> lh(mutex);
+
+    const bool replication = priority == Priority::Replication;
+    if (!replication && replicationWaiting_UNLOCKED()) {
+        enqueue_UNLOCKED(manager, priority);
+        return false;
+    }
+
+    if (maxScans != 0 && runningScans >= maxScans) {
+        enqueue_UNLOCKED(manager, priority);
+        return false;
+    }
+
+    if (!hasReadBudget_UNLOCKED(priority, snoozeTime)) {
+        enqueue_UNLOCKED(manager, priority);
+        return false;
+    }
+
+    dequeue_UNLOCKED(manager.get());
+    ++runningScans;
+    return true;
+}
+
+bool BackfillScheduler::tryContinueScan(Priority priority,
+                                        double& snoozeTime) {
+    std::lock_guard<std::mutex> lh(mutex);
+    return hasReadBudget_UNLOCKED(priority, snoozeTime);
+}
+
+void BackfillScheduler::scanCompleted() {
+    std::vector<std::weak_ptr<BackfillManager>> wake;
+    {
+        std::lock_guard<std::mutex> lh(mutex);
+        if (runningScans > 0) {
+            --runningScans;
+        }
+        wake = toWake_UNLOCKED();
+    }
+
+    // Outside of our lock: waking takes the manager's lock.
+    for (auto& handle : wake) {
+        auto manager = handle.lock();
+        if (manager) {
+            manager->wakeUpTask();
+        }
+    }
+}
+
+bool BackfillScheduler::consumeBytes(size_t bytes, Priority priority) {
+    std::lock_guard<std::mutex> lh(mutex);
+    if (bytesPerSec == 0) {
+        return true;
+    }
+
+    refill_UNLOCKED(ProcessClock::now());
+    if (priority == Priority::Replication) {
+        // Never refuse a replication scan with budget left, even if the item
+        // overdraws it: the debt is paid back before its next scan.
+        if (tokens <= 0) {
+            return false;
+        }
+    } else if (tokens < std::min(double(bytes), double(bytesPerSec)) ||
+               replicationWaiting_UNLOCKED()) {
+        // (An item larger than the whole budget is read once it is full.)
+        return false;
+    }
+    tokens -= bytes;
+    return true;
+}
+
+void BackfillScheduler::cancelWait(const BackfillManager* manager) {
+    std::lock_guard<std::mutex> lh(mutex);
+    dequeue_UNLOCKED(manager);
+}
+
+size_t BackfillScheduler::getRunningScans() {
+    std::lock_guard<std::mutex> lh(mutex);
+    return runningScans;
+}
+
+size_t BackfillScheduler::getWaitingManagers() {
+    std::lock_guard<std::mutex> lh(mutex);
+    return waiting[0].size() + waiting[1].size();
+}
+
+void BackfillScheduler::refill_UNLOCKED(ProcessClock::time_point now) {
+    const std::chrono::duration<double> elapsed = now - lastRefill;
+    lastRefill = now;
+    tokens = std::min(double(bytesPerSec),
+                      tokens + elapsed.count() * bytesPerSec);
+}
+
+bool BackfillScheduler::hasReadBudget_UNLOCKED(Priority priority,
+                                               double& snoozeTime) {
+    if (bytesPerSec == 0) {
+        return true;
+    }
+
+    refill_UNLOCKED(ProcessClock::now());
+    const double needed = priority == Priority::Replication
+                                  ? 1 : bytesPerSec * otherScanMinBudget;
+    if (tokens < needed) {
+        snoozeTime = (needed - tokens) / bytesPerSec;
+        return false;
+    }
+    return true;
+}
+
+bool BackfillScheduler::replicationWaiting_UNLOCKED() const {
+    for (const auto& waiter : waiting[priorityIndex(Priority::Replication)]) {
+        if (!waiter.handle.expired()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void BackfillScheduler::enqueue_UNLOCKED(
+        const std::shared_ptr<BackfillManager>& manager, Priority priority) {
+    auto& queue = waiting[priorityIndex(priority)];
+    for (const auto& waiter : queue) {
+        if (waiter.manager == manager.get()) {
+            return;
+        }
+    }
+    queue.push_back({manager.get(), manager});
+}
+
+void BackfillScheduler::dequeue_UNLOCKED(const BackfillManager* manager) {
+    for (auto& queue : waiting) {
+        queue.remove_if([manager](const Waiter& waiter) {
+            return waiter.manager == manager || waiter.handle.expired();
+        });
+    }
+}
+
+std::vector<std::weak_ptr<BackfillManager>>
+BackfillScheduler::toWake_UNLOCKED() {
+    std::vector<std::weak_ptr<BackfillManager>> wake;
+    if (maxScans != 0 && runningScans >= maxScans) {
+        return wake;
+    }
+    // Only wake the highest priority waiters; the others retry once their
+    // snooze expires.
+    for (auto& queue : waiting) {
+        for (const auto& waiter : queue) {
+            wake.push_back(waiter.handle);
+        }
+        if (!wake.empty()) {
+            break;
+        }
+    }
+    return wake;
+}
@@ -0,0 +1,161 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include <platform/processclock.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class BackfillManager;
+
+/**
+ * Bucket-wide budget for the disk backfills of all the DCP producers.
+ *
+ * Each BackfillManager (one per producer) asks the scheduler for a scan
+ * slot before creating a disk backfill, which holds it (see ScanSlot) until
+ * the backfill completes or is cancelled; it asks again for read budget
+ * before each later step, and charges it for every byte it reads. Two
+ * limits apply across all producers:
+ * - the number of disk backfill scans open concurrently
+ *   (dcp_backfill_max_scans);
+ * - the bytes read from disk per second (dcp_backfill_bytes_per_sec), as a
+ *   token bucket holding up to one second worth of bytes.
+ * A value of 0 disables the corresponding limit.
+ *
+ * Replication producers have priority over the other (e.g. index, XDCR)
+ * ones: while a replication producer is waiting for a scan slot or for read
+ * budget, other producers cannot start a scan or read. A manager which is
+ * refused is queued and woken (BackfillManager::wakeUpTask()) once a scan
+ * slot frees up, replication ones first.
+ *
+ * Lock ordering: a BackfillManager may call the scheduler with its own lock
+ * held; the scheduler never calls a manager with its lock held.
+ */
+class BackfillScheduler {
+public:
+    enum class Priority {
+        Replication,
+        Other
+    };
+
+    /**
+     * A scan slot granted by tryStartScan(), given back (scanCompleted())
+     * when destroyed.
+     */
+    class ScanSlot {
+    public:
+        ScanSlot(BackfillScheduler& s) : scheduler(s) {
+        }
+
+        ~ScanSlot() {
+            scheduler.scanCompleted();
+        }
+
+    private:
+        BackfillScheduler& scheduler;
+    };
+
+    BackfillScheduler(size_t maxScans, size_t bytesPerSec);
+
+    void setMaxScans(size_t maxScans);
+
+    void setBytesPerSecond(size_t bytesPerSec);
+
+    /**
+     * Ask to open a disk backfill scan for the given manager.
+     *
+     * @param snoozeTime set, if refused, to how long (in seconds) to wait for
+     *        the read budget to refill; the manager is also woken as soon as
+     *        a scan slot frees up.
+     * @return true if the scan may be opened now, in which case
+     *         scanCompleted() must be called once it is closed.
+     */
+    bool tryStartScan(const std::shared_ptr<BackfillManager>& manager,
+                      Priority priority,
+                      double& snoozeTime);
+
+    /// A scan allowed by tryStartScan() has been closed.
+    void scanCompleted();
+
+    /**
+     * Ask to run another step of an open scan, which only waits for the
+     * read budget.
+     *
+     * @param snoozeTime set, if refused, to how long (in seconds) to wait
+     *        for the read budget to refill.
+     */
+    bool tryContinueScan(Priority priority, double& snoozeTime);
+
+    /**
+     * Charge bytes read from disk by a running scan to the read budget.
+     *
+     * @return false if over budget, in which case nothing is charged and the
+     *         item should be read later.
+     */
+    bool consumeBytes(size_t bytes, Priority priority);
+
+    /// Stop waiting for a slot on behalf of the given manager (which has no
+    /// more disk backfills to run, or is being destroyed).
+    void cancelWait(const BackfillManager* manager);
+
+    size_t getRunningScans();
+
+    size_t getWaitingManagers();
+
+private:
+    struct Waiter {
+        const BackfillManager* manager;
+        std::weak_ptr<BackfillManager> handle;
+    };
+
+    /// Add the bytes earned since the last refill to the read budget.
+    void refill_UNLOCKED(ProcessClock::time_point now);
+
+    /// True if enough read budget is left for a scan to run a step.
+    bool hasReadBudget_UNLOCKED(Priority priority, double& snoozeTime);
+
+    /// True if a replication manager is waiting (Other ones must yield).
+    bool replicationWaiting_UNLOCKED() const;
+
+    void enqueue_UNLOCKED(const std::shared_ptr<BackfillManager>& manager,
+                          Priority priority);
+
+    void dequeue_UNLOCKED(const BackfillManager* manager);
+
+    /// The waiters to wake once a scan slot is available.
+    std::vector<std::weak_ptr<BackfillManager>> toWake_UNLOCKED();
+
+    std::mutex mutex;
+
+    size_t maxScans;
+    size_t runningScans;
+
+    size_t bytesPerSec;
+    //! Read budget left; may go negative as replication scans are allowed
+    //! to overdraw it by their last item.
+    double tokens;
+    ProcessClock::time_point lastRefill;
+
+    //! Managers waiting, in arrival order, per priority.
+    std::list<Waiter> waiting[2];
+};
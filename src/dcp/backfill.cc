@@ -19,7 +19,11 @@
 
 #include "ep_engine.h"
 #include "dcp/backfill.h"
+#include "dcp/dcpconnmap.h"
 #include "dcp/stream.h"
+#include "ephemeral_vb.h"
+
+#include <algorithm>
 
 static std::string backfillStateToString(backfill_state_t state) {
     switch (state) {
@@ -35,20 +39,19 @@ static std::string backfillStateToString(backfill_state_t state) {
     return "<invalid>:" + std::to_string(state);
 }
 
-CacheCallback::CacheCallback(EventuallyPersistentEngine* e, stream_t &s)
+CacheCallback::CacheCallback(EventuallyPersistentEngine* e,
+                             SharedDiskScan& s)
     : engine_(e),
-      stream_(s) {
-    if (stream_.get() == nullptr) {
-        throw std::invalid_argument("CacheCallback(): stream is NULL");
-    }
-    if (stream_.get()->getType() != STREAM_ACTIVE) {
-        throw std::invalid_argument("CacheCallback(): stream->getType() "
-                "(which is " + std::to_string(stream_.get()->getType()) +
-                ") is not ACTIVE");
-    }
+      scan_(s) {
 }
 
 void CacheCallback::callback(CacheLookup &lookup) {
+    if (!scan_.isWanted(lookup.getBySeqno())) {
+        /* Every stream already has it; skip reading the document */
+        setStatus(ENGINE_KEY_EEXISTS);
+        return;
+    }
+
     RCPtr<VBucket> vb = engine_->getKVBucket()->getVBucket(
                                                         lookup.getVBucketId());
     if (!vb) {
@@ -60,21 +63,19 @@ void CacheCallback::callback(CacheLookup &lookup) {
     auto lh = vb->ht.getLockedBucket(lookup.getKey(), &bucket_num);
     StoredValue *v = vb->ht.unlocked_find(lookup.getKey(), bucket_num, false, false);
     if (v && v->isResident() && v->getBySeqno() == lookup.getBySeqno()) {
-        ActiveStream* as = static_cast<ActiveStream*>(stream_.get());
-        Item* it;
+        std::unique_ptr<Item> it;
         try {
-            it = v->toItem(false, lookup.getVBucketId());
+            it.reset(v->toItem(false, lookup.getVBucketId()));
         } catch (const std::bad_alloc&) {
             setStatus(ENGINE_ENOMEM);
-            as->getLogger().log(EXTENSION_LOG_WARNING,
-                                "Alloc error when trying to create an "
-                                "item copy from hash table. Item seqno:%" PRIi64
-                                ", vb:%" PRIu16, v->getBySeqno(),
-                                lookup.getVBucketId());
+            LOG(EXTENSION_LOG_WARNING,
+                "Alloc error when trying to create an item copy from hash "
+                "table. Item seqno:%" PRIi64 ", vb:%" PRIu16,
+                v->getBySeqno(), lookup.getVBucketId());
             return;
         }
         lh.unlock();
-        if (!as->backfillReceived(it, BACKFILL_FROM_MEMORY)) {
+        if (!scan_.deliver(std::move(it), BACKFILL_FROM_MEMORY)) {
             setStatus(ENGINE_ENOMEM); // Pause the backfill
         } else {
             setStatus(ENGINE_KEY_EEXISTS);
@@ -84,16 +85,8 @@ void CacheCallback::callback(CacheLookup &lookup) {
     }
 }
 
-DiskCallback::DiskCallback(stream_t &s)
-    : stream_(s) {
-    if (stream_.get() == nullptr) {
-        throw std::invalid_argument("DiskCallback(): stream is NULL");
-    }
-    if (stream_.get()->getType() != STREAM_ACTIVE) {
-        throw std::invalid_argument("DiskCallback(): stream->getType() "
-                "(which is " + std::to_string(stream_.get()->getType()) +
-                ") is not ACTIVE");
-    }
+DiskCallback::DiskCallback(SharedDiskScan& s)
+    : scan_(s) {
 }
 
 void DiskCallback::callback(GetValue &val) {
@@ -101,18 +94,257 @@ void DiskCallback::callback(GetValue &val) {
         throw std::invalid_argument("DiskCallback::callback: val is NULL");
     }
 
-    ActiveStream* as = static_cast<ActiveStream*>(stream_.get());
-    if (!as->backfillReceived(val.getValue(), BACKFILL_FROM_DISK)) {
+    std::unique_ptr<Item> item(val.getValue());
+    if (!scan_.deliver(std::move(item), BACKFILL_FROM_DISK)) {
         setStatus(ENGINE_ENOMEM); // Pause the backfill
     } else {
         setStatus(ENGINE_SUCCESS);
     }
 }
 
+SharedDiskScan::SharedDiskScan(EventuallyPersistentEngine& e, uint16_t vb,
+                               ValueFilter filter)
+    : engine(e),
+      vbid(vb),
+      valFilter(filter),
+      scanCtx(nullptr),
+      driver(nullptr),
+      finished(false) {
+}
+
+SharedDiskScan::~SharedDiskScan() {
+    if (scanCtx) {
+        KVStore* kvstore = engine.getKVBucket()->getROUnderlying(vbid);
+        kvstore->destroyScanContext(scanCtx);
+    }
+}
+
+bool SharedDiskScan::initScanContext_UNLOCKED(uint64_t startSeqno) {
+    KVStore* kvstore = engine.getKVBucket()->getROUnderlying(vbid);
+    std::shared_ptr<Callback<GetValue> > cb(new DiskCallback(*this));
+    std::shared_ptr<Callback<CacheLookup> > cl(new CacheCallback(&engine,
+                                                                 *this));
+    scanCtx = kvstore->initScanContext(cb, cl, vbid, startSeqno,
+                                       DocumentFilter::ALL_ITEMS, valFilter);
+    if (!scanCtx) {
+        finished = true;
+        return false;
+    }
+    return true;
+}
+
+bool SharedDiskScan::open(const stream_t& stream, uint64_t startSeqno,
+                          uint64_t endSeqno) {
+    std::lock_guard<std::mutex> lh(lock);
+    if (!initScanContext_UNLOCKED(startSeqno)) {
+        return false;
+    }
+
+    addReader_UNLOCKED(stream, startSeqno, endSeqno);
+    return true;
+}
+
+bool SharedDiskScan::resume(const stream_t& stream, uint64_t startSeqno,
+                            uint64_t endSeqno) {
+    std::lock_guard<std::mutex> lh(lock);
+    if (startSeqno > endSeqno) {
+        finished = true;
+        return false;
+    }
+    if (!initScanContext_UNLOCKED(startSeqno)) {
+        return false;
+    }
+
+    readers.push_back({stream, startSeqno, 0, endSeqno});
+    return true;
+}
+
+bool SharedDiskScan::attach(const stream_t& stream, uint64_t startSeqno,
+                            uint64_t endSeqno) {
+    std::lock_guard<std::mutex> lh(lock);
+    if (finished || !scanCtx) {
+        return false;
+    }
+
+    /* The scan resumes from the seqno after the last one it has read */
+    uint64_t nextSeqno = scanCtx->lastReadSeqno != 0
+                                 ? scanCtx->lastReadSeqno + 1
+                                 : scanCtx->startSeqno;
+    if (startSeqno < nextSeqno || startSeqno > scanCtx->maxSeqno) {
+        return false;
+    }
+
+    addReader_UNLOCKED(stream, startSeqno, endSeqno);
+    return true;
+}
+
+SharedDiskScan::Status SharedDiskScan::scan(const Stream* stream) {
+    std::unique_lock<std::mutex> lh(lock, std::try_to_lock);
+    if (!lh) {
+        /* Another backfill is reading; its items reach us as well */
+        return Status::Blocked;
+    }
+    if (std::any_of(detached.begin(), detached.end(),
+                    [stream](const Reader& reader) {
+                        return reader.stream.get() == stream;
+                    })) {
+        return Status::Detached;
+    }
+    if (finished) {
+        return Status::Finished;
+    }
+
+    driver = stream;
+    KVStore* kvstore = engine.getKVBucket()->getROUnderlying(vbid);
+    scan_error_t error = kvstore->scan(scanCtx);
+    driver = nullptr;
+
+    if (error == scan_again) {
+        return Status::Running;
+    }
+
+    finished = true;
+    readers.clear();
+    return Status::Finished;
+}
+
+bool SharedDiskScan::deliver(std::unique_ptr<Item> item,
+                             backfill_source_t source) {
+    const uint64_t seqno = item->getBySeqno();
+    size_t needed = std::count_if(readers.begin(), readers.end(),
+                                  [this, seqno](const Reader& reader) {
+                                      return needs(reader, seqno);
+                                  });
+
+    for (auto it = readers.begin(); it != readers.end();) {
+        if (!needs(*it, seqno)) {
+            ++it;
+            continue;
+        }
+
+        /* The last stream needing the item gets the original */
+        std::unique_ptr<Item> offered(--needed > 0 ? new Item(*item)
+                                                   : item.release());
+        ActiveStream* as = static_cast<ActiveStream*>(it->stream.get());
+        if (!as->backfillReceived(offered, source)) {
+            if (it->stream.get() == driver) {
+                return false;
+            }
+            /* Don't hold back the other streams for this one */
+            detached.push_back(std::move(*it));
+            it = readers.erase(it);
+            continue;
+        }
+        it->lastSeqno = seqno;
+        ++it;
+    }
+    return true;
+}
+
+bool SharedDiskScan::takeDetached(const Stream* stream, uint64_t& startSeqno,
+                                  uint64_t& endSeqno) {
+    std::lock_guard<std::mutex> lh(lock);
+    auto it = std::find_if(detached.begin(), detached.end(),
+                           [stream](const Reader& reader) {
+                               return reader.stream.get() == stream;
+                           });
+    if (it == detached.end()) {
+        return false;
+    }
+
+    startSeqno = std::max(it->startSeqno, it->lastSeqno + 1);
+    endSeqno = it->endSeqno;
+    detached.erase(it);
+    return true;
+}
+
+bool SharedDiskScan::isWanted(uint64_t seqno) const {
+    for (const auto& reader : readers) {
+        if (needs(reader, seqno)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SharedDiskScan::addReader_UNLOCKED(const stream_t& stream,
+                                        uint64_t startSeqno,
+                                        uint64_t endSeqno) {
+    /* (For a stream attaching to a running scan, the document count is an
+       estimate of what is left.) */
+    ActiveStream* as = static_cast<ActiveStream*>(stream.get());
+    as->incrBackfillRemaining(scanCtx->documentCount);
+    as->markDiskSnapshot(startSeqno, scanCtx->maxSeqno);
+    if (endSeqno > scanCtx->maxSeqno) {
+        as->requestFollowUpBackfill();
+    }
+    readers.push_back({stream, startSeqno, 0, scanCtx->maxSeqno});
+}
+
+SharedDiskScans::SharedDiskScans() : numAttaches(0) {
+}
+
+std::shared_ptr<SharedDiskScan> SharedDiskScans::attach(
+        const stream_t& stream,
+        uint64_t startSeqno,
+        uint64_t endSeqno,
+        ValueFilter valFilter) {
+    std::vector<std::shared_ptr<SharedDiskScan>> candidates;
+    {
+        std::lock_guard<std::mutex> lh(mutex);
+        auto it = scans.find(stream->getVBucket());
+        if (it == scans.end()) {
+            return nullptr;
+        }
+        for (const auto& handle : it->second) {
+            auto scan = handle.lock();
+            if (scan && scan->getValueFilter() == valFilter) {
+                candidates.push_back(scan);
+            }
+        }
+    }
+
+    /* Not holding our mutex, as attaching waits for any running step */
+    for (auto& scan : candidates) {
+        if (scan->attach(stream, startSeqno, endSeqno)) {
+            ++numAttaches;
+            return scan;
+        }
+    }
+    return nullptr;
+}
+
+void SharedDiskScans::add(const std::shared_ptr<SharedDiskScan>& scan) {
+    std::lock_guard<std::mutex> lh(mutex);
+    auto& vbScans = scans[scan->getVBucketId()];
+    vbScans.erase(std::remove_if(vbScans.begin(), vbScans.end(),
+                                 [](const std::weak_ptr<SharedDiskScan>& h) {
+                                     return h.expired();
+                                 }),
+                  vbScans.end());
+    vbScans.push_back(scan);
+}
+
+size_t SharedDiskScans::getNumScans() {
+    std::lock_guard<std::mutex> lh(mutex);
+    size_t count = 0;
+    for (auto it = scans.begin(); it != scans.end();) {
+        auto& vbScans = it->second;
+        vbScans.erase(std::remove_if(vbScans.begin(), vbScans.end(),
+                                     [](const std::weak_ptr<SharedDiskScan>& h) {
+                                         return h.expired();
+                                     }),
+                      vbScans.end());
+        count += vbScans.size();
+        it = vbScans.empty() ? scans.erase(it) : std::next(it);
+    }
+    return count;
+}
+
 DCPBackfill::DCPBackfill(EventuallyPersistentEngine* e, const stream_t& s,
                          uint64_t start_seqno, uint64_t end_seqno)
     : engine(e), stream(s),startSeqno(start_seqno), endSeqno(end_seqno),
-      scanCtx(NULL), state(backfill_state_init) {
+      state(backfill_state_init) {
     if (stream->getType() != STREAM_ACTIVE) {
         throw std::invalid_argument("DCPBackfill(): stream->getType() "
                 "(which is " + std::to_string(stream->getType()) +
@@ -122,19 +354,29 @@ DCPBackfill::DCPBackfill(EventuallyPersistentEngine* e, const stream_t& s,
 
 backfill_status_t DCPBackfill::run() {
     LockHolder lh(lock);
+    backfill_status_t status = backfill_finished;
     switch (state) {
         case backfill_state_init:
-            return create();
+            status = create();
+            break;
         case backfill_state_scanning:
-            return scan();
+            status = scan();
+            break;
         case backfill_state_completing:
-            return complete(false);
+            status = complete(false);
+            break;
         case backfill_state_done:
-            return backfill_finished;
+            break;
+        default:
+            throw std::logic_error("DCPBackfill::run: Invalid backfill state " +
+                                   std::to_string(state));
     }
 
-    throw std::logic_error("DCPBackfill::run: Invalid backfill state " +
-                           std::to_string(state));
+    if (state == backfill_state_done) {
+        /* Let another backfill open a scan */
+        scanSlot.reset();
+    }
+    return status;
 }
 
 uint16_t DCPBackfill::getVBucketId() {
@@ -150,9 +392,17 @@ void DCPBackfill::cancel() {
     if (state != backfill_state_done) {
         complete(true);
     }
+    scanSlot.reset();
 }
 
-backfill_status_t DCPBackfill::create() {
+DCPBackfillDisk::DCPBackfillDisk(EventuallyPersistentEngine* e,
+                                 const stream_t& s,
+                                 uint64_t start_seqno,
+                                 uint64_t end_seqno)
+    : DCPBackfill(e, s, start_seqno, end_seqno) {
+}
+
+backfill_status_t DCPBackfillDisk::create() {
     uint16_t vbid = stream->getVBucket();
 
     uint64_t lastPersistedSeqno =
@@ -167,20 +417,30 @@ backfill_status_t DCPBackfill::create() {
         return backfill_snooze;
     }
 
-    KVStore* kvstore = engine->getKVBucket()->getROUnderlying(vbid);
     ValueFilter valFilter = ValueFilter::VALUES_DECOMPRESSED;
     if (as->isCompressionEnabled()) {
         valFilter = ValueFilter::VALUES_COMPRESSED;
     }
 
-    std::shared_ptr<Callback<GetValue> > cb(new DiskCallback(stream));
-    std::shared_ptr<Callback<CacheLookup> > cl(new CacheCallback(engine, stream));
-    scanCtx = kvstore->initScanContext(cb, cl, vbid, startSeqno,
-                                       DocumentFilter::ALL_ITEMS, valFilter);
+    SharedDiskScans& scans = engine->getDcpConnMap().getSharedDiskScans();
+    const bool share = engine->getConfiguration().isDcpBackfillShareScans();
+    if (share) {
+        diskScan = scans.attach(stream, startSeqno, endSeqno, valFilter);
+        if (diskScan) {
+            as->getLogger().log(EXTENSION_LOG_NOTICE,
+                "(vb %d) Backfill (%" PRIu64 " to %" PRIu64 ") attached to a "
+                "running disk scan", vbid, startSeqno, endSeqno);
+            transitionState(backfill_state_scanning);
+            return backfill_success;
+        }
+    }
 
-    if (scanCtx) {
-        as->incrBackfillRemaining(scanCtx->documentCount);
-        as->markDiskSnapshot(startSeqno, scanCtx->maxSeqno);
+    auto newScan = std::make_shared<SharedDiskScan>(*engine, vbid, valFilter);
+    if (newScan->open(stream, startSeqno, endSeqno)) {
+        diskScan = newScan;
+        if (share) {
+            scans.add(diskScan);
+        }
         transitionState(backfill_state_scanning);
     } else {
         transitionState(backfill_state_done);
@@ -189,18 +449,36 @@ backfill_status_t DCPBackfill::create() {
     return backfill_success;
 }
 
-backfill_status_t DCPBackfill::scan() {
-    uint16_t vbid = stream->getVBucket();
-
+backfill_status_t DCPBackfillDisk::scan() {
     if (!(stream->isActive())) {
         return complete(true);
     }
 
-    KVStore* kvstore = engine->getKVBucket()->getROUnderlying(vbid);
-    scan_error_t error = kvstore->scan(scanCtx);
-
-    if (error == scan_again) {
+    switch (diskScan->scan(stream.get())) {
+    case SharedDiskScan::Status::Running:
         return backfill_success;
+    case SharedDiskScan::Status::Blocked:
+        return backfill_snooze;
+    case SharedDiskScan::Status::Detached: {
+        /* Continue on a scan of our own from where we were left */
+        uint64_t resumeStart = 0;
+        uint64_t resumeEnd = 0;
+        diskScan->takeDetached(stream.get(), resumeStart, resumeEnd);
+        ActiveStream* as = static_cast<ActiveStream*>(stream.get());
+        as->getLogger().log(EXTENSION_LOG_NOTICE,
+            "(vb %d) Backfill (%" PRIu64 " to %" PRIu64 ") detached from a "
+            "shared disk scan, resuming from %" PRIu64,
+            stream->getVBucket(), startSeqno, endSeqno, resumeStart);
+        auto ownScan = std::make_shared<SharedDiskScan>(
+                *engine, stream->getVBucket(), diskScan->getValueFilter());
+        diskScan = ownScan;
+        if (diskScan->resume(stream, resumeStart, resumeEnd)) {
+            return backfill_success;
+        }
+        break;
+    }
+    case SharedDiskScan::Status::Finished:
+        break;
     }
 
     transitionState(backfill_state_completing);
@@ -208,10 +486,10 @@ backfill_status_t DCPBackfill::scan() {
     return backfill_success;
 }
 
-backfill_status_t DCPBackfill::complete(bool cancelled) {
+backfill_status_t DCPBackfillDisk::complete(bool cancelled) {
     uint16_t vbid = stream->getVBucket();
-    KVStore* kvstore = engine->getKVBucket()->getROUnderlying(vbid);
-    kvstore->destroyScanContext(scanCtx);
+    /* The last backfill using the scan closes it */
+    diskScan.reset();
 
     ActiveStream* as = static_cast<ActiveStream*>(stream.get());
     as->completeBackfill();
@@ -266,3 +544,124 @@ void DCPBackfill::transitionState(backfill_state_t newState) {
 
     state = newState;
 }
+
+DCPBackfillMemory::DCPBackfillMemory(EventuallyPersistentEngine* e,
+                                     const stream_t& s,
+                                     uint64_t start_seqno,
+                                     uint64_t end_seqno)
+    : DCPBackfill(e, s, start_seqno, end_seqno) {
+}
+
+DCPBackfillMemory::~DCPBackfillMemory() {
+    /* The range read must end before the vbucket can go */
+    rangeItr.reset();
+}
+
+backfill_status_t DCPBackfillMemory::create() {
+    uint16_t vbid = stream->getVBucket();
+    ActiveStream* as = static_cast<ActiveStream*>(stream.get());
+
+    vb = engine->getVBucket(vbid);
+    if (!vb) {
+        as->getLogger().log(EXTENSION_LOG_WARNING,
+            "(vb %d) Cancelling in-memory backfill as the vbucket no longer "
+            "exists", vbid);
+        return complete(true);
+    }
+
+    EphemeralVBucket* evb = dynamic_cast<EphemeralVBucket*>(vb.get());
+    if (!evb) {
+        throw std::logic_error("DCPBackfillMemory::create: vb:" +
+                               std::to_string(vbid) +
+                               " is not an ephemeral vbucket");
+    }
+
+    /* Start a point-in-time snapshot of the range; the snapshot may extend
+       beyond endSeqno to stay consistent with concurrent writes */
+    ENGINE_ERROR_CODE status;
+    std::tie(status, rangeItr) = evb->makeRangeIterator(startSeqno, endSeqno);
+
+    switch (status) {
+    case ENGINE_SUCCESS:
+        break;
+    case ENGINE_TMPFAIL:
+        as->getLogger().log(EXTENSION_LOG_INFO,
+            "(vb %d) Rescheduling in-memory backfill (%" PRIu64 " to %" PRIu64
+            ") as another backfill is reading the vbucket",
+            vbid, startSeqno, endSeqno);
+        vb.reset();
+        return backfill_snooze;
+    default:
+        /* There is nothing in the requested range */
+        as->getLogger().log(EXTENSION_LOG_NOTICE,
+            "(vb %d) In-memory backfill (%" PRIu64 " to %" PRIu64 ") found no "
+            "items, status:%d", vbid, startSeqno, endSeqno, status);
+        return complete(false);
+    }
+
+    const uint64_t snapshotEnd = rangeItr->getEnd();
+    /* (An estimate, as the range may contain stale items) */
+    as->incrBackfillRemaining(std::min(snapshotEnd - startSeqno + 1,
+                                       uint64_t(vb->ht.getNumItems())));
+    as->markDiskSnapshot(startSeqno, snapshotEnd);
+    transitionState(backfill_state_scanning);
+
+    return backfill_success;
+}
+
+backfill_status_t DCPBackfillMemory::scan() {
+    if (!(stream->isActive())) {
+        return complete(true);
+    }
+
+    ActiveStream* as = static_cast<ActiveStream*>(stream.get());
+    while (true) {
+        if (!pendingItem) {
+            ENGINE_ERROR_CODE status;
+            std::tie(status, pendingItem) = rangeItr->next();
+            if (status == ENGINE_ENOMEM) {
+                /* Retry the same item later */
+                return backfill_snooze;
+            } else if (status != ENGINE_SUCCESS) {
+                as->getLogger().log(EXTENSION_LOG_NOTICE,
+                    "(vb %d) Cancelling in-memory backfill (%" PRIu64 " to %"
+                    PRIu64 ") as the vbucket was cleared, status:%d",
+                    stream->getVBucket(), startSeqno, endSeqno, status);
+                return complete(true);
+            }
+            if (!pendingItem) {
+                break;
+            }
+        }
+
+        if (!as->backfillReceived(pendingItem, BACKFILL_FROM_MEMORY)) {
+            /* The scan buffer or the connection's backfill buffer is full;
+               we continue from this item in the next run */
+            return backfill_success;
+        }
+    }
+
+    transitionState(backfill_state_completing);
+
+    return backfill_success;
+}
+
+backfill_status_t DCPBackfillMemory::complete(bool cancelled) {
+    pendingItem.reset();
+    rangeItr.reset();
+    vb.reset();
+
+    ActiveStream* as = static_cast<ActiveStream*>(stream.get());
+    as->completeBackfill();
+
+    EXTENSION_LOG_LEVEL severity = cancelled ? EXTENSION_LOG_NOTICE
+                                             : EXTENSION_LOG_INFO;
+    as->getLogger().log(severity,
+        "(vb %d) In-memory backfill task (%" PRIu64 " to %" PRIu64 ") %s",
+        stream->getVBucket(), startSeqno, endSeqno,
+        cancelled ? "cancelled" : "finished");
+
+    transitionState(backfill_state_done);
+
+    return backfill_success;
+}
@@ -21,10 +21,20 @@
 #include "config.h"
 
 #include "callbacks.h"
+#include "dcp/backfill-scheduler.h"
 #include "dcp/stream.h"
+#include "kvstore.h"
+#include "seqlist.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 class EventuallyPersistentEngine;
 class ScanContext;
+class SharedDiskScan;
 
 enum backfill_state_t {
     backfill_state_init,
@@ -41,30 +51,213 @@ enum backfill_status_t {
 
 class CacheCallback : public Callback<CacheLookup> {
 public:
-    CacheCallback(EventuallyPersistentEngine* e, stream_t &s);
+    CacheCallback(EventuallyPersistentEngine* e, SharedDiskScan& s);
 
     void callback(CacheLookup &lookup);
 
 private:
     EventuallyPersistentEngine* engine_;
-    stream_t stream_;
+    SharedDiskScan& scan_;
 };
 
 class DiskCallback : public Callback<GetValue> {
 public:
-    DiskCallback(stream_t &s);
+    DiskCallback(SharedDiskScan& s);
 
     void callback(GetValue &val);
 
 private:
-    stream_t stream_;
+    SharedDiskScan& scan_;
 };
 
+/**
+ * A KVStore scan of a vbucket whose items are handed to the disk backfills
+ * of several streams.
+ *
+ * After a failover or a restart, several DCP connections (replication,
+ * indexing, XDCR, ...) typically backfill the same vbucket from about the
+ * same seqno. Rather than each of them reading the file, the DCPBackfillDisk
+ * of a stream attaches to a scan of the vbucket which has not read past the
+ * stream's start seqno yet (see SharedDiskScans); every item read is then
+ * handed to each attached stream whose range includes it. Each stream
+ * receives its items exactly once and in seqno order.
+ *
+ * The scan is driven by whichever of the attached backfills runs, one at a
+ * time. It pauses when the stream of that backfill cannot take an item (its
+ * connection's backfill buffer is full) and resumes from that item. Any
+ * other stream which cannot take an item is detached rather than holding
+ * back the others: its backfill continues on a scan of its own, from the
+ * item after the last one it received (see resume()).
+ *
+ * The scan reads up to the seqno persisted when it was opened; a stream
+ * which needs more than that gets the remainder from a follow-up backfill
+ * once the shared one has completed.
+ */
+class SharedDiskScan {
+public:
+    enum class Status {
+        Running,  // More items to read
+        Blocked,  // Being read by another backfill
+        Detached, // The stream was detached from the scan (see takeDetached())
+        Finished
+    };
+
+    SharedDiskScan(EventuallyPersistentEngine& e, uint16_t vbid,
+                   ValueFilter valFilter);
+
+    ~SharedDiskScan();
+
+    /**
+     * Open the scan from startSeqno, for the given (first) stream, which
+     * needs the items up to endSeqno.
+     *
+     * @return false if there is nothing to scan.
+     */
+    bool open(const stream_t& stream, uint64_t startSeqno, uint64_t endSeqno);
+
+    /**
+     * Attach a stream to the scan if it has not yet read past startSeqno,
+     * sending the stream its snapshot marker.
+     */
+    bool attach(const stream_t& stream, uint64_t startSeqno,
+                uint64_t endSeqno);
+
+    /**
+     * Open the scan for a stream detached from another scan, which needs
+     * the items from startSeqno to endSeqno (the end of the snapshot it was
+     * sent). No snapshot marker is sent.
+     *
+     * @return false if there is nothing to scan.
+     */
+    bool resume(const stream_t& stream, uint64_t startSeqno,
+                uint64_t endSeqno);
+
+    /**
+     * Read the next batch of items, on behalf of the backfill of the given
+     * stream.
+     */
+    Status scan(const Stream* driver);
+
+    /**
+     * Forget a stream detached from the scan, returning the range of seqnos
+     * it still needs to resume() from.
+     *
+     * @return false if the stream was not detached.
+     */
+    bool takeDetached(const Stream* stream, uint64_t& startSeqno,
+                      uint64_t& endSeqno);
+
+    /**
+     * Hand an item read by the scan to the streams which need it; only
+     * called by the scan callbacks (i.e. from scan()).
+     *
+     * @return false if a stream cannot take it, in which case the scan
+     *         pauses and the item is read again when it resumes.
+     */
+    bool deliver(std::unique_ptr<Item> item, backfill_source_t source);
+
+    /// Does any stream still need the given seqno? (As for deliver().)
+    bool isWanted(uint64_t seqno) const;
+
+    uint16_t getVBucketId() const {
+        return vbid;
+    }
+
+    ValueFilter getValueFilter() const {
+        return valFilter;
+    }
+
+private:
+    struct Reader {
+        stream_t stream;
+        uint64_t startSeqno;
+        //! Last seqno handed to the stream, as the item a scan pauses on
+        //! may already have been delivered to some of the streams.
+        uint64_t lastSeqno;
+        //! End of the snapshot sent to the stream.
+        uint64_t endSeqno;
+    };
+
+    bool needs(const Reader& reader, uint64_t seqno) const {
+        return seqno >= reader.startSeqno && seqno > reader.lastSeqno &&
+               seqno <= reader.endSeqno;
+    }
+
+    bool initScanContext_UNLOCKED(uint64_t startSeqno);
+
+    void addReader_UNLOCKED(const stream_t& stream, uint64_t startSeqno,
+                            uint64_t endSeqno);
+
+    EventuallyPersistentEngine& engine;
+    const uint16_t vbid;
+    const ValueFilter valFilter;
+
+    //! Serialises the scan steps and the attachment of streams.
+    std::mutex lock;
+    ScanContext* scanCtx;
+    std::vector<Reader> readers;
+    //! Readers which could not keep up, until their backfill notices.
+    std::vector<Reader> detached;
+    //! Stream whose backfill runs the current step.
+    const Stream* driver;
+    std::atomic<bool> finished;
+};
+
+/**
+ * The disk scans of the bucket which backfills may attach to.
+ */
+class SharedDiskScans {
+public:
+    SharedDiskScans();
+
+    /**
+     * Attach the stream to a running scan of its vbucket able to serve it.
+     *
+     * @return the scan, or null if there is none.
+     */
+    std::shared_ptr<SharedDiskScan> attach(const stream_t& stream,
+                                           uint64_t startSeqno,
+                                           uint64_t endSeqno,
+                                           ValueFilter valFilter);
+
+    /// Make a newly opened scan available to other backfills.
+    void add(const std::shared_ptr<SharedDiskScan>& scan);
+
+    /// Number of scans running.
+    size_t getNumScans();
+
+    /// Number of backfills served by attaching to a running scan.
+    size_t getNumAttaches() const {
+        return numAttaches.load();
+    }
+
+private:
+    std::mutex mutex;
+    std::unordered_map<uint16_t, std::vector<std::weak_ptr<SharedDiskScan>>>
+            scans;
+    std::atomic<size_t> numAttaches;
+};
+
+/**
+ * Base class of a DCP backfill; reads the items of a seqno range of a
+ * vbucket (which are no longer in the checkpoints) for an ActiveStream. A
+ * backfill is driven by the BackfillManager of the stream's DCP connection,
+ * which calls run() repeatedly until it returns backfill_finished.
+ *
+ * Each run() performs one step of the state machine
+ * init -> scanning -> completing -> done, implemented by the subclass in
+ * create(), scan() and complete().
+ *
+ * The concrete backfill for a vbucket is created by
+ * VBucket::createDCPBackfill().
+ */
 class DCPBackfill {
 public:
     DCPBackfill(EventuallyPersistentEngine* e, const stream_t& s,
                 uint64_t start_seqno, uint64_t end_seqno);
 
+    virtual ~DCPBackfill() {}
+
     backfill_status_t run();
 
     uint16_t getVBucketId();
@@ -77,13 +270,36 @@ public:
 
     void cancel();
 
-private:
+    /**
+     * Does this backfill read from disk? Only such backfills are subject to
+     * the bucket-wide BackfillScheduler (concurrent scans and disk read
+     * rate); all are batched by the scan buffer of the BackfillManager.
+     */
+    virtual bool readsFromDisk() const {
+        return true;
+    }
 
-    backfill_status_t create();
+    /**
+     * Hand the backfill the scan slot granted to it by the
+     * BackfillScheduler, which it holds until it completes or is cancelled.
+     */
+    void setScanSlot(std::unique_ptr<BackfillScheduler::ScanSlot> slot) {
+        LockHolder lh(lock);
+        scanSlot = std::move(slot);
+    }
+
+    bool holdsScanSlot() {
+        LockHolder lh(lock);
+        return scanSlot != nullptr;
+    }
 
-    backfill_status_t scan();
+protected:
 
-    backfill_status_t complete(bool cancelled);
+    virtual backfill_status_t create() = 0;
+
+    virtual backfill_status_t scan() = 0;
+
+    virtual backfill_status_t complete(bool cancelled) = 0;
 
     void transitionState(backfill_state_t newState);
 
@@ -91,9 +307,72 @@ private:
     stream_t                    stream;
     uint64_t                    startSeqno;
     uint64_t                    endSeqno;
-    ScanContext*                scanCtx;
     backfill_state_t            state;
     std::mutex                       lock;
+
+private:
+    std::unique_ptr<BackfillScheduler::ScanSlot> scanSlot;
+};
+
+/**
+ * Backfill which reads the items from the KVStore of the vbucket, through a
+ * SharedDiskScan possibly shared with the backfills of other streams.
+ */
+class DCPBackfillDisk : public DCPBackfill {
+public:
+    DCPBackfillDisk(EventuallyPersistentEngine* e, const stream_t& s,
+                    uint64_t start_seqno, uint64_t end_seqno);
+
+protected:
+
+    backfill_status_t create() override;
+
+    backfill_status_t scan() override;
+
+    backfill_status_t complete(bool cancelled) override;
+
+private:
+    std::shared_ptr<SharedDiskScan> diskScan;
+};
+
+/**
+ * Backfill which reads the items directly from the in-memory sequence list
+ * of an ephemeral vbucket; it never touches a KVStore.
+ *
+ * create() starts a consistent snapshot of the range (see
+ * EphemeralVBucket::makeRangeIterator()), which may be extended beyond the
+ * requested end so that the snapshot marker sent is consistent with the
+ * items. scan() then copies the items one at a time and hands them to the
+ * stream, ending the run when the scan buffer or the connection's backfill
+ * buffer is full; the next run resumes from the same position. Only the
+ * items buffered for the connection are in memory at any time.
+ */
+class DCPBackfillMemory : public DCPBackfill {
+public:
+    DCPBackfillMemory(EventuallyPersistentEngine* e, const stream_t& s,
+                      uint64_t start_seqno, uint64_t end_seqno);
+
+    ~DCPBackfillMemory();
+
+    bool readsFromDisk() const override {
+        return false;
+    }
+
+protected:
+
+    backfill_status_t create() override;
+
+    backfill_status_t scan() override;
+
+    backfill_status_t complete(bool cancelled) override;
+
+private:
+    /* The vbucket being read, kept alive for rangeItr */
+    RCPtr<VBucket>                                 vb;
+    /* The range read of the snapshot, from create() until complete() */
+    std::unique_ptr<SequenceList::RangeIterator>   rangeItr;
+    /* Item read but not yet accepted by the stream (its buffer was full) */
+    std::unique_ptr<Item>                          pendingItem;
 };
 
 #endif  // SRC_DCP_BACKFILL_H_
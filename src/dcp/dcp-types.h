@@ -23,11 +23,16 @@
 
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <mutex>
 #include <queue>
+#include <set>
+#include <unordered_map>
 #include <unordered_set>
 
+#include <platform/processclock.h>
+
 #include "locks.h"
 
 template <class S> class SingleThreadedRCPtr;
@@ -50,16 +55,26 @@ class PassiveStream;
 typedef RCPtr<PassiveStream> passive_stream_t;
 
 /**
- * DcpReadyQueue is a std::queue wrapper for managing a
- * queue of vbuckets that are ready for a DCP producer/consumer to process.
+ * DcpReadyQueue manages a queue of vbuckets that are ready for a DCP
+ * producer/consumer to process.
  * The queue does not allow duplicates and the push_unique method enforces
  * this. The interface is generally customised for the needs of:
  * - getNextItem and is thread safe as the frontend operations and
  *   DCPProducer threads are accessing this data.
  * - processBufferedItems by the processer task of the consumer
  *
- * Internally a std::queue and std::set track the contents and the std::set
- * enables a fast exists method which is used by front-end threads.
+ * Vbuckets are scheduled by start-time fair queueing: each queued vbucket is
+ * tagged with the virtual time at which it may start sending - the later of
+ * the current virtual time and the virtual time its previous sends finish -
+ * and popFront() returns the lowest tag (ties in push order). charge()
+ * records what a vbucket has just sent, its cost in virtual time being the
+ * bytes sent divided by the stream's weight: while several streams are
+ * busy, each gets a share of the connection proportional to its weight.
+ * Without any charge() all tags are equal and the queue is a plain FIFO.
+ *
+ * Internally a std::set orders the queued vbuckets by tag and a std::map
+ * tracks the contents, enabling a fast exists method which is used by
+ * front-end threads.
  */
 class DcpReadyQueue {
 public:
@@ -73,11 +88,24 @@ public:
      * empty. frontValue is set to the front of the queue.
      */
     bool popFront(uint16_t &frontValue) {
+        ProcessClock::duration waited;
+        return popFront(frontValue, waited);
+    }
+
+    /**
+     * As popFront(uint16_t&), also setting 'waited' to how long the vbucket
+     * was queued for.
+     */
+    bool popFront(uint16_t &frontValue, ProcessClock::duration& waited) {
         LockHolder lh(lock);
         if (!readyQueue.empty()) {
-            frontValue = readyQueue.front();
-            readyQueue.pop();
-            queuedValues.erase(frontValue);
+            const Tag& front = *readyQueue.begin();
+            frontValue = front.vbucket;
+            virtualTime = front.start;
+            readyQueue.erase(readyQueue.begin());
+            auto it = queuedValues.find(frontValue);
+            waited = ProcessClock::now() - it->second;
+            queuedValues.erase(it);
             return true;
         }
         return false;
@@ -88,11 +116,8 @@ public:
      * Safe to call on an empty list
      */
     void pop() {
-        LockHolder lh(lock);
-        if (!readyQueue.empty()) {
-            queuedValues.erase(readyQueue.front());
-            readyQueue.pop();
-        }
+        uint16_t vbucket;
+        popFront(vbucket);
     }
 
     /**
@@ -102,13 +127,29 @@ public:
     bool pushUnique(uint16_t vbucket) {
         LockHolder lh(lock);
         if (queuedValues.count(vbucket) == 0) {
-            readyQueue.push(vbucket);
-            queuedValues.insert(vbucket);
+            uint64_t start = virtualTime;
+            auto finish = finishTimes.find(vbucket);
+            if (finish != finishTimes.end()) {
+                start = std::max(start, finish->second);
+            }
+            readyQueue.insert({start, nextArrival++, vbucket});
+            queuedValues.emplace(vbucket, ProcessClock::now());
             return true;
         }
         return false;
     }
 
+    /**
+     * Record that the given vbucket (just popped) sent 'bytes' bytes, with
+     * the given scheduling weight (greater than zero).
+     */
+    void charge(uint16_t vbucket, size_t bytes, uint32_t weight) {
+        LockHolder lh(lock);
+        uint64_t& finish = finishTimes[vbucket];
+        finish = std::max(finish, virtualTime) +
+                 std::max(uint64_t(1), (uint64_t(bytes) << 10) / weight);
+    }
+
     /**
      * Size of the queue.
      */
@@ -123,15 +164,37 @@ public:
     }
 
 private:
+    struct Tag {
+        bool operator<(const Tag& other) const {
+            return start < other.start ||
+                   (start == other.start && arrival < other.arrival);
+        }
+
+        //! Virtual start time.
+        uint64_t start;
+        //! Push order, for ties.
+        uint64_t arrival;
+        uint16_t vbucket;
+    };
+
     std::mutex lock;
 
-    /* a queue of vbuckets that are ready for producing */
-    std::queue<uint16_t> readyQueue;
+    /* the vbuckets that are ready for producing, in scheduling order */
+    std::set<Tag> readyQueue;
 
     /**
-     * maintain a std::unordered_set of values that are in the readyQueue.
+     * maintain a std::unordered_map of values that are in the readyQueue
+     * (to when they were pushed).
      * find() is performed by front-end threads so we want it to be
-     * efficient so just a set lookup is required.
+     * efficient so just a map lookup is required.
      */
-    std::unordered_set<uint16_t> queuedValues;
+    std::unordered_map<uint16_t, ProcessClock::time_point> queuedValues;
+
+    /* virtual time at which each charged vbucket's sends finish */
+    std::unordered_map<uint16_t, uint64_t> finishTimes;
+
+    /* start tag of the last vbucket popped */
+    uint64_t virtualTime = 0;
+
+    uint64_t nextArrival = 0;
 };
@@ -19,6 +19,7 @@
 
 #include <algorithm>
 #include <limits>
+#include <queue>
 #include <string>
 #include <vector>
 
@@ -35,6 +36,9 @@ const uint8_t DcpConnMap::numBackfillsMemThreshold = 1;
 
 DcpConnMap::DcpConnMap(EventuallyPersistentEngine &e)
     : ConnMap(e),
+      backfillScheduler(
+              e.getConfiguration().getDcpBackfillMaxScans(),
+              e.getConfiguration().getDcpBackfillBytesPerSec()),
       aggrDcpConsumerBufferSize(0) {
     backfills.numActiveSnoozing = 0;
     updateMaxActiveSnoozingBackfills(engine.getEpStats().getMaxDataSize());
@@ -48,6 +52,37 @@ DcpConnMap::DcpConnMap(EventuallyPersistentEngine &e)
     engine.getConfiguration().
         addValueChangedListener("dcp_consumer_process_buffered_messages_batch_size",
                                 new DcpConfigChangeListener(*this));
+    engine.getConfiguration().
+        addValueChangedListener("dcp_producer_step_batch_size",
+                                new DcpConfigChangeListener(*this));
+    engine.getConfiguration().
+        addValueChangedListener("dcp_backfill_max_scans",
+                                new DcpConfigChangeListener(*this));
+    engine.getConfiguration().
+        addValueChangedListener("dcp_backfill_bytes_per_sec",
+                                new DcpConfigChangeListener(*this));
+}
+
+DcpConnMap::~DcpConnMap() {
+    // Release the connections held by this map before its members are
+    // destroyed: a producer's backfill manager uses the backfillScheduler
+    // and the sharedDiskScans on destruction, while the connection
+    // containers (members of ConnMap or declared first) would otherwise
+    // outlive them.
+    CookieToConnectionMap conns;
+    std::list<connection_t> connList;
+    {
+        LockHolder lh(connsLock);
+        conns.swap(map_);
+        connList.swap(all);
+        connList.splice(connList.end(), deadConnections);
+    }
+    for (size_t vbid = 0; vbid < vbConns.size(); ++vbid) {
+        std::lock_guard<SpinLock> lh(vbConnLocks[vbid % vbConnLockNum]);
+        connList.splice(connList.end(), vbConns[vbid]);
+    }
+    std::queue<connection_t> pending;
+    pendingNotifications.getAll(pending);
 }
 
 DcpConsumer *DcpConnMap::newConsumer(const void* cookie,
@@ -428,6 +463,14 @@ void DcpConnMap::addStats(ADD_STAT add_stat, const void *c) {
     LockHolder lh(connsLock);
     add_casted_stat("ep_dcp_dead_conn_count", deadConnections.size(), add_stat,
                     c);
+    add_casted_stat("ep_dcp_num_running_scans",
+                    backfillScheduler.getRunningScans(), add_stat, c);
+    add_casted_stat("ep_dcp_num_scan_waiters",
+                    backfillScheduler.getWaitingManagers(), add_stat, c);
+    add_casted_stat("ep_dcp_num_shared_scans",
+                    sharedDiskScans.getNumScans(), add_stat, c);
+    add_casted_stat("ep_dcp_num_scan_attaches",
+                    sharedDiskScans.getNumAttaches(), add_stat, c);
 }
 
 void DcpConnMap::updateMinCompressionRatioForProducers(float value) {
@@ -447,6 +490,12 @@ void DcpConnMap::DcpConfigChangeListener::sizeValueChanged(const std::string &ke
         myConnMap.consumerYieldConfigChanged(value);
     } else if (key == "dcp_consumer_process_buffered_messages_batch_size") {
         myConnMap.consumerBatchSizeConfigChanged(value);
+    } else if (key == "dcp_producer_step_batch_size") {
+        myConnMap.producerStepBatchSizeConfigChanged(value);
+    } else if (key == "dcp_backfill_max_scans") {
+        myConnMap.backfillScheduler.setMaxScans(value);
+    } else if (key == "dcp_backfill_bytes_per_sec") {
+        myConnMap.backfillScheduler.setBytesPerSecond(value);
     }
 }
 
@@ -478,6 +527,20 @@ void DcpConnMap::consumerBatchSizeConfigChanged(size_t newValue) {
     }
 }
 
+/*
+ * Find all DcpProducers and set the number of responses sent per step
+ */
+void DcpConnMap::producerStepBatchSizeConfigChanged(size_t newValue) {
+    LockHolder lh(connsLock);
+    for (const auto cookieToConn : map_) {
+        DcpProducer* dcpProducer = dynamic_cast<DcpProducer*>(
+                cookieToConn.second.get());
+        if (dcpProducer) {
+            dcpProducer->setStepBatchSize(newValue);
+        }
+    }
+}
+
 connection_t DcpConnMap::findByName(const std::string& name) {
     LockHolder lh(connsLock);
     for (const auto cookieToConn : map_) {
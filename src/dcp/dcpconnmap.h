@@ -29,6 +29,8 @@
 #include "syncobject.h"
 #include "atomicqueue.h"
 #include "connmap.h"
+#include "dcp/backfill-scheduler.h"
+#include "dcp/backfill.h"
 #include "dcp/consumer.h"
 #include "dcp/producer.h"
 
@@ -38,6 +40,8 @@ public:
 
     DcpConnMap(EventuallyPersistentEngine &engine);
 
+    ~DcpConnMap();
+
     /**
      * Find or build a dcp connection for the given cookie and with
      * the given name.
@@ -106,6 +110,14 @@ public:
         return backfills.maxActiveSnoozing;
     }
 
+    BackfillScheduler& getBackfillScheduler() {
+        return backfillScheduler;
+    }
+
+    SharedDiskScans& getSharedDiskScans() {
+        return sharedDiskScans;
+    }
+
     ENGINE_ERROR_CODE addPassiveStream(ConnHandler& conn, uint32_t opaque,
                                        uint16_t vbucket, uint32_t flags);
 
@@ -155,6 +167,11 @@ protected:
      */
     void consumerBatchSizeConfigChanged(size_t newValue);
 
+    /*
+     * Change the number of responses a DcpProducer sends per step
+     */
+    void producerStepBatchSizeConfigChanged(size_t newValue);
+
     bool isPassiveStreamConnected_UNLOCKED(uint16_t vbucket);
 
     /*
@@ -182,6 +199,12 @@ protected:
     /* Max percentage of memory we want backfills to occupy */
     static const uint8_t numBackfillsMemThreshold;
 
+    /* Bucket-wide limits on the disk backfills of all the producers */
+    BackfillScheduler backfillScheduler;
+
+    /* Disk scans the backfills of different streams can share */
+    SharedDiskScans sharedDiskScans;
+
     std::atomic<float> minCompressionRatioForProducer;
 
     /* Total memory used by all DCP consumer buffers */
@@ -27,6 +27,7 @@
 #include "dcp/dcpconnmap.h"
 #include "dcp/response.h"
 #include "dcp/stream.h"
+#include "dcp/value-codec.h"
 
 const std::chrono::seconds DcpProducer::defaultDcpNoopTxInterval(20);
 
@@ -114,6 +115,7 @@ DcpProducer::DcpProducer(EventuallyPersistentEngine &e, const void *cookie,
                          const std::string &name, bool isNotifier)
     : Producer(e, cookie, name), rejectResp(NULL),
       notifyOnly(isNotifier), lastSendTime(ep_current_time()), log(*this),
+      stepBatchSize(e.getConfiguration().getDcpProducerStepBatchSize()),
       itemsSent(0), totalBytesSent(0) {
     setSupportAck(true);
     setReserved(true);
@@ -155,7 +157,8 @@ DcpProducer::DcpProducer(EventuallyPersistentEngine &e, const void *cookie,
     noopCtx.enabled = false;
 
     enableExtMetaData = false;
-    enableValueCompression = false;
+    valueCodec = nullptr;
+    valueCodecNegotiated = false;
 
     // Cursor dropping is disabled for replication connections by default,
     // but will be enabled through a control message to support backward
@@ -168,6 +171,12 @@ DcpProducer::DcpProducer(EventuallyPersistentEngine &e, const void *cookie,
     }
 
     backfillMgr.reset(new BackfillManager(&engine_));
+    // Replication backfills (e.g. for a rebalance) take precedence over
+    // those of the other connections in the bucket-wide backfill scheduler.
+    if (name.find("replication") < name.length()) {
+        backfillMgr->setSchedulerPriority(
+                BackfillScheduler::Priority::Replication);
+    }
 
     checkpointCreatorTask = new ActiveStreamCheckpointProcessorTask(e);
     ExecutorPool::get()->schedule(checkpointCreatorTask, AUXIO_TASK_IDX);
@@ -305,7 +314,7 @@ ENGINE_ERROR_CODE DcpProducer::streamRequest(uint32_t flags,
     }
 
     if (flags & DCP_ADD_STREAM_FLAG_DISKONLY) {
-        end_seqno = engine_.getKVBucket()->getLastPersistedSeqno(vbucket);
+        end_seqno = vb->getMaxBackfillSeqno(engine_);
     }
 
     if (!notifyOnly && start_seqno > end_seqno) {
@@ -342,6 +351,11 @@ ENGINE_ERROR_CODE DcpProducer::streamRequest(uint32_t flags,
                              opaque, vbucket, start_seqno,
                              end_seqno, vbucket_uuid,
                              snap_start_seqno, snap_end_seqno);
+        if (flags & DCP_ADD_STREAM_FLAG_TAKEOVER) {
+            // Takeover streams gate the end of a vbucket move: give them
+            // precedence over the other streams of the connection.
+            s->setWeight(engine_.getConfiguration().getDcpTakeoverStreamWeight());
+        }
     }
 
     {
@@ -404,14 +418,49 @@ ENGINE_ERROR_CODE DcpProducer::step(struct dcp_message_producers* producers) {
         return ret;
     }
 
+    // Hand several responses to the producers per call (up to the step
+    // batch size), saving the per-call overhead for each of them.
+    const size_t batchSize = stepBatchSize.load();
+    size_t compressionSavings = 0;
+    size_t sent = 0;
+    do {
+        ret = sendNextResponse(producers, compressionSavings);
+    } while (ret == ENGINE_SUCCESS && ++sent < batchSize);
+
+    // What value compression saved is acknowledged once for the batch.
+    if (compressionSavings > 0) {
+        log.acknowledge(compressionSavings);
+    }
+
+    if (sent == 0) {
+        // Nothing to send (ENGINE_EWOULDBLOCK) or the first response failed.
+        return (ret == ENGINE_EWOULDBLOCK) ? ENGINE_SUCCESS : ret;
+    }
+    switch (ret) {
+    case ENGINE_SUCCESS:
+    case ENGINE_EWOULDBLOCK:
+    case ENGINE_E2BIG:
+    case ENGINE_ENOMEM:
+        // Let the responses already handed over be shipped; one which
+        // failed transiently is retried from rejectResp by the next step.
+        return ENGINE_WANT_MORE;
+    default:
+        return ret;
+    }
+}
+
+ENGINE_ERROR_CODE DcpProducer::sendNextResponse(
+        struct dcp_message_producers* producers, size_t& compressionSavings) {
+    ENGINE_ERROR_CODE ret;
     DcpResponse *resp;
+    stream_t stream;
     if (rejectResp) {
         resp = rejectResp;
         rejectResp = NULL;
     } else {
-        resp = getNextItem();
+        resp = getNextItem(&stream);
         if (!resp) {
-            return ENGINE_SUCCESS;
+            return ENGINE_EWOULDBLOCK;
         }
     }
 
@@ -429,24 +478,21 @@ ENGINE_ERROR_CODE DcpProducer::step(struct dcp_message_producers* producers) {
             return ENGINE_ENOMEM;
         }
 
-        if (enableValueCompression) {
+        if (valueCodecNegotiated) {
             /**
-             * If value compression is enabled, the producer will need
-             * to snappy-compress the document before transmitting.
-             * Compression will obviously be done only if the datatype
-             * indicates that the value isn't compressed already.
+             * The stream compresses the value with its codec before it is
+             * transmitted (unless it is compressed already, e.g. as read
+             * from disk).
              */
-            uint32_t sizeBefore = itmCpy->getNBytes();
-            if (!itmCpy->compressValue(
-                            engine_.getDcpConnMap().getMinCompressionRatio())) {
-                LOG(EXTENSION_LOG_WARNING,
-                    "%s Failed to snappy compress an uncompressed value!",
-                    logHeader());
+            if (!stream) {
+                // A response being retried.
+                stream = findStream(mutationResponse->getVBucket());
             }
-            uint32_t sizeAfter = itmCpy->getNBytes();
-
-            if (sizeAfter < sizeBefore) {
-                log.acknowledge(sizeBefore - sizeAfter);
+            ActiveStream* as = dynamic_cast<ActiveStream*>(stream.get());
+            if (as) {
+                compressionSavings += as->encodeValue(
+                        *itmCpy,
+                        engine_.getDcpConnMap().getMinCompressionRatio());
             }
         }
     }
@@ -537,7 +583,7 @@ ENGINE_ERROR_CODE DcpProducer::step(struct dcp_message_producers* producers) {
     }
 
     lastSendTime = ep_current_time();
-    return (ret == ENGINE_SUCCESS) ? ENGINE_WANT_MORE : ret;
+    return ret;
 }
 
 ENGINE_ERROR_CODE DcpProducer::bufferAcknowledgement(uint32_t opaque,
@@ -584,10 +630,22 @@ ENGINE_ERROR_CODE DcpProducer::control(uint32_t opaque, const void* key,
         return ENGINE_SUCCESS;
     } else if (strncmp(param, "enable_value_compression", nkey) == 0) {
         if (valueStr == "true") {
-            enableValueCompression = true;
+            valueCodec = DcpValueCodec::find("snappy");
         } else {
-            enableValueCompression = false;
+            valueCodec = nullptr;
         }
+        updateValueCodecNegotiated();
+        return ENGINE_SUCCESS;
+    } else if (strncmp(param, "value_compression_codec", nkey) == 0) {
+        const DcpValueCodec* codec = nullptr;
+        if (valueStr != "none" &&
+            !(codec = DcpValueCodec::find(valueStr))) {
+            LOG(EXTENSION_LOG_WARNING, "%s Unsupported value compression "
+                "codec '%s'", logHeader(), valueStr.c_str());
+            return ENGINE_ENOTSUP;
+        }
+        valueCodec = codec;
+        updateValueCodecNegotiated();
         return ENGINE_SUCCESS;
     } else if (strncmp(param, "supports_cursor_dropping", nkey) == 0) {
         if (valueStr == "true") {
@@ -620,6 +678,42 @@ ENGINE_ERROR_CODE DcpProducer::control(uint32_t opaque, const void* key,
                 return ENGINE_EINVAL;
             }
         }
+    } else if (strncmp(param, "set_stream_weight", nkey) == 0) {
+        // Value is "<vbucket>:<weight>", for an existing stream.
+        uint16_t vbucket;
+        uint32_t weight;
+        auto sep = valueStr.find(':');
+        if (sep != std::string::npos &&
+            parseUint16(valueStr.substr(0, sep).c_str(), &vbucket) &&
+            parseUint32(valueStr.substr(sep + 1).c_str(), &weight) &&
+            weight > 0) {
+            stream_t stream = findStream(vbucket);
+            if (stream) {
+                stream->setWeight(weight);
+                return ENGINE_SUCCESS;
+            }
+        }
+    } else if (strncmp(param, "set_stream_compression", nkey) == 0) {
+        // Value is "<vbucket>:<codec>", for an existing stream.
+        uint16_t vbucket;
+        auto sep = valueStr.find(':');
+        if (sep != std::string::npos &&
+            parseUint16(valueStr.substr(0, sep).c_str(), &vbucket)) {
+            const std::string name = valueStr.substr(sep + 1);
+            const DcpValueCodec* codec = nullptr;
+            if (name != "none" && !(codec = DcpValueCodec::find(name))) {
+                LOG(EXTENSION_LOG_WARNING, "%s Unsupported value compression "
+                    "codec '%s'", logHeader(), name.c_str());
+                return ENGINE_ENOTSUP;
+            }
+            stream_t stream = findStream(vbucket);
+            ActiveStream* as = dynamic_cast<ActiveStream*>(stream.get());
+            if (as) {
+                as->setValueCodec(codec);
+                updateValueCodecNegotiated();
+                return ENGINE_SUCCESS;
+            }
+        }
     } else if(strncmp(param, "set_priority", nkey) == 0) {
         if (valueStr == "high") {
             engine_.setDCPPriority(getCookie(), CONN_PRIORITY_HIGH);
@@ -642,6 +736,21 @@ ENGINE_ERROR_CODE DcpProducer::control(uint32_t opaque, const void* key,
     return ENGINE_EINVAL;
 }
 
+void DcpProducer::updateValueCodecNegotiated() {
+    bool negotiated = valueCodec.load() != nullptr;
+    if (!negotiated) {
+        streams.for_each(
+            [&negotiated](StreamsMap::value_type& iter) {
+                auto* as = dynamic_cast<ActiveStream*>(iter.second.get());
+                if (as && as->hasOwnValueCodec()) {
+                    negotiated = true;
+                }
+            }
+        );
+    }
+    valueCodecNegotiated = negotiated;
+}
+
 ENGINE_ERROR_CODE DcpProducer::handleResponse(
                                         protocol_binary_response_header *resp) {
     lastReceiveTime = ep_current_time();
@@ -761,9 +870,11 @@ void DcpProducer::addStats(ADD_STAT add_stat, const void *c) {
     addStat("priority", priority.c_str(), add_stat, c);
     addStat("enable_ext_metadata", enableExtMetaData ? "enabled" : "disabled",
             add_stat, c);
-    addStat("enable_value_compression",
-            enableValueCompression ? "enabled" : "disabled",
+    const DcpValueCodec* codec = valueCodec.load();
+    addStat("enable_value_compression", codec ? "enabled" : "disabled",
             add_stat, c);
+    addStat("value_compression_codec",
+            codec ? codec->getName().c_str() : "none", add_stat, c);
     addStat("cursor_dropping",
             supportsCursorDropping ? "ELIGIBLE" : "NOT_ELIGIBLE",
             add_stat, c);
@@ -884,12 +995,13 @@ const char* DcpProducer::getType() const {
     }
 }
 
-DcpResponse* DcpProducer::getNextItem() {
+DcpResponse* DcpProducer::getNextItem(stream_t* responseStream) {
     do {
         setPaused(false);
 
         uint16_t vbucket = 0;
-        while (ready.popFront(vbucket)) {
+        ProcessClock::duration waited;
+        while (ready.popFront(vbucket, waited)) {
             if (log.pauseIfFull()) {
                 ready.pushUnique(vbucket);
                 return NULL;
@@ -927,6 +1039,12 @@ DcpResponse* DcpProducer::getNextItem() {
                             to_string(op->getEvent()));
             }
 
+            // Charge the stream for what it sends before requeueing it, so
+            // that busy streams share the connection according to their
+            // weights.
+            const uint32_t size = op->getMessageSize();
+            ready.charge(vbucket, size, stream->getWeight());
+            stream->recordSent(size, waited);
             ready.pushUnique(vbucket);
 
             if (op->getEvent() == DcpEvent::Mutation || op->getEvent() == DcpEvent::Deletion ||
@@ -934,8 +1052,11 @@ DcpResponse* DcpProducer::getNextItem() {
                 itemsSent++;
             }
 
-            totalBytesSent.fetch_add(op->getMessageSize());
+            totalBytesSent.fetch_add(size);
 
+            if (responseStream) {
+                responseStream->reset(stream);
+            }
             return op;
         }
 
@@ -26,6 +26,7 @@
 
 class BackfillManager;
 class DcpResponse;
+class DcpValueCodec;
 
 class DcpProducer : public Producer {
 public:
@@ -110,12 +111,23 @@ public:
         return enableExtMetaData;
     }
 
-    bool isValueCompressionEnabled() {
-        return enableValueCompression;
+    /// The value codec of the connection, for its streams which did not
+    /// negotiate their own (null if values are sent uncompressed).
+    const DcpValueCodec* getValueCodec() const {
+        return valueCodec.load();
+    }
+
+    /// Does the connection or any of its streams have a value codec?
+    bool isValueCodecNegotiated() const {
+        return valueCodecNegotiated;
     }
 
     void notifyPaused(bool schedule);
 
+    void setStepBatchSize(size_t newValue) {
+        stepBatchSize = newValue;
+    }
+
     class BufferLog {
     public:
 
@@ -245,7 +257,31 @@ protected:
 private:
 
 
-    DcpResponse* getNextItem();
+    /**
+     * Get the next response to send, from the next ready stream.
+     *
+     * @param[out] stream if not null, set to the stream of the response
+     */
+    DcpResponse* getNextItem(stream_t* stream = nullptr);
+
+    /**
+     * Recompute valueCodecNegotiated: whether the connection or any of its
+     * streams has a value codec.
+     */
+    void updateValueCodecNegotiated();
+
+    /**
+     * Send the next response, if any, through the given producers.
+     *
+     * @param[out] compressionSavings incremented by the bytes saved by
+     *             compressing the value of the response
+     * @return ENGINE_SUCCESS if a response was sent, ENGINE_EWOULDBLOCK if
+     *         there was none to send, otherwise the error hit (the response
+     *         being kept in rejectResp for a retry on ENGINE_E2BIG or
+     *         ENGINE_ENOMEM)
+     */
+    ENGINE_ERROR_CODE sendNextResponse(struct dcp_message_producers* producers,
+                                       size_t& compressionSavings);
 
     size_t getItemsRemaining();
     stream_t findStreamByVbid(uint16_t vbid);
@@ -257,7 +293,10 @@ private:
     bool notifyOnly;
 
     Couchbase::RelaxedAtomic<bool> enableExtMetaData;
-    Couchbase::RelaxedAtomic<bool> enableValueCompression;
+    std::atomic<const DcpValueCodec*> valueCodec;
+    //! Whether a codec is negotiated for the connection or any of its
+    //! streams, for step() to only encode the values then.
+    Couchbase::RelaxedAtomic<bool> valueCodecNegotiated;
     Couchbase::RelaxedAtomic<bool> supportsCursorDropping;
 
     Couchbase::RelaxedAtomic<rel_time_t> lastSendTime;
@@ -271,6 +310,9 @@ private:
 
     DcpReadyQueue ready;
 
+    // Max number of responses sent per call to step().
+    Couchbase::RelaxedAtomic<size_t> stepBatchSize;
+
     // Map of vbid -> stream. Map itself is atomic (thread-safe).
     typedef AtomicUnorderedMap<uint16_t, SingleThreadedRCPtr<Stream>> StreamsMap;
     StreamsMap streams;
@@ -80,6 +80,9 @@ Stream::Stream(const std::string &name, uint32_t flags, uint32_t opaque,
       snap_end_seqno_(snap_end_seqno),
       state_(STREAM_PENDING), itemsReady(false),
       readyQ_non_meta_items(0),
+      weight(1),
+      bytesSent(0),
+      readyWaitTime(0),
       readyQueueMemory(0) {
 }
 
@@ -101,37 +104,29 @@ void Stream::pushToReadyQ(DcpResponse* resp)
 {
    /* expect streamMutex.ownsLock() == true */
     if (resp) {
-        readyQ.push(resp);
+        // Account for the response before publishing it, so a concurrent
+        // pop never makes the counters underflow.
         if (!resp->isMetaEvent()) {
             readyQ_non_meta_items++;
         }
         readyQueueMemory.fetch_add(resp->getMessageSize(),
                                    std::memory_order_relaxed);
+        readyQ.push(resp);
     }
 }
 
 void Stream::popFromReadyQ(void)
 {
-    /* expect streamMutex.ownsLock() == true */
     if (!readyQ.empty()) {
         const auto& front = readyQ.front();
-        if (!front->isMetaEvent()) {
-            readyQ_non_meta_items--;
-        }
+        const bool isMeta = front->isMetaEvent();
         const uint32_t respSize = front->getMessageSize();
         readyQ.pop();
 
-        /* Decrement the readyQ size */
-        if (respSize <= readyQueueMemory.load(std::memory_order_relaxed)) {
-            readyQueueMemory.fetch_sub(respSize, std::memory_order_relaxed);
-        } else {
-            LOG(EXTENSION_LOG_DEBUG, "readyQ size for stream %s (vb %d)"
-                "underflow, likely wrong stat calculation! curr size: %" PRIu64
-                "; new size: %d",
-                name_.c_str(), getVBucket(),
-                readyQueueMemory.load(std::memory_order_relaxed), respSize);
-            readyQueueMemory.store(0, std::memory_order_relaxed);
+        if (!isMeta) {
+            readyQ_non_meta_items--;
         }
+        readyQueueMemory.fetch_sub(respSize, std::memory_order_relaxed);
     }
 }
 
@@ -197,9 +192,11 @@ ActiveStream::ActiveStream(EventuallyPersistentEngine* e, dcp_producer_t p,
        lastReadSeqnoUnSnapshotted(st_seqno), lastReadSeqno(st_seqno),
        lastSentSeqno(st_seqno), curChkSeqno(st_seqno),
        takeoverState(vbucket_state_pending), backfillRemaining(0),
-       itemsFromMemoryPhase(0), firstMarkerSent(false), waitForSnapshot(0),
+       itemsFromMemoryPhase(0), codecSet(false), codec(nullptr),
+       firstMarkerSent(false), waitForSnapshot(0),
        engine(e), producer(p), lastSentSnapEndSeqno(0),
-       chkptItemsExtractionInProgress(false) {
+       chkptItemsExtractionInProgress(false),
+       cursorManager(nullptr) {
 
     const char* type = "";
     if (flags_ & DCP_ADD_STREAM_FLAG_TAKEOVER) {
@@ -226,6 +223,12 @@ ActiveStream::ActiveStream(EventuallyPersistentEngine* e, dcp_producer_t p,
     backfillItems.disk = 0;
     backfillItems.sent = 0;
 
+    compression.values = 0;
+    compression.bytesIn = 0;
+    compression.bytesOut = 0;
+    compression.timeNs = 0;
+    compression.asIs = 0;
+
     type_ = STREAM_ACTIVE;
 
     bufferedBackfill.bytes = 0;
@@ -250,6 +253,19 @@ ActiveStream::~ActiveStream() {
 }
 
 DcpResponse* ActiveStream::next() {
+    // Fast path: an in-memory stream with responses queued hands them out
+    // without taking streamMutex, so the front-end thread does not contend
+    // with the checkpoint processor pushing more. This is safe as only the
+    // front-end thread pops from the readyQ in this state: endStream() only
+    // clears it when backfilling, and only next() moves an in-memory stream
+    // back to backfilling.
+    if (state_ == STREAM_IN_MEMORY && lastSentSeqno.load() < end_seqno_) {
+        DcpResponse* response = nextQueuedItem();
+        if (response) {
+            return response;
+        }
+    }
+
     std::lock_guard<std::mutex> lh(streamMutex);
     return next(lh);
 }
@@ -364,20 +380,29 @@ bool ActiveStream::backfillReceived(Item* itm, backfill_source_t backfill_source
         return false;
     }
 
+    std::unique_ptr<Item> item(itm);
+    return backfillReceived(item, backfill_source);
+}
+
+bool ActiveStream::backfillReceived(std::unique_ptr<Item>& itm,
+                                    backfill_source_t backfill_source) {
+    if (!itm) {
+        return false;
+    }
+
     if (itm->shouldReplicate()) {
         std::unique_lock<std::mutex> lh(streamMutex);
         if (state_ == STREAM_BACKFILLING) {
             if (!producer->recordBackfillManagerBytesRead(itm->size())) {
-                delete itm;
                 return false;
             }
 
             bufferedBackfill.bytes.fetch_add(itm->size());
             bufferedBackfill.items++;
 
-            pushToReadyQ(new MutationResponse(itm, opaque_, nullptr));
-
             lastReadSeqno.store(itm->getBySeqno());
+            pushToReadyQ(new MutationResponse(itm.release(), opaque_, nullptr));
+
             lh.unlock();
             bool inverse = false;
             if (itemsReady.compare_exchange_strong(inverse, true)) {
@@ -390,10 +415,10 @@ bool ActiveStream::backfillReceived(Item* itm, backfill_source_t backfill_source
                 backfillItems.disk++;
             }
         } else {
-            delete itm;
+            itm.reset();
         }
     } else {
-        delete itm;
+        itm.reset();
     }
 
     return true;
@@ -442,6 +467,13 @@ void ActiveStream::completeBackfill() {
     }
 }
 
+void ActiveStream::requestFollowUpBackfill() {
+    LockHolder lh(streamMutex);
+    if (state_ == STREAM_BACKFILLING) {
+        pendingBackfill = true;
+    }
+}
+
 void ActiveStream::snapshotMarkerAckReceived() {
     bool inverse = false;
     if (--waitForSnapshot == 0 &&
@@ -595,7 +627,59 @@ DcpResponse* ActiveStream::deadPhase() {
 }
 
 bool ActiveStream::isCompressionEnabled() {
-    return producer->isValueCompressionEnabled();
+    const DcpValueCodec* valueCodec = getValueCodec();
+    return valueCodec && valueCodec->sendsSnappyAsIs();
+}
+
+const DcpValueCodec* ActiveStream::getValueCodec() const {
+    if (codecSet.load()) {
+        return codec.load();
+    }
+    return producer->getValueCodec();
+}
+
+void ActiveStream::setValueCodec(const DcpValueCodec* newCodec) {
+    codec.store(newCodec);
+    codecSet.store(true);
+}
+
+size_t ActiveStream::encodeValue(Item& item, float minCompressionRatio) {
+    const DcpValueCodec* valueCodec = getValueCodec();
+    const uint32_t sizeBefore = item.getNBytes();
+
+    if (mcbp::datatype::is_compressed(item.getDataType())) {
+        if (valueCodec && valueCodec->sendsSnappyAsIs()) {
+            compression.asIs++;
+        } else if (!item.decompressValue()) {
+            /* Read compressed before the stream changed codec */
+            producer->getLogger().log(EXTENSION_LOG_WARNING,
+                "(vb %" PRIu16 ") Failed to decompress the value of seqno %"
+                PRIu64, vb_, item.getBySeqno());
+        }
+        return 0;
+    }
+
+    if (!valueCodec) {
+        return 0;
+    }
+
+    const auto start = ProcessClock::now();
+    const bool compressed = valueCodec->compress(item, minCompressionRatio);
+    compression.timeNs.fetch_add(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    ProcessClock::now() - start).count());
+    if (!compressed) {
+        producer->getLogger().log(EXTENSION_LOG_WARNING,
+            "(vb %" PRIu16 ") Failed to %s compress an uncompressed value!",
+            vb_, valueCodec->getName().c_str());
+        return 0;
+    }
+
+    const uint32_t sizeAfter = item.getNBytes();
+    compression.values++;
+    compression.bytesIn.fetch_add(sizeBefore);
+    compression.bytesOut.fetch_add(sizeAfter);
+    return sizeAfter < sizeBefore ? sizeBefore - sizeAfter : 0;
 }
 
 void ActiveStream::addStats(ADD_STAT add_stat, const void *c) {
@@ -630,6 +714,43 @@ void ActiveStream::addStats(ADD_STAT add_stat, const void *c) {
         checked_snprintf(buffer, bsize, "%s:stream_%d_ready_queue_memory",
                          name_.c_str(), vb_);
         add_casted_stat(buffer, getReadyQueueMemory(), add_stat, c);
+        checked_snprintf(buffer, bsize, "%s:stream_%d_weight",
+                         name_.c_str(), vb_);
+        add_casted_stat(buffer, getWeight(), add_stat, c);
+        checked_snprintf(buffer, bsize, "%s:stream_%d_bytes_sent",
+                         name_.c_str(), vb_);
+        add_casted_stat(buffer, bytesSent.load(), add_stat, c);
+        checked_snprintf(buffer, bsize, "%s:stream_%d_ready_wait_us",
+                         name_.c_str(), vb_);
+        add_casted_stat(buffer, readyWaitTime.load(), add_stat, c);
+        const DcpValueCodec* valueCodec = getValueCodec();
+        checked_snprintf(buffer, bsize, "%s:stream_%d_compression_codec",
+                         name_.c_str(), vb_);
+        add_casted_stat(buffer,
+                        valueCodec ? valueCodec->getName().c_str() : "none",
+                        add_stat, c);
+        checked_snprintf(buffer, bsize, "%s:stream_%d_compressed_values",
+                         name_.c_str(), vb_);
+        add_casted_stat(buffer, compression.values, add_stat, c);
+        checked_snprintf(buffer, bsize, "%s:stream_%d_compressed_as_is",
+                         name_.c_str(), vb_);
+        add_casted_stat(buffer, compression.asIs, add_stat, c);
+        checked_snprintf(buffer, bsize, "%s:stream_%d_compression_bytes_in",
+                         name_.c_str(), vb_);
+        add_casted_stat(buffer, compression.bytesIn, add_stat, c);
+        checked_snprintf(buffer, bsize, "%s:stream_%d_compression_bytes_out",
+                         name_.c_str(), vb_);
+        add_casted_stat(buffer, compression.bytesOut, add_stat, c);
+        checked_snprintf(buffer, bsize, "%s:stream_%d_compression_ratio",
+                         name_.c_str(), vb_);
+        const uint64_t bytesIn = compression.bytesIn.load();
+        add_casted_stat(buffer,
+                        bytesIn ? double(compression.bytesOut.load()) / bytesIn
+                                : 1.0,
+                        add_stat, c);
+        checked_snprintf(buffer, bsize, "%s:stream_%d_compression_ns",
+                         name_.c_str(), vb_);
+        add_casted_stat(buffer, compression.timeNs, add_stat, c);
         checked_snprintf(buffer, bsize, "%s:stream_%d_items_ready",
                          name_.c_str(), vb_);
         add_casted_stat(buffer, itemsReady.load() ? "true" : "false", add_stat,
@@ -738,7 +859,8 @@ DcpResponse* ActiveStream::nextQueuedItem() {
 
 bool ActiveStream::nextCheckpointItem() {
     RCPtr<VBucket> vbucket = engine->getVBucket(vb_);
-    if (vbucket && vbucket->checkpointManager.getNumItemsForCursor(name_) > 0) {
+    if (vbucket && vbucket->checkpointManager.getNumItemsForCursor(
+                           getCursorHandle(*vbucket)) > 0) {
         // schedule this stream to build the next checkpoint
         producer->scheduleCheckpointProcessorTask(this);
         return true;
@@ -826,7 +948,7 @@ void ActiveStream::getOutstandingItems(RCPtr<VBucket> &vb,
     chkptItemsExtractionInProgress.store(true);
 
     hrtime_t _begin_ = gethrtime();
-    vb->checkpointManager.getAllItemsForCursor(name_, items);
+    vb->checkpointManager.getAllItemsForCursor(getCursorHandle(*vb), items);
     engine->getEpStats().dcpCursorsGetItemsHisto.add(
                                             (gethrtime() - _begin_) / 1000);
 
@@ -1028,7 +1150,7 @@ void ActiveStream::scheduleBackfill_UNLOCKED(bool reschedule) {
                DCP_ADD_STREAM_FLAG_DISKONLY (the else part), end_seqno_ is
                set to last persisted seqno befor calling
                scheduleBackfill_UNLOCKED() */
-            backfillEnd = engine->getKVBucket()->getLastPersistedSeqno(vb_);
+            backfillEnd = vbucket->getMaxBackfillSeqno(*engine);
         } else {
             backfillEnd = end_seqno_;
         }
@@ -1291,10 +1413,26 @@ size_t ActiveStream::getItemsRemaining() {
     // Items remaining is the sum of:
     // (a) Items outstanding in checkpoints
     // (b) Items pending in our readyQ, excluding any meta items.
-    return vbucket->checkpointManager.getNumItemsForCursor(name_) +
+    return vbucket->checkpointManager.getNumItemsForCursor(
+                   getCursorHandle(*vbucket)) +
             readyQ_non_meta_items;
 }
 
+CheckpointCursorHandle ActiveStream::getCursorHandle(VBucket& vb) {
+    {
+        std::lock_guard<SpinLock> lh(cursorLock);
+        if (cursorManager == &vb.checkpointManager && !cursor.expired()) {
+            return cursor;
+        }
+    }
+
+    auto handle = vb.checkpointManager.getCursorHandle(name_);
+    std::lock_guard<SpinLock> lh(cursorLock);
+    cursor = handle;
+    cursorManager = &vb.checkpointManager;
+    return handle;
+}
+
 uint64_t ActiveStream::getLastReadSeqno() const {
     return lastReadSeqno.load();
 }
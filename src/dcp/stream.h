@@ -24,7 +24,9 @@
 #include "ext_meta_parser.h"
 #include "dcp/dcp-types.h"
 #include "dcp/producer.h"
+#include "dcp/value-codec.h"
 #include "response.h"
+#include "spsc_queue.h"
 #include "vbucket.h"
 
 #include <atomic>
@@ -141,6 +143,28 @@ public:
     /// Return a string describing the given stream state.
     static const char* stateName(stream_state_t st);
 
+    /// Weight of the stream when scheduling its connection's streams (see
+    /// DcpReadyQueue).
+    uint32_t getWeight() const {
+        return weight.load();
+    }
+
+    void setWeight(uint32_t newWeight) {
+        weight.store(newWeight);
+    }
+
+    /**
+     * Record that a response of the given size was sent, the stream having
+     * waited for the given time in its connection's ready queue.
+     */
+    void recordSent(size_t bytes, ProcessClock::duration waited) {
+        bytesSent.fetch_add(bytes, std::memory_order_relaxed);
+        readyWaitTime.fetch_add(
+                std::chrono::duration_cast<std::chrono::microseconds>(waited)
+                        .count(),
+                std::memory_order_relaxed);
+    }
+
 protected:
 
     void clear_UNLOCKED();
@@ -148,7 +172,7 @@ protected:
     /* To be called after getting streamMutex lock */
     void pushToReadyQ(DcpResponse* resp);
 
-    /* To be called after getting streamMutex lock */
+    /* To be called by the readyQ consumer (see readyQ) */
     void popFromReadyQ(void);
 
     uint64_t getReadyQueueMemory(void);
@@ -167,19 +191,33 @@ protected:
 
     std::atomic<bool> itemsReady;
     std::mutex streamMutex;
-    std::queue<DcpResponse*> readyQ;
+
+    /*
+     * Responses waiting to be sent. Pushes (pushToReadyQ) are serialised
+     * by streamMutex; pops are made by the connection's front-end thread,
+     * under streamMutex except on ActiveStream's in-memory fast path (see
+     * ActiveStream::next()) - hence a single-producer/single-consumer queue.
+     */
+    SpscQueue<DcpResponse*> readyQ;
 
     // Number of items in the readyQ that are not meta items. Used for
     // calculating getItemsRemaining(). Atomic so it can be safely read by
     // getItemsRemaining() without acquiring streamMutex.
     std::atomic<size_t> readyQ_non_meta_items;
 
+    std::atomic<uint32_t> weight;
+
+    // Bytes sent, and time (in µs) spent waiting to be scheduled.
+    std::atomic<uint64_t> bytesSent;
+    std::atomic<uint64_t> readyWaitTime;
+
     const static uint64_t dcpMaxSeqno;
 
 private:
     /* readyQueueMemory tracks the memory occupied by elements
-     * in the readyQ.  It is an atomic because otherwise
-       getReadyQueueMemory would need to acquire streamMutex.
+     * in the readyQ.  It is an atomic as the readyQ is pushed to and
+     * popped from concurrently, and so that getReadyQueueMemory does not
+     * need to acquire streamMutex.
      */
     std::atomic <uint64_t> readyQueueMemory;
 };
@@ -222,10 +260,50 @@ public:
 
     bool backfillReceived(Item* itm, backfill_source_t backfill_source);
 
+    /**
+     * As backfillReceived(Item*, backfill_source_t), but if the item cannot
+     * be accepted because the backfill buffer of the connection is full,
+     * false is returned and ownership of the item stays with the caller (so
+     * the item can be offered again later). Otherwise itm is reset.
+     */
+    bool backfillReceived(std::unique_ptr<Item>& itm,
+                          backfill_source_t backfill_source);
+
     void completeBackfill();
 
+    /**
+     * Schedule another backfill, from the last seqno read, once the running
+     * one completes (as it does not cover all the items the stream needs).
+     */
+    void requestFollowUpBackfill();
+
+    /**
+     * Can values already Snappy compressed be sent as they are, i.e. should
+     * backfills read them compressed from disk?
+     */
     bool isCompressionEnabled();
 
+    /// The value codec of the stream, or else of its connection (null if
+    /// values are sent uncompressed).
+    const DcpValueCodec* getValueCodec() const;
+
+    /// Set the value codec of the stream (null for none).
+    void setValueCodec(const DcpValueCodec* codec);
+
+    /// Has the stream negotiated a value codec of its own (not none)?
+    bool hasOwnValueCodec() const {
+        return codecSet.load() && codec.load() != nullptr;
+    }
+
+    /**
+     * Prepare the value of an item copy about to be sent: compress it with
+     * the codec of the stream, or decompress it if the stream does not take
+     * compressed values, accounting for it in the stream's stats.
+     *
+     * @return the bytes saved by compression.
+     */
+    size_t encodeValue(Item& item, float minCompressionRatio);
+
     void addStats(ADD_STAT add_stat, const void *c);
 
     void addTakeoverStats(ADD_STAT add_stat, const void *c, const VBucket& vb);
@@ -308,6 +386,14 @@ private:
 
     bool isCurrentSnapshotCompleted() const;
 
+    /**
+     * Return the handle to this stream's cursor in the given vbucket's
+     * checkpoint manager. The handle is looked up by name again when the
+     * cursor it referred to no longer exists (the cursor was re-registered
+     * or the vbucket re-created).
+     */
+    CheckpointCursorHandle getCursorHandle(VBucket& vb);
+
     /* Drop the cursor registered with the checkpoint manager.
      * Note: Expects the streamMutex to be acquired when called
      */
@@ -347,6 +433,21 @@ private:
     //! The amount of items that have been sent during the memory phase
     std::atomic<size_t> itemsFromMemoryPhase;
 
+    //! Value codec negotiated for this stream, if codecSet (otherwise the
+    //! one of the connection applies).
+    std::atomic<bool> codecSet;
+    std::atomic<const DcpValueCodec*> codec;
+
+    //! Stats of the values compressed for this stream
+    struct {
+        std::atomic<uint64_t> values;
+        std::atomic<uint64_t> bytesIn;
+        std::atomic<uint64_t> bytesOut;
+        std::atomic<uint64_t> timeNs;
+        //! Values sent as they were already compressed (e.g. from disk)
+        std::atomic<uint64_t> asIs;
+    } compression;
+
     //! Whether ot not this is the first snapshot marker sent
     bool firstMarkerSent;
 
@@ -371,6 +472,11 @@ private:
        items are added to the readyQ */
     std::atomic<bool> chkptItemsExtractionInProgress;
 
+    //! Cached handle to this stream's checkpoint cursor, and the checkpoint
+    //! manager it belongs to; guarded by cursorLock.
+    CheckpointCursorHandle cursor;
+    const CheckpointManager* cursorManager;
+    SpinLock cursorLock;
 };
 
 
@@ -0,0 +1,76 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "dcp/value-codec.h"
+#include "item.h"
+
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+struct Registry {
+    Registry() {
+        codecs.emplace_back(new SnappyDcpValueCodec());
+    }
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<DcpValueCodec>> codecs;
+};
+
+Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+} // anonymous namespace
+
+const DcpValueCodec* DcpValueCodec::find(const std::string& name) {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lh(reg.mutex);
+    for (const auto& codec : reg.codecs) {
+        if (codec->getName() == name) {
+            return codec.get();
+        }
+    }
+    return nullptr;
+}
+
+void DcpValueCodec::add(std::unique_ptr<DcpValueCodec> codec) {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lh(reg.mutex);
+    for (const auto& existing : reg.codecs) {
+        if (existing->getName() == codec->getName()) {
+            throw std::invalid_argument("DcpValueCodec::add: codec " +
+                                        codec->getName() +
+                                        " is already registered");
+        }
+    }
+    reg.codecs.push_back(std::move(codec));
+}
+
+const std::string& SnappyDcpValueCodec::getName() const {
+    static const std::string name("snappy");
+    return name;
+}
+
+bool SnappyDcpValueCodec::compress(Item& item, float minRatio) const {
+    return item.compressValue(minRatio);
+}
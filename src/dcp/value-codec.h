@@ -0,0 +1,90 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include <memory>
+#include <string>
+
+class Item;
+
+/**
+ * A compression codec a DCP producer applies to the values it sends.
+ *
+ * The codec of a stream is negotiated by the consumer through
+ * DcpProducer::control():
+ * - "value_compression_codec" sets the codec of the connection, used by
+ *   the streams which did not negotiate their own;
+ * - "set_stream_compression" ("<vbucket>:<codec>") sets the codec of an
+ *   existing stream;
+ * - "enable_value_compression" ("true" / "false") is the same as
+ *   "value_compression_codec" with "snappy" / "none".
+ * The codec "none" disables compression.
+ *
+ * Codecs are looked up by name with find(); further ones may be registered
+ * with add().
+ */
+class DcpValueCodec {
+public:
+    virtual ~DcpValueCodec() {}
+
+    /// Name the codec is negotiated with.
+    virtual const std::string& getName() const = 0;
+
+    /**
+     * Can values already Snappy compressed (as they are stored on disk) be
+     * sent as they are? If so, the backfills of streams using the codec read
+     * the values compressed instead of inflating them, so they are never
+     * decompressed and compressed again.
+     */
+    virtual bool sendsSnappyAsIs() const = 0;
+
+    /**
+     * Compress the (uncompressed) value of an item about to be sent, unless
+     * the compressed value is larger than minRatio times the original.
+     *
+     * @return false if the value could not be compressed.
+     */
+    virtual bool compress(Item& item, float minRatio) const = 0;
+
+    /// The codec registered with the given name, or null.
+    static const DcpValueCodec* find(const std::string& name);
+
+    /**
+     * Register a codec, which lives until shutdown.
+     *
+     * @throws std::invalid_argument if a codec of that name exists.
+     */
+    static void add(std::unique_ptr<DcpValueCodec> codec);
+};
+
+/**
+ * Snappy, the compression which the COMPRESSED datatype of DCP values
+ * identifies and the one values are stored with on disk.
+ */
+class SnappyDcpValueCodec : public DcpValueCodec {
+public:
+    const std::string& getName() const override;
+
+    bool sendsSnappyAsIs() const override {
+        return true;
+    }
+
+    bool compress(Item& item, float minRatio) const override;
+};
@@ -86,14 +86,16 @@ bool DefragmentVisitor::visit(uint16_t vbucket_id, HashTable& ht) {
     }
 }
 
-bool DefragmentVisitor::visit(StoredValue& v) {
+bool DefragmentVisitor::visit(const std::unique_lock<std::mutex>& htLock,
+                              StoredValue& v) {
     const size_t value_len = v.valuelen();
 
     // value must be at least non-zero (also covers Items with null Blobs)
     // and no larger than the biggest size class the allocator
     // supports, so it can be successfully reallocated to a run with other
-    // objects of the same size.
-    if (value_len > 0 && value_len <= max_size_class) {
+    // objects of the same size. Inline values have no Blob of their own to
+    // move.
+    if (value_len > 0 && value_len <= max_size_class && !v.isValueInline()) {
         // If sufficiently old reallocate, otherwise increment it's age.
         if (v.getValue()->getAge() >= age_threshold) {
             v.reallocate();
@@ -39,7 +39,8 @@ public:
     virtual bool visit(uint16_t vbucket_id, HashTable& ht);
 
     // Implementation of PauseResumeHashTableVisitor interface:
-    virtual bool visit(StoredValue& v);
+    virtual bool visit(const std::unique_lock<std::mutex>& htLock,
+                       StoredValue& v);
 
     // Returns the current hashtable position.
     HashTable::Position getHashtablePosition() const;
@@ -21,6 +21,8 @@
 #include "ep_engine.h"
 #include "flusher.h"
 
+#include <platform/make_unique.h>
+
 EPBucket::EPBucket(EventuallyPersistentEngine& theEngine)
     : KVBucket(theEngine) {
     const std::string& policy =
@@ -69,26 +71,32 @@ void EPBucket::reset() {
     // Need to additionally update disk state
     bool inverse = true;
     deleteAllTaskCtx.delay.compare_exchange_strong(inverse, false);
-    // Waking up (notifying) one flusher is good enough for diskDeleteAll
-    vbMap.getShard(EP_PRIMARY_SHARD)->getFlusher()->notifyFlushEvent();
+    // The delete-all is run by writer 0 of the primary shard (the other
+    // writers wait for it, see Flusher::flushVB()), which notifies every
+    // writer once it is done (see KVBucket::flushOneDeleteAll()).
+    vbMap.getShard(EP_PRIMARY_SHARD)->getFlusher(0)->notifyFlushEvent();
 }
 
 void EPBucket::startFlusher() {
     for (const auto& shard : vbMap.shards) {
-        shard->getFlusher()->start();
+        for (size_t writer = 0; writer < shard->getNumWriters(); ++writer) {
+            shard->getFlusher(writer)->start();
+        }
     }
 }
 
 void EPBucket::stopFlusher() {
     for (const auto& shard : vbMap.shards) {
-        auto* flusher = shard->getFlusher();
-        LOG(EXTENSION_LOG_NOTICE,
-            "Attempting to stop the flusher for "
-            "shard:%" PRIu16,
-            shard->getId());
-        bool rv = flusher->stop(stats.forceShutdown);
-        if (rv && !stats.forceShutdown) {
-            flusher->wait();
+        for (size_t writer = 0; writer < shard->getNumWriters(); ++writer) {
+            auto* flusher = shard->getFlusher(writer);
+            LOG(EXTENSION_LOG_NOTICE,
+                "Attempting to stop the flusher for "
+                "shard:%" PRIu16 " writer:%" PRIu64,
+                shard->getId(), uint64_t(writer));
+            bool rv = flusher->stop(stats.forceShutdown);
+            if (rv && !stats.forceShutdown) {
+                flusher->wait();
+            }
         }
     }
 }
@@ -96,14 +104,17 @@ void EPBucket::stopFlusher() {
 bool EPBucket::pauseFlusher() {
     bool rv = true;
     for (const auto& shard : vbMap.shards) {
-        auto* flusher = shard->getFlusher();
-        if (!flusher->pause()) {
-            LOG(EXTENSION_LOG_WARNING,
-                "Attempted to pause flusher in state "
-                "[%s], shard = %d",
-                flusher->stateName(),
-                shard->getId());
-            rv = false;
+        for (size_t writer = 0; writer < shard->getNumWriters(); ++writer) {
+            auto* flusher = shard->getFlusher(writer);
+            if (!flusher->pause()) {
+                LOG(EXTENSION_LOG_WARNING,
+                    "Attempted to pause flusher in state "
+                    "[%s], shard = %d, writer = %" PRIu64,
+                    flusher->stateName(),
+                    shard->getId(),
+                    uint64_t(writer));
+                rv = false;
+            }
         }
     }
     return rv;
@@ -112,14 +123,17 @@ bool EPBucket::pauseFlusher() {
 bool EPBucket::resumeFlusher() {
     bool rv = true;
     for (const auto& shard : vbMap.shards) {
-        auto* flusher = shard->getFlusher();
-        if (!flusher->resume()) {
-            LOG(EXTENSION_LOG_WARNING,
-                "Attempted to resume flusher in state [%s], "
-                "shard = %" PRIu16,
-                flusher->stateName(),
-                shard->getId());
-            rv = false;
+        for (size_t writer = 0; writer < shard->getNumWriters(); ++writer) {
+            auto* flusher = shard->getFlusher(writer);
+            if (!flusher->resume()) {
+                LOG(EXTENSION_LOG_WARNING,
+                    "Attempted to resume flusher in state [%s], "
+                    "shard = %" PRIu16 ", writer = %" PRIu64,
+                    flusher->stateName(),
+                    shard->getId(),
+                    uint64_t(writer));
+                rv = false;
+            }
         }
     }
     return rv;
@@ -128,7 +142,26 @@ bool EPBucket::resumeFlusher() {
 void EPBucket::wakeUpFlusher() {
     if (stats.diskQueueSize.load() == 0) {
         for (const auto& shard : vbMap.shards) {
-            shard->getFlusher()->wake();
+            for (size_t writer = 0; writer < shard->getNumWriters();
+                 ++writer) {
+                shard->getFlusher(writer)->wake();
+            }
+        }
+    }
+}
+
+void EPBucket::setFlusherBatchDeferDelay(size_t delayMs) {
+    for (const auto& shard : vbMap.shards) {
+        for (size_t writer = 0; writer < shard->getNumWriters(); ++writer) {
+            shard->getFlusher(writer)->setBatchDeferDelay(delayMs);
+        }
+    }
+}
+
+void EPBucket::setFlusherBatchDeferItems(size_t items) {
+    for (const auto& shard : vbMap.shards) {
+        for (size_t writer = 0; writer < shard->getNumWriters(); ++writer) {
+            shard->getFlusher(writer)->setBatchDeferItems(items);
         }
     }
 }
@@ -178,10 +211,14 @@ ENGINE_ERROR_CODE EPBucket::getFileStats(const void* cookie,
     DBFileInfo totalInfo;
 
     for (uint16_t shardId = 0; shardId < numShards; shardId++) {
-        const auto dbInfo =
-                getRWUnderlyingByShard(shardId)->getAggrDbFileInfo();
-        totalInfo.spaceUsed += dbInfo.spaceUsed;
-        totalInfo.fileSize += dbInfo.fileSize;
+        // Each writer's KVStore only accounts for the vbuckets it writes.
+        KVShard* shard = vbMap.getShard(shardId);
+        for (size_t writer = 0; writer < shard->getNumWriters(); ++writer) {
+            const auto dbInfo =
+                    shard->getRWUnderlying(writer)->getAggrDbFileInfo();
+            totalInfo.spaceUsed += dbInfo.spaceUsed;
+            totalInfo.fileSize += dbInfo.fileSize;
+        }
     }
 
     add_casted_stat("ep_db_data_size", totalInfo.spaceUsed, add_stat, cookie);
@@ -200,8 +237,10 @@ ENGINE_ERROR_CODE EPBucket::getPerVBucketDiskStats(const void* cookie,
         void visitBucket(RCPtr<VBucket>& vb) override {
             char buf[32];
             uint16_t vbid = vb->getId();
+            KVShard* shard = vb->getShard();
             DBFileInfo dbInfo =
-                    vb->getShard()->getRWUnderlying()->getDbFileInfo(vbid);
+                    shard->getRWUnderlying(shard->getWriterId(vbid))
+                            ->getDbFileInfo(vbid);
 
             try {
                 checked_snprintf(buf, sizeof(buf), "vb_%d:data_size", vbid);
@@ -251,6 +290,8 @@ RCPtr<VBucket> EPBucket::makeVBucket(
                                       std::move(newSeqnoCb),
                                       engine.getConfiguration(),
                                       eviction_policy,
+                                      std::make_unique<StoredValueFactory>(
+                                              stats),
                                       initState,
                                       purgeSeqno,
                                       maxCas));
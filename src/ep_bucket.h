@@ -53,6 +53,9 @@ public:
 
     void wakeUpFlusher() override;
 
+    void setFlusherBatchDeferDelay(size_t delayMs) override;
+    void setFlusherBatchDeferItems(size_t items) override;
+
     /**
      * Starts the background fetcher for each shard.
      * @return true if successful.
@@ -414,6 +414,12 @@ static protocol_binary_response_status setCheckpointParam(
             e->getConfiguration().setKeepClosedChks(cb_stob(valz));
         } else if (strcmp(keyz, "enable_chk_merge") == 0) {
             e->getConfiguration().setEnableChkMerge(cb_stob(valz));
+        } else if (strcmp(keyz, "chk_expel_enabled") == 0) {
+            e->getConfiguration().setChkExpelEnabled(cb_stob(valz));
+        } else if (strcmp(keyz, "chk_max_size") == 0) {
+            e->getConfiguration().setChkMaxSize(std::stoull(valz));
+        } else if (strcmp(keyz, "chk_mem_quota_percent") == 0) {
+            e->getConfiguration().setChkMemQuotaPercent(std::stoull(valz));
         } else {
             msg = "Unknown config param";
             rv = PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
@@ -481,6 +487,8 @@ static protocol_binary_response_status setFlushParam(
         } else if (strcmp(keyz, "mutation_mem_threshold") == 0) {
             e->getConfiguration().setMutationMemThreshold(
                 std::stoull(valz));
+        } else if (strcmp(keyz, "inline_value_threshold") == 0) {
+            e->getConfiguration().setInlineValueThreshold(std::stoull(valz));
         } else if (strcmp(keyz, "timing_log") == 0) {
             EPStats& stats = e->getEpStats();
             std::ostream* old = stats.timingLog;
@@ -559,12 +567,40 @@ static protocol_binary_response_status setFlushParam(
                 std::stoull(valz));
         } else if (strcmp(keyz, "defragmenter_run") == 0) {
             e->runDefragmenterTask();
+        } else if (strcmp(keyz, "ephemeral_metadata_purge_age") == 0) {
+            e->getConfiguration().setEphemeralMetadataPurgeAge(
+                std::stoull(valz));
+        } else if (strcmp(keyz, "ephemeral_metadata_purge_interval") == 0) {
+            e->getConfiguration().setEphemeralMetadataPurgeInterval(
+                std::stoull(valz));
+        } else if (strcmp(keyz, "ephemeral_metadata_purge_chunk_duration") ==
+                   0) {
+            e->getConfiguration().setEphemeralMetadataPurgeChunkDuration(
+                std::stoull(valz));
+        } else if (strcmp(keyz, "vb_mem_deletion_chunk_duration") == 0) {
+            e->getConfiguration().setVbMemDeletionChunkDuration(
+                std::stoull(valz));
         } else if (strcmp(keyz, "compaction_write_queue_cap") == 0) {
             e->getConfiguration().setCompactionWriteQueueCap(
                 std::stoull(valz));
         } else if (strcmp(keyz, "dcp_min_compression_ratio") == 0) {
             e->getConfiguration().setDcpMinCompressionRatio(
                 std::stof(valz));
+        } else if (strcmp(keyz, "flusher_batch_defer_delay") == 0) {
+            e->getConfiguration().setFlusherBatchDeferDelay(
+                std::stoull(valz));
+        } else if (strcmp(keyz, "flusher_batch_defer_items") == 0) {
+            e->getConfiguration().setFlusherBatchDeferItems(
+                std::stoull(valz));
+        } else if (strcmp(keyz, "flusher_commit_latency_target") == 0) {
+            e->getConfiguration().setFlusherCommitLatencyTarget(
+                std::stoull(valz));
+        } else if (strcmp(keyz, "flusher_batch_max_items") == 0) {
+            e->getConfiguration().setFlusherBatchMaxItems(
+                std::stoull(valz));
+        } else if (strcmp(keyz, "flusher_batch_max_bytes") == 0) {
+            e->getConfiguration().setFlusherBatchMaxBytes(
+                std::stoull(valz));
         } else if (strcmp(keyz, "access_scanner_run") == 0) {
             if (!(e->runAccessScannerTask())) {
                 rv = PROTOCOL_BINARY_RESPONSE_ETMPFAIL;
@@ -625,10 +661,34 @@ static protocol_binary_response_status setDcpParam(
             validate(v, size_t(1), std::numeric_limits<size_t>::max());
             e->getConfiguration().setDcpConsumerProcessBufferedMessagesBatchSize(
                 v);
+        } else if (strcmp(keyz, "dcp_producer_step_batch_size") == 0) {
+            size_t v = atoi(valz);
+            checkNumeric(valz);
+            validate(v, size_t(1), std::numeric_limits<size_t>::max());
+            e->getConfiguration().setDcpProducerStepBatchSize(v);
+        } else if (strcmp(keyz, "dcp_takeover_stream_weight") == 0) {
+            size_t v = atoi(valz);
+            checkNumeric(valz);
+            validate(v, size_t(1), size_t(1000));
+            e->getConfiguration().setDcpTakeoverStreamWeight(v);
+        } else if (strcmp(keyz, "dcp_backfill_max_scans") == 0) {
+            checkNumeric(valz);
+            e->getConfiguration().setDcpBackfillMaxScans(
+                    std::strtoull(valz, nullptr, 10));
+        } else if (strcmp(keyz, "dcp_backfill_bytes_per_sec") == 0) {
+            checkNumeric(valz);
+            e->getConfiguration().setDcpBackfillBytesPerSec(
+                    std::strtoull(valz, nullptr, 10));
+        } else if (strcmp(keyz, "dcp_backfill_share_scans") == 0) {
+            e->getConfiguration().setDcpBackfillShareScans(cb_stob(valz));
         } else {
             msg = "Unknown config param";
             rv = PROTOCOL_BINARY_RESPONSE_KEY_ENOENT;
         }
+        // Handles exceptions thrown by the cb_stob function
+    } catch (invalid_argument_bool& error) {
+        msg = error.what();
+        rv = PROTOCOL_BINARY_RESPONSE_EINVAL;
     } catch (std::runtime_error& ex) {
         msg = "Value out of range.";
         rv = PROTOCOL_BINARY_RESPONSE_EINVAL;
@@ -1916,6 +1976,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::initialize(const char* config) {
     HashTable::setDefaultNumLocks(configuration.getHtLocks());
     StoredValue::setMutationMemoryThreshold(
                                       configuration.getMutationMemThreshold());
+    StoredValue::setInlineValueThreshold(
+                                      configuration.getInlineValueThreshold());
 
     if (configuration.getMaxSize() == 0) {
         configuration.setMaxSize(std::numeric_limits<size_t>::max());
@@ -2999,7 +3061,9 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     epstats.diskQueueSize, add_stat, cookie);
     add_casted_stat("ep_diskqueue_items",
                     epstats.diskQueueSize, add_stat, cookie);
-    auto* flusher = kvBucket->getFlusher(EP_PRIMARY_SHARD);
+    // All the flushers are driven through the same states: report the one
+    // persisting vbucket 0.
+    auto* flusher = kvBucket->getFlusher(0);
     if (flusher) {
         add_casted_stat("ep_commit_num", epstats.flusherCommits,
                         add_stat, cookie);
@@ -3019,6 +3083,16 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                         flusher->stateName(), add_stat, cookie);
         add_casted_stat("ep_flusher_todo",
                         epstats.flusher_todo, add_stat, cookie);
+        const auto& batchController = kvBucket->getFlushBatchController();
+        add_casted_stat("ep_flusher_batch_item_limit",
+                        batchController.getItemLimit(), add_stat, cookie);
+        add_casted_stat("ep_flusher_batch_byte_limit",
+                        batchController.getByteLimit(), add_stat, cookie);
+        add_casted_stat("ep_flusher_batches_limited",
+                        batchController.getLimitedBatches(), add_stat, cookie);
+        add_casted_stat("ep_flusher_commit_latency_avg",
+                        batchController.getLatencyAverage().count(),
+                        add_stat, cookie);
         add_casted_stat("ep_total_persisted",
                         epstats.totalPersisted, add_stat, cookie);
         add_casted_stat("ep_uncommitted_items",
@@ -3028,6 +3102,19 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
                     epstats.vbucketDeletions, add_stat, cookie);
     add_casted_stat("ep_vbucket_del_fail",
                     epstats.vbucketDeletionFail, add_stat, cookie);
+    add_casted_stat("ep_vbucket_mem_del_bytes_freed",
+                    epstats.vbucketMemDelBytesFreed, add_stat, cookie);
+    add_casted_stat("ep_vbucket_mem_del_walltime",
+                    epstats.vbucketMemDelTotWalltime, add_stat, cookie);
+    add_casted_stat("ep_vbucket_mem_del_max_walltime",
+                    epstats.vbucketMemDelMaxRunWalltime, add_stat, cookie);
+    const hrtime_t memDelWalltime = epstats.vbucketMemDelTotWalltime.load();
+    add_casted_stat("ep_vbucket_mem_del_bytes_per_sec",
+                    memDelWalltime > 0
+                            ? (epstats.vbucketMemDelBytesFreed.load() *
+                               1000000) / memDelWalltime
+                            : 0,
+                    add_stat, cookie);
     add_casted_stat("ep_flush_duration_total",
                     epstats.cumulativeFlushTime, add_stat, cookie);
     add_casted_stat(
@@ -3267,6 +3354,18 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
     add_casted_stat("ep_storedval_overhead", "unknown", add_stat, cookie);
 #endif
     add_casted_stat("ep_storedval_num", stats.numStoredVal, add_stat, cookie);
+    add_casted_stat("ep_inline_value_num", stats.numInlineValue,
+                    add_stat, cookie);
+    add_casted_stat("ep_inline_value_overhead_saved",
+                    stats.inlineValueOverheadSaved, add_stat, cookie);
+    const size_t numInline = stats.numInlineValue;
+    add_casted_stat("ep_inline_value_saved_per_item",
+                    numInline ? stats.inlineValueOverheadSaved / numInline : 0,
+                    add_stat, cookie);
+    add_casted_stat("ep_arena_mapped_bytes", stats.arenaMappedBytes,
+                    add_stat, cookie);
+    add_casted_stat("ep_arena_used_bytes", stats.arenaUsedBytes,
+                    add_stat, cookie);
     add_casted_stat("ep_overhead", stats.memOverhead, add_stat, cookie);
     add_casted_stat("ep_item_num", stats.numItem, add_stat, cookie);
     add_casted_stat("ep_total_cache_size",
@@ -3307,6 +3406,12 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
     add_casted_stat("ep_items_rm_from_checkpoints",
                     epstats.itemsRemovedFromCheckpoints,
                     add_stat, cookie);
+    add_casted_stat("ep_checkpoint_items_expelled",
+                    epstats.itemsExpelledFromCheckpoints,
+                    add_stat, cookie);
+    add_casted_stat("ep_checkpoint_mem_expelled",
+                    epstats.memExpelledFromCheckpoints,
+                    add_stat, cookie);
     add_casted_stat("ep_num_value_ejects", epstats.numValueEjects,
                     add_stat, cookie);
     add_casted_stat("ep_num_eject_failures", epstats.numFailedEjects,
@@ -3475,10 +3580,19 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doEngineStats(const void *cookie,
     add_casted_stat("ep_defragmenter_num_moved", epstats.defragNumMoved,
                     add_stat, cookie);
 
+    add_casted_stat("ep_ht_resizes_in_progress",
+                    epstats.numHtResizesInProgress, add_stat, cookie);
+    add_casted_stat("ep_ht_resize_buckets_remaining",
+                    epstats.htResizeBucketsRemaining, add_stat, cookie);
+
     add_casted_stat("ep_cursor_dropping_lower_threshold",
                     epstats.cursorDroppingLThreshold, add_stat, cookie);
     add_casted_stat("ep_cursor_dropping_upper_threshold",
                     epstats.cursorDroppingUThreshold, add_stat, cookie);
+    add_casted_stat("ep_checkpoint_memory",
+                    epstats.checkpointMemUsage, add_stat, cookie);
+    add_casted_stat("ep_checkpoint_memory_quota",
+                    epstats.checkpointMemQuota, add_stat, cookie);
     add_casted_stat("ep_cursors_dropped",
                     epstats.cursorsDropped, add_stat, cookie);
 
@@ -3576,6 +3690,18 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doMemoryStats(const void *cookie,
     add_casted_stat("ep_storedval_overhead", "unknown", add_stat, cookie);
 #endif
     add_casted_stat("ep_storedval_num", stats.numStoredVal, add_stat, cookie);
+    add_casted_stat("ep_inline_value_num", stats.numInlineValue,
+                    add_stat, cookie);
+    add_casted_stat("ep_inline_value_overhead_saved",
+                    stats.inlineValueOverheadSaved, add_stat, cookie);
+    const size_t numInline = stats.numInlineValue;
+    add_casted_stat("ep_inline_value_saved_per_item",
+                    numInline ? stats.inlineValueOverheadSaved / numInline : 0,
+                    add_stat, cookie);
+    add_casted_stat("ep_arena_mapped_bytes", stats.arenaMappedBytes,
+                    add_stat, cookie);
+    add_casted_stat("ep_arena_used_bytes", stats.arenaUsedBytes,
+                    add_stat, cookie);
     add_casted_stat("ep_item_num", stats.numItem, add_stat, cookie);
 
     std::map<std::string, size_t> alloc_stats;
@@ -4242,6 +4368,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doTimingStats(const void *cookie,
     add_casted_stat("checkpoint_remover", stats.checkpointRemoverHisto, add_stat, cookie);
     add_casted_stat("item_pager", stats.itemPagerHisto, add_stat, cookie);
     add_casted_stat("expiry_pager", stats.expiryPagerHisto, add_stat, cookie);
+    add_casted_stat("ht_resize_stall", stats.htResizeStallHisto,
+                    add_stat, cookie);
 
     add_casted_stat("storage_age", stats.dirtyAgeHisto, add_stat, cookie);
 
@@ -4271,6 +4399,8 @@ ENGINE_ERROR_CODE EventuallyPersistentEngine::doTimingStats(const void *cookie,
     add_casted_stat("disk_del", stats.diskDelHisto, add_stat, cookie);
     add_casted_stat("disk_vb_del", stats.diskVBDelHisto, add_stat, cookie);
     add_casted_stat("disk_commit", stats.diskCommitHisto, add_stat, cookie);
+    add_casted_stat("disk_commit_docs", stats.diskCommitDocsHisto,
+                    add_stat, cookie);
 
     add_casted_stat("item_alloc_sizes", stats.itemAllocSizeHisto,
                     add_stat, cookie);
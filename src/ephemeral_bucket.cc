@@ -18,6 +18,7 @@
 #include "ephemeral_bucket.h"
 
 #include "ep_engine.h"
+#include "ephemeral_tombstone_purger.h"
 #include "ephemeral_vb.h"
 
 EphemeralBucket::EphemeralBucket(EventuallyPersistentEngine& theEngine)
@@ -29,6 +30,16 @@ EphemeralBucket::EphemeralBucket(EventuallyPersistentEngine& theEngine)
     eviction_policy = VALUE_ONLY;
 }
 
+bool EphemeralBucket::initialize() {
+    KVBucket::initialize();
+
+    ExTask purgerTask =
+            make_STRCPtr<EphemeralTombstonePurgerTask>(&engine, *this);
+    ExecutorPool::get()->schedule(purgerTask, NONIO_TASK_IDX);
+
+    return true;
+}
+
 RCPtr<VBucket> EphemeralBucket::makeVBucket(
         VBucket::id_type id,
         vbucket_state_t state,
@@ -0,0 +1,212 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "ephemeral_tombstone_purger.h"
+
+#include "ep_engine.h"
+#include "ephemeral_vb.h"
+
+#include <phosphor/phosphor.h>
+#include <platform/make_unique.h>
+
+#include <sstream>
+
+// EphemeralTombstonePurgeVisitor implementation //////////////////////////////
+
+EphemeralTombstonePurgeVisitor::EphemeralTombstonePurgeVisitor(
+        KVBucketIface& store, rel_time_t purgeAge)
+    : store(store),
+      purgeAge(purgeAge),
+      now(ep_current_time()),
+      deadline(0),
+      currentVb(nullptr),
+      resume_vbucket_id(0),
+      hashtable_position(),
+      resume_stale_purge(false),
+      purged_tombstone_count(0),
+      purged_stale_count(0),
+      visited_count(0) {
+}
+
+void EphemeralTombstonePurgeVisitor::setDeadline(hrtime_t deadline_) {
+    deadline = deadline_;
+}
+
+bool EphemeralTombstonePurgeVisitor::visit(uint16_t vbucket_id,
+                                           HashTable& ht) {
+    RCPtr<VBucket> vb = store.getVBucket(vbucket_id);
+    if (!vb) {
+        return true;
+    }
+    currentVb = dynamic_cast<EphemeralVBucket*>(vb.get());
+    if (!currentVb) {
+        throw std::logic_error(
+                "EphemeralTombstonePurgeVisitor::visit: vb:" +
+                std::to_string(vbucket_id) + " is not an EphemeralVBucket");
+    }
+
+    // Check if this vbucket_id matches the position we should resume
+    // from. If so then call the visitor using our stored HashTable::Position,
+    // unless it is the purge of the sequence list which paused.
+    HashTable::Position ht_start;
+    bool htVisited = false;
+    if (resume_vbucket_id == vbucket_id) {
+        ht_start = hashtable_position;
+        htVisited = resume_stale_purge;
+    }
+    resume_stale_purge = false;
+
+    if (!htVisited) {
+        hashtable_position = ht.pauseResumeVisit(*this, ht_start);
+        if (hashtable_position != ht.endPosition()) {
+            // We didn't get to the end of this hashtable. Record the
+            // vbucket_id we got to and return false.
+            resume_vbucket_id = vbucket_id;
+            currentVb = nullptr;
+            return false;
+        }
+    }
+
+    // All old tombstones of this vbucket are now stale items of its
+    // sequence list; free them. The list keeps its position if paused.
+    bool paused = false;
+    purged_stale_count += currentVb->purgeStaleItems(deadline, paused);
+    currentVb = nullptr;
+    if (paused) {
+        resume_vbucket_id = vbucket_id;
+        resume_stale_purge = true;
+        return false;
+    }
+    return true;
+}
+
+bool EphemeralTombstonePurgeVisitor::visit(
+        const std::unique_lock<std::mutex>& htLock, StoredValue& v) {
+    ++visited_count;
+
+    if (v.isDeleted() && !v.isTempItem() &&
+        (now - v.toOrderedStoredValue()->getDeletedTime()) >= purgeAge) {
+        currentVb->purgeTombstone(htLock, v);
+        ++purged_tombstone_count;
+    }
+
+    // See if we have done enough work for this chunk. If so stop visiting
+    // (for now).
+    if ((visited_count % DEADLINE_CHECK_INTERVAL) == 0) {
+        return gethrtime() < deadline;
+    }
+    return true;
+}
+
+HashTable::Position EphemeralTombstonePurgeVisitor::getHashtablePosition()
+        const {
+    return hashtable_position;
+}
+
+void EphemeralTombstonePurgeVisitor::clearStats() {
+    purged_tombstone_count = 0;
+    purged_stale_count = 0;
+    visited_count = 0;
+}
+
+size_t EphemeralTombstonePurgeVisitor::getPurgedTombstoneCount() const {
+    return purged_tombstone_count;
+}
+
+size_t EphemeralTombstonePurgeVisitor::getPurgedStaleCount() const {
+    return purged_stale_count;
+}
+
+size_t EphemeralTombstonePurgeVisitor::getVisitedCount() const {
+    return visited_count;
+}
+
+// EphemeralTombstonePurgerTask implementation ////////////////////////////////
+
+EphemeralTombstonePurgerTask::EphemeralTombstonePurgerTask(
+        EventuallyPersistentEngine* e, KVBucketIface& store)
+    : GlobalTask(e,
+                 TaskId::EphemeralTombstonePurgerTask,
+                 e->getConfiguration().getEphemeralMetadataPurgeInterval(),
+                 false),
+      store(store),
+      epstore_position(store.startPosition()) {
+}
+
+bool EphemeralTombstonePurgerTask::run(void) {
+    TRACE_EVENT0("ep-engine/task", "EphemeralTombstonePurgerTask");
+
+    // If we didn't finish the previous pass then resume from where we last
+    // were, otherwise create a new visitor and reset the position.
+    if (!visitor) {
+        visitor = std::make_unique<EphemeralTombstonePurgeVisitor>(
+                store, getPurgeAge());
+        epstore_position = store.startPosition();
+    }
+
+    hrtime_t start = gethrtime();
+    visitor->setDeadline(start + (getChunkDurationMS() * 1000 * 1000));
+    visitor->clearStats();
+
+    epstore_position = store.pauseResumeVisit(*visitor, epstore_position);
+    hrtime_t end = gethrtime();
+
+    bool completed = (epstore_position == store.endPosition());
+
+    std::stringstream ss;
+    ss << getDescription() << " for bucket '" << engine->getName() << "'";
+    if (completed) {
+        ss << " finished.";
+    } else {
+        ss << " paused at position " << epstore_position << ", "
+           << visitor->getHashtablePosition() << ".";
+    }
+    ss << " Took " << (end - start) / 1000 << " us."
+       << " Purged " << visitor->getPurgedTombstoneCount() << "/"
+       << visitor->getVisitedCount() << " visited items, freed "
+       << visitor->getPurgedStaleCount() << " stale items.";
+    LOG(EXTENSION_LOG_INFO, "%s", ss.str().c_str());
+
+    if (completed) {
+        visitor.reset();
+        snooze(getSleepTime());
+    } else {
+        // Resume as soon as other tasks had a chance to run.
+        snooze(0);
+    }
+
+    if (engine->getEpStats().isShutdown) {
+        return false;
+    }
+    return true;
+}
+
+std::string EphemeralTombstonePurgerTask::getDescription() {
+    return std::string("Ephemeral tombstone purger");
+}
+
+size_t EphemeralTombstonePurgerTask::getSleepTime() const {
+    return engine->getConfiguration().getEphemeralMetadataPurgeInterval();
+}
+
+size_t EphemeralTombstonePurgerTask::getPurgeAge() const {
+    return engine->getConfiguration().getEphemeralMetadataPurgeAge();
+}
+
+size_t EphemeralTombstonePurgerTask::getChunkDurationMS() const {
+    return engine->getConfiguration().getEphemeralMetadataPurgeChunkDuration();
+}
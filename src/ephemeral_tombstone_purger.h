@@ -0,0 +1,153 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * Tombstone purging of Ephemeral buckets.
+ *
+ * An Ephemeral bucket has no disk to compact, so deleted items (tombstones)
+ * would stay in memory forever. The EphemeralTombstonePurgerTask periodically
+ * purges the tombstones which are older than ephemeral_metadata_purge_age, in
+ * two phases per vbucket:
+ *
+ * 1. The HashTable is visited and the old enough tombstones are released from
+ *    it into the sequence list as stale items; the vbucket's purge seqno is
+ *    advanced to the highest seqno released, so that DCP clients which have
+ *    not seen a purged deletion are told to roll back.
+ * 2. The stale items of the sequence list are freed.
+ *
+ * Both phases are limited to ephemeral_metadata_purge_chunk_duration per
+ * run; when paused the next run resumes from the same vbucket, at the
+ * HashTable::Position or the sequence list element reached, so HashTable
+ * locks are only ever held for one hash bucket at a time.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include "hash_table.h"
+#include "kv_bucket_iface.h"
+#include "tasks.h"
+
+#include <memory>
+
+class EphemeralVBucket;
+
+/**
+ * Visits the vbuckets of an Ephemeral bucket, purging old tombstones.
+ * Pauses when the deadline is reached, remembering the vbucket and
+ * HashTable position to resume from (its sequence list remembers its own).
+ */
+class EphemeralTombstonePurgeVisitor : public PauseResumeEPStoreVisitor,
+                                       public PauseResumeHashTableVisitor {
+public:
+    /**
+     * @param store the bucket being visited
+     * @param purgeAge minimum age (in seconds) of a tombstone to be purged
+     */
+    EphemeralTombstonePurgeVisitor(KVBucketIface& store, rel_time_t purgeAge);
+
+    // Set the deadline at which point the visitor will pause visiting.
+    void setDeadline(hrtime_t deadline_);
+
+    // Implementation of PauseResumeEPStoreVisitor interface:
+    bool visit(uint16_t vbucket_id, HashTable& ht) override;
+
+    // Implementation of PauseResumeHashTableVisitor interface:
+    bool visit(const std::unique_lock<std::mutex>& htLock,
+               StoredValue& v) override;
+
+    // Returns the current hashtable position.
+    HashTable::Position getHashtablePosition() const;
+
+    // Resets any held stats to zero.
+    void clearStats();
+
+    // Returns the number of tombstones released from hash tables.
+    size_t getPurgedTombstoneCount() const;
+
+    // Returns the number of stale items freed from sequence lists.
+    size_t getPurgedStaleCount() const;
+
+    // Returns the number of items visited.
+    size_t getVisitedCount() const;
+
+private:
+    // Check the deadline every this many visited items.
+    static const size_t DEADLINE_CHECK_INTERVAL = 100;
+
+    KVBucketIface& store;
+
+    // How old a tombstone must be to be purged.
+    const rel_time_t purgeAge;
+
+    // Time the purge started; tombstones are aged relative to it.
+    const rel_time_t now;
+
+    // When to pause visiting.
+    hrtime_t deadline;
+
+    // The vbucket whose HashTable is being visited.
+    EphemeralVBucket* currentVb;
+
+    // When resuming, which vbucket should we start from?
+    uint16_t resume_vbucket_id;
+
+    // When pausing / resuming, hashtable position to use.
+    HashTable::Position hashtable_position;
+
+    // Was the purge of the sequence list (rather than the HashTable visit)
+    // of resume_vbucket_id paused?
+    bool resume_stale_purge;
+
+    /* Statistics */
+    size_t purged_tombstone_count;
+    size_t purged_stale_count;
+    size_t visited_count;
+};
+
+/**
+ * Task which periodically purges old tombstones from the vbuckets of an
+ * Ephemeral bucket. See the top of this file for details.
+ */
+class EphemeralTombstonePurgerTask : public GlobalTask {
+public:
+    EphemeralTombstonePurgerTask(EventuallyPersistentEngine* e,
+                                 KVBucketIface& store);
+
+    bool run(void) override;
+
+    std::string getDescription() override;
+
+private:
+    /// Duration (in seconds) the purger should sleep for between runs.
+    size_t getSleepTime() const;
+
+    /// Minimum age (in seconds) of a tombstone to be purged.
+    size_t getPurgeAge() const;
+
+    /// Upper limit on how long (in ms) each run can visit for.
+    size_t getChunkDurationMS() const;
+
+    KVBucketIface& store;
+
+    // Opaque marker indicating how far through the bucket we have visited.
+    KVBucketIface::Position epstore_position;
+
+    // Visitor of the pass in progress; null between passes.
+    std::unique_ptr<EphemeralTombstonePurgeVisitor> visitor;
+};
@@ -17,6 +17,15 @@
 
 #include "ephemeral_vb.h"
 
+#include "dcp/backfill.h"
+#include "linked_list.h"
+
+#define STATWRITER_NAMESPACE vbucket
+#include "statwriter.h"
+#undef STATWRITER_NAMESPACE
+
+#include <platform/make_unique.h>
+
 EphemeralVBucket::EphemeralVBucket(
         id_type i,
         vbucket_state_t newState,
@@ -46,33 +55,167 @@ EphemeralVBucket::EphemeralVBucket(
               std::move(newSeqnoCb),
               config,
               evictionPolicy,
+              std::make_unique<OrderedStoredValueFactory>(st),
               initState,
               purgeSeqno,
-              maxCas) {}
+              maxCas),
+      seqList(std::make_unique<BasicLinkedList>(i, st)),
+      purgedTombstoneCount(0) {
+}
 
-std::pair<MutationStatus, VBNotifyCtx> EphemeralVBucket::updateStoredValue(
-        const std::unique_lock<std::mutex>& htLock,
-        StoredValue& v,
-        const Item& itm,
-        const VBQueueItemCtx* queueItmCtx) {
+void EphemeralVBucket::clearInMemoryItems() {
     std::lock_guard<std::mutex> lh(sequenceLock);
+    seqList->clear(lh);
+    ht.clear();
+}
+
+bool EphemeralVBucket::clearInMemoryItemsChunk(size_t maxItems) {
+    // The sequence list only links the StoredValues owned by the HashTable
+    // (plus stale items, which it frees); unlink them, a chunk at a time,
+    // before the HashTable starts freeing them.
+    {
+        std::lock_guard<std::mutex> lh(sequenceLock);
+        if (!seqList->clearChunk(lh, maxItems)) {
+            return false;
+        }
+    }
+    return ht.clearChunk(maxItems);
+}
+
+void EphemeralVBucket::addStats(bool details,
+                                ADD_STAT add_stat,
+                                const void* c,
+                                item_eviction_policy_t policy) {
+    VBucket::addStats(details, add_stat, c, policy);
+    if (details) {
+        const std::string prefix("vb_" + std::to_string(getId()));
+        add_prefixed_stat(
+                prefix, "seqlist_count", seqList->getNumItems(), add_stat, c);
+        add_prefixed_stat(prefix,
+                          "seqlist_stale_count",
+                          seqList->getNumStaleItems(),
+                          add_stat,
+                          c);
+        add_prefixed_stat(prefix,
+                          "seqlist_stale_value_bytes",
+                          seqList->getStaleValueBytes(),
+                          add_stat,
+                          c);
+        add_prefixed_stat(prefix,
+                          "seqlist_stale_metadata_bytes",
+                          seqList->getStaleMetadataBytes(),
+                          add_stat,
+                          c);
+        add_prefixed_stat(prefix,
+                          "seqlist_high_seqno",
+                          seqList->getHighSeqno(),
+                          add_stat,
+                          c);
+        add_prefixed_stat(prefix,
+                          "seqlist_highest_deduped_seqno",
+                          seqList->getHighestDedupedSeqno(),
+                          add_stat,
+                          c);
+        add_prefixed_stat(prefix,
+                          "purged_tombstones",
+                          purgedTombstoneCount,
+                          add_stat,
+                          c);
+        add_prefixed_stat(prefix,
+                          "seqlist_range_read_begin",
+                          seqList->getRangeReadBegin(),
+                          add_stat,
+                          c);
+        add_prefixed_stat(prefix,
+                          "seqlist_range_read_end",
+                          seqList->getRangeReadEnd(),
+                          add_stat,
+                          c);
+    }
+}
+
+std::unique_ptr<DCPBackfill> EphemeralVBucket::createDCPBackfill(
+        EventuallyPersistentEngine& e,
+        const stream_t& stream,
+        uint64_t startSeqno,
+        uint64_t endSeqno) {
+    /* Ephemeral vbuckets have no KVStore; backfill from the sequence list */
+    return std::make_unique<DCPBackfillMemory>(
+            &e, stream, startSeqno, endSeqno);
+}
 
-    /* Update the StoredValue in HT + EphemeralVBucket data structure.
-       From the EphemeralVBucket data structure we will know whether to update
-       the current StoredValue or mark the current StoredValue as stale and
-       add a new StoredValue.
-       (Coming soon)
-     */
-    MutationStatus status = ht.unlocked_updateStoredValue(htLock, v, itm);
+uint64_t EphemeralVBucket::getMaxBackfillSeqno(EventuallyPersistentEngine&) {
+    /* Nothing is persisted; everything in memory can be backfilled */
+    return static_cast<uint64_t>(getHighSeqno());
+}
+
+std::pair<ENGINE_ERROR_CODE, std::unique_ptr<SequenceList::RangeIterator>>
+EphemeralVBucket::makeRangeIterator(seqno_t start, seqno_t end) {
+    /* The sequence lock is only held while the list marks the range to be
+       read; makeRangeIterator() releases it before returning */
+    std::unique_lock<std::mutex> lh(sequenceLock);
+    return seqList->makeRangeIterator(lh, start, end);
+}
+
+uint64_t EphemeralVBucket::getNumStaleItems() const {
+    return seqList->getNumStaleItems();
+}
+
+uint64_t EphemeralVBucket::getSeqListNumItems() const {
+    return seqList->getNumItems();
+}
+
+void EphemeralVBucket::purgeTombstone(
+        const std::unique_lock<std::mutex>& htLock, StoredValue& v) {
+    if (!v.isDeleted() || v.isTempItem()) {
+        throw std::invalid_argument(
+                "EphemeralVBucket::purgeTombstone: v (with seqno " +
+                std::to_string(v.getBySeqno()) + ") is not a tombstone");
+    }
+
+    /* A range read may be walking over v; it is only freed once no range
+       read is in progress (see purgeStaleItems()) */
+    std::lock_guard<std::mutex> lh(sequenceLock);
+    const uint64_t seqno = v.getBySeqno();
+    StoredValue* released = ht.unlocked_release(htLock, v.getKey());
+    seqList->markItemStale(lh, released, /*replacement*/ nullptr);
 
-    if (queueItmCtx) {
-        return {status, queueDirty(v, *queueItmCtx)};
+    /* Only the purger moves the purge seqno of an ephemeral vbucket, and it
+       does so under sequenceLock */
+    if (seqno > getPurgeSeqno()) {
+        setPurgeSeqno(seqno);
     }
+    ++purgedTombstoneCount;
+}
 
-    /* PlaceHolder for post seqno generation operation in EphemeralVBucket
-     * data structure
-     */
-    return {status, VBNotifyCtx()};
+size_t EphemeralVBucket::purgeStaleItems(hrtime_t deadline, bool& paused) {
+    return seqList->purgeTombstones(deadline, paused);
+}
+
+std::tuple<StoredValue*, MutationStatus, VBNotifyCtx>
+EphemeralVBucket::updateStoredValue(const std::unique_lock<std::mutex>& htLock,
+                                    StoredValue& v,
+                                    const Item& itm,
+                                    const VBQueueItemCtx* queueItmCtx) {
+    std::lock_guard<std::mutex> lh(sequenceLock);
+
+    /* Temp items are not in the sequence list; once they get a real value
+       they are appended to it */
+    const bool wasTemp = v.isTempItem();
+    StoredValue* newSv = wasTemp ? &v : moveOrReplaceInSeqList(lh, htLock, v);
+
+    MutationStatus status = ht.unlocked_updateStoredValue(htLock, *newSv, itm);
+
+    if (wasTemp) {
+        if (newSv->isTempItem()) {
+            return std::make_tuple(newSv, status, VBNotifyCtx());
+        }
+        seqList->appendToList(lh, *newSv->toOrderedStoredValue());
+    }
+
+    VBNotifyCtx notifyCtx =
+            queueAndUpdateSeqList(lh, *newSv, queueItmCtx, !wasTemp);
+    return std::make_tuple(newSv, status, notifyCtx);
 }
 
 std::pair<StoredValue*, VBNotifyCtx> EphemeralVBucket::addNewStoredValue(
@@ -84,20 +227,17 @@ std::pair<StoredValue*, VBNotifyCtx> EphemeralVBucket::addNewStoredValue(
 
     std::lock_guard<std::mutex> lh(sequenceLock);
 
-    /* Add the newly added stored value to Ephemeral VBucket data structure.
-       (Coming soon)
-     */
-    if (queueItmCtx) {
-        return {v, queueDirty(*v, *queueItmCtx)};
+    /* Temp items (used for meta data lookups) do not have a seqno and are
+       not part of the sequence list */
+    if (v->isTempItem()) {
+        return {v, VBNotifyCtx()};
     }
 
-    /* PlaceHolder for post seqno generation operation in EphemeralVBucket
-     * data structure
-     */
-    return {v, VBNotifyCtx()};
+    seqList->appendToList(lh, *v->toOrderedStoredValue());
+    return {v, queueAndUpdateSeqList(lh, *v, queueItmCtx, false)};
 }
 
-VBNotifyCtx EphemeralVBucket::softDeleteStoredValue(
+std::tuple<StoredValue*, VBNotifyCtx> EphemeralVBucket::softDeleteStoredValue(
         const std::unique_lock<std::mutex>& htLock,
         StoredValue& v,
         bool onlyMarkDeleted,
@@ -105,21 +245,93 @@ VBNotifyCtx EphemeralVBucket::softDeleteStoredValue(
         uint64_t bySeqno) {
     std::lock_guard<std::mutex> lh(sequenceLock);
 
-    /* Soft delete the StoredValue in HT + EphemeralVBucket data structure.
-       From the EphemeralVBucket data structure we will know whether to update
-       (soft delete) the current StoredValue or mark the current StoredValue
-       as stale and add a new softDeleted StoredValue.
-       (Coming soon)
-     */
-    ht.unlocked_softDelete(htLock, v, onlyMarkDeleted);
+    /* Soft delete the StoredValue in HT + sequence list. If a range read is
+       in progress over v then v is left (stale) in the list for the reader
+       and a new, deleted StoredValue is appended instead */
+    const bool wasTemp = v.isTempItem();
+    StoredValue* newSv = wasTemp ? &v : moveOrReplaceInSeqList(lh, htLock, v);
+
+    ht.unlocked_softDelete(htLock, *newSv, onlyMarkDeleted);
 
     if (queueItmCtx.genBySeqno == GenerateBySeqno::No) {
-        v.setBySeqno(bySeqno);
+        newSv->setBySeqno(bySeqno);
+    }
+
+    if (wasTemp) {
+        seqList->appendToList(lh, *newSv->toOrderedStoredValue());
+    }
+
+    return std::make_tuple(
+            newSv, queueAndUpdateSeqList(lh, *newSv, &queueItmCtx, !wasTemp));
+}
+
+bool EphemeralVBucket::deleteStoredValue(
+        const std::unique_lock<std::mutex>& htLock,
+        StoredValue& v,
+        int bucketNum) {
+    if (!v.isDeleted() && v.isLocked(ep_current_time())) {
+        return false;
     }
 
-    return queueDirty(v, queueItmCtx);
+    if (v.isTempItem()) {
+        /* Not in the sequence list, the HashTable owns it alone */
+        return VBucket::deleteStoredValue(htLock, v, bucketNum);
+    }
 
-    /* PlaceHolder for post seqno generation operation in EphemeralVBucket
-     * data structure
-     */
+    /* A range read may be walking over v, hence instead of freeing it we
+       release it from the HashTable and hand its ownership over to the
+       sequence list as a stale item. It is freed when stale items are
+       purged from the list. */
+    std::lock_guard<std::mutex> lh(sequenceLock);
+    StoredValue* released = ht.unlocked_release(htLock, v.getKey());
+    seqList->markItemStale(lh, released, /*replacement*/ nullptr);
+    return true;
+}
+
+StoredValue* EphemeralVBucket::moveOrReplaceInSeqList(
+        std::lock_guard<std::mutex>& seqLock,
+        const std::unique_lock<std::mutex>& htLock,
+        StoredValue& v) {
+    OrderedStoredValue& osv = *v.toOrderedStoredValue();
+    if (seqList->updateListElem(seqLock, osv) ==
+        SequenceList::UpdateStatus::Success) {
+        return &v;
+    }
+
+    /* A range read covers v; v must not be modified. Replace it in the
+       HashTable by a copy, and let the list own v as a stale item which
+       points to its replacement */
+    StoredValue* newSv;
+    StoredValue* oldSv;
+    std::tie(newSv, oldSv) = ht.unlocked_replaceByCopy(htLock, v);
+    seqList->markItemStale(seqLock, oldSv, newSv);
+    seqList->appendToList(seqLock, *newSv->toOrderedStoredValue());
+    return newSv;
+}
+
+VBNotifyCtx EphemeralVBucket::queueAndUpdateSeqList(
+        std::lock_guard<std::mutex>& seqLock,
+        StoredValue& v,
+        const VBQueueItemCtx* queueItmCtx,
+        bool isUpdate) {
+    if (v.isDeleted()) {
+        /* Start the clock of the tombstone purger */
+        v.toOrderedStoredValue()->setDeletedTime(ep_current_time());
+    }
+
+    if (!queueItmCtx) {
+        return VBNotifyCtx();
+    }
+
+    /* The seqno of v is generated (or set) while queueing; the list is
+       told about it afterwards, still under the sequence lock */
+    VBNotifyCtx notifyCtx = queueDirty(v, *queueItmCtx);
+
+    const OrderedStoredValue& osv = *v.toOrderedStoredValue();
+    seqList->updateHighSeqno(seqLock, osv);
+    if (isUpdate) {
+        /* An older version of the item was de-duplicated by this one */
+        seqList->updateHighestDedupedSeqno(seqLock, osv);
+    }
+    return notifyCtx;
 }
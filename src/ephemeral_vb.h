@@ -19,6 +19,7 @@
 
 #include "config.h"
 
+#include "seqlist.h"
 #include "vbucket.h"
 
 class EphemeralVBucket : public VBucket {
@@ -39,8 +40,78 @@ public:
                      uint64_t purgeSeqno = 0,
                      uint64_t maxCas = 0);
 
+    void clearInMemoryItems() override;
+
+    bool clearInMemoryItemsChunk(size_t maxItems) override;
+
+    std::unique_ptr<DCPBackfill> createDCPBackfill(
+            EventuallyPersistentEngine& e,
+            const stream_t& stream,
+            uint64_t startSeqno,
+            uint64_t endSeqno) override;
+
+    uint64_t getMaxBackfillSeqno(EventuallyPersistentEngine& e) override;
+
+    void addStats(bool details,
+                  ADD_STAT add_stat,
+                  const void* c,
+                  item_eviction_policy_t policy) override;
+
+    /**
+     * Starts reading backfill items from the in memory ordered data
+     * structure; the items are then read one at a time from the returned
+     * iterator, which must not outlive the vbucket.
+     *
+     * Because the backfill may have to extend the range to be consistent,
+     * the actual snapshot end is given by the iterator.
+     *
+     * @param start seqno from which the backfill items are needed
+     * @param end seqno up to which the backfill items are needed
+     *
+     * @return ENGINE_SUCCESS and the iterator on success; otherwise an
+     *         error code (ENGINE_TMPFAIL if another backfill is reading
+     *         the vbucket).
+     */
+    std::pair<ENGINE_ERROR_CODE, std::unique_ptr<SequenceList::RangeIterator>>
+    makeRangeIterator(seqno_t start, seqno_t end);
+
+    /**
+     * Returns the number of stale (superseded but not yet freed) items in
+     * the sequence list.
+     */
+    uint64_t getNumStaleItems() const;
+
+    /**
+     * Returns the number of items (stale ones included) linked in the
+     * sequence list.
+     */
+    uint64_t getSeqListNumItems() const;
+
+    /**
+     * Purges the tombstone v from the HashTable. The tombstone is handed
+     * over to the sequence list as a stale item (it is freed by the next
+     * purgeStaleItems()), and the purge seqno of the vbucket is advanced to
+     * the seqno of the tombstone so that DCP clients which have not yet seen
+     * the deletion roll back.
+     *
+     * @param htLock the HashTable lock of the bucket containing v
+     * @param v the deleted (non-temp) StoredValue to purge
+     */
+    void purgeTombstone(const std::unique_lock<std::mutex>& htLock,
+                        StoredValue& v);
+
+    /**
+     * Frees the stale items of the sequence list, pausing at the deadline;
+     * the next call resumes from where it paused.
+     *
+     * @param deadline when (as per gethrtime()) to pause
+     * @param[out] paused set to true if the list was not walked to its end
+     * @return the number of items freed
+     */
+    size_t purgeStaleItems(hrtime_t deadline, bool& paused);
+
 private:
-    std::pair<MutationStatus, VBNotifyCtx> updateStoredValue(
+    std::tuple<StoredValue*, MutationStatus, VBNotifyCtx> updateStoredValue(
             const std::unique_lock<std::mutex>& htLock,
             StoredValue& v,
             const Item& itm,
@@ -52,13 +123,47 @@ private:
             const VBQueueItemCtx* queueItmCtx,
             int bucketNum) override;
 
-    VBNotifyCtx softDeleteStoredValue(
+    std::tuple<StoredValue*, VBNotifyCtx> softDeleteStoredValue(
             const std::unique_lock<std::mutex>& htLock,
             StoredValue& v,
             bool onlyMarkDeleted,
             const VBQueueItemCtx& queueItmCtx,
             uint64_t bySeqno) override;
 
+    bool deleteStoredValue(const std::unique_lock<std::mutex>& htLock,
+                           StoredValue& v,
+                           int bucketNum) override;
+
+    /**
+     * Moves v to the end of the sequence list, or (if a range read currently
+     * covers v) replaces v in the HashTable by a copy which is appended to
+     * the list, leaving v in the list as a stale item.
+     * Caller must hold sequenceLock and the HT bucket lock.
+     *
+     * @return the StoredValue which must now be updated
+     */
+    StoredValue* moveOrReplaceInSeqList(
+            std::lock_guard<std::mutex>& seqLock,
+            const std::unique_lock<std::mutex>& htLock,
+            StoredValue& v);
+
+    /**
+     * Queues v in the checkpoint (if queueItmCtx is given) and updates the
+     * seqnos tracked by the sequence list. If v is deleted its deletion time
+     * is recorded for the tombstone purger.
+     * Caller must hold sequenceLock and the HT bucket lock.
+     */
+    VBNotifyCtx queueAndUpdateSeqList(std::lock_guard<std::mutex>& seqLock,
+                                      StoredValue& v,
+                                      const VBQueueItemCtx* queueItmCtx,
+                                      bool isUpdate);
+
+    /* Data structure for in-memory sequential storage */
+    std::unique_ptr<SequenceList> seqList;
+
+    /* Count of tombstones purged from the HashTable */
+    std::atomic<uint64_t> purgedTombstoneCount;
+
     /**
      * Lock to synchronize order of bucket elements.
      * The sequence number is not generated in EphemeralVBucket for now. It is
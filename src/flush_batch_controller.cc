@@ -0,0 +1,144 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "flush_batch_controller.h"
+
+#include <algorithm>
+
+const size_t FlushBatchController::minItems;
+const size_t FlushBatchController::minBytes;
+const size_t FlushBatchController::backlogAgeFactor;
+
+/* Weight of the latest commit in the latency moving average. */
+static const double latencyAvgWeight = 0.25;
+
+/* The limits grow by this fraction of their max per commit. */
+static const size_t increaseSteps = 32;
+
+FlushBatchController::FlushBatchController(
+        std::chrono::milliseconds latencyTarget,
+        size_t maxItems,
+        size_t maxBytes)
+    : latencyTargetMs(latencyTarget.count()),
+      maxItems(maxItems),
+      maxBytes(maxBytes),
+      itemLimit(0),
+      byteLimit(0),
+      latencyAvgUs(0),
+      limitedBatches(0),
+      limitedSinceCommit(false),
+      oldestAgeSinceCommit(0) {
+    std::lock_guard<std::mutex> lh(mutex);
+    reset_UNLOCKED();
+}
+
+void FlushBatchController::setLatencyTarget(
+        std::chrono::milliseconds target) {
+    std::lock_guard<std::mutex> lh(mutex);
+    latencyTargetMs = target.count();
+    reset_UNLOCKED();
+}
+
+void FlushBatchController::setMaxItems(size_t newMaxItems) {
+    std::lock_guard<std::mutex> lh(mutex);
+    maxItems = newMaxItems;
+    reset_UNLOCKED();
+}
+
+void FlushBatchController::setMaxBytes(size_t newMaxBytes) {
+    std::lock_guard<std::mutex> lh(mutex);
+    maxBytes = newMaxBytes;
+    reset_UNLOCKED();
+}
+
+size_t FlushBatchController::getItemLimit() const {
+    return latencyTargetMs == 0 ? 0 : itemLimit.load();
+}
+
+size_t FlushBatchController::getByteLimit() const {
+    return latencyTargetMs == 0 ? 0 : byteLimit.load();
+}
+
+void FlushBatchController::batchFlushed(bool limited,
+                                        std::chrono::seconds oldestAge) {
+    std::lock_guard<std::mutex> lh(mutex);
+    if (limited) {
+        limitedSinceCommit = true;
+        ++limitedBatches;
+    }
+    oldestAgeSinceCommit = std::max(oldestAgeSinceCommit, oldestAge);
+}
+
+void FlushBatchController::commitCompleted(
+        std::chrono::microseconds latency) {
+    std::lock_guard<std::mutex> lh(mutex);
+    const bool limited = limitedSinceCommit;
+    const auto oldestAge = oldestAgeSinceCommit;
+    limitedSinceCommit = false;
+    oldestAgeSinceCommit = std::chrono::seconds(0);
+
+    double avg = latencyAvgUs;
+    if (avg == 0) {
+        avg = latency.count();
+    } else {
+        avg += latencyAvgWeight * (latency.count() - avg);
+    }
+    latencyAvgUs = static_cast<size_t>(avg);
+
+    if (latencyTargetMs == 0) {
+        return;
+    }
+
+    const std::chrono::microseconds target =
+            std::chrono::milliseconds(latencyTargetMs.load());
+    const bool aging = oldestAge > backlogAgeFactor * target;
+
+    double items = itemLimit;
+    double bytes = byteLimit;
+    if (avg > target.count()) {
+        if (aging) {
+            return;
+        }
+        const double factor = std::max(0.5, target.count() / avg);
+        items *= factor;
+        bytes *= factor;
+    } else if (limited) {
+        if (aging) {
+            items *= 2;
+            bytes *= 2;
+        } else {
+            items += std::max(minItems, maxItems / increaseSteps);
+            bytes += std::max(minBytes, maxBytes / increaseSteps);
+        }
+    } else {
+        return;
+    }
+
+    itemLimit = std::min(std::max(size_t(items), minItems),
+                         std::max(maxItems, minItems));
+    byteLimit = std::min(std::max(size_t(bytes), minBytes),
+                         std::max(maxBytes, minBytes));
+}
+
+void FlushBatchController::reset_UNLOCKED() {
+    itemLimit = std::max(maxItems, minItems);
+    byteLimit = std::max(maxBytes, minBytes);
+    limitedSinceCommit = false;
+    oldestAgeSinceCommit = std::chrono::seconds(0);
+}
@@ -0,0 +1,123 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+/**
+ * Bucket-wide controller of the size of the batches the flushers read from
+ * the persistence cursor, aiming for a commit latency target
+ * (flusher_commit_latency_target).
+ *
+ * Each flusher asks for the item and byte limits before reading a batch
+ * (getItemLimit() / getByteLimit(), 0 meaning unlimited), reports what it
+ * read (batchFlushed()) and the latency of the resulting commit
+ * (commitCompleted()). The limits then follow an AIMD scheme on a moving
+ * average of the commit latency:
+ * - above the target, they shrink in proportion (at most halving per
+ *   commit), unless the disk queue is aging: once the oldest item flushed
+ *   has waited more than backlogAgeFactor times the target, smaller batches
+ *   would only make writes wait longer for the flusher;
+ * - at or below the target, they grow by a fixed step if a batch was cut
+ *   short since the previous commit, doubling instead while the disk queue
+ *   is aging;
+ * all within [min, max] bounds, the max ones being configured
+ * (flusher_batch_max_items / flusher_batch_max_bytes) and the starting point.
+ *
+ * With no target (0) the limits are disabled; the latency average is still
+ * maintained for the stats.
+ *
+ * Thread safe: the flushers of all the shards share the controller.
+ */
+class FlushBatchController {
+public:
+    //! A batch is never limited below these sizes.
+    static const size_t minItems = 100;
+    static const size_t minBytes = 256 * 1024;
+
+    //! The disk queue is aging once its oldest flushed item has waited this
+    //! many times the latency target.
+    static const size_t backlogAgeFactor = 4;
+
+    FlushBatchController(std::chrono::milliseconds latencyTarget,
+                         size_t maxItems,
+                         size_t maxBytes);
+
+    /// Change the latency target, restarting from the max limits.
+    void setLatencyTarget(std::chrono::milliseconds target);
+
+    void setMaxItems(size_t maxItems);
+
+    void setMaxBytes(size_t maxBytes);
+
+    /// Items to read for the next batch (0: unlimited).
+    size_t getItemLimit() const;
+
+    /// Bytes to read for the next batch (0: unlimited).
+    size_t getByteLimit() const;
+
+    /**
+     * A batch was read from the persistence cursor.
+     *
+     * @param limited true if the batch stopped at the limits with more items
+     *        left to read.
+     * @param oldestAge how long the oldest item of the batch was queued for.
+     */
+    void batchFlushed(bool limited, std::chrono::seconds oldestAge);
+
+    /// A commit of the batch(es) flushed since the previous one completed.
+    void commitCompleted(std::chrono::microseconds latency);
+
+    std::chrono::milliseconds getLatencyTarget() const {
+        return std::chrono::milliseconds(latencyTargetMs.load());
+    }
+
+    /// Moving average of the commit latency.
+    std::chrono::microseconds getLatencyAverage() const {
+        return std::chrono::microseconds(latencyAvgUs.load());
+    }
+
+    /// Number of batches cut short by the limits.
+    size_t getLimitedBatches() const {
+        return limitedBatches.load();
+    }
+
+private:
+    void reset_UNLOCKED();
+
+    mutable std::mutex mutex;
+
+    std::atomic<size_t> latencyTargetMs;
+    size_t maxItems;
+    size_t maxBytes;
+
+    std::atomic<size_t> itemLimit;
+    std::atomic<size_t> byteLimit;
+
+    std::atomic<size_t> latencyAvgUs;
+    std::atomic<size_t> limitedBatches;
+
+    //! Feedback gathered since the previous commit.
+    bool limitedSinceCommit;
+    std::chrono::seconds oldestAgeSinceCommit;
+};
@@ -134,7 +134,8 @@ void Flusher::schedule_UNLOCKED() {
     ExecutorPool* iom = ExecutorPool::get();
     ExTask task = new FlusherTask(ObjectRegistry::getCurrentEngine(),
                                   this,
-                                  shard->getId());
+                                  shard->getId(),
+                                  writerId);
     this->setTaskId(task->getId());
     iom->schedule(task, WRITER_TASK_IDX);
 }
@@ -185,7 +186,7 @@ bool Flusher::step(GlobalTask *task) {
         if (_state == running) {
             double tosleep = computeMinSleepTime();
             if (tosleep > 0) {
-                store->commit(shard->getId());
+                store->commit(shard->getId(), writerId);
                 resetCommitInterval();
                 task->snooze(tosleep);
             }
@@ -200,7 +201,7 @@ bool Flusher::step(GlobalTask *task) {
             LOG(EXTENSION_LOG_DEBUG, "%s", ss.str().c_str());
         }
         completeFlush();
-        store->commit(shard->getId());
+        store->commit(shard->getId(), writerId);
         resetCommitInterval();
         LOG(EXTENSION_LOG_DEBUG, "Flusher stopped");
         transition_state(stopped);
@@ -217,6 +218,8 @@ bool Flusher::step(GlobalTask *task) {
 }
 
 void Flusher::completeFlush() {
+    // Nothing is held back once stopping (see deferFlush()).
+    requeueDeferred(true);
     while(!canSnooze()) {
         flushVB();
     }
@@ -228,7 +231,60 @@ double Flusher::computeMinSleepTime() {
         return 0;
     }
     minSleepTime *= 2;
-    return std::min(minSleepTime, DEFAULT_MAX_SLEEP_TIME);
+    double tosleep = std::min(minSleepTime, DEFAULT_MAX_SLEEP_TIME);
+
+    if (!deferredVbs.empty()) {
+        // Wake up in time to flush the first held back vbucket.
+        const std::chrono::milliseconds delay(batchDeferDelay.load());
+        auto first = deferredVbs.begin()->second;
+        for (const auto& deferred : deferredVbs) {
+            first = std::min(first, deferred.second);
+        }
+        const std::chrono::duration<double> remaining =
+                first + delay - ProcessClock::now();
+        tosleep = std::min(tosleep, std::max(remaining.count(), 0.0));
+    }
+    return tosleep;
+}
+
+bool Flusher::deferFlush(uint16_t vbid) {
+    const size_t delayMs = batchDeferDelay.load();
+    if (delayMs == 0 || _state != running) {
+        deferredVbs.erase(vbid);
+        return false;
+    }
+
+    RCPtr<VBucket> vb = store->getVBucket(vbid);
+    if (!vb || vb->getHighPriorityChkSize() > 0) {
+        deferredVbs.erase(vbid);
+        return false;
+    }
+
+    const size_t dirty = vb->checkpointManager.getNumItemsForCursor(
+            CheckpointManager::pCursorName);
+    if (dirty == 0 || dirty >= batchDeferItems.load() ||
+        !vb->rejectQueue.empty()) {
+        deferredVbs.erase(vbid);
+        return false;
+    }
+
+    const auto now = ProcessClock::now();
+    auto it = deferredVbs.emplace(vbid, now).first;
+    if (now - it->second >= std::chrono::milliseconds(delayMs)) {
+        deferredVbs.erase(it);
+        return false;
+    }
+    return true;
+}
+
+void Flusher::requeueDeferred(bool all) {
+    const auto now = ProcessClock::now();
+    const std::chrono::milliseconds delay(batchDeferDelay.load());
+    for (const auto& deferred : deferredVbs) {
+        if (all || now - deferred.second >= delay) {
+            lpVbs.push(deferred.first);
+        }
+    }
 }
 
 uint16_t Flusher::decrCommitInterval(void) {
@@ -244,8 +300,9 @@ uint16_t Flusher::decrCommitInterval(void) {
 }
 
 void Flusher::flushVB(void) {
-    if (store->isDeleteAllScheduled() && shard->getId() != EP_PRIMARY_SHARD) {
-        // another shard is doing disk flush
+    if (store->isDeleteAllScheduled() &&
+        (shard->getId() != EP_PRIMARY_SHARD || writerId != 0)) {
+        // another shard (or writer) is doing disk flush
         bool inverse = false;
         pendingMutation.compare_exchange_strong(inverse, true);
         return;
@@ -258,13 +315,20 @@ void Flusher::flushVB(void) {
         bool inverse = true;
         if (pendingMutation.compare_exchange_strong(inverse, false)) {
             for (auto vbid : shard->getVBucketsSortedByState()) {
-                lpVbs.push(vbid);
+                if (shard->getWriterId(vbid) == writerId) {
+                    lpVbs.push(vbid);
+                }
             }
+        } else {
+            requeueDeferred(false);
         }
     }
 
     if (!doHighPriority && shard->highPriorityCount.load() > 0) {
         for (auto vbid : shard->getVBuckets()) {
+            if (shard->getWriterId(vbid) != writerId) {
+                continue;
+            }
             RCPtr<VBucket> vb = store->getVBucket(vbid);
             if (vb && vb->getHighPriorityChkSize() > 0) {
                 hpVbs.push(vbid);
@@ -277,7 +341,9 @@ void Flusher::flushVB(void) {
     }
 
     if (hpVbs.empty() && lpVbs.empty()) {
-        LOG(EXTENSION_LOG_INFO, "Trying to flush but no vbucket exist");
+        if (deferredVbs.empty()) {
+            LOG(EXTENSION_LOG_INFO, "Trying to flush but no vbucket exist");
+        }
         return;
     } else if (!hpVbs.empty()) {
         uint16_t vbid = hpVbs.front();
@@ -291,6 +357,9 @@ void Flusher::flushVB(void) {
         }
         uint16_t vbid = lpVbs.front();
         lpVbs.pop();
+        if (deferFlush(vbid)) {
+            return;
+        }
         if (store->flushVBucket(vbid) == RETRY_FLUSH_VBUCKET) {
             lpVbs.push(vbid);
         }
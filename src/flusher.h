@@ -20,6 +20,8 @@
 
 #include "config.h"
 
+#include <platform/processclock.h>
+
 #include <list>
 #include <map>
 #include <queue>
@@ -54,11 +56,18 @@ class KVShard;
 class Flusher {
 public:
 
-    Flusher(KVBucket* st, KVShard* k, uint16_t commitInt) :
+    /**
+     * @param writer the writer of the shard this flusher is: it only
+     *        flushes the vbuckets of the shard owned by that writer
+     *        (see KVShard::getWriterId()).
+     */
+    Flusher(KVBucket* st, KVShard* k, uint16_t commitInt,
+            size_t writer = 0) :
         store(st), _state(initializing), taskId(0), minSleepTime(0.1),
         initCommitInterval(commitInt), currCommitInterval(commitInt),
         forceShutdownReceived(false), doHighPriority(false), numHighPriority(0),
-        pendingMutation(false), shard(k) { }
+        pendingMutation(false), batchDeferDelay(0), batchDeferItems(0),
+        shard(k), writerId(writer) { }
 
     ~Flusher() {
         if (_state != stopped) {
@@ -90,6 +99,10 @@ public:
     }
     void setTaskId(size_t newId) { taskId = newId; }
 
+    size_t getWriterId() const {
+        return writerId;
+    }
+
     uint16_t getCommitInterval(void) {
         return currCommitInterval;
     }
@@ -100,6 +113,24 @@ public:
         currCommitInterval = initCommitInterval;
     }
 
+    /**
+     * Batching deferral: a vbucket with fewer than batchDeferItems items to
+     * persist (and nobody waiting for their persistence) is held back for
+     * up to delayMs milliseconds, so that more items are written by its
+     * next batch (and fewer commits are made). Each vbucket is still
+     * committed on its own. A delay of 0 flushes vbuckets as soon as they
+     * are dirty.
+     */
+    void setBatchDeferDelay(size_t delayMs) {
+        batchDeferDelay = delayMs;
+        wake();
+    }
+
+    void setBatchDeferItems(size_t items) {
+        batchDeferItems = items;
+        wake();
+    }
+
 private:
     bool transition_state(enum flusher_state to);
     void flushVB();
@@ -108,6 +139,13 @@ private:
     void schedule_UNLOCKED();
     double computeMinSleepTime();
 
+    /// True if the (low priority) vbucket should be held back to batch more
+    /// items rather than flushed now.
+    bool deferFlush(uint16_t vbid);
+
+    /// Queue again the held back vbuckets whose delay expired (or all).
+    void requeueDeferred(bool all);
+
     const char * stateName(enum flusher_state st) const;
 
     bool canSnooze(void) {
@@ -132,7 +170,13 @@ private:
     size_t numHighPriority;
     std::atomic<bool> pendingMutation;
 
+    std::atomic<size_t> batchDeferDelay;
+    std::atomic<size_t> batchDeferItems;
+    //! vbuckets held back to batch more items, with when they first were.
+    std::map<uint16_t, ProcessClock::time_point> deferredVbs;
+
     KVShard *shard;
+    const size_t writerId;
 
     DISALLOW_COPY_AND_ASSIGN(Flusher);
 };
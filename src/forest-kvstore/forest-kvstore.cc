@@ -2048,6 +2048,7 @@ extern "C" {
         ForestStatFile *fsf = reinterpret_cast<ForestStatFile *>(fops_handle);
 
         if (fsf) {
+            ++fsf->fs_stats->totalReads;
             fsf->fs_stats->readSizeHisto.add(count);
             if (fsf->last_offs) {
                 fsf->fs_stats->readSeekHisto.add(std::abs(offset - fsf->last_offs));
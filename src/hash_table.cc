@@ -17,7 +17,13 @@
 
 #include "hash_table.h"
 
+#include "slab_arena.h"
+
+#include <platform/make_unique.h>
+
+#include <cstdint>
 #include <cstring>
+#include <new>
 
 #ifndef DEFAULT_HT_SIZE
 #define DEFAULT_HT_SIZE 1531
@@ -25,6 +31,8 @@
 
 size_t HashTable::defaultNumBuckets = DEFAULT_HT_SIZE;
 size_t HashTable::defaultNumLocks = 193;
+thread_local size_t HashTable::sharedHolds = 0;
+const size_t HashTable::resizeStepBuckets;
 
 static ssize_t prime_size_table[] = {
     3, 7, 13, 23, 47, 97, 193, 383, 769, 1531, 3079, 6143, 12289, 24571, 49157,
@@ -39,7 +47,26 @@ std::ostream& operator<<(std::ostream& os, const HashTable::Position& pos) {
     return os;
 }
 
+HashTable::Layout HashTable::layoutFromString(const std::string& name) {
+    if (name == "chained") {
+        return Layout::Chained;
+    } else if (name == "bucketized") {
+        return Layout::Bucketized;
+    }
+    throw std::invalid_argument("HashTable::layoutFromString: unknown layout '" +
+                                name + "'");
+}
+
 HashTable::HashTable(EPStats &st, size_t s, size_t l)
+    : HashTable(st, std::make_unique<StoredValueFactory>(st), s, l) {
+}
+
+HashTable::HashTable(EPStats& st,
+                     std::unique_ptr<AbstractStoredValueFactory> svFactory,
+                     size_t s,
+                     size_t l,
+                     Layout layout,
+                     bool arenaAllocation)
     : maxDeletedRevSeqno(0),
       numTotalItems(0),
       numNonResidentItems(0),
@@ -48,16 +75,35 @@ HashTable::HashTable(EPStats &st, size_t s, size_t l)
       cacheSize(0),
       metaDataMemory(0),
       stats(st),
-      valFact(st),
+      valFact(std::move(svFactory)),
       visitors(0),
       numItems(0),
       numResizes(0),
-      numTempItems(0)
+      numTempItems(0),
+      index(nullptr),
+      indexAlloc(nullptr),
+      newValues(nullptr),
+      newSize(0),
+      migrated(0),
+      newIndex(nullptr),
+      newIndexAlloc(nullptr),
+      arena(arenaAllocation ? std::make_unique<SlabArena>(st) : nullptr),
+      clearPosition(0)
 {
+    static_assert(sizeof(BucketIndex) == 64,
+                  "BucketIndex should occupy exactly one cache line");
+
     size = HashTable::getNumBuckets(s);
     n_locks = HashTable::getNumLocks(l);
     values = static_cast<StoredValue**>(cb_calloc(size, sizeof(StoredValue*)));
+    if (layout == Layout::Bucketized) {
+        index = allocateIndex(size, indexAlloc);
+        if (!index) {
+            throw std::bad_alloc();
+        }
+    }
     mutexes = new std::mutex[n_locks];
+    readers = new cb::CachelinePadded<StripeReaders>[n_locks];
     activeState = true;
 }
 
@@ -72,8 +118,11 @@ HashTable::~HashTable() {
 #endif
     }
     delete []mutexes;
+    delete []readers;
     cb_free(values);
     values = NULL;
+    cb_free(indexAlloc);
+    index = nullptr;
 }
 
 void HashTable::clear(bool deactivate) {
@@ -87,16 +136,32 @@ void HashTable::clear(bool deactivate) {
         }
     }
     MultiLockHolder mlh(mutexes, n_locks);
+    drainAllReaders();
     if (deactivate) {
         setActiveState(false);
     }
+
+    // If every object of the arena is in this table (none have been
+    // released to someone else), destroy them in place and free the whole
+    // arena at once instead of returning them one by one.
+    const bool releaseArena =
+            arena && arena->getNumObjects() == countArenaAllocated();
+
     for (int i = 0; i < (int)size; i++) {
-        while (values[i]) {
-            StoredValue *v = values[i];
-            rv.visit(v);
-            values[i] = v->next;
-            delete v;
+        deleteChain(values[i], rv, releaseArena);
+    }
+    if (index) {
+        std::memset(index, 0, size * sizeof(BucketIndex));
+    }
+    if (isResizing()) {
+        // Nothing left to migrate; keep the current bucket array.
+        for (size_t i = 0; i < newSize; i++) {
+            deleteChain(newValues[i], rv, releaseArena);
         }
+        abandonResize();
+    }
+    if (releaseArena) {
+        arena->releaseAll();
     }
 
     stats.currentSize.fetch_sub(rv.memSize - rv.valSize);
@@ -109,6 +174,95 @@ void HashTable::clear(bool deactivate) {
     cacheSize.store(0);
 }
 
+void HashTable::deleteChain(StoredValue*& head,
+                            HashTableStatVisitor& rv,
+                            bool releaseArena) {
+    while (head) {
+        StoredValue* v = head;
+        rv.visit(v);
+        head = v->next;
+        if (releaseArena && v->isArenaAllocated()) {
+            // The memory goes with the arena.
+            v->~StoredValue();
+        } else {
+            StoredValue::destroy(v);
+        }
+    }
+}
+
+bool HashTable::clearChunk(size_t maxItems) {
+    MultiLockHolder mlh(mutexes, n_locks);
+    drainAllReaders();
+
+    // Buckets are numbered as by chainHead(): those of values, followed by
+    // those of newValues if a resize is in progress.
+    const size_t numBuckets = size + newSize;
+    size_t freed = 0;
+    while (freed < maxItems && clearPosition < numBuckets) {
+        StoredValue*& head = chainHead(clearPosition);
+        while (head) {
+            StoredValue* v = head;
+            head = v->next;
+            accountRemoval(*v);
+            StoredValue::destroy(v);
+            ++freed;
+        }
+        if (index) {
+            std::memset(&bucketIndex(clearPosition), 0, sizeof(BucketIndex));
+        }
+        ++clearPosition;
+    }
+
+    if (clearPosition < numBuckets) {
+        return false;
+    }
+    clearPosition = 0;
+    if ((numItems.load() + numTempItems.load()) > 0) {
+        // A resize step between two chunks moved items behind our
+        // position; go round again.
+        return false;
+    }
+
+    if (isResizing()) {
+        abandonResize();
+    }
+    if (arena && arena->getNumObjects() == 0) {
+        // Every object is back on a free list; give the slabs back.
+        arena->releaseAll();
+    }
+    numNonResidentItems.store(0);
+    return true;
+}
+
+void HashTable::accountRemoval(StoredValue& v) {
+    StoredValue::reduceCacheSize(*this, v.size());
+    StoredValue::reduceMetaDataSize(*this, stats, v.metaDataSize());
+    if (v.isTempItem()) {
+        --numTempItems;
+    } else {
+        decrNumItems();
+        decrNumTotalItems();
+    }
+}
+
+size_t HashTable::countArenaAllocated() {
+    size_t count = 0;
+    const auto countChain = [&count](StoredValue* v) {
+        for (; v; v = v->next) {
+            if (v->isArenaAllocated()) {
+                ++count;
+            }
+        }
+    };
+    for (size_t i = 0; i < size; i++) {
+        countChain(values[i]);
+    }
+    for (size_t i = 0; i < newSize; i++) {
+        countChain(newValues[i]);
+    }
+    return count;
+}
+
 static size_t distance(size_t a, size_t b) {
     return std::max(a, b) - std::min(a, b);
 }
@@ -153,66 +307,169 @@ void HashTable::resize() {
     resize(new_size);
 }
 
-void HashTable::resize(size_t newSize) {
+void HashTable::resize(size_t to) {
+    std::lock_guard<std::mutex> rlh(resizeLock);
+
+    // Finish off a resize which a previous call could not complete.
+    while (isResizing()) {
+        if (!resizeStep()) {
+            return;
+        }
+    }
+
+    if (!startResize(to)) {
+        return;
+    }
+
+    // Migrate the buckets a step at a time, releasing all locks in between
+    // so front-end operations only ever wait for a single step.
+    while (isResizing()) {
+        if (!resizeStep()) {
+            return;
+        }
+    }
+}
+
+bool HashTable::startResize(size_t to) {
     if (!isActive()) {
-        throw std::logic_error("HashTable::resize: Cannot call on a "
+        throw std::logic_error("HashTable::startResize: Cannot call on a "
                 "non-active object");
     }
 
     // Due to the way hashing works, we can't fit anything larger than
     // an int.
-    if (newSize > static_cast<size_t>(std::numeric_limits<int>::max())) {
-        return;
+    if (to > static_cast<size_t>(std::numeric_limits<int>::max())) {
+        return false;
     }
 
     // Don't resize to the same size, either.
-    if (newSize == size) {
-        return;
+    if (to == size) {
+        return false;
     }
 
     MultiLockHolder mlh(mutexes, n_locks);
-    if (visitors.load() > 0) {
+    if (visitors.load() > 0 || isResizing()) {
         // Do not allow a resize while any visitors are actually
         // processing.  The next attempt will have to pick it up.  New
         // visitors cannot start doing meaningful work (we own all
         // locks at this point).
-        return;
+        return false;
     }
 
     // Get a place for the new items.
-    StoredValue **newValues = static_cast<StoredValue**>(cb_calloc(newSize,
-                                                        sizeof(StoredValue*)));
+    StoredValue** nv =
+            static_cast<StoredValue**>(cb_calloc(to, sizeof(StoredValue*)));
     // If we can't allocate memory, don't move stuff around.
-    if (!newValues) {
-        return;
+    if (!nv) {
+        return false;
+    }
+    BucketIndex* ni = nullptr;
+    void* niAlloc = nullptr;
+    if (index) {
+        ni = allocateIndex(to, niAlloc);
+        if (!ni) {
+            cb_free(nv);
+            return false;
+        }
     }
 
     stats.memOverhead->fetch_sub(memorySize());
-    ++numResizes;
+    newValues = nv;
+    newIndex = ni;
+    newIndexAlloc = niAlloc;
+    migrated.store(0);
+    newSize.store(to);
+    stats.memOverhead->fetch_add(memorySize());
+
+    ++stats.numHtResizesInProgress;
+    stats.htResizeBucketsRemaining.fetch_add(size);
+    return true;
+}
 
-    // Set the new size so all the hashy stuff works.
-    size_t oldSize = size;
-    size.store(newSize);
+bool HashTable::resizeStep() {
+    MultiLockHolder mlh(mutexes, n_locks);
+    if (!isResizing() || visitors.load() > 0) {
+        // Visitors only register with no resize in progress, but never
+        // move items under the feet of one.
+        return false;
+    }
+    drainAllReaders();
 
-    // Move existing records into the new space.
-    for (size_t i = 0; i < oldSize; i++) {
+    const hrtime_t start = gethrtime();
+    const size_t curSize = size;
+    const size_t first = migrated;
+    const size_t last = std::min(first + resizeStepBuckets, curSize);
+    for (size_t i = first; i < last; i++) {
         while (values[i]) {
-            StoredValue *v = values[i];
+            StoredValue* v = values[i];
             values[i] = v->next;
 
-            int newBucket = getBucketForHash(v->getKey().hash());
+            const int hash = v->getKey().hash();
+            const size_t newBucket = abs(hash % static_cast<int>(newSize));
             v->next = newValues[newBucket];
             newValues[newBucket] = v;
+            if (newIndex) {
+                indexInsert(curSize + newBucket, *v);
+            }
+        }
+        if (index) {
+            std::memset(&index[i], 0, sizeof(BucketIndex));
+        }
+    }
+    migrated.store(last);
+    stats.htResizeBucketsRemaining.fetch_sub(last - first);
+
+    if (last == curSize) {
+        // Every item now lives in the new array; switch over to it.
+        stats.memOverhead->fetch_sub(memorySize());
+        cb_free(values);
+        values = newValues;
+        if (index) {
+            cb_free(indexAlloc);
+            index = newIndex;
+            indexAlloc = newIndexAlloc;
         }
+        newValues = nullptr;
+        newIndex = nullptr;
+        newIndexAlloc = nullptr;
+        size.store(newSize);
+        newSize.store(0);
+        migrated.store(0);
+        stats.memOverhead->fetch_add(memorySize());
+        ++numResizes;
+        --stats.numHtResizesInProgress;
     }
 
-    // values still points to the old (now empty) table.
-    cb_free(values);
-    values = newValues;
+    stats.htResizeStallHisto.add((gethrtime() - start) / 1000);
+    return true;
+}
 
+void HashTable::abandonResize() {
+    stats.memOverhead->fetch_sub(memorySize());
+    stats.htResizeBucketsRemaining.fetch_sub(size - migrated);
+    --stats.numHtResizesInProgress;
+    cb_free(newValues);
+    cb_free(newIndexAlloc);
+    newValues = nullptr;
+    newIndex = nullptr;
+    newIndexAlloc = nullptr;
+    newSize.store(0);
+    migrated.store(0);
     stats.memOverhead->fetch_add(memorySize());
 }
 
+std::unique_lock<std::mutex> HashTable::lockWithoutResize() {
+    std::unique_lock<std::mutex> lh(mutexes[0]);
+    while (isResizing()) {
+        // No visitor can be registered while a resize is in progress (see
+        // resize()), so the steps always make progress.
+        lh.unlock();
+        resizeStep();
+        lh.lock();
+    }
+    return lh;
+}
+
 StoredValue* HashTable::find(const DocKey& key, bool trackReference,
                              bool wantsDeleted) {
     if (!isActive()) {
@@ -225,14 +482,16 @@ StoredValue* HashTable::find(const DocKey& key, bool trackReference,
 }
 
 Item* HashTable::getRandomKey(long rnd) {
-    /* Try to locate a partition */
-    size_t start = rnd % size;
+    /* Try to locate a partition; while resizing the slots of both bucket
+       arrays are candidates */
+    const size_t slots = size + newSize;
+    size_t start = rnd % slots;
     size_t curr = start;
     Item *ret;
 
     do {
         ret = getRandomKeyFromSlot(curr++);
-        if (curr == size) {
+        if (curr == slots) {
             curr = 0;
         }
     } while (ret == NULL && curr != start);
@@ -304,8 +563,12 @@ StoredValue* HashTable::unlocked_addNewStoredValue(
                 "call on a non-active HT object");
     }
 
-    StoredValue* v = valFact(itm, values[bucketNum], *this);
-    values[bucketNum] = v;
+    StoredValue*& head = chainHead(bucketNum);
+    StoredValue* v = (*valFact)(itm, head, *this);
+    head = v;
+    if (index) {
+        indexInsert(bucketNum, *v);
+    }
 
     if (v->isTempItem()) {
         ++numTempItems;
@@ -338,27 +601,119 @@ void HashTable::unlocked_softDelete(const std::unique_lock<std::mutex>& htLock,
 
 StoredValue* HashTable::unlocked_find(const DocKey& key, int bucket_num,
                                       bool wantsDeleted, bool trackReference) {
-    StoredValue *v = values[bucket_num];
+    StoredValue* v = index ? findInIndex(key, bucket_num)
+                           : findInChain(key, bucket_num);
+    if (!v) {
+        return NULL;
+    }
+    if (trackReference && !v->isDeleted()) {
+        v->referenced();
+    }
+    if (wantsDeleted || !v->isDeleted()) {
+        return v;
+    }
+    return NULL;
+}
+
+StoredValue* HashTable::unlocked_find(const SharedBucketLock& lh,
+                                      const DocKey& key,
+                                      bool wantsDeleted) {
+    if (!lh) {
+        throw std::invalid_argument(
+                "HashTable::unlocked_find: shared lock not held");
+    }
+    const int bucket_num = lh.getBucketNum();
+    StoredValue* v = index ? findInIndex(key, bucket_num)
+                           : findInChain(key, bucket_num);
+    if (v && (wantsDeleted || !v->isDeleted())) {
+        return v;
+    }
+    return NULL;
+}
+
+StoredValue* HashTable::findInChain(const DocKey& key, int bucket_num) {
+    StoredValue *v = chainHead(bucket_num);
     while (v) {
         if (v->hasKey(key)) {
-            if (trackReference && !v->isDeleted()) {
-                v->referenced();
-            }
-            if (wantsDeleted || !v->isDeleted()) {
-                return v;
-            } else {
-                return NULL;
-            }
+            return v;
         }
         v = v->next;
     }
     return NULL;
 }
 
+StoredValue* HashTable::findInIndex(const DocKey& key, int bucket_num) {
+    const BucketIndex& bi = bucketIndex(bucket_num);
+    const uint8_t tag = tagForHash(key.hash());
+    for (uint8_t i = 0; i < bi.count; i++) {
+        if (bi.tags[i] == tag && bi.svs[i]->hasKey(key)) {
+            return bi.svs[i];
+        }
+    }
+    if (bi.overflowed) {
+        // Only part of the chain is indexed.
+        return findInChain(key, bucket_num);
+    }
+    return NULL;
+}
+
+HashTable::BucketIndex* HashTable::allocateIndex(size_t n, void*& alloc) {
+    const size_t alignment = sizeof(BucketIndex);
+    alloc = cb_calloc(1, (n * sizeof(BucketIndex)) + alignment - 1);
+    if (!alloc) {
+        return nullptr;
+    }
+    const uintptr_t addr = reinterpret_cast<uintptr_t>(alloc);
+    return reinterpret_cast<BucketIndex*>((addr + alignment - 1) &
+                                          ~(uintptr_t(alignment) - 1));
+}
+
+void HashTable::indexInsert(int bucket_num, StoredValue& v) {
+    BucketIndex& bi = bucketIndex(bucket_num);
+    if (bi.count == BucketIndex::numSlots) {
+        bi.overflowed = 1;
+        return;
+    }
+    bi.tags[bi.count] = tagForHash(v.getKey().hash());
+    bi.svs[bi.count] = &v;
+    ++bi.count;
+}
+
+void HashTable::indexRemove(int bucket_num, const StoredValue& v) {
+    BucketIndex& bi = bucketIndex(bucket_num);
+    if (bi.overflowed) {
+        // Pull the entries which were not indexed into the freed slot(s).
+        indexRebuild(bucket_num);
+        return;
+    }
+    for (uint8_t i = 0; i < bi.count; i++) {
+        if (bi.svs[i] == &v) {
+            // Keep the slots dense by moving the last entry into the hole.
+            const uint8_t last = bi.count - 1;
+            bi.tags[i] = bi.tags[last];
+            bi.svs[i] = bi.svs[last];
+            bi.svs[last] = nullptr;
+            bi.count = last;
+            return;
+        }
+    }
+}
+
+void HashTable::indexRebuild(int bucket_num) {
+    BucketIndex& bi = bucketIndex(bucket_num);
+    std::memset(&bi, 0, sizeof(BucketIndex));
+    for (StoredValue* v = chainHead(bucket_num); v; v = v->next) {
+        indexInsert(bucket_num, *v);
+        if (bi.overflowed) {
+            break;
+        }
+    }
+}
+
 void HashTable::unlocked_del(const std::unique_lock<std::mutex>& htLock,
                              const DocKey& key,
                              int bucket_num) {
-    delete unlocked_release(htLock, key, bucket_num);
+    StoredValue::destroy(unlocked_release(htLock, key, bucket_num));
 }
 
 StoredValue* HashTable::unlocked_release(
@@ -366,6 +721,40 @@ StoredValue* HashTable::unlocked_release(
     return unlocked_release(htLock, key, getBucketForHash(key.hash()));
 }
 
+std::pair<StoredValue*, StoredValue*> HashTable::unlocked_replaceByCopy(
+        const std::unique_lock<std::mutex>& htLock,
+        const StoredValue& vToCopy) {
+    if (!htLock) {
+        throw std::invalid_argument(
+                "HashTable::unlocked_replaceByCopy: htLock "
+                "not held");
+    }
+
+    if (!isActive()) {
+        throw std::logic_error(
+                "HashTable::unlocked_replaceByCopy: Cannot call on a "
+                "non-active object");
+    }
+
+    const int bucketNum = getBucketForHash(vToCopy.getKey().hash());
+
+    /* Create the copy before releasing the original, the copy is built from
+       its Item representation */
+    std::unique_ptr<Item> itm(vToCopy.toItem(false, 0));
+    const bool wasDirty = vToCopy.isDirty();
+    const bool wasDeleted = vToCopy.isDeleted();
+
+    StoredValue* released =
+            unlocked_release(htLock, vToCopy.getKey(), bucketNum);
+    StoredValue* newSv = unlocked_addNewStoredValue(htLock, *itm, bucketNum);
+    newSv->deleted = wasDeleted;
+    if (!wasDirty) {
+        newSv->markClean();
+    }
+
+    return {newSv, released};
+}
+
 StoredValue* HashTable::unlocked_release(
         const std::unique_lock<std::mutex>& htLock,
         const DocKey& key,
@@ -381,7 +770,8 @@ StoredValue* HashTable::unlocked_release(
                 "HashTable::unlocked_remove: Cannot call on a "
                 "non-active object");
     }
-    StoredValue *v = values[bucket_num];
+    StoredValue*& head = chainHead(bucket_num);
+    StoredValue *v = head;
 
     /* An empty Hash Bucket when trying to remove a StoredValue indicates a
        potential memory leak / error in our HashTable handling */
@@ -393,15 +783,11 @@ StoredValue* HashTable::unlocked_release(
 
     // Special case the first one
     if (v->hasKey(key)) {
-        values[bucket_num] = v->next;
-        StoredValue::reduceCacheSize(*this, v->size());
-        StoredValue::reduceMetaDataSize(*this, stats, v->metaDataSize());
-        if (v->isTempItem()) {
-            --numTempItems;
-        } else {
-            decrNumItems();
-            decrNumTotalItems();
+        head = v->next;
+        if (index) {
+            indexRemove(bucket_num, *v);
         }
+        accountRemoval(*v);
         return v;
     }
 
@@ -409,14 +795,10 @@ StoredValue* HashTable::unlocked_release(
         if (v->next->hasKey(key)) {
             StoredValue *tmp = v->next;
             v->next = v->next->next;
-            StoredValue::reduceCacheSize(*this, tmp->size());
-            StoredValue::reduceMetaDataSize(*this, stats, tmp->metaDataSize());
-            if (tmp->isTempItem()) {
-                --numTempItems;
-            } else {
-                decrNumItems();
-                decrNumTotalItems();
+            if (index) {
+                indexRemove(bucket_num, *tmp);
             }
+            accountRemoval(*tmp);
             return tmp;
         } else {
             v = v->next;
@@ -436,7 +818,7 @@ void HashTable::visit(HashTableVisitor &visitor) {
     // Acquire one (any) of the mutexes before incrementing {visitors}, this
     // prevents any race between this visitor and the HashTable resizer.
     // See comments in pauseResumeVisit() for further details.
-    std::unique_lock<std::mutex> lh(mutexes[0]);
+    std::unique_lock<std::mutex> lh = lockWithoutResize();
     VisitorTracker vt(&visitors);
     lh.unlock();
 
@@ -448,6 +830,7 @@ void HashTable::visit(HashTableVisitor &visitor) {
             // (re)acquire mutex on each HashBucket, to minimise any impact
             // on front-end threads.
             LockHolder lh(mutexes[l]);
+            drainReaders(l);
 
             StoredValue *v = values[i];
             if (v) {
@@ -478,10 +861,13 @@ void HashTable::visitDepth(HashTableDepthVisitor &visitor) {
         return;
     }
     size_t visited = 0;
+    std::unique_lock<std::mutex> vlh = lockWithoutResize();
     VisitorTracker vt(&visitors);
+    vlh.unlock();
 
     for (int l = 0; l < static_cast<int>(n_locks); l++) {
         LockHolder lh(mutexes[l]);
+        drainReaders(l);
         for (int i = l; i < static_cast<int>(size); i+= n_locks) {
             size_t depth = 0;
             StoredValue *p = values[i];
@@ -530,7 +916,9 @@ HashTable::pauseResumeVisit(PauseResumeHashTableVisitor& visitor,
     // inside the inner for() loop. To prevent this race, we explicitly acquire
     // (any) mutex, increment {visitors} and then release the mutex. This
     //avoids the race as if visitors >0 then Resizer will not attempt to resize.
-    std::unique_lock<std::mutex> lh(mutexes[0]);
+    // Any incremental resize in progress is completed first, so there is only
+    // one bucket array to visit.
+    std::unique_lock<std::mutex> lh = lockWithoutResize();
     VisitorTracker vt(&visitors);
     lh.unlock();
 
@@ -553,12 +941,13 @@ HashTable::pauseResumeVisit(PauseResumeHashTableVisitor& visitor,
         // Note: we don't record how far into the bucket linked-list we
         // pause at; so any restart will begin from the next bucket.
         for (; !paused && hash_bucket < size; hash_bucket += n_locks) {
-            LockHolder lh(mutexes[lock]);
+            std::unique_lock<std::mutex> lh(mutexes[lock]);
+            drainReaders(lock);
 
             StoredValue *v = values[hash_bucket];
             while (!paused && v) {
                 StoredValue *tmp = v->next;
-                paused = !visitor.visit(*v);
+                paused = !visitor.visit(lh, *v);
                 v = tmp;
             }
         }
@@ -631,10 +1020,11 @@ bool HashTable::unlocked_ejectItem(StoredValue*& vptr,
                                             vptr->metaDataSize());
             StoredValue::reduceCacheSize(*this, vptr->size());
             int bucket_num = getBucketForHash(vptr->getKey().hash());
-            StoredValue *v = values[bucket_num];
+            StoredValue*& head = chainHead(bucket_num);
+            StoredValue *v = head;
             // Remove the item from the hash table.
             if (v == vptr) {
-                values[bucket_num] = v->next;
+                head = v->next;
             } else {
                 while (v->next) {
                     if (v->next == vptr) {
@@ -645,6 +1035,9 @@ bool HashTable::unlocked_ejectItem(StoredValue*& vptr,
                     }
                 }
             }
+            if (index) {
+                indexRemove(bucket_num, *vptr);
+            }
 
             if (vptr->isResident()) {
                 ++stats.numValueEjects;
@@ -657,7 +1050,7 @@ bool HashTable::unlocked_ejectItem(StoredValue*& vptr,
             ++numEjects;
             updateMaxDeletedRevSeqno(vptr->getRevSeqno());
 
-            delete vptr; // Free the item.
+            StoredValue::destroy(vptr); // Free the item.
             vptr = NULL;
             return true;
         } else {
@@ -669,7 +1062,11 @@ bool HashTable::unlocked_ejectItem(StoredValue*& vptr,
 
 Item *HashTable::getRandomKeyFromSlot(int slot) {
     std::unique_lock<std::mutex> lh = getLockedBucket(slot);
-    StoredValue *v = values[slot];
+    if (static_cast<size_t>(slot) >= size + newSize) {
+        // A resize completed since the slot was picked.
+        return NULL;
+    }
+    StoredValue *v = chainHead(slot);
 
     while (v) {
         if (!v->isTempItem() && !v->isDeleted() && v->isResident()) {
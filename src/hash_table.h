@@ -21,10 +21,15 @@
 #include "storeddockey.h"
 #include "stored-value.h"
 
+#include <platform/cacheline_padded.h>
+
+#include <thread>
+
 class HashTableStatVisitor;
 class HashTableVisitor;
 class HashTableDepthVisitor;
 class PauseResumeHashTableVisitor;
+class SlabArena;
 
 /**
  * Mutation types as returned by store commands.
@@ -62,6 +67,18 @@ enum class AddStatus : uint16_t {
  * order of the number of CPUs. Essentially ht bucket B is guarded by
  * mutex B mod N.
  *
+ * Read-only lookups can instead hold a lock stripe in shared mode (see
+ * SharedBucketLock), so readers of the same (hot) keys do not serialise on
+ * each other.
+ *
+ * Resizing is incremental: the new bucket array is allocated alongside the
+ * current one and the buckets are migrated a few at a time (each step holding
+ * all ht_locks only for the buckets it moves), so front-end operations are
+ * never blocked for the whole rehash. While a resize is in progress a key
+ * lives in the new array if its bucket of the current array has already been
+ * migrated, otherwise in the current array; bucket numbers at or above
+ * getSize() refer to the new array.
+ *
  * StoredValue objects can have their value (Blob object) ejected, making the
  * value non-resident. Such StoredValues are still in the HashTable, and their
  * metadata (CAS, revSeqno, bySeqno, etc) is still accessible, but the value
@@ -84,6 +101,29 @@ enum class AddStatus : uint16_t {
 class HashTable {
 public:
 
+    /**
+     * How items are located within a hash bucket.
+     */
+    enum class Layout {
+        /// Walk the chain of StoredValues of the hash bucket, comparing the
+        /// key of each one.
+        Chained,
+        /// As Chained, but each hash bucket also has a cache line sized
+        /// index of (the first few entries of) its chain, holding a key
+        /// fingerprint and the StoredValue pointer of each entry. Only
+        /// StoredValues whose fingerprint matches are dereferenced, so a
+        /// miss usually costs a single cache line load. See BucketIndex.
+        Bucketized
+    };
+
+    /**
+     * Returns the Layout named by the given configuration string
+     * ("chained" or "bucketized").
+     *
+     * @throws std::invalid_argument if the name is not known
+     */
+    static Layout layoutFromString(const std::string& name);
+
     /**
      * Represents a position within the hashtable.
      *
@@ -123,6 +163,72 @@ public:
         friend std::ostream& operator<<(std::ostream& os, const Position& pos);
     };
 
+    /**
+     * A shared hold of the lock stripe of a hash bucket, for read-only
+     * lookups.
+     *
+     * Readers register themselves on the stripe with an atomic increment,
+     * without touching its mutex. Exclusive holders (getLockedBucket() and
+     * friends) flag the stripe as write pending after acquiring its mutex,
+     * then wait for the registered readers to drain; a reader finding the
+     * flag set backs off and registers under the mutex instead, clearing
+     * the flag (which only the exclusive holders of the stripe may set, so
+     * is stale once the mutex is acquired). So readers exclude writers and
+     * a waiting writer is not starved by new readers, while only the first
+     * reader of a stripe after a write takes its mutex.
+     *
+     * Nothing may be modified under a shared hold, not even the NRU value
+     * of a StoredValue. A thread holding a shared lock must not acquire any
+     * other lock of the hash table - exclusive or shared, of any stripe:
+     * writers locking several stripes (clear(), resize steps...) wait for
+     * the readers of each stripe while holding the mutexes of the others,
+     * so that could deadlock. This is checked, the acquisition throwing
+     * std::logic_error. For the same reason a SharedBucketLock must be
+     * released by the thread which acquired it.
+     */
+    class SharedBucketLock {
+    public:
+        SharedBucketLock(SharedBucketLock&& other)
+            : ht(other.ht), lock(other.lock), bucket(other.bucket) {
+            other.ht = nullptr;
+        }
+
+        ~SharedBucketLock() {
+            unlock();
+        }
+
+        /// Release the shared hold (if still held).
+        void unlock() {
+            if (ht) {
+                ht->readers[lock]->count.fetch_sub(1,
+                                                   std::memory_order_release);
+                --sharedHolds;
+                ht = nullptr;
+            }
+        }
+
+        explicit operator bool() const {
+            return ht != nullptr;
+        }
+
+        /// The hash bucket held.
+        int getBucketNum() const {
+            return bucket;
+        }
+
+    private:
+        SharedBucketLock(HashTable& ht_, size_t lock_, int bucket_)
+            : ht(&ht_), lock(lock_), bucket(bucket_) {
+        }
+
+        HashTable* ht;
+        size_t lock;
+        int bucket;
+
+        friend class HashTable;
+        DISALLOW_COPY_AND_ASSIGN(SharedBucketLock);
+    };
+
     /**
      * Create a HashTable.
      *
@@ -132,19 +238,63 @@ public:
      */
     HashTable(EPStats &st, size_t s = 0, size_t l = 0);
 
+    /**
+     * Create a HashTable which uses the given factory to create its
+     * StoredValues.
+     *
+     * @param st the global stats reference
+     * @param svFactory factory to use for constructing stored values
+     * @param s the number of hash table buckets
+     * @param l the number of locks in the hash table
+     * @param layout how items are located within a hash bucket
+     * @param arenaAllocation if true StoredValues are allocated from a slab
+     *        arena owned by this table (see SlabArena), which is freed as a
+     *        whole when the table is cleared
+     */
+    HashTable(EPStats& st,
+              std::unique_ptr<AbstractStoredValueFactory> svFactory,
+              size_t s = 0,
+              size_t l = 0,
+              Layout layout = Layout::Chained,
+              bool arenaAllocation = false);
+
     ~HashTable();
 
     size_t memorySize() {
         return sizeof(HashTable)
-            + (size * sizeof(StoredValue*))
-            + (n_locks * sizeof(std::mutex));
+            + ((size + newSize) * sizeof(StoredValue*))
+            + (index ? (size + newSize) * sizeof(BucketIndex) : 0)
+            + (n_locks * (sizeof(std::mutex) + sizeof(*readers)));
+    }
+
+    /**
+     * Get the layout of this hash table.
+     */
+    Layout getLayout() const {
+        return index ? Layout::Bucketized : Layout::Chained;
     }
 
     /**
-     * Get the number of hash table buckets this hash table has.
+     * Get the number of hash table buckets this hash table has. While a
+     * resize is in progress this is the size being resized from.
      */
     size_t getSize(void) { return size; }
 
+    /**
+     * Returns true if an incremental resize is in progress.
+     */
+    bool isResizing() const {
+        return newSize.load() != 0;
+    }
+
+    /**
+     * Get the number of hash buckets the resize in progress still has to
+     * migrate (zero if no resize is in progress).
+     */
+    size_t getResizeBucketsRemaining() const {
+        return isResizing() ? size - migrated : 0;
+    }
+
     /**
      * Get the number of locks in this hash table.
      */
@@ -230,6 +380,18 @@ public:
      */
     void clear(bool deactivate = false);
 
+    /**
+     * Clear the hash table a chunk at a time, for releasing the memory of a
+     * table which is no longer used (e.g. of a dead vbucket) without
+     * monopolising a thread. Each call removes and frees whole hash chains
+     * until at least maxItems items have been freed; the next call resumes
+     * where the previous one stopped.
+     *
+     * @param maxItems number of items to free before returning
+     * @return true once the table is empty
+     */
+    bool clearChunk(size_t maxItems);
+
     /**
      * Get the number of times this hash table has been resized.
      */
@@ -247,9 +409,32 @@ public:
 
     /**
      * Resize to the specified size.
+     *
+     * Completes any resize already in progress first. Buckets are migrated
+     * in steps of resizeStepBuckets, all ht_locks being released between
+     * steps; a visitor starting meanwhile completes the resize itself
+     * before visiting (see lockWithoutResize()).
      */
     void resize(size_t to);
 
+    /**
+     * Start an incremental resize to the specified size, without migrating
+     * any bucket yet (see resizeStep()).
+     *
+     * @return false if the resize could not be started: the size is
+     *         invalid or unchanged, a resize or a visitor is already in
+     *         progress, or the new bucket array could not be allocated.
+     */
+    bool startResize(size_t to);
+
+    /**
+     * Migrate the next resizeStepBuckets buckets of the resize in progress,
+     * completing the resize once all buckets have been migrated.
+     *
+     * @return true if any progress was made
+     */
+    bool resizeStep();
+
     /**
      * Find the item with the given key.
      *
@@ -338,6 +523,20 @@ public:
                                bool wantsDeleted=false,
                                bool trackReference=true);
 
+    /**
+     * Find an item within the bucket held in shared mode. The reference is
+     * not tracked (that would modify the item).
+     *
+     * @param lh the shared lock of the key's bucket
+     * @param key the key of the item to find
+     * @param wantsDeleted true if soft deleted items should be returned
+     *
+     * @return a pointer to a StoredValue -- NULL if not found
+     */
+    StoredValue* unlocked_find(const SharedBucketLock& lh,
+                               const DocKey& key,
+                               bool wantsDeleted = false);
+
     /**
      * Get a lock holder holding a lock for the given bucket
      *
@@ -345,8 +544,16 @@ public:
      * @return a locked LockHolder
      */
     inline std::unique_lock<std::mutex> getLockedBucket(int bucket) {
-        std::unique_lock<std::mutex> rv(mutexes[mutexForBucket(bucket)]);
-        return rv;
+        checkNoSharedHold("getLockedBucket");
+        while (true) {
+            const size_t lock = mutexForBucket(bucket);
+            std::unique_lock<std::mutex> rv(mutexes[lock]);
+            // A resize step may have changed which lock guards the bucket.
+            if (lock == mutexForBucket(bucket)) {
+                drainReaders(lock);
+                return rv;
+            }
+        }
     }
 
     /**
@@ -358,15 +565,55 @@ public:
      * @return a locked LockHolder
      */
     inline std::unique_lock<std::mutex> getLockedBucket(int h, int *bucket) {
+        std::unique_lock<std::mutex> rv = lockBucketMutex(h, bucket);
+        drainReaders(mutexForBucket(*bucket));
+        return rv;
+    }
+
+    /**
+     * Get a shared hold of the bucket for the hash of the given key.
+     *
+     * @param key the key
+     * @return the shared lock, which knows the bucket
+     */
+    SharedBucketLock getSharedLockedBucket(const DocKey& key) {
+        checkNoSharedHold("getSharedLockedBucket");
+        const int h = key.hash();
         while (true) {
             if (!isActive()) {
-                throw std::logic_error("HashTable::getLockedBucket: "
+                throw std::logic_error("HashTable::getSharedLockedBucket: "
                         "Cannot call on a non-active object");
             }
-            *bucket = getBucketForHash(h);
-            std::unique_lock<std::mutex> rv(mutexes[mutexForBucket(*bucket)]);
-            if (*bucket == getBucketForHash(h)) {
-                return rv;
+            const int bucket = getBucketForHash(h);
+            const size_t lock = mutexForBucket(bucket);
+            StripeReaders& stripe = *readers[lock];
+
+            // Register, then check for a writer: a writer flags the stripe
+            // then checks for readers (see drainReaders()), so either it
+            // waits for us or we see its flag (both sequentially
+            // consistent).
+            stripe.count.fetch_add(1);
+            if (!stripe.writerPending.load()) {
+                // A resize step may have moved the key before we registered.
+                if (bucket == getBucketForHash(h) &&
+                    lock == mutexForBucket(bucket)) {
+                    ++sharedHolds;
+                    return SharedBucketLock(*this, lock, bucket);
+                }
+                stripe.count.fetch_sub(1, std::memory_order_release);
+                continue;
+            }
+            stripe.count.fetch_sub(1, std::memory_order_release);
+
+            // The stripe is held by a writer, or was last: register under
+            // its mutex, no writer holding it meanwhile.
+            std::lock_guard<std::mutex> lh(mutexes[lock]);
+            if (bucket == getBucketForHash(h) &&
+                lock == mutexForBucket(bucket)) {
+                stripe.writerPending.store(false, std::memory_order_relaxed);
+                stripe.count.fetch_add(1, std::memory_order_relaxed);
+                ++sharedHolds;
+                return SharedBucketLock(*this, lock, bucket);
             }
         }
     }
@@ -413,6 +660,25 @@ public:
      */
     StoredValue* unlocked_release(const std::unique_lock<std::mutex>& htLock,
                                   const DocKey& key);
+
+    /**
+     * Replaces vToCopy in the hash table with a new StoredValue which is a
+     * copy of it. The old StoredValue is released (not deleted) and returned
+     * to the caller, who then owns it.
+     * Assumes that the hash bucket lock is already held.
+     *
+     * Used by data structures which reference StoredValues intrusively and
+     * cannot allow an in-place update of vToCopy at the moment (for example
+     * an in-progress range read over a sequence list).
+     *
+     * @param htLock Hash table lock that must be held
+     * @param vToCopy StoredValue to be replaced by a copy
+     *
+     * @return pair of {the new StoredValue, the released StoredValue}
+     */
+    std::pair<StoredValue*, StoredValue*> unlocked_replaceByCopy(
+            const std::unique_lock<std::mutex>& htLock,
+            const StoredValue& vToCopy);
     /**
      * Visit all items within this hashtable.
      */
@@ -553,6 +819,25 @@ public:
 private:
     friend class StoredValue;
 
+    /**
+     * Index of the chain of one hash bucket, used by the Bucketized layout.
+     * Exactly one cache line: a one byte fingerprint (tag) of the key hash
+     * and the StoredValue pointer for up to numSlots entries of the chain.
+     * If the chain holds more entries than there are slots the index is
+     * marked as overflowed, and lookups which do not match an indexed entry
+     * fall back to walking the chain.
+     *
+     * Guarded by the lock of the hash bucket, like the chain itself.
+     */
+    struct BucketIndex {
+        static const uint8_t numSlots = 7;
+
+        uint8_t tags[numSlots];
+        uint8_t count : 7;
+        uint8_t overflowed : 1;
+        StoredValue* svs[numSlots];
+    };
+
     inline bool isActive() const { return activeState; }
     inline void setActiveState(bool newv) { activeState = newv; }
 
@@ -560,19 +845,65 @@ private:
     size_t               n_locks;
     StoredValue        **values;
     std::mutex               *mutexes;
+    /// The shared holders of a lock stripe (see SharedBucketLock).
+    struct StripeReaders {
+        //! Number of shared holders.
+        std::atomic<size_t> count{0};
+        //! Set by the exclusive holders of the stripe's mutex; cleared
+        //! under the mutex by the next reader.
+        std::atomic<bool> writerPending{false};
+    };
+    cb::CachelinePadded<StripeReaders> *readers;
+    //! Number of SharedBucketLocks held by the calling thread.
+    static thread_local size_t sharedHolds;
     EPStats&             stats;
-    StoredValueFactory   valFact;
+    std::unique_ptr<AbstractStoredValueFactory> valFact;
     std::atomic<size_t>       visitors;
     std::atomic<size_t>       numItems;
     std::atomic<size_t>       numResizes;
     std::atomic<size_t>       numTempItems;
     bool                 activeState;
+    //! Per hash bucket chain index; null unless the layout is Bucketized.
+    BucketIndex         *index;
+    //! Allocation backing index (which is aligned to a cache line within).
+    void                *indexAlloc;
+
+    //! Bucket array being resized to; null unless a resize is in progress.
+    StoredValue        **newValues;
+    //! Size of newValues; zero unless a resize is in progress.
+    std::atomic<size_t> newSize;
+    //! Number of buckets of values (from the start) already migrated to
+    //! newValues by the resize in progress.
+    std::atomic<size_t> migrated;
+    //! Chain index of newValues; null unless the layout is Bucketized.
+    BucketIndex         *newIndex;
+    void                *newIndexAlloc;
+    //! Serialises resize() calls.
+    std::mutex           resizeLock;
+    //! Allocator of the StoredValues; null if they are heap allocated.
+    std::unique_ptr<SlabArena> arena;
+    //! Bucket clearChunk() resumes from.
+    size_t clearPosition;
 
     static size_t                 defaultNumBuckets;
     static size_t                 defaultNumLocks;
 
+    //! Number of buckets migrated by each resize step.
+    static const size_t resizeStepBuckets = 1024;
+
+    /*
+     * Unlocked callers (see getLockedBucket) may observe the resize state
+     * being changed under them; the result is then meaningless but safe
+     * to use, and is re-checked once the lock is held.
+     */
     int getBucketForHash(int h) {
-        return abs(h % static_cast<int>(size));
+        const int curSize = static_cast<int>(size);
+        const int resizeSize = static_cast<int>(newSize);
+        const int bucket = abs(h % curSize);
+        if (resizeSize != 0 && static_cast<size_t>(bucket) < migrated) {
+            return curSize + abs(h % resizeSize);
+        }
+        return bucket;
     }
 
     inline size_t mutexForBucket(size_t bucket_num) {
@@ -580,9 +911,97 @@ private:
             throw std::logic_error("HashTable::mutexForBucket: Cannot call on a "
                     "non-active object");
         }
+        const size_t curSize = size;
+        if (bucket_num >= curSize) {
+            bucket_num -= curSize;
+        }
         return bucket_num % n_locks;
     }
 
+    /**
+     * Lock the mutex of the bucket for the given hash, without waiting for
+     * the readers of the stripe (see SharedBucketLock).
+     */
+    std::unique_lock<std::mutex> lockBucketMutex(int h, int* bucket) {
+        checkNoSharedHold("getLockedBucket");
+        while (true) {
+            if (!isActive()) {
+                throw std::logic_error("HashTable::getLockedBucket: "
+                        "Cannot call on a non-active object");
+            }
+            *bucket = getBucketForHash(h);
+            const size_t lock = mutexForBucket(*bucket);
+            std::unique_lock<std::mutex> rv(mutexes[lock]);
+            if (*bucket == getBucketForHash(h) &&
+                lock == mutexForBucket(*bucket)) {
+                return rv;
+            }
+        }
+    }
+
+    /**
+     * Wait for the shared holders of the given lock stripe to finish.
+     * Caller must hold the stripe's mutex; new readers see the stripe is
+     * write pending and wait for the mutex.
+     */
+    void drainReaders(size_t lock) {
+        checkNoSharedHold("drainReaders");
+        StripeReaders& stripe = *readers[lock];
+        stripe.writerPending.store(true);
+        while (stripe.count.load() != 0) {
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * Throw if the calling thread holds a SharedBucketLock, in which case
+     * it must not acquire any other hash table lock (see SharedBucketLock).
+     */
+    static void checkNoSharedHold(const char* caller) {
+        if (sharedHolds != 0) {
+            throw std::logic_error(std::string("HashTable::") + caller +
+                    ": the thread already holds a SharedBucketLock");
+        }
+    }
+
+    /// drainReaders() for every stripe; caller must hold all the mutexes.
+    void drainAllReaders() {
+        for (size_t l = 0; l < n_locks; l++) {
+            drainReaders(l);
+        }
+    }
+
+    /// Returns the head of the chain of the given bucket (bucket lock held).
+    StoredValue*& chainHead(int bucket_num) {
+        const size_t curSize = size;
+        if (static_cast<size_t>(bucket_num) < curSize) {
+            return values[bucket_num];
+        }
+        return newValues[bucket_num - curSize];
+    }
+
+    /// Returns the index of the given bucket (bucket lock held).
+    BucketIndex& bucketIndex(int bucket_num) {
+        const size_t curSize = size;
+        if (static_cast<size_t>(bucket_num) < curSize) {
+            return index[bucket_num];
+        }
+        return newIndex[bucket_num - curSize];
+    }
+
+    /**
+     * Abandon the resize in progress, freeing the new bucket array. Caller
+     * must hold all ht_locks and the new array must be empty.
+     */
+    void abandonResize();
+
+    /**
+     * Lock (any) ht_lock with no resize in progress, completing the resize
+     * in progress first if there is one. Visitors take this before
+     * registering themselves, as they expect a single bucket array.
+     */
+    std::unique_lock<std::mutex> lockWithoutResize();
+
     /**
      * Releases an item(StoredValue) in the hash table, but does not delete it.
      * It will pass out the removed item to the caller who can decide whether to
@@ -604,6 +1023,52 @@ private:
 
     Item *getRandomKeyFromSlot(int slot);
 
+    /// Find the StoredValue with the given key by walking the bucket chain.
+    StoredValue* findInChain(const DocKey& key, int bucket_num);
+
+    /// Find the StoredValue with the given key via the bucket index.
+    StoredValue* findInIndex(const DocKey& key, int bucket_num);
+
+    /// Returns the fingerprint of a key hash stored in a BucketIndex.
+    static uint8_t tagForHash(int h) {
+        // The bucket is chosen by h modulo a prime; the top bits are
+        // (mostly) independent of it.
+        return static_cast<uint8_t>(static_cast<uint32_t>(h) >> 24);
+    }
+
+    /**
+     * Allocate a zeroed, cache line aligned array of n BucketIndexes.
+     * The allocation to free is returned in alloc.
+     *
+     * @return the array, or null if the allocation failed
+     */
+    static BucketIndex* allocateIndex(size_t n, void*& alloc);
+
+    /// Add v (just linked into the chain of bucket_num) to the index.
+    void indexInsert(int bucket_num, StoredValue& v);
+
+    /// Remove v (just unlinked from the chain of bucket_num) from the index.
+    void indexRemove(int bucket_num, const StoredValue& v);
+
+    /// Re-populate the index of bucket_num from its chain.
+    void indexRebuild(int bucket_num);
+
+    /**
+     * Free the chain of StoredValues starting at head (clear() helper),
+     * accumulating their stats in rv. If releaseArena is true the arena
+     * allocated ones are only destroyed, their memory being freed by
+     * releasing the whole arena afterwards.
+     */
+    static void deleteChain(StoredValue*& head,
+                            HashTableStatVisitor& rv,
+                            bool releaseArena);
+
+    /// Updates the table's counters for v being removed (bucket lock held).
+    void accountRemoval(StoredValue& v);
+
+    /// Number of arena allocated StoredValues in the table (all locks held).
+    size_t countArenaAllocated();
+
     DISALLOW_COPY_AND_ASSIGN(HashTable);
 };
 
@@ -667,10 +1132,16 @@ public:
     /**
      * Visit an individual item within a hash table.
      *
+     * The visitor may remove (release) v from the hash table; the visit
+     * continues from the item which followed it.
+     *
+     * @param htLock the lock of the hash bucket containing v; held for the
+     *               duration of the call.
      * @param v a pointer to a value in the hash table.
      * @return True if visiting should continue, otherwise false.
      */
-    virtual bool visit(StoredValue& v) = 0;
+    virtual bool visit(const std::unique_lock<std::mutex>& htLock,
+                       StoredValue& v) = 0;
 };
 
 /**
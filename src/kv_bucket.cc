@@ -72,6 +72,9 @@ public:
             stats.mem_low_wat.store(low_wat);
             stats.mem_high_wat.store(high_wat);
             store.setCursorDroppingLowerUpperThresholds(value);
+            store.setCheckpointMemoryQuota(value);
+        } else if (key.compare("chk_mem_quota_percent") == 0) {
+            store.setCheckpointMemoryQuota(stats.getMaxDataSize());
         } else if (key.compare("mem_low_wat") == 0) {
             stats.mem_low_wat.store(value);
             stats.mem_low_wat_percent.store(
@@ -125,6 +128,8 @@ public:
         } else if (key.compare("mutation_mem_threshold") == 0) {
             double mem_threshold = static_cast<double>(value) / 100;
             StoredValue::setMutationMemoryThreshold(mem_threshold);
+        } else if (key.compare("inline_value_threshold") == 0) {
+            StoredValue::setInlineValueThreshold(value);
         } else if (key.compare("backfill_mem_threshold") == 0) {
             double backfill_threshold = static_cast<double>(value) / 100;
             store.setBackfillMemoryThreshold(backfill_threshold);
@@ -134,6 +139,17 @@ public:
             store.getEPEngine().getReplicationThrottle().setQueueCap(value);
         } else if (key.compare("replication_throttle_cap_pcnt") == 0) {
             store.getEPEngine().getReplicationThrottle().setCapPercent(value);
+        } else if (key.compare("flusher_batch_defer_delay") == 0) {
+            store.setFlusherBatchDeferDelay(value);
+        } else if (key.compare("flusher_batch_defer_items") == 0) {
+            store.setFlusherBatchDeferItems(value);
+        } else if (key.compare("flusher_commit_latency_target") == 0) {
+            store.getFlushBatchController().setLatencyTarget(
+                    std::chrono::milliseconds(value));
+        } else if (key.compare("flusher_batch_max_items") == 0) {
+            store.getFlushBatchController().setMaxItems(value);
+        } else if (key.compare("flusher_batch_max_bytes") == 0) {
+            store.getFlushBatchController().setMaxBytes(value);
         } else {
             LOG(EXTENSION_LOG_WARNING,
                 "Failed to change value for unknown variable, %s\n",
@@ -345,7 +361,12 @@ KVBucket::KVBucket(EventuallyPersistentEngine& theEngine)
       bgFetchDelay(0),
       backfillMemoryThreshold(0.95),
       statsSnapshotTaskId(0),
-      lastTransTimePerItem(0) {
+      lastTransTimePerItem(0),
+      flushBatchController(
+              std::chrono::milliseconds(theEngine.getConfiguration()
+                                                .getFlusherCommitLatencyTarget()),
+              theEngine.getConfiguration().getFlusherBatchMaxItems(),
+              theEngine.getConfiguration().getFlusherBatchMaxBytes()) {
     cachedResidentRatio.activeRatio.store(0);
     cachedResidentRatio.replicaRatio.store(0);
 
@@ -393,6 +414,10 @@ KVBucket::KVBucket(EventuallyPersistentEngine& theEngine)
 
     setCursorDroppingLowerUpperThresholds(config.getMaxSize());
 
+    setCheckpointMemoryQuota(config.getMaxSize());
+    config.addValueChangedListener("chk_mem_quota_percent",
+                                   new StatsValueChangeListener(stats, *this));
+
     stats.replicationThrottleThreshold.store(static_cast<double>
                                     (config.getReplicationThrottleThreshold())
                                      / 100.0);
@@ -424,6 +449,8 @@ KVBucket::KVBucket(EventuallyPersistentEngine& theEngine)
     StoredValue::setMutationMemoryThreshold(mem_threshold);
     config.addValueChangedListener("mutation_mem_threshold",
                                    new EPStoreValueChangeListener(*this));
+    config.addValueChangedListener("inline_value_threshold",
+                                   new EPStoreValueChangeListener(*this));
 
     double backfill_threshold = static_cast<double>
                                       (config.getBackfillMemThreshold()) / 100;
@@ -449,6 +476,17 @@ KVBucket::KVBucket(EventuallyPersistentEngine& theEngine)
     config.addValueChangedListener("dcp_min_compression_ratio",
                                    new EPStoreValueChangeListener(*this));
 
+    config.addValueChangedListener("flusher_batch_defer_delay",
+                                   new EPStoreValueChangeListener(*this));
+    config.addValueChangedListener("flusher_batch_defer_items",
+                                   new EPStoreValueChangeListener(*this));
+    config.addValueChangedListener("flusher_commit_latency_target",
+                                   new EPStoreValueChangeListener(*this));
+    config.addValueChangedListener("flusher_batch_max_items",
+                                   new EPStoreValueChangeListener(*this));
+    config.addValueChangedListener("flusher_batch_max_bytes",
+                                   new EPStoreValueChangeListener(*this));
+
     if (config.isWarmup()) {
         warmupTask = std::make_unique<Warmup>(*this, config);
     }
@@ -528,17 +566,18 @@ KVBucket::~KVBucket() {
     defragmenterTask.reset();
 }
 
-const Flusher* KVBucket::getFlusher(uint16_t shardId) {
-    return vbMap.shards[shardId]->getFlusher();
+const Flusher* KVBucket::getFlusher(uint16_t vbid) {
+    KVShard* shard = vbMap.getShardByVbId(vbid);
+    return shard->getFlusher(shard->getWriterId(vbid));
 }
 
-uint16_t KVBucket::getCommitInterval(uint16_t shardId) {
-    Flusher *flusher = vbMap.shards[shardId]->getFlusher();
+uint16_t KVBucket::getCommitInterval(uint16_t shardId, size_t writerId) {
+    Flusher *flusher = vbMap.shards[shardId]->getFlusher(writerId);
     return flusher->getCommitInterval();
 }
 
-uint16_t KVBucket::decrCommitInterval(uint16_t shardId) {
-    Flusher *flusher = vbMap.shards[shardId]->getFlusher();
+uint16_t KVBucket::decrCommitInterval(uint16_t shardId, size_t writerId) {
+    Flusher *flusher = vbMap.shards[shardId]->getFlusher(writerId);
     return flusher->decrCommitInterval();
 }
 
@@ -560,6 +599,14 @@ void KVBucket::wakeUpFlusher() {
     // Nothing do to - no flusher in this class
 }
 
+void KVBucket::setFlusherBatchDeferDelay(size_t delayMs) {
+    // Nothing do to - no flusher in this class
+}
+
+void KVBucket::setFlusherBatchDeferItems(size_t items) {
+    // Nothing do to - no flusher in this class
+}
+
 void KVBucket::deleteExpiredItem(uint16_t vbid,
                                  const DocKey& key,
                                  time_t startTime,
@@ -975,8 +1022,7 @@ void KVBucket::compactInternal(compaction_ctx *ctx) {
     ExpiredItemsCBPtr expiry(new ExpiredItemsCallback(*this));
     ctx->expiryCallback = expiry;
 
-    KVShard* shard = vbMap.getShardByVbId(ctx->db_file_id);
-    KVStore* store = shard->getRWUnderlying();
+    KVStore* store = getRWUnderlying(ctx->db_file_id);
     bool result = store->compactDB(ctx);
 
     Configuration& config = getEPEngine().getConfiguration();
@@ -1132,7 +1178,11 @@ void KVBucket::snapshotStats() {
         ss << ep_real_time();
         snap.smap["ep_shutdown_time"] = ss.str();
     }
-    getOneRWUnderlying()->snapshotStats(snap.smap);
+    // The snapshot (engine stats, aggregated over every shard and writer)
+    // is a single file of the bucket's data directory: any read-write
+    // KVStore can write it.
+    vbMap.shards[EP_PRIMARY_SHARD]->getRWUnderlying()->snapshotStats(
+            snap.smap);
 }
 
 void KVBucket::completeBGFetch(const DocKey& key, uint16_t vbucket,
@@ -1606,7 +1656,7 @@ void KVBucket::reset() {
         RCPtr<VBucket> vb = getVBucket(vbid);
         if (vb) {
             LockHolder lh(vb_mutexes[vb->getId()]);
-            vb->ht.clear();
+            vb->clearInMemoryItems();
             vb->checkpointManager.clear(vb->getState());
             vb->resetStats();
             vb->setPersistedSnapshot(0, 0);
@@ -1789,12 +1839,23 @@ void KVBucket::flushOneDeleteAll() {
 
     --stats.diskQueueSize;
     setDeleteAllComplete();
+
+    // Every other writer held back its flush during the delete-all.
+    for (const auto& shard : vbMap.shards) {
+        for (size_t writer = 0; writer < shard->getNumWriters(); ++writer) {
+            Flusher* flusher = shard->getFlusher(writer);
+            if (flusher) {
+                flusher->notifyFlushEvent();
+            }
+        }
+    }
 }
 
 int KVBucket::flushVBucket(uint16_t vbid) {
     KVShard *shard = vbMap.getShardByVbId(vbid);
+    const size_t writerId = shard->getWriterId(vbid);
     if (diskDeleteAll && !deleteAllTaskCtx.delay) {
-        if (shard->getId() == EP_PRIMARY_SHARD) {
+        if (shard->getId() == EP_PRIMARY_SHARD && writerId == 0) {
             flushOneDeleteAll();
         } else {
             // disk flush is pending just return
@@ -1823,11 +1884,17 @@ int KVBucket::flushVBucket(uint16_t vbid) {
         // Append any 'backfill' items (mutations added by a TAP stream).
         vb->getBackfillItems(items);
 
-        // Append all items outstanding for the persistence cursor.
+        // Append the items outstanding for the persistence cursor, up to
+        // the batch limits (whole checkpoints at a time).
         snapshot_range_t range;
+        bool moreAvailable = false;
         hrtime_t _begin_ = gethrtime();
-        range = vb->checkpointManager.getAllItemsForCursor(
-                CheckpointManager::pCursorName, items);
+        range = vb->checkpointManager.getItemsForCursor(
+                CheckpointManager::pCursorName,
+                items,
+                flushBatchController.getItemLimit(),
+                flushBatchController.getByteLimit(),
+                moreAvailable);
         stats.persistenceCursorGetItemsHisto.add((gethrtime() - _begin_) / 1000);
 
         if (!items.empty()) {
@@ -1846,12 +1913,14 @@ int KVBucket::flushVBucket(uint16_t vbid) {
 
             bool mustCheckpointVBState = false;
             std::list<PersistenceCallback*>& pcbs = rwUnderlying->getPersistenceCbList();
+            rel_time_t oldestQueued = ep_current_time();
 
             for (const auto& item : items) {
 
                 if (!item->shouldPersist()) {
                     continue;
                 }
+                oldestQueued = std::min(oldestQueued, item->getQueuedTime());
 
                 if (item->getOperation() == queue_op::set_vbucket_state) {
                     // No actual item explicitly persisted to (this op exists
@@ -1930,6 +1999,10 @@ int KVBucket::flushVBucket(uint16_t vbid) {
                 }
             }
 
+            flushBatchController.batchFlushed(
+                    moreAvailable,
+                    std::chrono::seconds(ep_current_time() - oldestQueued));
+
             /* Perform an explicit commit to disk if the commit
              * interval reaches zero and if there is a non-zero number
              * of items to flush.
@@ -1941,9 +2014,9 @@ int KVBucket::flushVBucket(uint16_t vbid) {
              * each flushVBucket call.
              */
             if ((items_flushed > 0) &&
-                (decrCommitInterval(shard->getId()) == 0)) {
+                (decrCommitInterval(shard->getId(), writerId) == 0)) {
 
-                commit(shard->getId());
+                commit(shard->getId(), writerId);
 
                 // Now the commit is complete, vBucket file must exist.
                 if (vb->setBucketCreation(false)) {
@@ -1977,6 +2050,11 @@ int KVBucket::flushVBucket(uint16_t vbid) {
             wakeUpCheckpointRemover();
         }
 
+        if (moreAvailable) {
+            // The batch stopped at the limits: come back for the rest.
+            notifyFlusher(vbid);
+        }
+
         if (vb->rejectQueue.empty()) {
             vb->checkpointManager.itemsPersisted();
             uint64_t seqno = vb->getPersistenceSeqno();
@@ -1994,8 +2072,8 @@ int KVBucket::flushVBucket(uint16_t vbid) {
     return items_flushed;
 }
 
-void KVBucket::commit(uint16_t shardId) {
-    KVStore *rwUnderlying = getRWUnderlyingByShard(shardId);
+void KVBucket::commit(uint16_t shardId, size_t writerId) {
+    KVStore *rwUnderlying = vbMap.shards[shardId]->getRWUnderlying(writerId);
     std::list<PersistenceCallback *>& pcbs = rwUnderlying->getPersistenceCbList();
     BlockTimer timer(&stats.diskCommitHisto, "disk_commit", stats.timingLog);
     hrtime_t commit_start = gethrtime();
@@ -2024,6 +2102,8 @@ void KVBucket::commit(uint16_t shardId) {
         }
     }
 
+    stats.diskCommitDocsHisto.add(pcbs.size());
+
     while (!pcbs.empty()) {
          delete pcbs.front();
          pcbs.pop_front();
@@ -2031,6 +2111,8 @@ void KVBucket::commit(uint16_t shardId) {
 
     ++stats.flusherCommits;
     hrtime_t commit_end = gethrtime();
+    flushBatchController.commitCompleted(
+            std::chrono::microseconds((commit_end - commit_start) / 1000));
     uint64_t commit_time = (commit_end - commit_start) / 1000000;
     stats.commit_time.store(commit_time);
     stats.cumulativeCommitTime.fetch_add(commit_time);
@@ -2420,7 +2502,9 @@ void KVBucket::resetUnderlyingStats(void)
 {
     for (size_t i = 0; i < vbMap.shards.size(); i++) {
         KVShard *shard = vbMap.shards[i].get();
-        shard->getRWUnderlying()->resetStats();
+        for (size_t writer = 0; writer < shard->getNumWriters(); ++writer) {
+            shard->getRWUnderlying(writer)->resetStats();
+        }
         shard->getROUnderlying()->resetStats();
     }
 
@@ -2438,9 +2522,12 @@ void KVBucket::addKVStoreStats(ADD_STAT add_stat, const void* cookie) {
          * write instance whereas ForestKVStore has only instance
          * for both read write and read-only.
          */
+        KVShard* shard = vbMap.shards[i].get();
         std::set<KVStore *> underlyingSet;
-        underlyingSet.insert(vbMap.shards[i]->getRWUnderlying());
-        underlyingSet.insert(vbMap.shards[i]->getROUnderlying());
+        for (size_t writer = 0; writer < shard->getNumWriters(); ++writer) {
+            underlyingSet.insert(shard->getRWUnderlying(writer));
+        }
+        underlyingSet.insert(shard->getROUnderlying());
 
         for (auto* store : underlyingSet) {
             store->addStats(add_stat, cookie);
@@ -2450,9 +2537,12 @@ void KVBucket::addKVStoreStats(ADD_STAT add_stat, const void* cookie) {
 
 void KVBucket::addKVStoreTimingStats(ADD_STAT add_stat, const void* cookie) {
     for (size_t i = 0; i < vbMap.shards.size(); i++) {
+        KVShard* shard = vbMap.shards[i].get();
         std::set<KVStore*> underlyingSet;
-        underlyingSet.insert(vbMap.shards[i]->getRWUnderlying());
-        underlyingSet.insert(vbMap.shards[i]->getROUnderlying());
+        for (size_t writer = 0; writer < shard->getNumWriters(); ++writer) {
+            underlyingSet.insert(shard->getRWUnderlying(writer));
+        }
+        underlyingSet.insert(shard->getROUnderlying());
 
         for (auto* store : underlyingSet) {
             store->addTimingStats(add_stat, cookie);
@@ -2473,8 +2563,12 @@ bool KVBucket::getKVStoreStat(const char* name, size_t& value, KVSOption option)
         }
 
         if (option == KVSOption::RW || option == KVSOption::BOTH) {
-            success &= shard->getRWUnderlying()->getStat(name, per_shard_value);
-            value += per_shard_value;
+            for (size_t writer = 0; writer < shard->getNumWriters();
+                 ++writer) {
+                success &= shard->getRWUnderlying(writer)->getStat(
+                        name, per_shard_value);
+                value += per_shard_value;
+            }
         }
     }
     return success;
@@ -2484,10 +2578,6 @@ KVStore *KVBucket::getOneROUnderlying(void) {
     return vbMap.shards[EP_PRIMARY_SHARD]->getROUnderlying();
 }
 
-KVStore *KVBucket::getOneRWUnderlying(void) {
-    return vbMap.shards[EP_PRIMARY_SHARD]->getRWUnderlying();
-}
-
 class Rollback : public RollbackCB {
 public:
     Rollback(EventuallyPersistentEngine& e)
@@ -2591,7 +2681,7 @@ ENGINE_ERROR_CODE KVBucket::rollback(uint16_t vbid, uint64_t rollbackSeqno) {
                                         (vb->checkpointManager.getHighSeqno());
         if (rollbackSeqno != 0) {
             std::shared_ptr<Rollback> cb(new Rollback(engine));
-            KVStore* rwUnderlying = vbMap.getShardByVbId(vbid)->getRWUnderlying();
+            KVStore* rwUnderlying = getRWUnderlying(vbid);
             RollbackResult result = rwUnderlying->rollback(vbid, rollbackSeqno, cb);
 
             if (result.success) {
@@ -2636,6 +2726,12 @@ void KVBucket::setCursorDroppingLowerUpperThresholds(size_t maxSize) {
                     ((double)(config.getCursorDroppingUpperMark()) / 100)));
 }
 
+void KVBucket::setCheckpointMemoryQuota(size_t maxSize) {
+    Configuration &config = engine.getConfiguration();
+    stats.checkpointMemQuota.store(static_cast<size_t>(maxSize *
+                    ((double)(config.getChkMemQuotaPercent()) / 100)));
+}
+
 size_t KVBucket::getActiveResidentRatio() const {
     return cachedResidentRatio.activeRatio.load();
 }
@@ -2666,12 +2762,17 @@ void KVBucket::notifyNewSeqno(const uint16_t vbid,
     if (notifyCtx.notifyReplication) {
         notifyReplication(vbid, notifyCtx.bySeqno);
     }
+    // Don't wait for the next periodic run of the checkpoint remover to
+    // release (or drop the cursors holding) checkpoint memory.
+    if (stats.isCheckpointMemQuotaExceeded()) {
+        wakeUpCheckpointRemover();
+    }
 }
 
 void KVBucket::notifyFlusher(const uint16_t vbid) {
     KVShard* shard = vbMap.getShardByVbId(vbid);
     if (shard) {
-        shard->getFlusher()->notifyFlushEvent();
+        shard->getFlusher(shard->getWriterId(vbid))->notifyFlushEvent();
     } else {
         throw std::logic_error(
                 "KVBucket::notifyFlusher() : shard null for "
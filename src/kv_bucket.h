@@ -18,6 +18,7 @@
 
 #include "ep_types.h"
 #include "executorpool.h"
+#include "flush_batch_controller.h"
 #include "mutation_log.h"
 #include "storeddockey.h"
 #include "stored-value.h"
@@ -284,6 +285,10 @@ public:
     virtual bool resumeFlusher();
     virtual void wakeUpFlusher();
 
+    /// Set the batching deferral delay (ms) / item threshold of the flushers.
+    virtual void setFlusherBatchDeferDelay(size_t delayMs);
+    virtual void setFlusherBatchDeferItems(size_t items);
+
     /**
      * Takes a snapshot of the current stats and persists them to disk.
      */
@@ -467,7 +472,7 @@ public:
      */
     Position endPosition() const;
 
-    const Flusher* getFlusher(uint16_t shardId);
+    const Flusher* getFlusher(uint16_t vbid);
 
     Warmup* getWarmup(void) const;
 
@@ -499,11 +504,8 @@ public:
 
 
     KVStore* getRWUnderlying(uint16_t vbId) {
-        return vbMap.getShardByVbId(vbId)->getRWUnderlying();
-    }
-
-    KVStore* getRWUnderlyingByShard(size_t shardId) {
-        return vbMap.shards[shardId]->getRWUnderlying();
+        KVShard* shard = vbMap.getShardByVbId(vbId);
+        return shard->getRWUnderlying(shard->getWriterId(vbId));
     }
 
     KVStore* getROUnderlyingByShard(size_t shardId) {
@@ -547,6 +549,10 @@ public:
         return lastTransTimePerItem.load();
     }
 
+    FlushBatchController& getFlushBatchController() {
+        return flushBatchController;
+    }
+
     bool isDeleteAllScheduled() {
         return diskDeleteAll.load();
     }
@@ -622,7 +628,7 @@ public:
      */
     int flushVBucket(uint16_t vbid);
 
-    void commit(uint16_t shardId);
+    void commit(uint16_t shardId, size_t writerId);
 
     void addKVStoreStats(ADD_STAT add_stat, const void* cookie);
 
@@ -642,7 +648,6 @@ public:
 
     void resetUnderlyingStats(void);
     KVStore *getOneROUnderlying(void);
-    KVStore *getOneRWUnderlying(void);
 
     item_eviction_policy_t getItemEvictionPolicy(void) const {
         return eviction_policy;
@@ -708,6 +713,12 @@ public:
 
     void setCursorDroppingLowerUpperThresholds(size_t maxSize);
 
+    /**
+     * Set the memory quota of the checkpoints of all vbuckets, as the
+     * chk_mem_quota_percent of the given bucket quota.
+     */
+    void setCheckpointMemoryQuota(size_t maxSize);
+
     bool isAccessScannerEnabled() {
         LockHolder lh(accessScanner.mutex);
         return accessScanner.enabled;
@@ -782,9 +793,9 @@ protected:
                          vbucket_state_t allowedState,
                          get_options_t options = TRACK_REFERENCE);
 
-    uint16_t getCommitInterval(uint16_t shardId);
+    uint16_t getCommitInterval(uint16_t shardId, size_t writerId);
 
-    uint16_t decrCommitInterval(uint16_t shardId);
+    uint16_t decrCommitInterval(uint16_t shardId, size_t writerId);
 
     /*
      * Helper method for the rollback function.
@@ -858,6 +869,8 @@ protected:
     } cachedResidentRatio;
     size_t statsSnapshotTaskId;
     std::atomic<size_t> lastTransTimePerItem;
+    //! Sizes the batches read by the flushers (see flushVBucket()).
+    FlushBatchController flushBatchController;
     item_eviction_policy_t eviction_policy;
 
     std::mutex compactionLock;
@@ -587,7 +587,8 @@ public:
      */
     virtual Position endPosition() const = 0;
 
-    virtual const Flusher* getFlusher(uint16_t shardId) = 0;
+    /// The flusher persisting the given vbucket (nullptr if none).
+    virtual const Flusher* getFlusher(uint16_t vbid) = 0;
 
     virtual Warmup* getWarmup(void) const = 0;
 
@@ -621,8 +622,6 @@ public:
 
     virtual KVStore* getRWUnderlying(uint16_t vbId) = 0;
 
-    virtual KVStore* getRWUnderlyingByShard(size_t shardId) = 0;
-
     virtual KVStore* getROUnderlyingByShard(size_t shardId) = 0;
 
     virtual KVStore* getROUnderlying(uint16_t vbId) = 0;
@@ -714,7 +713,8 @@ public:
      */
     virtual int flushVBucket(uint16_t vbid) = 0;
 
-    virtual void commit(uint16_t shardId) = 0;
+    /// Commit the transaction of the given writer of a shard (see KVShard).
+    virtual void commit(uint16_t shardId, size_t writerId) = 0;
 
     virtual void addKVStoreStats(ADD_STAT add_stat, const void* cookie) = 0;
 
@@ -745,7 +745,6 @@ public:
 
     virtual void resetUnderlyingStats(void) = 0;
     virtual KVStore *getOneROUnderlying(void) = 0;
-    virtual KVStore *getOneRWUnderlying(void) = 0;
 
     virtual item_eviction_policy_t getItemEvictionPolicy(void) const  = 0;
     virtual ENGINE_ERROR_CODE rollback(uint16_t vbid,
@@ -836,9 +835,9 @@ protected:
                                  vbucket_state_t allowedState,
                                  get_options_t options = TRACK_REFERENCE) = 0;
 
-    virtual uint16_t getCommitInterval(uint16_t shardId) = 0;
+    virtual uint16_t getCommitInterval(uint16_t shardId, size_t writerId) = 0;
 
-    virtual uint16_t decrCommitInterval(uint16_t shardId) = 0;
+    virtual uint16_t decrCommitInterval(uint16_t shardId, size_t writerId) = 0;
 
     // During the warmup phase we might want to enable external traffic
     // at a given point in time.. The LoadStorageKvPairCallback will be
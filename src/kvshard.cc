@@ -32,14 +32,28 @@ KVShard::KVShard(uint16_t id, KVBucket& kvBucket)
     : kvConfig(kvBucket.getEPEngine().getConfiguration(), id),
       vbuckets(kvConfig.getMaxVBuckets()),
       highPriorityCount(0) {
+    Configuration& config = kvBucket.getEPEngine().getConfiguration();
+    const bool persistent = config.getBucketType() == "persistent";
     const std::string backend = kvConfig.getBackend();
     uint16_t commitInterval = 1;
 
     if (backend == "couchdb") {
-        rwStore.reset(KVStoreFactory::create(kvConfig, false));
+        rwStores.emplace_back(KVStoreFactory::create(kvConfig, false));
         roStore.reset(KVStoreFactory::create(kvConfig, true));
+
+        // Additional writers, each with its own read-write KVStore (a
+        // couchstore file per vbucket lets them write concurrently).
+        const size_t writers = persistent ? config.getFlushersPerShard() : 1;
+        for (size_t writer = 1; writer < writers; ++writer) {
+            writerConfigs.emplace_back(
+                    std::make_unique<KVStoreConfig>(config, id));
+            writerConfigs.back()->setWriterId(writer);
+            rwStores.emplace_back(
+                    KVStoreFactory::create(*writerConfigs.back(), false));
+        }
     } else if (backend == "forestdb") {
-        rwStore.reset(KVStoreFactory::create(kvConfig));
+        // A single file per shard: a single writer.
+        rwStores.emplace_back(KVStoreFactory::create(kvConfig));
         commitInterval = kvConfig.getMaxVBuckets() / kvConfig.getMaxShards();
     } else {
         throw std::logic_error(
@@ -48,9 +62,15 @@ KVShard::KVShard(uint16_t id, KVBucket& kvBucket)
                 backend + "'");
     }
 
-    if (kvBucket.getEPEngine().getConfiguration().getBucketType() ==
-        "persistent") {
-        flusher = std::make_unique<Flusher>(&kvBucket, this, commitInterval);
+    if (persistent) {
+        for (size_t writer = 0; writer < rwStores.size(); ++writer) {
+            flushers.emplace_back(std::make_unique<Flusher>(
+                    &kvBucket, this, commitInterval, writer));
+            flushers.back()->setBatchDeferDelay(
+                    config.getFlusherBatchDeferDelay());
+            flushers.back()->setBatchDeferItems(
+                    config.getFlusherBatchDeferItems());
+        }
         bgFetcher = std::make_unique<BgFetcher>(kvBucket, *this);
     }
 }
@@ -59,8 +79,11 @@ KVShard::KVShard(uint16_t id, KVBucket& kvBucket)
 // unique_ptrs of forward-declared items
 KVShard::~KVShard() = default;
 
-Flusher *KVShard::getFlusher() {
-    return flusher.get();
+Flusher *KVShard::getFlusher(size_t writerId) {
+    if (flushers.empty()) {
+        return nullptr;
+    }
+    return flushers[writerId].get();
 }
 
 BgFetcher *KVShard::getBgFetcher() {
@@ -109,6 +132,6 @@ std::vector<VBucket::id_type> KVShard::getVBuckets() {
 
 void NotifyFlusherCB::callback(uint16_t &vb) {
     if (shard->getBucket(vb)) {
-        shard->getFlusher()->notifyFlushEvent();
+        shard->getFlusher(shard->getWriterId(vb))->notifyFlushEvent();
     }
 }
@@ -43,13 +43,18 @@
  *   |                                 |
  *   | vbuckets: VBucket[] (partitions)|----> [(VBucket),(VBucket)..]
  *   |                                 |
- *   | flusher: Flusher                |
+ *   | flusher: Flusher[] (writers)    |
  *   | BGFetcher: bgFetcher            |
  *   |                                 |
- *   | rwUnderlying: KVStore (write)   |----> (CouchKVStore)
+ *   | rwUnderlying: KVStore[] (write) |----> [(CouchKVStore)..]
  *   | roUnderlying: KVStore (read)    |----> (CouchKVStore)
  *   -----------------------------------
  *
+ * A shard may have several writers (flushers_per_shard), each made of a
+ * Flusher and its own read-write KVStore, so that disjoint vbuckets of the
+ * shard are persisted concurrently. A vbucket always belongs to the same
+ * writer (see getWriterId()), whose KVStore must be used for any write to
+ * it (flush, snapshot, compaction, deletion, rollback).
  */
 class BgFetcher;
 class Flusher;
@@ -62,18 +67,28 @@ public:
     KVShard(KVShard::id_type id, KVBucket& store);
     ~KVShard();
 
-    KVStore* getRWUnderlying() {
-        return rwStore.get();
+    /// The read-write KVStore of the given writer.
+    KVStore* getRWUnderlying(size_t writerId = 0) {
+        return rwStores[writerId].get();
     }
 
     KVStore* getROUnderlying() {
         if (roStore) {
             return roStore.get();
         }
-        return rwStore.get();
+        return rwStores[0].get();
     }
 
-    Flusher *getFlusher();
+    size_t getNumWriters() const {
+        return rwStores.size();
+    }
+
+    /// The writer (flusher and read-write KVStore) owning the vbucket.
+    size_t getWriterId(VBucket::id_type vbid) const {
+        return (vbid / kvConfig.getMaxShards()) % rwStores.size();
+    }
+
+    Flusher *getFlusher(size_t writerId = 0);
     BgFetcher *getBgFetcher();
 
     RCPtr<VBucket> getBucket(VBucket::id_type id) const;
@@ -91,10 +106,13 @@ private:
     KVStoreConfig kvConfig;
     std::vector<RCPtr<VBucket>> vbuckets;
 
-    std::unique_ptr<KVStore> rwStore;
+    //! Configuration of the additional writers' KVStores (which refer to
+    //! it), distinguished by their writer id.
+    std::vector<std::unique_ptr<KVStoreConfig>> writerConfigs;
+    std::vector<std::unique_ptr<KVStore>> rwStores;
     std::unique_ptr<KVStore> roStore;
 
-    std::unique_ptr<Flusher> flusher;
+    std::vector<std::unique_ptr<Flusher>> flushers;
     std::unique_ptr<BgFetcher> bgFetcher;
 
 public:
@@ -40,6 +40,9 @@ KVStoreConfig::KVStoreConfig(Configuration& config, uint16_t shardid)
                     config.getBackend(),
                     shardid,
                     config.isCollectionsPrototypeEnabled()) {
+    setIoBackend(config.getCouchstoreIoBackend(),
+                 config.getCouchstoreIoUringDepth(),
+                 config.isCouchstoreIoUringDirect());
 }
 
 KVStoreConfig::KVStoreConfig(uint16_t _maxVBuckets,
@@ -53,9 +56,13 @@ KVStoreConfig::KVStoreConfig(uint16_t _maxVBuckets,
       dbname(_dbname),
       backend(_backend),
       shardId(_shardId),
+      writerId(0),
       logger(&global_logger),
       buffered(true),
-      persistDocNamespace(_persistDocNamespace) {
+      persistDocNamespace(_persistDocNamespace),
+      ioBackend("sync"),
+      ioUringDepth(64),
+      ioUringDirect(false) {
 }
 
 KVStoreConfig& KVStoreConfig::setLogger(Logger& _logger) {
@@ -68,6 +75,20 @@ KVStoreConfig& KVStoreConfig::setBuffered(bool _buffered) {
     return *this;
 }
 
+KVStoreConfig& KVStoreConfig::setWriterId(size_t _writerId) {
+    writerId = _writerId;
+    return *this;
+}
+
+KVStoreConfig& KVStoreConfig::setIoBackend(const std::string& _ioBackend,
+                                           size_t _ioUringDepth,
+                                           bool _ioUringDirect) {
+    ioBackend = _ioBackend;
+    ioUringDepth = _ioUringDepth;
+    ioUringDirect = _ioUringDirect;
+    return *this;
+}
+
 KVStore *KVStoreFactory::create(KVStoreConfig &config, bool read_only) {
     KVStore *ret = NULL;
     std::string backend = config.getBackend();
@@ -217,6 +238,9 @@ void KVStore::addStats(ADD_STAT add_stat, const void *c) {
         prefixStream << "ro_" << shardId;
     } else {
         prefixStream << "rw_" << shardId;
+        if (configuration.getWriterId() != 0) {
+            prefixStream << "_" << configuration.getWriterId();
+        }
     }
 
     const std::string& prefix = prefixStream.str();
@@ -257,6 +281,14 @@ void KVStore::addStats(ADD_STAT add_stat, const void *c) {
             st.fsStatsCompaction.totalBytesRead, add_stat, c);
     addStat(prefix, "io_compaction_write_bytes",
             st.fsStatsCompaction.totalBytesWritten, add_stat, c);
+
+    if (!isReadOnly()) {
+        const size_t flushDocs = st.io_flush_docs;
+        const double readsPerItem =
+                flushDocs == 0 ? 0 : double(st.io_flush_reads) / flushDocs;
+        addStat(prefix, "io_flush_reads", st.io_flush_reads, add_stat, c);
+        addStat(prefix, "io_flush_reads_per_item", readsPerItem, add_stat, c);
+    }
 }
 
 void KVStore::addTimingStats(ADD_STAT add_stat, const void *c) {
@@ -275,6 +307,9 @@ void KVStore::addTimingStats(ADD_STAT add_stat, const void *c) {
         prefixStream << "ro_" << shardId;
     } else {
         prefixStream << "rw_" << shardId;
+        if (configuration.getWriterId() != 0) {
+            prefixStream << "_" << configuration.getWriterId();
+        }
     }
 
     const std::string& prefix = prefixStream.str();
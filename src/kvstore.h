@@ -327,6 +327,7 @@ public:
         readSeekHisto(ExponentialGenerator<size_t>(1, 2), 50),
         readSizeHisto(ExponentialGenerator<size_t>(1, 2), 25),
         writeSizeHisto(ExponentialGenerator<size_t>(1, 2), 25),
+        totalReads(0),
         totalBytesRead(0),
         totalBytesWritten(0) { }
 
@@ -343,6 +344,8 @@ public:
     //Time spent in sync
     Histogram<hrtime_t> syncTimeHisto;
 
+    // Number of reads from disk.
+    std::atomic<size_t> totalReads;
     // total bytes read from disk.
     std::atomic<size_t> totalBytesRead;
     // Total bytes written to disk.
@@ -355,6 +358,7 @@ public:
         writeTimeHisto.reset();
         writeSizeHisto.reset();
         syncTimeHisto.reset();
+        totalReads = 0;
         totalBytesRead = 0;
         totalBytesWritten = 0;
     }
@@ -383,6 +387,8 @@ public:
       io_num_write(0),
       io_read_bytes(0),
       io_write_bytes(0),
+      io_flush_reads(0),
+      io_flush_docs(0),
       readSizeHisto(ExponentialGenerator<size_t>(1, 2), 25),
       writeSizeHisto(ExponentialGenerator<size_t>(1, 2), 25) {
     }
@@ -437,6 +443,11 @@ public:
     Couchbase::RelaxedAtomic<size_t> io_read_bytes;
     //! Number of bytes written (key + value + application rev metadata)
     Couchbase::RelaxedAtomic<size_t> io_write_bytes;
+    //! Number of disk reads made while saving flushed documents (B-tree
+    //! nodes missing from the underlying store's read buffer)
+    Couchbase::RelaxedAtomic<size_t> io_flush_reads;
+    //! Number of flushed documents saved
+    Couchbase::RelaxedAtomic<size_t> io_flush_docs;
 
     /* for flush and vb delete, no error handling in KVStore, such
      * failure should be tracked in MC-engine  */
@@ -597,6 +608,16 @@ public:
         return shardId;
     }
 
+    /**
+     * Index of the writer of the shard using this configuration, when the
+     * shard has several read-write KVStores (see KVShard).
+     */
+    size_t getWriterId() const {
+        return writerId;
+    }
+
+    KVStoreConfig& setWriterId(size_t _writerId);
+
     Logger& getLogger() {
         return *logger;
     }
@@ -631,15 +652,41 @@ public:
         persistDocNamespace = value;
     }
 
+    /**
+     * How the underlying file I/O is done: "sync" or "io_uring", the
+     * latter with the given queue depth and optionally direct I/O.
+     *
+     * Only recognised by CouchKVStore
+     */
+    const std::string& getIoBackend() const {
+        return ioBackend;
+    }
+
+    size_t getIoUringDepth() const {
+        return ioUringDepth;
+    }
+
+    bool isIoUringDirect() const {
+        return ioUringDirect;
+    }
+
+    KVStoreConfig& setIoBackend(const std::string& _ioBackend,
+                                size_t _ioUringDepth,
+                                bool _ioUringDirect);
+
 private:
     uint16_t maxVBuckets;
     uint16_t maxShards;
     std::string dbname;
     std::string backend;
     uint16_t shardId;
+    size_t writerId;
     Logger* logger;
     bool buffered;
     bool persistDocNamespace;
+    std::string ioBackend;
+    size_t ioUringDepth;
+    bool ioUringDirect;
 };
 
 class IORequest {
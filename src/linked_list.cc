@@ -0,0 +1,520 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "linked_list.h"
+
+#include <platform/make_unique.h>
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+/* A tombstone purge checks its deadline every this many elements */
+static const size_t purgeDeadlineCheckInterval = 100;
+
+BasicLinkedList::BasicLinkedList(uint16_t vbucketId, EPStats& st)
+    : SequenceList(),
+      head(nullptr),
+      tail(nullptr),
+      rangeReadInProgress(false),
+      purgePosition(nullptr),
+      st(st),
+      readRange(0, 0),
+      vbid(vbucketId),
+      numItems(0),
+      numStaleItems(0),
+      staleSize(0),
+      staleMetaDataSize(0),
+      numClears(0),
+      highSeqno(0),
+      highestDedupedSeqno(0) {
+}
+
+BasicLinkedList::~BasicLinkedList() {
+    /* Delete stale items here, other items are deleted by the hash table */
+    std::lock_guard<std::mutex> writeGuard(writeLock);
+    OrderedStoredValue* v = head;
+    while (v) {
+        OrderedStoredValue* next = v->seqNext;
+        if (v->isStale(writeGuard)) {
+            freeStaleItem(writeGuard, v);
+        }
+        v = next;
+    }
+    head = tail = nullptr;
+}
+
+void BasicLinkedList::appendToList(std::lock_guard<std::mutex>& seqLock,
+                                   OrderedStoredValue& v) {
+    /* Allow only one write to the list at a time */
+    std::lock_guard<std::mutex> writeGuard(writeLock);
+    linkAtTail(writeGuard, v);
+    ++numItems;
+}
+
+SequenceList::UpdateStatus BasicLinkedList::updateListElem(
+        std::lock_guard<std::mutex>& seqLock, OrderedStoredValue& v) {
+    /* Allow only one write to the list at a time */
+    std::lock_guard<std::mutex> writeGuard(writeLock);
+
+    {
+        /* Lock that needed for consistent read of SeqRange 'readRange' */
+        std::lock_guard<SpinLock> lh(rangeLock);
+        if (readRange.fallsInRange(v.getBySeqno())) {
+            /* Range read is in middle of a point-in-time snapshot, hence we
+               cannot move the element to the end of the list. Return a temp
+               failure */
+            return UpdateStatus::Append;
+        }
+    }
+
+    /* Since there is no other reads or writes happenning in this range, we
+       can move the item to the end of the list */
+    unlink(writeGuard, v);
+    linkAtTail(writeGuard, v);
+    return UpdateStatus::Success;
+}
+
+/**
+ * The RangeIterator of a BasicLinkedList. Walks the list from the element
+ * at the head when the read started to the one at the tail, narrowing the
+ * read range as it goes so that writers can move the elements already read.
+ *
+ * Stale elements are not freed while a range read is in progress, and the
+ * elements in the read range are not moved, hence the position can be kept
+ * between calls to next(). Only a clear() can unlink the elements; the
+ * iterator then stops without touching them again.
+ */
+class BasicLinkedList::RangeIteratorLL : public SequenceList::RangeIterator {
+public:
+    RangeIteratorLL(BasicLinkedList& list,
+                    OrderedStoredValue* first,
+                    OrderedStoredValue* last,
+                    seqno_t start,
+                    seqno_t end,
+                    uint64_t numClears)
+        : list(list),
+          curr(first),
+          last(last),
+          start(start),
+          end(end),
+          numClears(numClears),
+          finished(false) {
+    }
+
+    ~RangeIteratorLL() {
+        finish();
+    }
+
+    std::pair<ENGINE_ERROR_CODE, std::unique_ptr<Item>> next() override;
+
+    seqno_t getEnd() const override {
+        return end;
+    }
+
+private:
+    /* Ends the range read, letting writers move any element again */
+    void finish();
+
+    BasicLinkedList& list;
+
+    /* The next element to read; null once the snapshot has been read */
+    OrderedStoredValue* curr;
+
+    /* The element at the tail when the read started */
+    OrderedStoredValue* const last;
+
+    const seqno_t start;
+    const seqno_t end;
+
+    /* list.numClears when the read started */
+    const uint64_t numClears;
+
+    bool finished;
+};
+
+std::pair<ENGINE_ERROR_CODE, std::unique_ptr<Item>>
+BasicLinkedList::RangeIteratorLL::next() {
+    while (curr) {
+        std::lock_guard<std::mutex> writeGuard(list.writeLock);
+        if (list.numClears != numClears) {
+            /* The elements have been unlinked, and the stale ones freed */
+            curr = nullptr;
+            return {ENGINE_TMPFAIL, nullptr};
+        }
+
+        const seqno_t currSeqno = curr->getBySeqno();
+        if (currSeqno > end) {
+            /* We have read all the items in the requested range */
+            break;
+        }
+
+        /* Check if this OSV has been made stale. If it has been removed
+           without a replacement, or superseded by a newer version which is
+           /also/ in the range we are reading, we should skip this item to
+           avoid returning removed items or duplicates */
+        bool replacedInRange = false;
+        if (curr->isStale(writeGuard)) {
+            StoredValue* replacement = curr->getReplacementIfStale(writeGuard);
+            replacedInRange = !replacement || replacement->getBySeqno() <= end;
+        }
+
+        if (currSeqno > 0) {
+            /* Everything before this element has been read and may be moved
+               by writers from now on */
+            std::lock_guard<SpinLock> lh(list.rangeLock);
+            list.readRange.setBegin(currSeqno);
+        }
+
+        std::unique_ptr<Item> item;
+        if (currSeqno >= start && !replacedInRange) {
+            try {
+                item.reset(curr->toItem(false, list.vbid));
+            } catch (const std::bad_alloc&) {
+                LOG(EXTENSION_LOG_WARNING,
+                    "BasicLinkedList::RangeIteratorLL::next(): "
+                    "(vb %" PRIu16 ") ENOMEM while trying to copy "
+                    "item with seqno %" PRIi64 " before streaming it",
+                    list.vbid,
+                    currSeqno);
+                return {ENGINE_ENOMEM, nullptr};
+            }
+        }
+
+        curr = (curr == last) ? nullptr : curr->seqNext;
+        if (item) {
+            return {ENGINE_SUCCESS, std::move(item)};
+        }
+    }
+
+    curr = nullptr;
+    finish();
+    return {ENGINE_SUCCESS, nullptr};
+}
+
+void BasicLinkedList::RangeIteratorLL::finish() {
+    if (finished) {
+        return;
+    }
+    finished = true;
+
+    std::lock_guard<std::mutex> rangeReadGuard(list.rangeReadLock);
+    {
+        std::lock_guard<SpinLock> lh(list.rangeLock);
+        list.readRange.reset();
+    }
+    list.rangeReadInProgress = false;
+}
+
+std::pair<ENGINE_ERROR_CODE, std::unique_ptr<SequenceList::RangeIterator>>
+BasicLinkedList::makeRangeIterator(std::unique_lock<std::mutex>& seqLock,
+                                   seqno_t start,
+                                   seqno_t end) {
+    if ((start > end) || (start <= 0)) {
+        seqLock.unlock();
+        LOG(EXTENSION_LOG_WARNING,
+            "BasicLinkedList::makeRangeIterator(): "
+            "(vb:%" PRIu16 ") ERANGE: start %" PRIi64 " > end %" PRIi64,
+            vbid,
+            start,
+            end);
+        return {ENGINE_ERANGE, nullptr};
+    }
+
+    std::lock_guard<std::mutex> rangeReadGuard(rangeReadLock);
+    if (rangeReadInProgress) {
+        /* Allows only 1 range read at a time */
+        seqLock.unlock();
+        return {ENGINE_TMPFAIL, nullptr};
+    }
+
+    std::unique_ptr<RangeIterator> itr;
+    {
+        std::lock_guard<std::mutex> writeGuard(writeLock);
+        if (start > highSeqno) {
+            seqLock.unlock();
+            LOG(EXTENSION_LOG_WARNING,
+                "BasicLinkedList::makeRangeIterator(): "
+                "(vb:%" PRIu16 ") ERANGE: start %" PRIi64
+                " > highSeqno %" PRIi64,
+                vbid,
+                start,
+                static_cast<seqno_t>(highSeqno));
+            return {ENGINE_ERANGE, nullptr};
+        }
+
+        /* Mark the initial read range. The snapshot must extend at least to
+           the highest de-duplicated seqno, else an item which was moved
+           beyond 'end' would be missing from the snapshot */
+        end = std::min(end, static_cast<seqno_t>(highSeqno));
+        end = std::max(end, static_cast<seqno_t>(highestDedupedSeqno));
+        {
+            std::lock_guard<SpinLock> lh(rangeLock);
+            readRange = SeqRange(1, end);
+        }
+
+        /* Anything linked after the current tail is appended (or moved)
+           after this point and hence has a seqno beyond the snapshot */
+        itr = std::make_unique<RangeIteratorLL>(
+                *this, head, tail, start, end, numClears);
+    }
+    rangeReadInProgress = true;
+
+    /* The read range is marked; writers can proceed and will not touch the
+       elements in the range */
+    seqLock.unlock();
+
+    return {ENGINE_SUCCESS, std::move(itr)};
+}
+
+std::tuple<ENGINE_ERROR_CODE, SequenceList::RangeReadItems, seqno_t>
+BasicLinkedList::rangeRead(std::unique_lock<std::mutex>& seqLock,
+                           seqno_t start,
+                           seqno_t end) {
+    ENGINE_ERROR_CODE status;
+    std::unique_ptr<RangeIterator> itr;
+    std::tie(status, itr) = makeRangeIterator(seqLock, start, end);
+    if (status != ENGINE_SUCCESS) {
+        return std::make_tuple(status, RangeReadItems(), 0);
+    }
+
+    RangeReadItems items;
+    while (true) {
+        std::unique_ptr<Item> item;
+        std::tie(status, item) = itr->next();
+        if (status != ENGINE_SUCCESS) {
+            return std::make_tuple(status, RangeReadItems(), 0);
+        }
+        if (!item) {
+            break;
+        }
+        items.push_back(std::move(item));
+    }
+
+    /* Return all the range read items */
+    return std::make_tuple(ENGINE_SUCCESS, std::move(items), itr->getEnd());
+}
+
+void BasicLinkedList::updateHighSeqno(std::lock_guard<std::mutex>& seqLock,
+                                      const OrderedStoredValue& v) {
+    std::lock_guard<std::mutex> writeGuard(writeLock);
+    highSeqno = v.getBySeqno();
+}
+
+void BasicLinkedList::updateHighestDedupedSeqno(
+        std::lock_guard<std::mutex>& seqLock, const OrderedStoredValue& v) {
+    std::lock_guard<std::mutex> writeGuard(writeLock);
+    highestDedupedSeqno = v.getBySeqno();
+}
+
+void BasicLinkedList::markItemStale(std::lock_guard<std::mutex>& seqLock,
+                                    StoredValue* ownedSv,
+                                    StoredValue* replacement) {
+    /* Release the StoredValue as BasicLinkedList does not want it to be of
+       owned type */
+    OrderedStoredValue* v = ownedSv->toOrderedStoredValue();
+
+    /* Update the stats tracking the memory owned by the list. The HashTable
+       has already stopped accounting for this object */
+    staleSize.fetch_add(v->size());
+    staleMetaDataSize.fetch_add(v->metaDataSize());
+    st.currentSize.fetch_add(v->metaDataSize());
+
+    ++numStaleItems;
+    std::lock_guard<std::mutex> writeGuard(writeLock);
+    v->markStale(writeGuard, replacement);
+}
+
+void BasicLinkedList::clear(std::lock_guard<std::mutex>& seqLock) {
+    clearChunk(seqLock, std::numeric_limits<size_t>::max());
+}
+
+bool BasicLinkedList::clearChunk(std::lock_guard<std::mutex>& seqLock,
+                                 size_t maxItems) {
+    /* Serialise with a tombstone purge walking the list. A range read in
+       progress is cancelled instead: it may last as long as its DCP client
+       takes to drain it */
+    std::lock_guard<std::mutex> rangeReadGuard(rangeReadLock);
+    std::lock_guard<std::mutex> writeGuard(writeLock);
+    ++numClears;
+    {
+        std::lock_guard<SpinLock> lh(rangeLock);
+        readRange.reset();
+    }
+    purgePosition = nullptr;
+
+    /* Unlink from the head, so that what is left is still a valid list */
+    size_t unlinked = 0;
+    while (head && unlinked < maxItems) {
+        OrderedStoredValue* v = head;
+        head = v->seqNext;
+        if (v->isStale(writeGuard)) {
+            freeStaleItem(writeGuard, v);
+        } else {
+            v->seqPrev = v->seqNext = nullptr;
+        }
+        --numItems;
+        ++unlinked;
+    }
+
+    if (head) {
+        head->seqPrev = nullptr;
+        return false;
+    }
+    tail = nullptr;
+    numItems = 0;
+    highSeqno = 0;
+    highestDedupedSeqno = 0;
+    return true;
+}
+
+size_t BasicLinkedList::purgeTombstones(hrtime_t deadline, bool& paused) {
+    paused = false;
+
+    /* Stale items are only freed while no range read is in progress, else
+       a reader could be positioned on (or be about to read the replacement
+       pointer of) an item freed here. A range read may last long (as long
+       as the DCP client takes to drain it), so rather than waiting for it
+       the stale items are left for the next purge */
+    std::lock_guard<std::mutex> rangeReadGuard(rangeReadLock);
+    if (rangeReadInProgress) {
+        return 0;
+    }
+
+    OrderedStoredValue* v;
+    {
+        std::lock_guard<std::mutex> writeGuard(writeLock);
+        v = purgePosition ? purgePosition : head;
+    }
+    purgePosition = nullptr;
+
+    /* writeLock is only held for one element at a time so that front end
+       writes are not blocked for the whole walk. Writers may move
+       non-stale elements to the tail under us, in which case some stale
+       items may be skipped until the next purge; they never free elements
+       (only this function and clear(), both under rangeReadLock, do) */
+    size_t purgedCount = 0;
+    size_t visitedCount = 0;
+    while (v) {
+        if ((++visitedCount % purgeDeadlineCheckInterval) == 0 &&
+            gethrtime() >= deadline) {
+            purgePosition = v;
+            paused = true;
+            break;
+        }
+
+        std::lock_guard<std::mutex> writeGuard(writeLock);
+        OrderedStoredValue* next = v->seqNext;
+        if (v->isStale(writeGuard)) {
+            unlink(writeGuard, *v);
+            --numItems;
+            freeStaleItem(writeGuard, v);
+            ++purgedCount;
+        }
+        v = next;
+    }
+    return purgedCount;
+}
+
+uint64_t BasicLinkedList::getNumStaleItems() const {
+    return numStaleItems;
+}
+
+size_t BasicLinkedList::getStaleValueBytes() const {
+    return staleSize - staleMetaDataSize;
+}
+
+size_t BasicLinkedList::getStaleMetadataBytes() const {
+    return staleMetaDataSize;
+}
+
+uint64_t BasicLinkedList::getNumItems() const {
+    return numItems;
+}
+
+uint64_t BasicLinkedList::getHighSeqno() const {
+    return highSeqno;
+}
+
+uint64_t BasicLinkedList::getHighestDedupedSeqno() const {
+    return highestDedupedSeqno;
+}
+
+seqno_t BasicLinkedList::getRangeReadBegin() const {
+    std::lock_guard<SpinLock> lh(rangeLock);
+    return readRange.getBegin();
+}
+
+seqno_t BasicLinkedList::getRangeReadEnd() const {
+    std::lock_guard<SpinLock> lh(rangeLock);
+    return readRange.getEnd();
+}
+
+void BasicLinkedList::dump() const {
+    std::cerr << *this << std::endl;
+}
+
+void BasicLinkedList::unlink(std::lock_guard<std::mutex>& writeGuard,
+                             OrderedStoredValue& v) {
+    if (v.seqPrev) {
+        v.seqPrev->seqNext = v.seqNext;
+    } else {
+        head = v.seqNext;
+    }
+    if (v.seqNext) {
+        v.seqNext->seqPrev = v.seqPrev;
+    } else {
+        tail = v.seqPrev;
+    }
+    v.seqPrev = v.seqNext = nullptr;
+}
+
+void BasicLinkedList::linkAtTail(std::lock_guard<std::mutex>& writeGuard,
+                                 OrderedStoredValue& v) {
+    v.seqNext = nullptr;
+    v.seqPrev = tail;
+    if (tail) {
+        tail->seqNext = &v;
+    } else {
+        head = &v;
+    }
+    tail = &v;
+}
+
+void BasicLinkedList::freeStaleItem(std::lock_guard<std::mutex>& writeGuard,
+                                    OrderedStoredValue* v) {
+    staleSize.fetch_sub(v->size());
+    staleMetaDataSize.fetch_sub(v->metaDataSize());
+    st.currentSize.fetch_sub(v->metaDataSize());
+    --numStaleItems;
+    StoredValue::destroy(v);
+}
+
+std::ostream& operator<<(std::ostream& os, const BasicLinkedList& ll) {
+    os << "BasicLinkedList[" << &ll << "] with numItems:" << ll.numItems
+       << " numStaleItems:" << ll.numStaleItems
+       << " highSeqno:" << ll.highSeqno
+       << " highestDedupedSeqno:" << ll.highestDedupedSeqno
+       << " elements:[" << std::endl;
+    std::lock_guard<std::mutex> writeGuard(ll.writeLock);
+    for (const OrderedStoredValue* v = ll.head; v; v = v->seqNext) {
+        os << "    seqno:" << v->getBySeqno()
+           << " stale:" << v->isStale(writeGuard) << std::endl;
+    }
+    os << "]" << std::endl;
+    return os;
+}
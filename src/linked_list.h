@@ -0,0 +1,259 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This header defines BasicLinkedList, a SequenceList implemented as a
+ * doubly linked list threaded through the OrderedStoredValues themselves.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include "atomic.h"
+#include "seqlist.h"
+#include "stats.h"
+
+#include <atomic>
+#include <mutex>
+
+/**
+ * A range of sequence numbers [begin, end] which is currently being read.
+ * An empty range is represented by {0, 0}.
+ */
+class SeqRange {
+public:
+    SeqRange(const seqno_t beginVal, const seqno_t endVal)
+        : end(endVal), begin(beginVal) {
+        if ((end < begin) || (begin < 0)) {
+            throw std::invalid_argument("Trying to create invalid SeqRange: [" +
+                                        std::to_string(begin) + ", " +
+                                        std::to_string(end) + "]");
+        }
+    }
+
+    /**
+     * Returns true if the seqno falls in the range [begin, end]
+     */
+    bool fallsInRange(const seqno_t seqno) const {
+        return (seqno >= begin) && (seqno <= end);
+    }
+
+    void reset() {
+        begin = 0;
+        end = 0;
+    }
+
+    seqno_t getBegin() const {
+        return begin;
+    }
+
+    void setBegin(const seqno_t start) {
+        if ((start <= 0) || (start > end)) {
+            throw std::invalid_argument(
+                    "SeqRange::setBegin: new begin (which is " +
+                    std::to_string(start) + ") must be in (0, " +
+                    std::to_string(end) + "]");
+        }
+        begin = start;
+    }
+
+    seqno_t getEnd() const {
+        return end;
+    }
+
+private:
+    seqno_t end;
+    seqno_t begin;
+};
+
+/**
+ * This class implements SequenceList as a basic doubly linked list.
+ * Uses the sequence list hooks embedded in OrderedStoredValue so no extra
+ * allocation is needed per item.
+ *
+ * Locking:
+ *  - writeLock guards the list links, the stale state of the elements and
+ *    the list wide counters (highSeqno, highestDedupedSeqno).
+ *  - rangeLock guards readRange, i.e. the part of the list which must not be
+ *    re-ordered because a range read is in progress over it.
+ *  - rangeReadLock serialises the walks which free elements (tombstone
+ *    purging, clear) with the start and end of range reads. A range read
+ *    lasts as long as its RangeIterator, possibly across threads, hence it
+ *    is tracked by rangeReadInProgress rather than by holding the lock.
+ *    Only one range read can be in progress at a time. Lock order is
+ *    sequenceLock (of the owning vbucket), then rangeReadLock, then
+ *    writeLock.
+ *
+ * Items are always appended at the tail in the order their seqnos are
+ * generated, hence the list is always sorted by seqno; updating an item moves
+ * it to the tail (with its new seqno) unless a range read currently covers
+ * it, in which case the caller must make the old version stale and append a
+ * new one.
+ */
+class BasicLinkedList : public SequenceList {
+public:
+    BasicLinkedList(uint16_t vbucketId, EPStats& st);
+
+    ~BasicLinkedList();
+
+    void appendToList(std::lock_guard<std::mutex>& seqLock,
+                      OrderedStoredValue& v) override;
+
+    SequenceList::UpdateStatus updateListElem(
+            std::lock_guard<std::mutex>& seqLock,
+            OrderedStoredValue& v) override;
+
+    std::pair<ENGINE_ERROR_CODE, std::unique_ptr<RangeIterator>>
+    makeRangeIterator(std::unique_lock<std::mutex>& seqLock,
+                      seqno_t start,
+                      seqno_t end) override;
+
+    std::tuple<ENGINE_ERROR_CODE, RangeReadItems, seqno_t> rangeRead(
+            std::unique_lock<std::mutex>& seqLock,
+            seqno_t start,
+            seqno_t end) override;
+
+    void updateHighSeqno(std::lock_guard<std::mutex>& seqLock,
+                         const OrderedStoredValue& v) override;
+
+    void updateHighestDedupedSeqno(std::lock_guard<std::mutex>& seqLock,
+                                   const OrderedStoredValue& v) override;
+
+    void markItemStale(std::lock_guard<std::mutex>& seqLock,
+                       StoredValue* ownedSv,
+                       StoredValue* replacement) override;
+
+    void clear(std::lock_guard<std::mutex>& seqLock) override;
+
+    bool clearChunk(std::lock_guard<std::mutex>& seqLock,
+                    size_t maxItems) override;
+
+    using SequenceList::purgeTombstones;
+
+    size_t purgeTombstones(hrtime_t deadline, bool& paused) override;
+
+    uint64_t getNumStaleItems() const override;
+
+    size_t getStaleValueBytes() const override;
+
+    size_t getStaleMetadataBytes() const override;
+
+    uint64_t getNumItems() const override;
+
+    uint64_t getHighSeqno() const override;
+
+    uint64_t getHighestDedupedSeqno() const override;
+
+    seqno_t getRangeReadBegin() const override;
+
+    seqno_t getRangeReadEnd() const override;
+
+    void dump() const override;
+
+protected:
+    /* Underlying data structure that holds the items in an Ordered Sequence */
+    OrderedStoredValue* head;
+    OrderedStoredValue* tail;
+
+    /**
+     * Lock that serializes writes (append, update, stale marking) on
+     * the list and the walk of the list by readers.
+     */
+    mutable std::mutex writeLock;
+
+    /**
+     * Lock that serializes the start and end of range reads on 'seqList'
+     * with the walks freeing elements.
+     */
+    mutable std::mutex rangeReadLock;
+
+    /* Is a RangeIterator alive? Guarded by rangeReadLock */
+    bool rangeReadInProgress;
+
+    /**
+     * Element a tombstone purge paused at, to resume from (null to start
+     * from the head). Only purgeTombstones() and clear() free elements, so
+     * it stays in the list. Guarded by rangeReadLock.
+     */
+    OrderedStoredValue* purgePosition;
+
+    /* Overall memory stats for the bucket */
+    EPStats& st;
+
+private:
+    class RangeIteratorLL;
+
+    /* Unlink v from the list; caller must hold writeLock */
+    void unlink(std::lock_guard<std::mutex>& writeGuard, OrderedStoredValue& v);
+
+    /* Link v at the tail of the list; caller must hold writeLock */
+    void linkAtTail(std::lock_guard<std::mutex>& writeGuard,
+                    OrderedStoredValue& v);
+
+    /* Free a stale item owned by the list; caller must hold writeLock */
+    void freeStaleItem(std::lock_guard<std::mutex>& writeGuard,
+                       OrderedStoredValue* v);
+
+    /**
+     * Lock that protects readRange.
+     * We use spinlock here since the lock is held only for very small time
+     * periods.
+     */
+    mutable SpinLock rangeLock;
+
+    /**
+     * Indicates the range of the list that is currently being read by a
+     * range read. Elements in this range must not be moved.
+     */
+    SeqRange readRange;
+
+    /* Id of the vBucket this list belongs to, used when building Items */
+    const uint16_t vbid;
+
+    /* Number of elements in the list (including stale ones) */
+    std::atomic<uint64_t> numItems;
+
+    /**
+     * The sum of the sizes of values and metadata of the stale items in the
+     * list.
+     */
+    std::atomic<uint64_t> numStaleItems;
+    std::atomic<size_t> staleSize;
+    std::atomic<size_t> staleMetaDataSize;
+
+    /**
+     * Number of times the list has been cleared; a range read started
+     * before a clear must stop. Guarded by writeLock.
+     */
+    uint64_t numClears;
+
+    /* Highest seqno in the list */
+    std::atomic<seqno_t> highSeqno;
+
+    /**
+     * Indicates the last seqno of the latest item which replaced an older
+     * version of the same key. A range read must extend up to this seqno to
+     * return a consistent snapshot.
+     */
+    std::atomic<seqno_t> highestDedupedSeqno;
+
+    friend std::ostream& operator<<(std::ostream& os,
+                                    const BasicLinkedList& ll);
+};
+
+std::ostream& operator<<(std::ostream& os, const BasicLinkedList& ll);
@@ -21,6 +21,7 @@
 
 #include "threadlocal.h"
 #include "ep_engine.h"
+#include "slab_arena.h"
 #include "stored-value.h"
 
 #if 1
@@ -112,7 +113,10 @@ void ObjectRegistry::onCreateStoredValue(const StoredValue *sv)
    EventuallyPersistentEngine *engine = th->get();
    if (verifyEngine(engine)) {
        EPStats &stats = engine->getEpStats();
-       size_t size = getAllocSize(sv);
+       // Arena allocations are not known to the allocator.
+       size_t size = sv->isArenaAllocated()
+                             ? SlabArena::getAllocationSize(sv->getObjectSize())
+                             : getAllocSize(sv);
        if (size == 0) {
            size = sv->getObjectSize();
        } else {
@@ -128,7 +132,10 @@ void ObjectRegistry::onDeleteStoredValue(const StoredValue *sv)
    EventuallyPersistentEngine *engine = th->get();
    if (verifyEngine(engine)) {
        EPStats &stats = engine->getEpStats();
-       size_t size = getAllocSize(sv);
+       // Arena allocations are not known to the allocator.
+       size_t size = sv->isArenaAllocated()
+                             ? SlabArena::getAllocationSize(sv->getObjectSize())
+                             : getAllocSize(sv);
        if (size == 0) {
            size = sv->getObjectSize();
        } else {
@@ -139,6 +146,36 @@ void ObjectRegistry::onDeleteStoredValue(const StoredValue *sv)
    }
 }
 
+void ObjectRegistry::onStoreInlineValue(const StoredValue *sv)
+{
+   EventuallyPersistentEngine *engine = th->get();
+   if (verifyEngine(engine)) {
+       EPStats &stats = engine->getEpStats();
+       size_t size = sv->getInlineValueLength();
+       stats.currentSize.fetch_add(size);
+       stats.totalValueSize.fetch_add(size);
+       stats.inlineValueOverheadSaved.fetch_add(
+               StoredValue::getInlineOverheadSaved(size,
+                                                   sv->getInlineCapacity()));
+       stats.numInlineValue++;
+   }
+}
+
+void ObjectRegistry::onReleaseInlineValue(const StoredValue *sv)
+{
+   EventuallyPersistentEngine *engine = th->get();
+   if (verifyEngine(engine)) {
+       EPStats &stats = engine->getEpStats();
+       size_t size = sv->getInlineValueLength();
+       stats.currentSize.fetch_sub(size);
+       stats.totalValueSize.fetch_sub(size);
+       stats.inlineValueOverheadSaved.fetch_sub(
+               StoredValue::getInlineOverheadSaved(size,
+                                                   sv->getInlineCapacity()));
+       stats.numInlineValue--;
+   }
+}
+
 
 void ObjectRegistry::onCreateItem(const Item *pItem)
 {
@@ -44,6 +44,9 @@ public:
     static void onCreateStoredValue(const StoredValue *sv);
     static void onDeleteStoredValue(const StoredValue *sv);
 
+    static void onStoreInlineValue(const StoredValue *sv);
+    static void onReleaseInlineValue(const StoredValue *sv);
+
 
     static EventuallyPersistentEngine *getCurrentEngine();
 
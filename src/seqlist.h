@@ -0,0 +1,303 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/**
+ * This header defines the abstract class SequenceList; the interface of the
+ * data structures which hold the items of an ephemeral vbucket in sequence
+ * number order.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include "item.h"
+#include "stored-value.h"
+
+#include <memcached/engine_error.h>
+
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+using seqno_t = int64_t;
+
+/**
+ * SequenceList is the abstract base class for the classes that hold the
+ * items (OrderedStoredValues) of a vbucket in sequence number order.
+ *
+ * The HashTable owns the OrderedStoredValues; a SequenceList links the same
+ * objects intrusively. The only exception are 'stale' items - old versions
+ * of an item which could not be updated in place because a range read was in
+ * progress over them. Stale items have been released from the HashTable and
+ * are owned (and eventually freed) by the SequenceList.
+ *
+ * Writers (appendToList, updateListElem, markItemStale, ...) must be
+ * serialised by the caller with the vbucket's sequenceLock, which is also
+ * held across seqno generation so that list order matches seqno order.
+ */
+class SequenceList {
+public:
+    /**
+     * Indicates whether the updateListElem is successful or the list is
+     * allowing only appends at the moment.
+     */
+    enum class UpdateStatus { Success, Append };
+
+    typedef std::vector<std::unique_ptr<Item>> RangeReadItems;
+
+    /**
+     * A range read in progress, returning the items of a point-in-time
+     * snapshot one at a time; see makeRangeIterator().
+     *
+     * While an iterator exists, no other range read can start and stale
+     * items are not purged from the list. The iterator must not outlive the
+     * list.
+     */
+    class RangeIterator {
+    public:
+        virtual ~RangeIterator() {
+        }
+
+        /**
+         * Copies the next item of the snapshot.
+         *
+         * @return ENGINE_SUCCESS and the item, or ENGINE_SUCCESS and null
+         *         once the whole snapshot has been read;
+         *         ENGINE_ENOMEM if the item could not be copied (next() may
+         *         be retried later);
+         *         ENGINE_TMPFAIL if the list was cleared under the iterator.
+         */
+        virtual std::pair<ENGINE_ERROR_CODE, std::unique_ptr<Item>> next() = 0;
+
+        /**
+         * Returns the seqno the snapshot ends at.
+         */
+        virtual seqno_t getEnd() const = 0;
+    };
+
+    virtual ~SequenceList() {
+    }
+
+    /**
+     * Add a new item at the end of the list.
+     *
+     * @param seqLock A sequence lock the calling module is expected to hold.
+     * @param v Ref to orderedStoredValue which will placed into the linked
+     *          list. Its intrusive list links will be updated.
+     */
+    virtual void appendToList(std::lock_guard<std::mutex>& seqLock,
+                              OrderedStoredValue& v) = 0;
+
+    /**
+     * If possible, update an existing element the list and move it to end.
+     * If there is a range read in the position of the element being updated
+     * we do not allow the update and indicate the caller to do an append.
+     *
+     * @param seqLock A sequence lock the calling module is expected to hold.
+     * @param v Ref to orderedStoredValue which will placed into the linked
+     *          list. Its intrusive list links will be updated.
+     *
+     * @return UpdateStatus::Success list element has been updated and moved
+     *                               to end.
+     *         UpdateStatus::Append list element is *not* updated. Caller
+     *                              must handle the append.
+     */
+    virtual SequenceList::UpdateStatus updateListElem(
+            std::lock_guard<std::mutex>& seqLock, OrderedStoredValue& v) = 0;
+
+    /**
+     * Starts a range read: a point-in-time snapshot, which can be used for
+     * incremental replication, read item by item through the returned
+     * iterator. Only the items are copied, one at a time, so a snapshot of
+     * any size can be read in bounded memory.
+     *
+     * The snapshot may extend beyond the requested end (up to the highest
+     * deduplicated seqno) so that it is consistent; see
+     * RangeIterator::getEnd().
+     *
+     * The sequence lock is needed only while the snapshot range is marked
+     * (so that no write is half way through at that point) and is released
+     * by this function.
+     *
+     * @param seqLock A sequence lock the calling module must hold; it is
+     *                unlocked before the function returns.
+     * @param start requested start seqno
+     * @param end requested end seqno
+     *
+     * @return ENGINE_SUCCESS and the iterator; or an error code
+     *         (ENGINE_ERANGE for an invalid range, ENGINE_TMPFAIL if another
+     *         range read is in progress).
+     */
+    virtual std::pair<ENGINE_ERROR_CODE, std::unique_ptr<RangeIterator>>
+    makeRangeIterator(std::unique_lock<std::mutex>& seqLock,
+                      seqno_t start,
+                      seqno_t end) = 0;
+
+    /**
+     * Reads a whole point-in-time snapshot at once (see
+     * makeRangeIterator()), copying the StoredValues as a vector of Items.
+     *
+     * @param seqLock A sequence lock the calling module must hold; it is
+     *                unlocked before the function returns.
+     * @param start requested start seqno
+     * @param end requested end seqno
+     *
+     * @return ENGINE_SUCCESS, the items in the range and the seqno the
+     *         snapshot actually ends at; or an error code (as for
+     *         makeRangeIterator(), or ENGINE_ENOMEM if the copy failed).
+     */
+    virtual std::tuple<ENGINE_ERROR_CODE, RangeReadItems, seqno_t> rangeRead(
+            std::unique_lock<std::mutex>& seqLock,
+            seqno_t start,
+            seqno_t end) = 0;
+
+    /**
+     * Updates the highSeqno in the list. Since seqno is generated and managed
+     * outside the list, the module managing it must update this after the
+     * seqno is generated for the item already put in the list.
+     *
+     * @param seqLock A sequence lock the calling module is expected to hold.
+     * @param v Ref to orderedStoredValue
+     */
+    virtual void updateHighSeqno(std::lock_guard<std::mutex>& seqLock,
+                                 const OrderedStoredValue& v) = 0;
+
+    /**
+     * Updates the highestDedupedSeqno in the list. Since seqno is generated
+     * and managed outside the list, the module managing it must update this
+     * after the seqno is generated for an item which replaces (deduplicates)
+     * an older version of the same key.
+     *
+     * @param seqLock A sequence lock the calling module is expected to hold.
+     * @param v Ref to orderedStoredValue
+     */
+    virtual void updateHighestDedupedSeqno(std::lock_guard<std::mutex>& seqLock,
+                                           const OrderedStoredValue& v) = 0;
+
+    /**
+     * Mark an OrderedStoredValue stale and assume its ownership.
+     * Note: It is upto the sequential data structure implementation how it
+     *       wants to own the OrderedStoredValue (as owned type vs non-owned
+     *       type)
+     *
+     * @param seqLock A sequence lock the calling module is expected to hold.
+     * @param ownedSv StoredValue whose ownership is passed to the sequential
+     *                data structure. It must already have been released
+     *                from the HashTable.
+     * @param replacement StoredValue which supersedes ownedSv; null if the
+     *                    item was removed without a newer version.
+     */
+    virtual void markItemStale(std::lock_guard<std::mutex>& seqLock,
+                               StoredValue* ownedSv,
+                               StoredValue* replacement) = 0;
+
+    /**
+     * Unlink and free the stale items in the list. Does nothing while a
+     * range read is in progress (the stale items are purged by a later
+     * call); otherwise only holds the list's internal locks for one element
+     * at a time, so writers can proceed concurrently.
+     *
+     * The walk pauses once the deadline is reached; the next call resumes
+     * it from the element it paused at.
+     *
+     * @param deadline when (as per gethrtime()) to pause the walk
+     * @param[out] paused set to true if the walk paused before the end of
+     *             the list
+     * @return the number of items purged
+     */
+    virtual size_t purgeTombstones(hrtime_t deadline, bool& paused) = 0;
+
+    /// Purge the stale items of the whole list (or the rest of a paused
+    /// walk).
+    size_t purgeTombstones() {
+        bool paused = false;
+        return purgeTombstones(std::numeric_limits<hrtime_t>::max(), paused);
+    }
+
+    /**
+     * Unlink every element of the list, freeing the stale items (which the
+     * list owns). The remaining items are still owned by the HashTable,
+     * which must be cleared by the caller afterwards. A range read in
+     * progress is cancelled (its iterator returns ENGINE_TMPFAIL).
+     *
+     * @param seqLock A sequence lock the calling module is expected to hold.
+     */
+    virtual void clear(std::lock_guard<std::mutex>& seqLock) = 0;
+
+    /**
+     * As clear(), but only unlinks up to maxItems elements from the head of
+     * the list, so that a large list can be cleared in several calls
+     * without holding the list's locks for long.
+     *
+     * @param seqLock A sequence lock the calling module is expected to hold.
+     * @param maxItems the maximum number of elements to unlink
+     * @return true once the list is empty
+     */
+    virtual bool clearChunk(std::lock_guard<std::mutex>& seqLock,
+                            size_t maxItems) = 0;
+
+    /**
+     * Returns the number of stale items in the list.
+     *
+     * @return count of stale items
+     */
+    virtual uint64_t getNumStaleItems() const = 0;
+
+    /**
+     * Return the count of bytes of the values of stale items in the list.
+     */
+    virtual size_t getStaleValueBytes() const = 0;
+
+    /**
+     * Return the count of bytes of the metadata of stale items in the list.
+     */
+    virtual size_t getStaleMetadataBytes() const = 0;
+
+    /**
+     * Returns the number of items in the list (including stale items).
+     */
+    virtual uint64_t getNumItems() const = 0;
+
+    /**
+     * Returns the highSeqno in the list.
+     */
+    virtual uint64_t getHighSeqno() const = 0;
+
+    /**
+     * Returns the highest de-duplicated sequence number in the list.
+     */
+    virtual uint64_t getHighestDedupedSeqno() const = 0;
+
+    /**
+     * Returns the current range read begin sequence number.
+     */
+    virtual seqno_t getRangeReadBegin() const = 0;
+
+    /**
+     * Returns the current range read end sequence number.
+     */
+    virtual seqno_t getRangeReadEnd() const = 0;
+
+    /**
+     * Debug - prints a representation of the list to stderr.
+     */
+    virtual void dump() const = 0;
+};
@@ -70,6 +70,7 @@ int main(int, char **) {
 
     display("GIGANTOR", GIGANTOR);
     display("Stored Value", sizeof(StoredValue));
+    display("Ordered Stored Value", sizeof(OrderedStoredValue));
 
     display("Stored Value Factory", sizeof(StoredValueFactory));
     display("Blob", sizeof(Blob));
@@ -0,0 +1,121 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "slab_arena.h"
+
+#include "stats.h"
+
+#include <limits>
+#include <stdexcept>
+
+static_assert((SlabArena::slabSize / SlabArena::granularity) <=
+                      std::numeric_limits<uint16_t>::max(),
+              "Slab offsets must fit in a uint16_t");
+
+SlabArena::SlabArena(EPStats& st)
+    : stats(st), numObjects(0), mappedBytes(0), usedBytes(0) {
+}
+
+SlabArena::~SlabArena() {
+    releaseAll();
+}
+
+void* SlabArena::allocate(size_t size, uint16_t& slabOffset) {
+    if (size == 0 || size > maxObjectSize) {
+        return nullptr;
+    }
+    const size_t allocSize = getAllocationSize(size);
+    SizeClass& sc = sizeClasses[sizeClassIndex(size)];
+
+    char* p;
+    {
+        std::lock_guard<std::mutex> lh(sc.mutex);
+        if (sc.freeList) {
+            p = reinterpret_cast<char*>(sc.freeList);
+            slabOffset = sc.freeList->slabOffset;
+            sc.freeList = sc.freeList->next;
+        } else {
+            if (static_cast<size_t>(sc.bumpEnd - sc.bump) < allocSize) {
+                Slab* slab = static_cast<Slab*>(::operator new(slabSize));
+                slab->arena = this;
+                slab->next = sc.slabs;
+                sc.slabs = slab;
+                sc.bump = reinterpret_cast<char*>(slab) + slabHeaderSize;
+                sc.bumpEnd = reinterpret_cast<char*>(slab) + slabSize;
+                mappedBytes.fetch_add(slabSize);
+                stats.arenaMappedBytes.fetch_add(slabSize);
+            }
+            p = sc.bump;
+            slabOffset = static_cast<uint16_t>(
+                    (p - reinterpret_cast<char*>(sc.slabs)) / granularity);
+            sc.bump += allocSize;
+        }
+    }
+
+    ++numObjects;
+    usedBytes.fetch_add(allocSize);
+    stats.arenaUsedBytes.fetch_add(allocSize);
+    return p;
+}
+
+void SlabArena::deallocate(void* p, size_t size, uint16_t slabOffset) {
+    const size_t allocSize = getAllocationSize(size);
+    SizeClass& sc = sizeClasses[sizeClassIndex(size)];
+    {
+        std::lock_guard<std::mutex> lh(sc.mutex);
+        FreeObject* obj = static_cast<FreeObject*>(p);
+        obj->next = sc.freeList;
+        obj->slabOffset = slabOffset;
+        sc.freeList = obj;
+    }
+
+    --numObjects;
+    usedBytes.fetch_sub(allocSize);
+    stats.arenaUsedBytes.fetch_sub(allocSize);
+}
+
+SlabArena& SlabArena::ownerOf(const void* p, uint16_t slabOffset) {
+    if (slabOffset == 0) {
+        throw std::invalid_argument(
+                "SlabArena::ownerOf: slabOffset must be non-zero");
+    }
+    const Slab* slab = reinterpret_cast<const Slab*>(
+            static_cast<const char*>(p) - (slabOffset * granularity));
+    return *slab->arena;
+}
+
+void SlabArena::releaseAll() {
+    for (auto& sc : sizeClasses) {
+        std::lock_guard<std::mutex> lh(sc.mutex);
+        releaseSizeClass(sc);
+    }
+    stats.arenaUsedBytes.fetch_sub(usedBytes.exchange(0));
+    numObjects.store(0);
+}
+
+void SlabArena::releaseSizeClass(SizeClass& sc) {
+    while (sc.slabs) {
+        Slab* slab = sc.slabs;
+        sc.slabs = slab->next;
+        ::operator delete(slab);
+        mappedBytes.fetch_sub(slabSize);
+        stats.arenaMappedBytes.fetch_sub(slabSize);
+    }
+    sc.freeList = nullptr;
+    sc.bump = nullptr;
+    sc.bumpEnd = nullptr;
+}
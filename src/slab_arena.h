@@ -0,0 +1,161 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+class EPStats;
+
+/**
+ * Size classed slab allocator for the StoredValues of one HashTable.
+ *
+ * Objects are carved out of fixed size slabs, one set of slabs per size
+ * class (multiples of granularity bytes, up to maxObjectSize). Freed objects
+ * are kept on a per size class free list for re-use, so the objects of a
+ * vbucket stay packed together instead of being scattered over the heap,
+ * and the whole arena can be released in one go when the vbucket's items
+ * are dropped (see releaseAll()).
+ *
+ * Slabs are obtained from (and returned to) the heap, so mem_used and the
+ * allocator stats of the MemoryTracker count them in full; the arena
+ * accounts the bytes it has mapped and the bytes its live objects use in
+ * EPStats (arenaMappedBytes, arenaUsedBytes), the difference being memory
+ * free within the arena.
+ *
+ * Allocations are identified by their offset from the start of their slab
+ * (in granularity units, never 0), which the caller records alongside the
+ * object; see ownerOf().
+ */
+class SlabArena {
+public:
+    //! Size of each slab, including its header.
+    static const size_t slabSize = 16 * 1024;
+    //! Object sizes are rounded up to a multiple of this.
+    static const size_t granularity = 16;
+    //! Largest object served by the arena.
+    static const size_t maxObjectSize = 512;
+
+    explicit SlabArena(EPStats& st);
+
+    /**
+     * Frees all slabs. Any objects allocated from the arena must have been
+     * destroyed beforehand.
+     */
+    ~SlabArena();
+
+    /**
+     * Allocate size bytes from the arena.
+     *
+     * @param size bytes required
+     * @param slabOffset [out] offset of the allocation within its slab, to
+     *        be passed to ownerOf() and deallocate()
+     * @return the allocation, or null if size is larger than maxObjectSize
+     */
+    void* allocate(size_t size, uint16_t& slabOffset);
+
+    /**
+     * Return an allocation of the given size (and slab offset, as returned
+     * by allocate()) to the arena.
+     */
+    void deallocate(void* p, size_t size, uint16_t slabOffset);
+
+    /**
+     * Returns the arena an allocation with the given slab offset belongs to.
+     */
+    static SlabArena& ownerOf(const void* p, uint16_t slabOffset);
+
+    /**
+     * Returns the number of bytes of the arena an object of the given size
+     * occupies.
+     */
+    static size_t getAllocationSize(size_t size) {
+        return (size + granularity - 1) & ~(granularity - 1);
+    }
+
+    /**
+     * Free all slabs at once; the caller guarantees that no object
+     * allocated from the arena is still in use (their destructors must have
+     * run, but they need not be deallocated individually).
+     */
+    void releaseAll();
+
+    /// Number of objects currently allocated from the arena.
+    size_t getNumObjects() const {
+        return numObjects;
+    }
+
+    /// Bytes of slabs currently held by the arena.
+    size_t getMappedBytes() const {
+        return mappedBytes;
+    }
+
+    /// Bytes of the arena occupied by live objects.
+    size_t getUsedBytes() const {
+        return usedBytes;
+    }
+
+private:
+    struct Slab {
+        SlabArena* arena;
+        Slab* next;
+    };
+
+    //! Allocations start this far into a slab; keeps them aligned.
+    static const size_t slabHeaderSize =
+            (sizeof(Slab) + granularity - 1) & ~(granularity - 1);
+    static const size_t numSizeClasses = maxObjectSize / granularity;
+
+    //! Overlaid on a freed object; the smallest object is big enough.
+    struct FreeObject {
+        FreeObject* next;
+        uint16_t slabOffset;
+    };
+    static_assert(sizeof(FreeObject) <= granularity,
+                  "A freed object must fit in the smallest size class");
+
+    struct SizeClass {
+        std::mutex mutex;
+        //! Objects freed since they were carved out of a slab.
+        FreeObject* freeList = nullptr;
+        //! Unused space at the end of the most recent slab.
+        char* bump = nullptr;
+        char* bumpEnd = nullptr;
+        //! All slabs of this size class.
+        Slab* slabs = nullptr;
+    };
+
+    static size_t sizeClassIndex(size_t size) {
+        return (getAllocationSize(size) / granularity) - 1;
+    }
+
+    /// Free the slabs of the given size class and reset it.
+    void releaseSizeClass(SizeClass& sc);
+
+    EPStats& stats;
+    std::array<SizeClass, numSizeClasses> sizeClasses;
+
+    std::atomic<size_t> numObjects;
+    std::atomic<size_t> mappedBytes;
+    std::atomic<size_t> usedBytes;
+};
@@ -0,0 +1,134 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#pragma once
+
+#include "config.h"
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * A FIFO queue safe for one producer and one consumer running concurrently
+ * without any lock.
+ *
+ * Elements are stored in fixed size blocks of BlockSize slots, each slot
+ * being written exactly once: the producer fills the last block and links a
+ * new one once it is full, the consumer frees a block once it has read past
+ * its last slot. The producer and the consumer therefore never write to the
+ * same memory, other than the element count.
+ *
+ * "Single producer" means that push() calls must not run concurrently with
+ * each other (they may come from different threads if serialised by some
+ * other means, e.g. a mutex); likewise for the consumer-side methods
+ * front(), pop() and clear(). empty() and size() may be called from any
+ * thread, concurrent changes making their result approximate.
+ */
+template <typename T, size_t BlockSize = 256>
+class SpscQueue {
+    struct Block {
+        //! Next slot to read; only accessed by the consumer.
+        size_t head = 0;
+        //! Number of slots written; only accessed by the producer.
+        size_t tail = 0;
+        std::atomic<Block*> next{nullptr};
+        T slots[BlockSize];
+    };
+
+public:
+    SpscQueue() : readBlock(new Block), writeBlock(readBlock), count(0) {
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    ~SpscQueue() {
+        while (readBlock) {
+            Block* next = readBlock->next.load(std::memory_order_relaxed);
+            delete readBlock;
+            readBlock = next;
+        }
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    size_t size() const {
+        return count.load(std::memory_order_acquire);
+    }
+
+    /// Producer side: append an element.
+    void push(const T& value) {
+        Block* block = writeBlock;
+        if (block->tail == BlockSize) {
+            Block* next = new Block;
+            block->next.store(next, std::memory_order_release);
+            writeBlock = block = next;
+        }
+        block->slots[block->tail++] = value;
+        // Publishes the slot (and any new block): a consumer seeing the
+        // incremented count through an acquire load sees the element.
+        count.fetch_add(1, std::memory_order_release);
+    }
+
+    /**
+     * Consumer side: the oldest element. The queue must not be empty, as
+     * observed by the consumer through empty() or size() (whose acquire
+     * load makes the element visible).
+     */
+    T& front() {
+        Block* block = frontBlock();
+        return block->slots[block->head];
+    }
+
+    /// Consumer side: remove the oldest element. The queue must not be empty.
+    void pop() {
+        Block* block = frontBlock();
+        block->slots[block->head] = T();
+        ++block->head;
+        count.fetch_sub(1, std::memory_order_release);
+    }
+
+    /// Consumer side: remove all the elements pushed so far.
+    void clear() {
+        while (!empty()) {
+            pop();
+        }
+    }
+
+private:
+    /// Consumer side: the block holding the oldest element, freeing any
+    /// fully read block before it.
+    Block* frontBlock() {
+        Block* block = readBlock;
+        if (block->head == BlockSize) {
+            // A non-empty queue with this block fully read means the
+            // producer has linked the next one.
+            Block* next = block->next.load(std::memory_order_acquire);
+            delete block;
+            readBlock = block = next;
+        }
+        return block;
+    }
+
+    //! Oldest block; owned by the consumer.
+    Block* readBlock;
+    //! Block being filled; owned by the producer.
+    Block* writeBlock;
+    std::atomic<size_t> count;
+};
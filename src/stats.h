@@ -93,9 +93,12 @@ public:
         cursorDroppingLThreshold(0),
         cursorDroppingUThreshold(0),
         cursorsDropped(0),
+        checkpointMemQuota(0),
         pagerRuns(0),
         expiryPagerRuns(0),
         itemsRemovedFromCheckpoints(0),
+        itemsExpelledFromCheckpoints(0),
+        memExpelledFromCheckpoints(0),
         numValueEjects(0),
         numFailedEjects(0),
         numNotMyVBuckets(0),
@@ -106,7 +109,12 @@ public:
         numStoredVal(0),
         totalStoredValSize(0),
         storedValOverhead(0),
+        numInlineValue(0),
+        inlineValueOverheadSaved(0),
+        arenaMappedBytes(0),
+        arenaUsedBytes(0),
         memOverhead(0),
+        checkpointMemUsage(0),
         numItem(0),
         totalMemory(0),
         memoryTrackerEnabled(false),
@@ -132,6 +140,9 @@ public:
         bgMaxLoad(0),
         vbucketDelMaxWalltime(0),
         vbucketDelTotWalltime(0),
+        vbucketMemDelBytesFreed(0),
+        vbucketMemDelTotWalltime(0),
+        vbucketMemDelMaxRunWalltime(0),
         numTapFetched(0),
         numTapBGFetched(0),
         numTapBGFetchRequeued(0),
@@ -168,6 +179,8 @@ public:
         rollbackCount(0),
         defragNumVisited(0),
         defragNumMoved(0),
+        numHtResizesInProgress(0),
+        htResizeBucketsRemaining(0),
         dirtyAgeHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
         diskCommitHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
         mlogCompactorHisto(GrowingWidthGenerator<hrtime_t>(0, ONE_SECOND, 1.4), 25),
@@ -195,6 +208,10 @@ public:
         return currentSize.load() + memOverhead->load();
     }
 
+    bool isCheckpointMemQuotaExceeded() {
+        return checkpointMemUsage->load() > checkpointMemQuota.load();
+    }
+
     //! Number of keys warmed up during key-only loading.
     Counter warmedUpKeys;
     //! Number of key-values warmed up during data loading.
@@ -281,12 +298,20 @@ public:
     //! Number of cursors dropped by checkpoint remover
     Counter cursorsDropped;
 
+    //! Bytes the checkpoints of all vbuckets may use before the checkpoint
+    //! remover is woken up and starts dropping cursors
+    std::atomic<size_t> checkpointMemQuota;
+
     //! Number of times we needed to kick in the pager
     Counter pagerRuns;
     //! Number of times the expiry pager runs for purging expired items
     Counter expiryPagerRuns;
     //! Number of items removed from closed unreferenced checkpoints.
     Counter itemsRemovedFromCheckpoints;
+    //! Number of items expelled from checkpoints after all cursors read them.
+    Counter itemsExpelledFromCheckpoints;
+    //! Bytes freed by expelling items from checkpoints.
+    Counter memExpelledFromCheckpoints;
     //! Number of times a value is ejected
     Counter numValueEjects;
     //! Number of times a value could not be ejected
@@ -307,8 +332,19 @@ public:
     Counter totalStoredValSize;
     //! Total size of StoredVal memory overhead
     Counter storedValOverhead;
+    //! The number of values stored inline in their StoredValue
+    Counter numInlineValue;
+    //! Bytes of Blob bookkeeping not allocated due to inline values
+    Counter inlineValueOverheadSaved;
+    //! Bytes of slabs held by StoredValue arenas
+    Counter arenaMappedBytes;
+    //! Bytes of StoredValue arenas occupied by live objects
+    Counter arenaUsedBytes;
     //! Amount of memory used to track items and what-not.
     cb::CachelinePadded<Counter> memOverhead;
+    //! Memory used by the checkpoints of all vbuckets: their queued items
+    //! plus their own overhead (also part of memOverhead).
+    cb::CachelinePadded<Counter> checkpointMemUsage;
     //! Total number of Item objects
     cb::CachelinePadded<Counter> numItem;
     //! The total amount of memory used by this bucket (From memory tracking)
@@ -379,6 +415,12 @@ public:
     std::atomic<hrtime_t> vbucketDelMaxWalltime;
     //! Total wall time of deleting vbuckets
     std::atomic<hrtime_t> vbucketDelTotWalltime;
+    //! Item memory (bytes) freed by deleting vbuckets from memory
+    Counter vbucketMemDelBytesFreed;
+    //! Total wall time (µs) spent deleting vbuckets from memory
+    std::atomic<hrtime_t> vbucketMemDelTotWalltime;
+    //! Longest single run (µs) of a vbucket memory deletion task
+    std::atomic<hrtime_t> vbucketMemDelMaxRunWalltime;
 
     //! Histogram of setWithMeta latencies.
     Histogram<hrtime_t> setWithMetaHisto;
@@ -488,6 +530,17 @@ public:
      */
     Counter defragNumMoved;
 
+    //! Number of hash tables with an incremental resize in progress.
+    Counter numHtResizesInProgress;
+
+    //! Number of hash buckets still to be migrated by the hash table
+    //! resizes in progress.
+    Counter htResizeBucketsRemaining;
+
+    //! Histogram of the time front-end operations are blocked for by each
+    //! step of a hash table resize.
+    Histogram<hrtime_t> htResizeStallHisto;
+
     //! Histogram of queue processing dirty age.
     Histogram<hrtime_t> dirtyAgeHisto;
 
@@ -553,6 +606,9 @@ public:
     //! Histogram of disk commits
     Histogram<hrtime_t> diskCommitHisto;
 
+    //! Histogram of the number of documents persisted per disk commit
+    Histogram<size_t> diskCommitDocsHisto;
+
     //! Histogram of mutation log compactor
     Histogram<hrtime_t> mlogCompactorHisto;
 
@@ -580,6 +636,8 @@ public:
         cursorsDropped.store(0);
         pagerRuns.store(0);
         itemsRemovedFromCheckpoints.store(0);
+        itemsExpelledFromCheckpoints.store(0);
+        memExpelledFromCheckpoints.store(0);
         numValueEjects.store(0);
         numFailedEjects.store(0);
         numNotMyVBuckets.store(0);
@@ -608,6 +666,9 @@ public:
         numTapFetched.store(0);
         vbucketDelMaxWalltime.store(0);
         vbucketDelTotWalltime.store(0);
+        vbucketMemDelBytesFreed.store(0);
+        vbucketMemDelTotWalltime.store(0);
+        vbucketMemDelMaxRunWalltime.store(0);
 
         mlogCompactorRuns.store(0);
         alogRuns.store(0);
@@ -642,12 +703,14 @@ public:
         diskDelHisto.reset();
         diskVBDelHisto.reset();
         diskCommitHisto.reset();
+        diskCommitDocsHisto.reset();
         itemAllocSizeHisto.reset();
         dirtyAgeHisto.reset();
         mlogCompactorHisto.reset();
         getMultiHisto.reset();
         persistenceCursorGetItemsHisto.reset();
         dcpCursorsGetItemsHisto.reset();
+        htResizeStallHisto.reset();
     }
 
     // Used by stats logging infrastructure.
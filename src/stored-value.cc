@@ -21,8 +21,12 @@
 #include "stored-value.h"
 
 #include "hash_table.h"
+#include "slab_arena.h"
+
+#include <cstring>
 
 double StoredValue::mutation_mem_threshold = 0.9;
+size_t StoredValue::inline_value_threshold = 0;
 const int64_t StoredValue::state_deleted_key = -3;
 const int64_t StoredValue::state_non_existent_key = -4;
 const int64_t StoredValue::state_temp_init = -5;
@@ -30,9 +34,8 @@ const int64_t StoredValue::state_collection_open = -6;
 
 bool StoredValue::ejectValue(HashTable &ht, item_eviction_policy_t policy) {
     if (eligibleForEviction(policy)) {
-        reduceCacheSize(ht, value->length());
+        reduceCacheSize(ht, valuelen());
         markNotResident();
-        value = NULL;
         return true;
     }
     return false;
@@ -72,7 +75,7 @@ void StoredValue::restoreValue(const Item& itm) {
         nru = INITIAL_NRU_VALUE;
     }
     deleted = itm.isDeleted();
-    value = itm.getValue();
+    assignValue(itm.getValue());
 }
 
 void StoredValue::restoreMeta(const Item& itm) {
@@ -99,6 +102,68 @@ void StoredValue::setMutationMemoryThreshold(double memThreshold) {
     }
 }
 
+void* StoredValue::allocate(HashTable& ht,
+                            size_t size,
+                            uint16_t& slabOffset) {
+    if (ht.arena) {
+        void* p = ht.arena->allocate(size, slabOffset);
+        if (p) {
+            return p;
+        }
+    }
+    slabOffset = 0;
+    return ::operator new(size);
+}
+
+void StoredValue::destroy(StoredValue* v) {
+    const uint16_t offset = v->slabOffset;
+    const size_t size = v->getObjectSize();
+    v->~StoredValue();
+    if (offset != 0) {
+        SlabArena::ownerOf(v, offset).deallocate(v, size, offset);
+    } else {
+        ::operator delete(v);
+    }
+}
+
+void StoredValue::setInlineValueThreshold(size_t threshold) {
+    if (threshold <= maxInlineValueThreshold) {
+        inline_value_threshold = threshold;
+    }
+}
+
+uint8_t StoredValue::getInlineCapacityFor(const Item& item) {
+    const size_t threshold = inline_value_threshold;
+    const value_t& v = item.getValue();
+    if (threshold == 0 || !v || v->length() > threshold) {
+        return 0;
+    }
+    // Round up to the next multiple of 8 bytes.
+    return static_cast<uint8_t>((v->length() + 7) & ~size_t(7));
+}
+
+void StoredValue::assignValue(const value_t& v) {
+    releaseInlineValue();
+    if (v && v->length() <= inlineCapacity) {
+        InlineValue* iv = inlineValue();
+        iv->size = static_cast<uint8_t>(v->length());
+        iv->extMetaLen = v->getExtLen();
+        std::memcpy(iv->payload, v->getBlob(), v->length());
+        value.reset();
+        valueInline = true;
+        ObjectRegistry::onStoreInlineValue(this);
+    } else {
+        value = v;
+    }
+}
+
+void StoredValue::releaseInlineValue() {
+    if (valueInline) {
+        ObjectRegistry::onReleaseInlineValue(this);
+        valueInline = false;
+    }
+}
+
 void StoredValue::increaseCacheSize(HashTable &ht, size_t by) {
     ht.cacheSize.fetch_add(by);
     ht.memSize.fetch_add(by);
@@ -135,7 +200,7 @@ bool StoredValue::hasAvailableSpace(EPStats &st, const Item &itm,
 }
 
 Item* StoredValue::toItem(bool lck, uint16_t vbucket) const {
-    Item* itm = new Item(key, getFlags(), getExptime(), value,
+    Item* itm = new Item(getKey(), getFlags(), getExptime(), getValue(),
                          lck ? static_cast<uint64_t>(-1) : getCas(),
                          bySeqno, vbucket, getRevSeqno());
 
@@ -149,6 +214,10 @@ Item* StoredValue::toItem(bool lck, uint16_t vbucket) const {
 }
 
 void StoredValue::reallocate() {
+    if (valueInline) {
+        // Lives in the StoredValue's own allocation; nothing to move.
+        return;
+    }
     // Allocate a new Blob for this stored value; copy the existing Blob to
     // the new one and free the old.
     value_t new_val(Blob::Copy(*value));
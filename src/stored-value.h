@@ -27,6 +27,7 @@
 
 // Forward declaration for StoredValue
 class HashTable;
+class OrderedStoredValue;
 class StoredValueFactory;
 
 /**
@@ -39,6 +40,21 @@ public:
         ::operator delete(p);
     }
 
+    /**
+     * Destroy the given StoredValue and free its memory, to the slab arena
+     * it was allocated from if any. StoredValues should be freed with this
+     * rather than delete, which is only valid for heap allocated ones.
+     */
+    static void destroy(StoredValue* v);
+
+    /**
+     * True if this object was allocated from the slab arena of its
+     * HashTable (see SlabArena).
+     */
+    bool isArenaAllocated() const {
+        return slabOffset != 0;
+    }
+
     uint8_t getNRUValue();
 
     void setNRUValue(uint8_t nru_val);
@@ -96,23 +112,37 @@ public:
      * @return true if this item's key is equal to k
      */
     bool hasKey(const DocKey& k) const {
-        return key == k;
+        return getKey() == k;
     }
 
     /**
      * Get this item's key.
      */
     const SerialisedDocKey& getKey() const {
-        return key;
+        return *key();
     }
 
     /**
      * Get this item's value.
+     *
+     * A value stored inline (see isValueInline()) is copied into a new Blob,
+     * hence callers must not rely on the identity of the returned Blob.
      */
-    const value_t &getValue() const {
+    value_t getValue() const {
+        if (valueInline) {
+            return value_t(inlineValue()->toBlob());
+        }
         return value;
     }
 
+    /**
+     * True if this item's value is held in the same allocation as the
+     * StoredValue (instead of a separately allocated Blob).
+     */
+    bool isValueInline() const {
+        return valueInline;
+    }
+
     /**
      * Get the expiration time of this item.
      *
@@ -152,7 +182,7 @@ public:
     void setValue(const Item& itm, HashTable& ht) {
         size_t currSize = size();
         reduceCacheSize(ht, currSize);
-        value = itm.getValue();
+        assignValue(itm.getValue());
         deleted = itm.isDeleted();
         flags = itm.getFlags();
         bySeqno = itm.getBySeqno();
@@ -298,7 +328,7 @@ public:
     /**
      * Is this a temporary item created for processing a get-meta request?
      */
-     bool isTempItem() {
+     bool isTempItem() const {
          return(isTempNonExistentItem() || isTempDeletedItem() || isTempInitialItem());
 
      }
@@ -306,7 +336,7 @@ public:
     /**
      * Is this an initial temporary item?
      */
-    bool isTempInitialItem() {
+    bool isTempInitialItem() const {
         return bySeqno == state_temp_init;
     }
 
@@ -320,7 +350,7 @@ public:
     /**
      * Is this a temporary item created for a deleted key?
      */
-    bool isTempDeletedItem() {
+    bool isTempDeletedItem() const {
          return bySeqno == state_deleted_key;
 
      }
@@ -329,7 +359,7 @@ public:
         if (isDeleted() || !isResident()) {
             return 0;
         }
-        return value->length();
+        return valueInline ? inlineValue()->size : value->length();
     }
 
     /**
@@ -338,11 +368,11 @@ public:
      * @return the amount of memory used by this item.
      */
     size_t size() {
-        return sizeof(StoredValue) + key.size() + valuelen();
+        return metaDataSize() + valuelen();
     }
 
     size_t metaDataSize() {
-        return sizeof(StoredValue) + key.size();
+        return getFixedSize() + getKey().size();
     }
 
     /**
@@ -359,15 +389,24 @@ public:
         return true;
     }
 
+    /**
+     * As isLocked(), but leaves an expired lock in place; for readers which
+     * must not modify the item (see HashTable::SharedBucketLock).
+     */
+    bool isLockedNoReset(rel_time_t curtime) const {
+        return lock_expiry != 0 && curtime <= lock_expiry;
+    }
+
     /**
      * True if this value is resident in memory currently.
      */
     bool isResident() const {
-        return value.get() != NULL;
+        return valueInline || value.get() != NULL;
     }
 
     void markNotResident() {
         value.reset();
+        releaseInlineValue();
     }
 
     /**
@@ -436,6 +475,28 @@ public:
         return mutation_mem_threshold;
     }
 
+    /**
+     * Set the size (in bytes) up to which a value is stored inline, in the
+     * same allocation as the StoredValue; 0 disables inline values. Only
+     * affects StoredValues created afterwards.
+     */
+    static void setInlineValueThreshold(size_t threshold);
+
+    static size_t getInlineValueThreshold() {
+        return inline_value_threshold;
+    }
+
+    /**
+     * Number of bytes of Blob bookkeeping which are not allocated for a value
+     * of the given size stored inline in a space of the given capacity.
+     */
+    static size_t getInlineOverheadSaved(size_t valueSize, size_t capacity) {
+        return sizeof(Blob) - InlineValue::getObjectSize(capacity) + valueSize;
+    }
+
+    /// Largest supported inline value threshold.
+    static const size_t maxInlineValueThreshold = 128;
+
     /*
      * Values of the bySeqno attribute used by temporarily created StoredValue
      * objects.
@@ -457,13 +518,49 @@ public:
     static const int64_t state_collection_open;
 
     ~StoredValue() {
+        releaseInlineValue();
         ObjectRegistry::onDeleteStoredValue(this);
     }
 
+    /**
+     * Return the number of bytes allocated for this object; the fixed size
+     * part plus the trailing SerialisedDocKey and inline value space.
+     */
     size_t getObjectSize() const {
-        return sizeof(*this) + key.getObjectSize();
+        return getFixedSize() + getKey().getObjectSize() +
+               getInlineStorageSize(inlineCapacity);
+    }
+
+    /**
+     * Capacity of the inline value space of this object; 0 if its values
+     * are always stored in a separate Blob.
+     */
+    size_t getInlineCapacity() const {
+        return inlineCapacity;
+    }
+
+    /**
+     * Length of the value stored inline; 0 if the value is not inline.
+     */
+    size_t getInlineValueLength() const {
+        return valueInline ? inlineValue()->size : 0;
+    }
+
+    /**
+     * True if this StoredValue is an OrderedStoredValue (i.e. it is also
+     * linked into a sequence ordered data structure).
+     */
+    bool isOrderedStoredValue() const {
+        return isOrdered;
     }
 
+    /**
+     * Downcast to an OrderedStoredValue.
+     * @throws std::logic_error if this is not an OrderedStoredValue.
+     */
+    OrderedStoredValue* toOrderedStoredValue();
+    const OrderedStoredValue* toOrderedStoredValue() const;
+
     /**
      * Reallocates the dynamic members of StoredValue. Used as part of
      * defragmentation.
@@ -475,9 +572,44 @@ public:
                                   const Item& item,
                                   bool isReplication = false);
 
-private:
-    StoredValue(const Item& itm, StoredValue* n, EPStats& stats, HashTable& ht)
-        : value(itm.getValue()),
+protected:
+    /**
+     * A value stored inline; a copy of the payload of a Blob (the
+     * FLEX_META_CODE byte, extended meta data and data) with just enough
+     * header to rebuild the Blob. Lives in the space following the key.
+     */
+    struct InlineValue {
+        /**
+         * Bytes needed for an InlineValue with space for a payload of
+         * capacity bytes.
+         */
+        static size_t getObjectSize(size_t capacity) {
+            return offsetof(InlineValue, payload) + capacity;
+        }
+
+        /// Create a new Blob holding a copy of this value.
+        Blob* toBlob() const {
+            const char* extMeta = payload + FLEX_DATA_OFFSET;
+            return Blob::New(extMeta + extMetaLen,
+                             size - FLEX_DATA_OFFSET - extMetaLen,
+                             reinterpret_cast<uint8_t*>(
+                                     const_cast<char*>(extMeta)),
+                             extMetaLen);
+        }
+
+        uint8_t size; //!< Bytes of payload in use.
+        uint8_t extMetaLen;
+        char payload[1];
+    };
+
+    StoredValue(const Item& itm,
+                StoredValue* n,
+                EPStats& stats,
+                HashTable& ht,
+                bool isOrdered,
+                uint8_t inlineCapacity,
+                uint16_t slabOffset)
+        : value(),
           next(n),
           cas(itm.getCas()),
           revSeqno(itm.getRevSeqno()),
@@ -488,7 +620,16 @@ private:
           deleted(false),
           newCacheItem(true),
           nru(itm.getNRUValue()),
-          key(itm.getKey()) {
+          isOrdered(isOrdered),
+          stale(false),
+          valueInline(false),
+          inlineCapacity(inlineCapacity),
+          slabOffset(slabOffset) {
+        // The key lives immediately after the (possibly derived) object, in
+        // the same allocation - see getRequiredStorage().
+        new (key()) SerialisedDocKey(itm.getKey());
+        assignValue(itm.getValue());
+
         if (isTempInitialItem()) {
             markClean();
         } else {
@@ -503,20 +644,85 @@ private:
         increaseCacheSize(ht, size());
 
         ObjectRegistry::onCreateStoredValue(this);
-        static_assert(offsetof(StoredValue, key) ==
-                      (sizeof(StoredValue) - sizeof(key)),
-                      "key must be the final member of StoredValue");
     }
 
     /*
-     * Return how many bytes are need to store Item as a StoredValue
+     * Return how many bytes are need to store Item as a StoredValue (or as
+     * an OrderedStoredValue if isOrdered is true) with an inline value space
+     * of the given capacity.
+     */
+    static size_t getRequiredStorage(const Item& item,
+                                     bool isOrdered,
+                                     uint8_t inlineCapacity);
+
+    /**
+     * Return the inline value capacity a new StoredValue for the given item
+     * should have, as per the current inline value threshold. Values up to
+     * the threshold are given some slack so they can grow a little (e.g. a
+     * counter) without moving to a Blob.
+     */
+    static uint8_t getInlineCapacityFor(const Item& item);
+
+    static size_t getInlineStorageSize(uint8_t capacity) {
+        return capacity == 0 ? 0 : InlineValue::getObjectSize(capacity);
+    }
+
+    /**
+     * Allocate size bytes for a new StoredValue of the given HashTable; from
+     * its slab arena if it has one (and the size is supported), else from
+     * the heap.
+     *
+     * @param slabOffset [out] to be passed to the constructor; 0 if heap
+     *        allocated
+     */
+    static void* allocate(HashTable& ht, size_t size, uint16_t& slabOffset);
+
+    /**
+     * Set the value of this item; stored inline if it fits the inline value
+     * space, otherwise by reference to the Blob.
      */
-    static size_t getRequiredStorage(const Item& item) {
-        return sizeof(StoredValue) + SerialisedDocKey::getObjectSize(item.getKey().size());
+    void assignValue(const value_t& v);
+
+    /// Stop storing a value inline (if currently doing so).
+    void releaseInlineValue();
+
+    /**
+     * Size of the fixed (non key) part of this object.
+     */
+    size_t getFixedSize() const;
+
+    /**
+     * The key is not a member; it is laid out directly after the fixed part
+     * of the object (which differs between StoredValue and
+     * OrderedStoredValue).
+     */
+    SerialisedDocKey* key() {
+        return reinterpret_cast<SerialisedDocKey*>(
+                reinterpret_cast<uint8_t*>(this) + getFixedSize());
+    }
+
+    const SerialisedDocKey* key() const {
+        return reinterpret_cast<const SerialisedDocKey*>(
+                reinterpret_cast<const uint8_t*>(this) + getFixedSize());
+    }
+
+    /**
+     * The inline value space (if any) is laid out directly after the key.
+     */
+    InlineValue* inlineValue() {
+        return reinterpret_cast<InlineValue*>(
+                reinterpret_cast<uint8_t*>(key()) + key()->getObjectSize());
+    }
+
+    const InlineValue* inlineValue() const {
+        return reinterpret_cast<const InlineValue*>(
+                reinterpret_cast<const uint8_t*>(key()) +
+                key()->getObjectSize());
     }
 
     friend class HashTable;
     friend class StoredValueFactory;
+    friend class OrderedStoredValueFactory;
 
     value_t            value;          // 8 bytes
     StoredValue        *next;          // 8 bytes
@@ -530,21 +736,183 @@ private:
     bool               deleted   :  1;
     bool               newCacheItem : 1;
     uint8_t            nru       :  2; //!< True if referenced since last sweep
-    SerialisedDocKey key; //!< The key itself.
+    bool               isOrdered :  1; //!< Is this an OrderedStoredValue?
+    //! Only used by OrderedStoredValue; the object has been superseded by a
+    //! newer version and is now owned by the sequence list.
+    bool               stale     :  1;
+    //! The value is held in the inline value space rather than 'value'.
+    bool               valueInline : 1;
+    //! Capacity of the inline value space; 0 if there is none.
+    uint8_t            inlineCapacity;
+    //! Offset of this object in its SlabArena slab; 0 if heap allocated.
+    uint16_t           slabOffset;
+    // The SerialisedDocKey follows the fixed size part of the object,
+    // followed by the inline value space (if any).
 
     static void increaseMetaDataSize(HashTable &ht, EPStats &st, size_t by);
     static void reduceMetaDataSize(HashTable &ht, EPStats &st, size_t by);
     static void increaseCacheSize(HashTable &ht, size_t by);
     static void reduceCacheSize(HashTable &ht, size_t by);
     static double mutation_mem_threshold;
+    static size_t inline_value_threshold;
 
     DISALLOW_COPY_AND_ASSIGN(StoredValue);
 };
 
+/**
+ * Subclass of StoredValue which additionally supports sequence number
+ * ordering.
+ *
+ * OrderedStoredValues are linked (intrusively) into a SequenceList owned by
+ * the vbucket in addition to the HashTable, which allows the vbucket to
+ * iterate its items in seqno order. The sequence list hooks are guarded by the
+ * list's write lock and must only be touched by the SequenceList.
+ *
+ * Note: OrderedStoredValues are destroyed via a StoredValue pointer (the
+ * HashTable does not know the concrete type), hence this class must not add
+ * any members which need destruction.
+ */
+class OrderedStoredValue : public StoredValue {
+public:
+    /**
+     * True if a newer version of this item exists (and this object is no
+     * longer in the HashTable). Caller must hold the sequence list's write
+     * lock.
+     */
+    bool isStale(std::lock_guard<std::mutex>& writeGuard) const {
+        return stale;
+    }
+
+    /**
+     * Mark this item as superseded by newSv (which may be null if the item
+     * was removed without a replacement). The 'next' chain pointer is
+     * re-used to record the replacement as a stale item is no longer in a
+     * HashTable bucket.
+     */
+    void markStale(std::lock_guard<std::mutex>& writeGuard,
+                   StoredValue* newSv) {
+        next = newSv;
+        stale = true;
+    }
+
+    /**
+     * Return the newer version of this item if it is stale, else null.
+     */
+    StoredValue* getReplacementIfStale(
+            std::lock_guard<std::mutex>& writeGuard) const {
+        return stale ? next : nullptr;
+    }
+
+    /**
+     * Returns the time this item was (last) deleted. Only meaningful if the
+     * item is deleted. Caller must hold the HashTable bucket lock.
+     */
+    rel_time_t getDeletedTime() const {
+        return deletedTime;
+    }
+
+    /**
+     * Records the time this item was deleted; used to determine when the
+     * tombstone can be purged. Caller must hold the HashTable bucket lock.
+     */
+    void setDeletedTime(rel_time_t time) {
+        deletedTime = time;
+    }
+
+    /**
+     * Return how many bytes are needed to store item as an
+     * OrderedStoredValue.
+     */
+    static size_t getRequiredStorage(const Item& item,
+                                     uint8_t inlineCapacity) {
+        return StoredValue::getRequiredStorage(item, true, inlineCapacity);
+    }
+
+private:
+    OrderedStoredValue(const Item& itm,
+                       StoredValue* n,
+                       EPStats& stats,
+                       HashTable& ht,
+                       uint8_t inlineCapacity,
+                       uint16_t slabOffset)
+        : StoredValue(itm,
+                      n,
+                      stats,
+                      ht,
+                      /*isOrdered*/ true,
+                      inlineCapacity,
+                      slabOffset),
+          seqPrev(nullptr),
+          seqNext(nullptr),
+          deletedTime(0) {
+    }
+
+    friend class OrderedStoredValueFactory;
+    friend class BasicLinkedList;
+
+    // Intrusive sequence list hooks; guarded by the list's writeLock.
+    OrderedStoredValue* seqPrev;
+    OrderedStoredValue* seqNext;
+
+    // Time of deletion; only valid if the item is deleted.
+    rel_time_t deletedTime;
+
+    DISALLOW_COPY_AND_ASSIGN(OrderedStoredValue);
+};
+
+inline size_t StoredValue::getRequiredStorage(const Item& item,
+                                              bool isOrdered,
+                                              uint8_t inlineCapacity) {
+    return (isOrdered ? sizeof(OrderedStoredValue) : sizeof(StoredValue)) +
+           SerialisedDocKey::getObjectSize(item.getKey().size()) +
+           getInlineStorageSize(inlineCapacity);
+}
+
+inline size_t StoredValue::getFixedSize() const {
+    return isOrdered ? sizeof(OrderedStoredValue) : sizeof(StoredValue);
+}
+
+inline OrderedStoredValue* StoredValue::toOrderedStoredValue() {
+    if (!isOrdered) {
+        throw std::logic_error("StoredValue::toOrderedStoredValue: Called on "
+                "a non-ordered StoredValue");
+    }
+    return static_cast<OrderedStoredValue*>(this);
+}
+
+inline const OrderedStoredValue* StoredValue::toOrderedStoredValue() const {
+    if (!isOrdered) {
+        throw std::logic_error("StoredValue::toOrderedStoredValue: Called on "
+                "a non-ordered StoredValue");
+    }
+    return static_cast<const OrderedStoredValue*>(this);
+}
+
+/**
+ * Abstract creator of StoredValue instances; lets a HashTable create either
+ * StoredValues or OrderedStoredValues without knowing which.
+ */
+class AbstractStoredValueFactory {
+public:
+    virtual ~AbstractStoredValueFactory() {}
+
+    /**
+     * Create a new StoredValue (or subclass) with the given item.
+     *
+     * @param itm the item the StoredValue should contain
+     * @param n the the top of the hash bucket into which this will be inserted
+     * @param ht the hashtable that will contain the StoredValue instance
+     *           created
+     */
+    virtual StoredValue* operator()(const Item& itm,
+                                    StoredValue* n,
+                                    HashTable& ht) = 0;
+};
+
 /**
  * Creator of StoredValue instances.
  */
-class StoredValueFactory {
+class StoredValueFactory : public AbstractStoredValueFactory {
 public:
 
     /**
@@ -560,23 +928,62 @@ public:
      * @param ht the hashtable that will contain the StoredValue instance
      *           created
      */
-    StoredValue* operator()(const Item& itm, StoredValue* n, HashTable& ht) {
-        return newStoredValue(itm, n, ht);
-    }
-
-private:
-    StoredValue* newStoredValue(const Item& itm,
-                                StoredValue* n,
-                                HashTable& ht) {
+    StoredValue* operator()(const Item& itm,
+                            StoredValue* n,
+                            HashTable& ht) override {
         // Allocate a buffer to store the StoredValue and any trailing bytes
         // that maybe required.
-        StoredValue* t =
-                new (::operator new(StoredValue::getRequiredStorage(itm)))
-                        StoredValue(itm, n, *stats, ht);
-        return t;
+        const uint8_t inlineCapacity = StoredValue::getInlineCapacityFor(itm);
+        uint16_t slabOffset;
+        void* p = StoredValue::allocate(
+                ht,
+                StoredValue::getRequiredStorage(
+                        itm, /*isOrdered*/ false, inlineCapacity),
+                slabOffset);
+        return new (p) StoredValue(itm,
+                                   n,
+                                   *stats,
+                                   ht,
+                                   /*isOrdered*/ false,
+                                   inlineCapacity,
+                                   slabOffset);
     }
 
+private:
     EPStats                *stats;
 };
 
+/**
+ * Creator of OrderedStoredValue instances.
+ */
+class OrderedStoredValueFactory : public AbstractStoredValueFactory {
+public:
+    OrderedStoredValueFactory(EPStats& s) : stats(&s) {
+    }
+
+    /**
+     * Create a new OrderedStoredValue with the given item.
+     *
+     * @param itm the item the StoredValue should contain
+     * @param n the the top of the hash bucket into which this will be inserted
+     * @param ht the hashtable that will contain the StoredValue instance
+     *           created
+     */
+    StoredValue* operator()(const Item& itm,
+                            StoredValue* n,
+                            HashTable& ht) override {
+        const uint8_t inlineCapacity = StoredValue::getInlineCapacityFor(itm);
+        uint16_t slabOffset;
+        void* p = StoredValue::allocate(
+                ht,
+                OrderedStoredValue::getRequiredStorage(itm, inlineCapacity),
+                slabOffset);
+        return new (p) OrderedStoredValue(
+                itm, n, *stats, ht, inlineCapacity, slabOffset);
+    }
+
+private:
+    EPStats* stats;
+};
+
 #endif  // SRC_STORED_VALUE_H_
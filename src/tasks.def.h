@@ -73,6 +73,7 @@ TASK(ExpiredItemPager, 7)
 TASK(ItemPagerVisitor, 7)
 TASK(ExpiredItemPagerVisitor, 7)
 TASK(DefragmenterTask, 7)
+TASK(EphemeralTombstonePurgerTask, 7)
 TASK(ConnManager, 8)
 TASK(WorkLoadMonitor, 10)
 TASK(ResumeCallback, 316)
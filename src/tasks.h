@@ -36,11 +36,14 @@ class Flusher;
 class FlusherTask : public GlobalTask {
 public:
     FlusherTask(EventuallyPersistentEngine *e, Flusher* f, uint16_t shardid,
-                bool completeBeforeShutdown = true)
+                size_t writerId = 0, bool completeBeforeShutdown = true)
         : GlobalTask(e, TaskId::FlusherTask, 0, completeBeforeShutdown),
           flusher(f) {
         std::stringstream ss;
         ss<<"Running a flusher loop: shard "<<shardid;
+        if (writerId != 0) {
+            ss<<" writer "<<writerId;
+        }
         desc = ss.str();
     }
 
@@ -25,6 +25,7 @@
 
 #include "atomic.h"
 #include "bgfetcher.h"
+#include "dcp/backfill.h"
 #include "ep_engine.h"
 
 #define STATWRITER_NAMESPACE vbucket
@@ -132,10 +133,16 @@ VBucket::VBucket(id_type i,
                  NewSeqnoCallback newSeqnoCb,
                  Configuration& config,
                  item_eviction_policy_t evictionPolicy,
+                 std::unique_ptr<AbstractStoredValueFactory> valFact,
                  vbucket_state_t initState,
                  uint64_t purgeSeqno,
                  uint64_t maxCas)
-    : ht(st),
+    : ht(st,
+         std::move(valFact),
+         /*size*/ 0,
+         /*locks*/ 0,
+         HashTable::layoutFromString(config.getHtLayout()),
+         config.isHtArena()),
       checkpointManager(st,
                         i,
                         chkConfig,
@@ -407,11 +414,11 @@ void VBucket::handlePreExpiry(StoredValue& v) {
          * value after pre-expiry is performed.
          */
         if (sapi->document->pre_expiry(itm_info)) {
-            char* extMeta = const_cast<char *>(v.getValue()->getExtMeta());
+            char* extMeta = const_cast<char *>(value->getExtMeta());
             Item new_item(v.getKey(), v.getFlags(), v.getExptime(),
                           itm_info.value[0].iov_base, itm_info.value[0].iov_len,
                           reinterpret_cast<uint8_t*>(extMeta),
-                          v.getValue()->getExtLen(), v.getCas(),
+                          value->getExtLen(), v.getCas(),
                           v.getBySeqno(), id, v.getRevSeqno(),
                           v.getNRUValue());
 
@@ -800,7 +807,7 @@ StoredValue* VBucket::fetchValidValue(std::unique_lock<std::mutex>& lh,
             if (queueExpired && getState() == vbucket_state_active) {
                 incExpirationStat(ExpireBy::Access);
                 handlePreExpiry(*v);
-                notifyNewSeqno(processExpiredItem(lh, *v).second);
+                notifyNewSeqno(processExpiredItem(lh, v).second);
             }
             return wantsDeleted ? v : NULL;
         }
@@ -808,6 +815,26 @@ StoredValue* VBucket::fetchValidValue(std::unique_lock<std::mutex>& lh,
     return v;
 }
 
+StoredValue* VBucket::fetchValidValueShared(
+        const HashTable::SharedBucketLock& lh,
+        const DocKey& key,
+        const bool trackReference) {
+    StoredValue* v = ht.unlocked_find(lh, key, /*wantsDeleted*/ true);
+    if (!v || v->isTempItem()) {
+        return nullptr;
+    }
+    if (!v->isDeleted()) {
+        // Both would modify v.
+        if (trackReference && v->getNRUValue() > MIN_NRU_VALUE) {
+            return nullptr;
+        }
+        if (v->isExpired(ep_real_time())) {
+            return nullptr;
+        }
+    }
+    return v;
+}
+
 void VBucket::incExpirationStat(const ExpireBy source) {
     switch (source) {
     case ExpireBy::Pager:
@@ -928,6 +955,29 @@ ENGINE_ERROR_CODE VBucket::statsVKey(const DocKey& key,
                                      const void* cookie,
                                      EventuallyPersistentEngine& engine,
                                      const int bgFetchDelay) {
+    {
+        // Optimistic path; see getInternal().
+        auto slh = ht.getSharedLockedBucket(key);
+        StoredValue* v = fetchValidValueShared(slh, key);
+        if (v) {
+            if (v->isDeleted()) {
+                return ENGINE_KEY_ENOENT;
+            }
+            const int64_t bySeqno = v->getBySeqno();
+            slh.unlock();
+            ++stats.numRemainingBgJobs;
+            ExTask task = new VKeyStatBGFetchTask(&engine,
+                                                  key,
+                                                  getId(),
+                                                  bySeqno,
+                                                  cookie,
+                                                  bgFetchDelay,
+                                                  false);
+            ExecutorPool::get()->schedule(task, READER_TASK_IDX);
+            return ENGINE_EWOULDBLOCK;
+        }
+    }
+
     int bucket_num(0);
     auto lh = ht.getLockedBucket(key, &bucket_num);
     StoredValue* v = fetchValidValue(lh, key, bucket_num, true);
@@ -1440,13 +1490,13 @@ ENGINE_ERROR_CODE VBucket::deleteItem(const DocKey& key,
     MutationStatus delrv;
     VBNotifyCtx notifyCtx;
     if (v->isExpired(ep_real_time())) {
-        std::tie(delrv, notifyCtx) = processExpiredItem(lh, *v);
+        std::tie(delrv, notifyCtx) = processExpiredItem(lh, v);
     } else {
         ItemMetaData metadata;
         metadata.revSeqno = v->getRevSeqno() + 1;
         std::tie(delrv, notifyCtx) =
                 processSoftDelete(lh,
-                                  *v,
+                                  v,
                                   cas,
                                   metadata,
                                   VBQueueItemCtx(GenerateBySeqno::Yes,
@@ -1594,7 +1644,7 @@ ENGINE_ERROR_CODE VBucket::deleteWithMeta(const DocKey& key,
         VBQueueItemCtx queueItmCtx(
                 genBySeqno, generateCas, TrackCasDrift::Yes, backfill);
         std::tie(delrv, notifyCtx) = processSoftDelete(lh,
-                                                       *v,
+                                                       v,
                                                        cas,
                                                        itemMeta,
                                                        queueItmCtx,
@@ -1652,7 +1702,7 @@ void VBucket::deleteExpiredItem(const DocKey& key,
             }
         } else if (v->isExpired(startTime) && !v->isDeleted()) {
             handlePreExpiry(*v);
-            VBNotifyCtx notifyCtx = processExpiredItem(lh, *v).second;
+            VBNotifyCtx notifyCtx = processExpiredItem(lh, v).second;
             // we unlock ht lock here because we want to avoid potential lock
             // inversions arising from notifyNewSeqno() call
             lh.unlock();
@@ -1671,7 +1721,7 @@ void VBucket::deleteExpiredItem(const DocKey& key,
                 v = ht.unlocked_find(key, bucket_num, true, false);
                 v->setDeleted();
                 v->setRevSeqno(revSeqno);
-                VBNotifyCtx notifyCtx = processExpiredItem(lh, *v).second;
+                VBNotifyCtx notifyCtx = processExpiredItem(lh, v).second;
                 // we unlock ht lock here because we want to avoid potential
                 // lock inversions arising from notifyNewSeqno() call
                 lh.unlock();
@@ -1882,7 +1932,8 @@ MutationStatus VBucket::insertFromWarmup(Item& itm,
                 return MutationStatus::InvalidCas;
             }
         }
-        updateStoredValue(lh, *v, itm, /*queueItmCtx*/ nullptr);
+        v = std::get<StoredValue*>(
+                updateStoredValue(lh, *v, itm, /*queueItmCtx*/ nullptr));
     }
 
     v->markClean();
@@ -1902,6 +1953,30 @@ GetValue VBucket::getInternal(const DocKey& key,
                               bool diskFlushAll) {
     const bool trackReference = (options & TRACK_REFERENCE);
     const bool getDeletedValue = (options & GET_DELETED_VALUE);
+    {
+        // Optimistic path: serve resident items under a shared lock of the
+        // hash bucket, so that concurrent readers of the same keys do not
+        // serialise on each other. Anything which needs the item to be
+        // modified (expiry, temp items, bg fetches...) falls through to
+        // the exclusive path below.
+        auto slh = ht.getSharedLockedBucket(key);
+        StoredValue* v = fetchValidValueShared(slh, key, trackReference);
+        if (v) {
+            if (v->isDeleted() && !getDeletedValue) {
+                return GetValue();
+            }
+            if (v->isResident()) {
+                const bool hide_cas = (options & HIDE_LOCKED_CAS) &&
+                                      v->isLockedNoReset(ep_current_time());
+                return GetValue(v->toItem(hide_cas, getId()),
+                                ENGINE_SUCCESS,
+                                v->getBySeqno(),
+                                false,
+                                v->getNRUValue());
+            }
+        }
+    }
+
     int bucket_num(0);
     auto lh = ht.getLockedBucket(key, &bucket_num);
     StoredValue* v = fetchValidValue(
@@ -1972,8 +2047,19 @@ ENGINE_ERROR_CODE VBucket::getMetaData(const DocKey& key,
                                        int bgFetchDelay,
                                        ItemMetaData& metadata,
                                        uint32_t& deleted) {
-    int bucket_num(0);
     deleted = 0;
+    {
+        // Optimistic path; see getInternal(). Only a miss or an item whose
+        // meta data still has to be fetched need the exclusive lock.
+        auto slh = ht.getSharedLockedBucket(key);
+        StoredValue* v = ht.unlocked_find(slh, key, /*wantsDeleted*/ true);
+        if (v && !v->isTempInitialItem()) {
+            stats.numOpsGetMeta++;
+            return readMetaData(*v, metadata, deleted);
+        }
+    }
+
+    int bucket_num(0);
     auto lh = ht.getLockedBucket(key, &bucket_num);
     StoredValue* v = ht.unlocked_find(key,
                                       bucket_num,
@@ -1985,25 +2071,8 @@ ENGINE_ERROR_CODE VBucket::getMetaData(const DocKey& key,
         if (v->isTempInitialItem()) { // Need bg meta fetch.
             bgFetch(key, cookie, engine, bgFetchDelay, true);
             return ENGINE_EWOULDBLOCK;
-        } else if (v->isTempNonExistentItem()) {
-            metadata.cas = v->getCas();
-            return ENGINE_KEY_ENOENT;
-        } else {
-            if (v->isTempDeletedItem() || v->isDeleted() ||
-                v->isExpired(ep_real_time())) {
-                deleted |= GET_META_ITEM_DELETED_FLAG;
-            }
-
-            if (v->isLocked(ep_current_time())) {
-                metadata.cas = static_cast<uint64_t>(-1);
-            } else {
-                metadata.cas = v->getCas();
-            }
-            metadata.flags = v->getFlags();
-            metadata.exptime = v->getExptime();
-            metadata.revSeqno = v->getRevSeqno();
-            return ENGINE_SUCCESS;
         }
+        return readMetaData(*v, metadata, deleted);
     } else {
         // The key wasn't found. However, this may be because it was previously
         // deleted or evicted with the full eviction strategy.
@@ -2024,6 +2093,30 @@ ENGINE_ERROR_CODE VBucket::getMetaData(const DocKey& key,
     }
 }
 
+ENGINE_ERROR_CODE VBucket::readMetaData(const StoredValue& v,
+                                        ItemMetaData& metadata,
+                                        uint32_t& deleted) {
+    if (v.isTempNonExistentItem()) {
+        metadata.cas = v.getCas();
+        return ENGINE_KEY_ENOENT;
+    }
+
+    if (v.isTempDeletedItem() || v.isDeleted() ||
+        v.isExpired(ep_real_time())) {
+        deleted |= GET_META_ITEM_DELETED_FLAG;
+    }
+
+    if (v.isLockedNoReset(ep_current_time())) {
+        metadata.cas = static_cast<uint64_t>(-1);
+    } else {
+        metadata.cas = v.getCas();
+    }
+    metadata.flags = v.getFlags();
+    metadata.exptime = v.getExptime();
+    metadata.revSeqno = v.getRevSeqno();
+    return ENGINE_SUCCESS;
+}
+
 ENGINE_ERROR_CODE VBucket::getKeyStats(const DocKey& key,
                                        const void* cookie,
                                        EventuallyPersistentEngine& engine,
@@ -2213,7 +2306,9 @@ void VBucket::addStats(bool details, ADD_STAT add_stat, const void *c,
         addStat("pending_writes", dirtyQueuePendingWrites.load(), add_stat, c);
 
         try {
-            DBFileInfo fileInfo = shard->getRWUnderlying()->getDbFileInfo(getId());
+            DBFileInfo fileInfo =
+                    shard->getRWUnderlying(shard->getWriterId(getId()))
+                            ->getDbFileInfo(getId());
             addStat("db_data_size", fileInfo.spaceUsed, add_stat, c);
             addStat("db_file_size", fileInfo.fileSize, add_stat, c);
         } catch (std::runtime_error& e) {
@@ -2364,7 +2459,11 @@ std::pair<MutationStatus, VBNotifyCtx> VBucket::processSet(
         if (!hasMetaData) {
             itm.setRevSeqno(v->getRevSeqno() + 1);
         }
-        return updateStoredValue(htLock, *v, itm, queueItmCtx);
+        MutationStatus status;
+        VBNotifyCtx notifyCtx;
+        std::tie(v, status, notifyCtx) =
+                updateStoredValue(htLock, *v, itm, queueItmCtx);
+        return {status, notifyCtx};
     } else if (cas != 0) {
         return {MutationStatus::NotFound, VBNotifyCtx()};
     } else {
@@ -2424,11 +2523,8 @@ std::pair<AddStatus, VBNotifyCtx> VBucket::processAdd(
         if (!v->isTempItem()) {
             itm.setRevSeqno(v->getRevSeqno() + 1);
         }
-        rv.second = updateStoredValue(htLock,
-                                      *v,
-                                      itm,
-                                      queueItmCtx)
-                            .second;
+        std::tie(v, std::ignore, rv.second) =
+                updateStoredValue(htLock, *v, itm, queueItmCtx);
     } else {
         if (itm.getBySeqno() != StoredValue::state_temp_init) {
             if (eviction == FULL_EVICTION && maybeKeyExists) {
@@ -2452,60 +2548,61 @@ std::pair<AddStatus, VBNotifyCtx> VBucket::processAdd(
 
 std::pair<MutationStatus, VBNotifyCtx> VBucket::processSoftDelete(
         const std::unique_lock<std::mutex>& htLock,
-        StoredValue& v,
+        StoredValue*& v,
         uint64_t cas,
         const ItemMetaData& metadata,
         const VBQueueItemCtx& queueItmCtx,
         bool use_meta,
         uint64_t bySeqno) {
-    if (v.isTempInitialItem() && eviction == FULL_EVICTION) {
+    if (v->isTempInitialItem() && eviction == FULL_EVICTION) {
         return {MutationStatus::NeedBgFetch, VBNotifyCtx()};
     }
 
-    if (v.isLocked(ep_current_time())) {
-        if (cas != v.getCas()) {
+    if (v->isLocked(ep_current_time())) {
+        if (cas != v->getCas()) {
             return {MutationStatus::IsLocked, VBNotifyCtx()};
         }
-        v.unlock();
+        v->unlock();
     }
 
-    if (cas != 0 && cas != v.getCas()) {
+    if (cas != 0 && cas != v->getCas()) {
         return {MutationStatus::InvalidCas, VBNotifyCtx()};
     }
 
     /* allow operation */
-    v.unlock();
+    v->unlock();
 
     MutationStatus rv =
-            v.isDirty() ? MutationStatus::WasDirty : MutationStatus::WasClean;
+            v->isDirty() ? MutationStatus::WasDirty : MutationStatus::WasClean;
 
     if (use_meta) {
-        v.setCas(metadata.cas);
-        v.setFlags(metadata.flags);
-        v.setExptime(metadata.exptime);
+        v->setCas(metadata.cas);
+        v->setFlags(metadata.flags);
+        v->setExptime(metadata.exptime);
     }
 
-    v.setRevSeqno(metadata.revSeqno);
-    VBNotifyCtx notifyCtx = softDeleteStoredValue(htLock,
-                                                  v,
-                                                  /*onlyMarkDeleted*/ false,
-                                                  queueItmCtx,
-                                                  bySeqno);
+    v->setRevSeqno(metadata.revSeqno);
+    VBNotifyCtx notifyCtx;
+    std::tie(v, notifyCtx) = softDeleteStoredValue(htLock,
+                                                   *v,
+                                                   /*onlyMarkDeleted*/ false,
+                                                   queueItmCtx,
+                                                   bySeqno);
     ht.updateMaxDeletedRevSeqno(metadata.revSeqno);
     return {rv, notifyCtx};
 }
 
 std::pair<MutationStatus, VBNotifyCtx> VBucket::processExpiredItem(
-        const std::unique_lock<std::mutex>& htLock, StoredValue& v) {
+        const std::unique_lock<std::mutex>& htLock, StoredValue*& v) {
     if (!htLock) {
         throw std::invalid_argument(
                 "VBucket::processExpiredItem: htLock not held for VBucket " +
                 std::to_string(getId()));
     }
 
-    if (v.isTempInitialItem() && eviction == FULL_EVICTION) {
+    if (v->isTempInitialItem() && eviction == FULL_EVICTION) {
         return {MutationStatus::NeedBgFetch,
-                queueDirty(v,
+                queueDirty(*v,
                            GenerateBySeqno::Yes,
                            GenerateCas::Yes,
                            /*isBackfillItem*/ false)};
@@ -2519,34 +2616,35 @@ std::pair<MutationStatus, VBNotifyCtx> VBucket::processExpiredItem(
      * but functionally correct and for performance reasons
      * only the system xattrs need to be stored.
      */
-    value_t value = v.getValue();
+    value_t value = v->getValue();
     bool onlyMarkDeleted =
             value && mcbp::datatype::is_xattr(value->getDataType());
-    v.setRevSeqno(v.getRevSeqno() + 1);
-    VBNotifyCtx notifyCtx =
+    v->setRevSeqno(v->getRevSeqno() + 1);
+    VBNotifyCtx notifyCtx;
+    std::tie(v, notifyCtx) =
             softDeleteStoredValue(htLock,
-                                  v,
+                                  *v,
                                   onlyMarkDeleted,
                                   VBQueueItemCtx(GenerateBySeqno::Yes,
                                                  GenerateCas::Yes,
                                                  TrackCasDrift::No,
                                                  /*isBackfillItem*/ false),
-                                  v.getBySeqno());
-    ht.updateMaxDeletedRevSeqno(v.getRevSeqno() + 1);
+                                  v->getBySeqno());
+    ht.updateMaxDeletedRevSeqno(v->getRevSeqno() + 1);
     return {MutationStatus::NotFound, notifyCtx};
 }
 
-std::pair<MutationStatus, VBNotifyCtx> VBucket::updateStoredValue(
-        const std::unique_lock<std::mutex>& htLock,
-        StoredValue& v,
-        const Item& itm,
-        const VBQueueItemCtx* queueItmCtx) {
+std::tuple<StoredValue*, MutationStatus, VBNotifyCtx>
+VBucket::updateStoredValue(const std::unique_lock<std::mutex>& htLock,
+                           StoredValue& v,
+                           const Item& itm,
+                           const VBQueueItemCtx* queueItmCtx) {
     MutationStatus status = ht.unlocked_updateStoredValue(htLock, v, itm);
 
     if (queueItmCtx) {
-        return {status, queueDirty(v, *queueItmCtx)};
+        return std::make_tuple(&v, status, queueDirty(v, *queueItmCtx));
     }
-    return {status, VBNotifyCtx()};
+    return std::make_tuple(&v, status, VBNotifyCtx());
 }
 
 std::pair<StoredValue*, VBNotifyCtx> VBucket::addNewStoredValue(
@@ -2563,6 +2661,18 @@ std::pair<StoredValue*, VBNotifyCtx> VBucket::addNewStoredValue(
     return {v, VBNotifyCtx()};
 }
 
+std::unique_ptr<DCPBackfill> VBucket::createDCPBackfill(
+        EventuallyPersistentEngine& e,
+        const stream_t& stream,
+        uint64_t startSeqno,
+        uint64_t endSeqno) {
+    return std::make_unique<DCPBackfillDisk>(&e, stream, startSeqno, endSeqno);
+}
+
+uint64_t VBucket::getMaxBackfillSeqno(EventuallyPersistentEngine& e) {
+    return e.getKVBucket()->getLastPersistedSeqno(getId());
+}
+
 bool VBucket::deleteStoredValue(const std::unique_lock<std::mutex>& htLock,
                                 StoredValue& v,
                                 int bucketNum) {
@@ -2577,7 +2687,7 @@ bool VBucket::deleteStoredValue(const std::unique_lock<std::mutex>& htLock,
     return true;
 }
 
-VBNotifyCtx VBucket::softDeleteStoredValue(
+std::tuple<StoredValue*, VBNotifyCtx> VBucket::softDeleteStoredValue(
         const std::unique_lock<std::mutex>& htLock,
         StoredValue& v,
         bool onlyMarkDeleted,
@@ -2589,7 +2699,7 @@ VBNotifyCtx VBucket::softDeleteStoredValue(
         v.setBySeqno(bySeqno);
     }
 
-    return queueDirty(v, queueItmCtx);
+    return std::make_tuple(&v, queueDirty(v, queueItmCtx));
 }
 
 /* [TBD]: Get rid of std::unique_lock<std::mutex> lock */
@@ -23,6 +23,7 @@
 #include "bloomfilter.h"
 #include "checkpoint.h"
 #include "conflict_resolution.h"
+#include "dcp/dcp-types.h"
 #include "ep_types.h"
 #include "failover-table.h"
 #include "hash_table.h"
@@ -35,8 +36,10 @@
 #include <platform/non_negative_counter.h>
 #include <atomic>
 #include <queue>
+#include <tuple>
 
 class BgFetcher;
+class DCPBackfill;
 
 const size_t MIN_CHK_FLUSH_TIMEOUT = 10; // 10 sec.
 const size_t MAX_CHK_FLUSH_TIMEOUT = 30; // 30 sec.
@@ -199,6 +202,7 @@ public:
             NewSeqnoCallback newSeqnoCb,
             Configuration& config,
             item_eviction_policy_t evictionPolicy,
+            std::unique_ptr<AbstractStoredValueFactory> valFact,
             vbucket_state_t initState = vbucket_state_dead,
             uint64_t purgeSeqno = 0,
             uint64_t maxCas = 0);
@@ -478,8 +482,8 @@ public:
     bool isResidentRatioUnderThreshold(float threshold,
                                        item_eviction_policy_t policy);
 
-    void addStats(bool details, ADD_STAT add_stat, const void *c,
-                  item_eviction_policy_t policy);
+    virtual void addStats(bool details, ADD_STAT add_stat, const void *c,
+                          item_eviction_policy_t policy);
 
     size_t getNumItems(item_eviction_policy_t policy) const;
 
@@ -526,6 +530,48 @@ public:
         return shard;
     }
 
+    /**
+     * Remove (and free) all items from the in-memory data structures which
+     * hold StoredValues - the HashTable, plus any subclass specific
+     * structures which reference the same StoredValues.
+     */
+    virtual void clearInMemoryItems() {
+        ht.clear();
+    }
+
+    /**
+     * Incremental version of clearInMemoryItems() for a vbucket which is no
+     * longer in use; frees (at least) maxItems items per call.
+     *
+     * @return true once all items have been freed
+     */
+    virtual bool clearInMemoryItemsChunk(size_t maxItems) {
+        return ht.clearChunk(maxItems);
+    }
+
+    /**
+     * Creates the DCP backfill which reads the given seqno range of this
+     * vbucket for a stream. By default the items are read from the KVStore.
+     *
+     * @param e the engine
+     * @param stream the (active) stream the items are backfilled for
+     * @param startSeqno first seqno to backfill
+     * @param endSeqno last seqno to backfill
+     */
+    virtual std::unique_ptr<DCPBackfill> createDCPBackfill(
+            EventuallyPersistentEngine& e,
+            const stream_t& stream,
+            uint64_t startSeqno,
+            uint64_t endSeqno);
+
+    /**
+     * Returns the highest seqno a DCP backfill of this vbucket can read up
+     * to: the last persisted seqno, as the items are read from the KVStore.
+     *
+     * @param e the engine
+     */
+    virtual uint64_t getMaxBackfillSeqno(EventuallyPersistentEngine& e);
+
     /**
      * Gets the valid StoredValue for the key and deletes an expired item if
      * desired by the caller. Requires the hash bucket to be locked
@@ -544,6 +590,21 @@ public:
                                  bool trackReference = true,
                                  bool queueExpired = true);
 
+    /**
+     * Read-only variant of fetchValidValue() (with wantsDeleted), for the
+     * optimistic read path under a shared hash bucket lock. Returns null if
+     * the key was not found, or if it is a temp item or reading it would
+     * modify it (expiry, tracking a reference to it); the caller should then
+     * retry under the exclusive lock with fetchValidValue().
+     *
+     * @param lh Reference to the shared hash bucket lock
+     * @param key
+     * @param trackReference
+     */
+    StoredValue* fetchValidValueShared(const HashTable::SharedBucketLock& lh,
+                                       const DocKey& key,
+                                       bool trackReference = true);
+
     /**
      * Complete the background fetch for the specified item. Depending on the
      * state of the item, restore it to the hashtable as appropriate,
@@ -1009,7 +1070,9 @@ protected:
      * Assumes that HT bucket lock is grabbed.
      *
      * @param htLock Hash table lock that must be held
-     * @param v Reference to the StoredValue to be soft deleted
+     * @param v[in, out] the stored value to be soft deleted. This can be
+     *          changed if the in-memory data structures replace the
+     *          StoredValue with a new one (see softDeleteStoredValue())
      * @param cas the expected CAS of the item (or 0 to override)
      * @param metadata ref to item meta data
      * @param queueItmCtx holds info needed to queue an item in chkpt or vb
@@ -1022,7 +1085,7 @@ protected:
      */
     std::pair<MutationStatus, VBNotifyCtx> processSoftDelete(
             const std::unique_lock<std::mutex>& htLock,
-            StoredValue& v,
+            StoredValue*& v,
             uint64_t cas,
             const ItemMetaData& metadata,
             const VBQueueItemCtx& queueItmCtx,
@@ -1046,9 +1109,9 @@ protected:
      *
      * @return true if an object was deleted, false otherwise
      */
-    bool deleteStoredValue(const std::unique_lock<std::mutex>& htLock,
-                           StoredValue& v,
-                           int bucketNum);
+    virtual bool deleteStoredValue(const std::unique_lock<std::mutex>& htLock,
+                                   StoredValue& v,
+                                   int bucketNum);
 
     /**
      * Queue an item for persistence and replication. Maybe track CAS drift
@@ -1115,6 +1178,16 @@ private:
                        const hrtime_t start,
                        const hrtime_t stop);
 
+    /**
+     * Fill in the meta data of a (non temp-initial) StoredValue for
+     * getMetaData(). Only reads v.
+     *
+     * @return the result of getMetaData()
+     */
+    static ENGINE_ERROR_CODE readMetaData(const StoredValue& v,
+                                          ItemMetaData& metadata,
+                                          uint32_t& deleted);
+
     /**
      * Updates an existing StoredValue in in-memory data structures like HT.
      * Assumes that HT bucket lock is grabbed.
@@ -1125,10 +1198,12 @@ private:
      * @param queueItmCtx holds info needed to queue an item in chkpt or vb
      *                    backfill queue; NULL if item need not be queued
      *
-     * @return Result indicating the status of the operation and notification
-     *                info
+     * @return The StoredValue now holding the item (a subclass may replace v
+     *         by a new StoredValue rather than update it in place), the
+     *         status of the operation and notification info
      */
-    virtual std::pair<MutationStatus, VBNotifyCtx> updateStoredValue(
+    virtual std::tuple<StoredValue*, MutationStatus, VBNotifyCtx>
+    updateStoredValue(
             const std::unique_lock<std::mutex>& htLock,
             StoredValue& v,
             const Item& itm,
@@ -1168,9 +1243,11 @@ private:
      *                    backfill queue
      * @param bySeqno seqno of the key being deleted
      *
-     * @return Notification info
+     * @return The StoredValue now holding the deleted item (a subclass may
+     *         replace v by a new StoredValue rather than update it in place)
+     *         and notification info
      */
-    virtual VBNotifyCtx softDeleteStoredValue(
+    virtual std::tuple<StoredValue*, VBNotifyCtx> softDeleteStoredValue(
             const std::unique_lock<std::mutex>& htLock,
             StoredValue& v,
             bool onlyMarkDeleted,
@@ -1183,13 +1260,15 @@ private:
      * Assumes that HT bucket lock is grabbed.
      *
      * @param htLock Hash table lock that must be held
-     * @param v Reference to the StoredValue to be soft deleted
+     * @param v[in, out] the stored value to be soft deleted. This can be
+     *          changed if the in-memory data structures replace the
+     *          StoredValue with a new one (see softDeleteStoredValue())
      *
      * @return Result indicating the status of the operation and notification
      *                info
      */
     std::pair<MutationStatus, VBNotifyCtx> processExpiredItem(
-            const std::unique_lock<std::mutex>& htLock, StoredValue& v);
+            const std::unique_lock<std::mutex>& htLock, StoredValue*& v);
 
     /**
      * Add a temporary item in hash table and enqueue a background fetch for a
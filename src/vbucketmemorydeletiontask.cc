@@ -17,6 +17,8 @@
 
 #include "vbucketmemorydeletiontask.h"
 
+#include "ep_engine.h"
+
 #include <phosphor/phosphor.h>
 
 #include <sstream>
@@ -25,7 +27,8 @@ VBucketMemoryDeletionTask::VBucketMemoryDeletionTask(
         EventuallyPersistentEngine& eng, RCPtr<VBucket>& vb, double delay)
     : GlobalTask(&eng, TaskId::VBucketMemoryDeletionTask, delay, true),
       e(eng),
-      vbucket(vb) {
+      vbucket(vb),
+      notifiedPendingConns(false) {
     if (!vb) {
         throw std::invalid_argument(
                 "VBucketMemoryDeletionTask: vb to delete cannot be null");
@@ -38,11 +41,51 @@ std::string VBucketMemoryDeletionTask::getDescription() {
     return description;
 }
 
+const size_t VBucketMemoryDeletionTask::chunkItems;
+
 bool VBucketMemoryDeletionTask::run() {
     TRACE_EVENT("ep-engine/task", "VBucketMemoryDeletionTask",
                 vbucket->getId());
-    vbucket->notifyAllPendingConnsFailed(e);
-    vbucket->ht.clear();
+    if (!notifiedPendingConns) {
+        vbucket->notifyAllPendingConnsFailed(e);
+        notifiedPendingConns = true;
+    }
+
+    EPStats& stats = e.getEpStats();
+    const hrtime_t start = gethrtime();
+    const size_t memBefore = vbucket->ht.getItemMemory();
+    const bool completed = clearItems();
+    const size_t memAfter = vbucket->ht.getItemMemory();
+    const hrtime_t wallTime = (gethrtime() - start) / 1000;
+
+    if (memBefore > memAfter) {
+        stats.vbucketMemDelBytesFreed.fetch_add(memBefore - memAfter);
+    }
+    stats.vbucketMemDelTotWalltime.fetch_add(wallTime);
+    atomic_setIfBigger(stats.vbucketMemDelMaxRunWalltime, wallTime);
+
+    if (!completed) {
+        // Resume as soon as other tasks had a chance to run.
+        snooze(0);
+        return true;
+    }
     vbucket.reset();
     return false;
 }
+
+bool VBucketMemoryDeletionTask::clearItems() {
+    const size_t chunkDuration =
+            e.getConfiguration().getVbMemDeletionChunkDuration();
+    if (chunkDuration == 0) {
+        vbucket->clearInMemoryItems();
+        return true;
+    }
+
+    const hrtime_t deadline = gethrtime() + (chunkDuration * 1000 * 1000);
+    do {
+        if (vbucket->clearInMemoryItemsChunk(chunkItems)) {
+            return true;
+        }
+    } while (gethrtime() < deadline);
+    return false;
+}
@@ -22,7 +22,13 @@
 /*
  * This is a NONIO task called as part of VB deletion.  The task is responsible
  * for clearing all the VBucket's pending operations and for clearing the
- * VBucket's hash table.
+ * VBucket's hash table. If the hash table allocates from a slab arena
+ * (ht_arena) its memory is released as a whole, see HashTable::clear().
+ *
+ * If vb_mem_deletion_chunk_duration is non-zero the items are instead freed
+ * in chunks, each run of the task stopping after that many milliseconds and
+ * rescheduling itself, so that deleting a large vbucket does not hold a
+ * NONIO thread (and the allocator) for long.
  */
 class VBucketMemoryDeletionTask : public GlobalTask {
 public:
@@ -35,7 +41,14 @@ public:
     bool run();
 
 private:
+    /// Frees the vbucket's items; returns true once all are freed.
+    bool clearItems();
+
+    /// Number of items freed between checks of the chunk deadline.
+    static const size_t chunkItems = 1000;
+
     EventuallyPersistentEngine& e;
     RCPtr<VBucket> vbucket;
     std::string description;
+    bool notifiedPendingConns;
 };
@@ -1046,14 +1046,16 @@ struct Ret_vals {
 
 /*
  * Performs a single DCP latency / bandwidth test with the given parameters.
- * Returns vectors of item timings and recived bytes.
+ * Returns vectors of item timings and recived bytes; items_per_sec is set to
+ * the stream's throughput (from its first to its last received item).
  */
 static std::pair<std::vector<hrtime_t>,
                  std::vector<size_t>>
 single_dcp_latency_bw_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
                            uint16_t vb, size_t item_count,
                            Doc_format typeOfData, const std::string& name,
-                           uint32_t opaque, bool retrieveCompressed) {
+                           uint32_t opaque, bool retrieveCompressed,
+                           double& items_per_sec) {
     std::vector<size_t> received;
 
     check(set_vbucket_state(h, h1, vb, vbucket_state_active),
@@ -1072,6 +1074,13 @@ single_dcp_latency_bw_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
     load_thread.join();
     dcp_thread.join();
 
+    items_per_sec = 0;
+    if (recv_times.size() > 1) {
+        const hrtime_t elapsed = recv_times.back() - recv_times.front();
+        items_per_sec = (recv_times.size() - 1) /
+                        (std::max(elapsed, hrtime_t(1)) / 1e9);
+    }
+
     std::vector<hrtime_t> timings;
     for (size_t j = 0; j < insert_times.size(); ++j) {
         if (insert_times[j] < recv_times[j]) {
@@ -1088,6 +1097,89 @@ single_dcp_latency_bw_test(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
     return {timings, received};
 }
 
+// Producers used by dcp_step_batch_throughput(): a single step may hand over
+// several messages (see dcp_producer_step_batch_size), so mutations are
+// counted by the callback itself rather than after each step.
+static dcp_message_producers* dcp_batch_base_producers;
+static size_t dcp_batch_mutations;
+
+static ENGINE_ERROR_CODE count_dcp_batch_mutation(const void* cookie,
+                                                  uint32_t opaque,
+                                                  item *itm,
+                                                  uint16_t vbucket,
+                                                  uint64_t by_seqno,
+                                                  uint64_t rev_seqno,
+                                                  uint32_t lock_time,
+                                                  const void *meta,
+                                                  uint16_t nmeta,
+                                                  uint8_t nru) {
+    ++dcp_batch_mutations;
+    return dcp_batch_base_producers->mutation(cookie, opaque, itm, vbucket,
+                                              by_seqno, rev_seqno, lock_time,
+                                              meta, nmeta, nru);
+}
+
+/*
+ * Streams the first item_count mutations of the given (already loaded)
+ * vbucket from a new DCP producer sending up to batch_size messages per
+ * step. Returns the throughput in items per second.
+ */
+static double dcp_step_batch_throughput(ENGINE_HANDLE *h, ENGINE_HANDLE_V1 *h1,
+                                        uint16_t vbid, size_t item_count,
+                                        size_t batch_size) {
+    check(set_param(h, h1, protocol_binary_engine_param_dcp,
+                    "dcp_producer_step_batch_size",
+                    std::to_string(batch_size).c_str()),
+          "Failed to set dcp_producer_step_batch_size");
+
+    const void *cookie = testHarness.create_cookie();
+    const std::string name("perf_batch_" + std::to_string(batch_size));
+    std::string uuid("vb_" + std::to_string(vbid) + ":0:id");
+    uint64_t vb_uuid = get_ull_stat(h, h1, uuid.c_str(), "failovers");
+    uint32_t opaque = 0xFFFF0000;
+
+    checkeq(h1->dcp.open(h, cookie, ++opaque, 0, DCP_OPEN_PRODUCER,
+                         (void*)name.c_str(), name.length()),
+            ENGINE_SUCCESS,
+            "Failed dcp producer open connection");
+
+    uint64_t rollback = 0;
+    checkeq(h1->dcp.stream_req(h, cookie, 0, ++opaque,
+                               vbid, 0, std::numeric_limits<uint64_t>::max(),
+                               vb_uuid, 0, 0, &rollback,
+                               mock_dcp_add_failover_log),
+            ENGINE_SUCCESS,
+            "Failed to initiate stream request");
+
+    std::unique_ptr<dcp_message_producers> base(get_dcp_producers(h, h1));
+    dcp_message_producers producers = *base;
+    producers.mutation = count_dcp_batch_mutation;
+    dcp_batch_base_producers = base.get();
+    dcp_batch_mutations = 0;
+
+    const hrtime_t start = gethrtime();
+    while (dcp_batch_mutations < item_count) {
+        ENGINE_ERROR_CODE err = h1->dcp.step(h, cookie, &producers);
+        switch (err) {
+        case ENGINE_SUCCESS:
+            // Wait for the backfill / checkpoint processor to catch up.
+            testHarness.lock_cookie(cookie);
+            testHarness.waitfor_cookie(cookie);
+            testHarness.unlock_cookie(cookie);
+            break;
+        case ENGINE_WANT_MORE:
+            break;
+        default:
+            fprintf(stderr, "Unhandled dcp->step() result: %d\n", err);
+            abort();
+        }
+    }
+    const hrtime_t elapsed = gethrtime() - start;
+
+    testHarness.destroy_cookie(cookie);
+    return item_count / (std::max(elapsed, hrtime_t(1)) / 1e9);
+}
+
 static enum test_result perf_dcp_latency_and_bandwidth(ENGINE_HANDLE *h,
                                                        ENGINE_HANDLE_V1 *h1,
                                                        std::string title,
@@ -1099,17 +1191,22 @@ static enum test_result perf_dcp_latency_and_bandwidth(ENGINE_HANDLE *h,
 
     std::vector<struct Ret_vals> iterations;
 
+    double as_is_throughput;
+    double compress_throughput;
+
     // For Loader & DCP client to get documents as is from vbucket 0
     auto as_is_results =
             single_dcp_latency_bw_test(h, h1, /*vb*/0, item_count, typeOfData,
-                                       "As_is", /*opaque*/0xFFFFFF00, false);
+                                       "As_is", /*opaque*/0xFFFFFF00, false,
+                                       as_is_throughput);
     all_timings.push_back({"As_is", &as_is_results.first});
     all_sizes.push_back({"As_s", &as_is_results.second});
 
     // For Loader & DCP client to get documents compressed from vbucket 1
     auto compress_results =
             single_dcp_latency_bw_test(h, h1, /*vb*/1, item_count, typeOfData,
-                                      "Compress", /*opaque*/0xFF000000, true);
+                                      "Compress", /*opaque*/0xFF000000, true,
+                                      compress_throughput);
     all_timings.push_back({"Compress", &compress_results.first});
     all_sizes.push_back({"Compress", &compress_results.second});
 
@@ -1130,6 +1227,31 @@ static enum test_result perf_dcp_latency_and_bandwidth(ENGINE_HANDLE *h,
     output_result(title, "Latency", all_timings, "µs");
     printf("\n\n");
 
+    printed = printf("=== %s Per-stream throughput with concurrent load "
+                     "(items/s)", title.c_str());
+    fillLineWith('=', 86-printed);
+    printf("\n");
+    printf("%-30s %-10s %12.0f\n", title.c_str(), "As_is", as_is_throughput);
+    printf("%-30s %-10s %12.0f\n", title.c_str(), "Compress",
+           compress_throughput);
+    printf("\n\n");
+
+    // Stream vbucket 0 (loaded above) again with increasing numbers of
+    // messages handed over per DCP step.
+    printed = printf("=== %s Throughput vs. step batch size (items/s)",
+                     title.c_str());
+    fillLineWith('=', 86-printed);
+    printf("\n");
+    for (size_t batch_size : {1, 4, 16, 64}) {
+        printf("%-30s batch %-4zu %12.0f\n", title.c_str(), batch_size,
+               dcp_step_batch_throughput(h, h1, /*vb*/0, item_count,
+                                         batch_size));
+    }
+    check(set_param(h, h1, protocol_binary_engine_param_dcp,
+                    "dcp_producer_step_batch_size", "1"),
+          "Failed to reset dcp_producer_step_batch_size");
+    printf("\n\n");
+
     return SUCCESS;
 }
 
@@ -1403,6 +1525,88 @@ static enum test_result perf_slow_stat_latency_100vb_sets_and_dcp(
                                      BackgroundWork::Dcp), 100);
 }
 
+/*
+ * Read throughput of a small hot keyset, with an increasing number of reader
+ * threads. Gets are served under a shared lock of the hash bucket, so the
+ * throughput should scale with the number of readers rather than serialise
+ * on the hash bucket locks of the hot keys.
+ */
+static enum test_result perf_hot_key_read_scaling(ENGINE_HANDLE *h,
+                                                  ENGINE_HANDLE_V1 *h1) {
+    // Only timing front-end performance, not considering persistence.
+    stop_persistence(h, h1);
+
+    const int num_keys = 16;
+    const std::string data(100, 'x');
+    std::vector<std::string> keys;
+    for (int i = 0; i < num_keys; i++) {
+        keys.push_back("hot_" + std::to_string(i));
+        item* it = NULL;
+        checkeq(ENGINE_SUCCESS,
+                store(h, h1, nullptr, OPERATION_SET, keys.back().c_str(),
+                      data.c_str(), &it),
+                "Failed to store a value");
+        h1->release(h, nullptr, it);
+    }
+
+    const size_t gets_per_thread = ITERATIONS / 4;
+    const std::vector<int> thread_counts = {1, 2, 4, 8};
+
+    std::vector<std::vector<hrtime_t>> timings(thread_counts.size());
+    std::vector<std::string> names;
+    std::vector<std::pair<std::string, std::vector<hrtime_t>*> > all_timings;
+    std::stringstream throughput;
+    for (size_t t = 0; t < thread_counts.size(); t++) {
+        const int n_threads = thread_counts[t];
+        std::vector<std::vector<hrtime_t>> thread_timings(n_threads);
+        std::vector<std::thread> threads;
+
+        const hrtime_t start = gethrtime();
+        for (int i = 0; i < n_threads; i++) {
+            threads.emplace_back([&, i]() {
+                const void* cookie = testHarness.create_cookie();
+                auto& samples = thread_timings[i];
+                samples.reserve(gets_per_thread);
+                for (size_t n = 0; n < gets_per_thread; n++) {
+                    item* it = NULL;
+                    const hrtime_t getStart = gethrtime();
+                    checkeq(ENGINE_SUCCESS,
+                            get(h, h1, cookie, &it,
+                                keys[(n + i) % num_keys], 0),
+                            "Failed to get a value");
+                    samples.push_back(gethrtime() - getStart);
+                    h1->release(h, cookie, it);
+                }
+                testHarness.destroy_cookie(cookie);
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        const hrtime_t elapsed = gethrtime() - start;
+
+        for (const auto& samples : thread_timings) {
+            timings[t].insert(timings[t].end(), samples.begin(), samples.end());
+        }
+        names.push_back(std::to_string(n_threads) + "_readers");
+        throughput << "  " << n_threads << " reader(s): "
+                   << uint64_t((gets_per_thread * n_threads) /
+                               (elapsed / 1e9))
+                   << " gets/s\n";
+    }
+    for (size_t t = 0; t < thread_counts.size(); t++) {
+        all_timings.push_back(std::make_pair(names[t], &timings[t]));
+    }
+
+    std::string description("Get latency, " + std::to_string(num_keys) +
+                            " hot keys (µs)");
+    output_result("Hot key read scaling", description, all_timings, "µs");
+    if (testHarness.output_format == OutputFormat::Text) {
+        printf("Throughput:\n%s\n", throughput.str().c_str());
+    }
+    return SUCCESS;
+}
+
 /*****************************************************************************
  * List of testcases
  *****************************************************************************/
@@ -1461,6 +1665,11 @@ BaseTestCase testsuite_testcases[] = {
                  "backend=couchdb;ht_size=393209",
                  prepare_tap, cleanup),
 
+        TestCase("Hot key read scaling", perf_hot_key_read_scaling,
+                 test_setup, teardown,
+                 "backend=couchdb;ht_size=393209",
+                 prepare, cleanup),
+
         TestCase("Baseline Stat latency", perf_stat_latency_baseline,
                  test_setup, teardown,
                  "backend=couchdb;ht_size=393209",
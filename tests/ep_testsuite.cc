@@ -4802,6 +4802,26 @@ static enum test_result test_multiple_transactions(ENGINE_HANDLE *h,
     return SUCCESS;
 }
 
+static enum test_result test_batch_defer(ENGINE_HANDLE *h,
+                                         ENGINE_HANDLE_V1 *h1) {
+    // With fewer items than flusher_batch_defer_items, the vbucket is held
+    // back for flusher_batch_defer_delay: all the items are written by a
+    // single commit.
+    const int commits = get_int_stat(h, h1, "ep_commit_num");
+    for (int j = 0; j < 5; ++j) {
+        std::string key("key" + std::to_string(j));
+        item *i;
+        checkeq(ENGINE_SUCCESS,
+                store(h, h1, NULL, OPERATION_SET, key.c_str(), "value", &i),
+                "Failed to store a value");
+        h1->release(h, NULL, i);
+    }
+    wait_for_stat_to_be(h, h1, "ep_total_persisted", 5);
+    checkeq(commits + 1, get_int_stat(h, h1, "ep_commit_num"),
+            "Expected the items to be persisted by a single commit");
+    return SUCCESS;
+}
+
 static enum test_result test_set_ret_meta(ENGINE_HANDLE *h,
                                           ENGINE_HANDLE_V1 *h1) {
     // Check that set without cas succeeds
@@ -6050,6 +6070,8 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "rw_0:failure_vbset",
                 "rw_0:io_compaction_read_bytes",
                 "rw_0:io_compaction_write_bytes",
+                "rw_0:io_flush_reads",
+                "rw_0:io_flush_reads_per_item",
                 "rw_0:io_num_read",
                 "rw_0:io_num_write",
                 "rw_0:io_read_bytes",
@@ -6068,6 +6090,8 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "rw_1:failure_vbset",
                 "rw_1:io_compaction_read_bytes",
                 "rw_1:io_compaction_write_bytes",
+                "rw_1:io_flush_reads",
+                "rw_1:io_flush_reads_per_item",
                 "rw_1:io_num_read",
                 "rw_1:io_num_write",
                 "rw_1:io_read_bytes",
@@ -6086,6 +6110,8 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "rw_2:failure_vbset",
                 "rw_2:io_compaction_read_bytes",
                 "rw_2:io_compaction_write_bytes",
+                "rw_2:io_flush_reads",
+                "rw_2:io_flush_reads_per_item",
                 "rw_2:io_num_read",
                 "rw_2:io_num_write",
                 "rw_2:io_read_bytes",
@@ -6104,6 +6130,8 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "rw_3:failure_vbset",
                 "rw_3:io_compaction_read_bytes",
                 "rw_3:io_compaction_write_bytes",
+                "rw_3:io_flush_reads",
+                "rw_3:io_flush_reads_per_item",
                 "rw_3:io_num_read",
                 "rw_3:io_num_write",
                 "rw_3:io_read_bytes",
@@ -6146,6 +6174,10 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_dcp_items_sent",
                 "ep_dcp_max_running_backfills",
                 "ep_dcp_num_running_backfills",
+                "ep_dcp_num_running_scans",
+                "ep_dcp_num_scan_attaches",
+                "ep_dcp_num_scan_waiters",
+                "ep_dcp_num_shared_scans",
                 "ep_dcp_producer_count",
                 "ep_dcp_queue_backfillremaining",
                 "ep_dcp_queue_fill",
@@ -6301,7 +6333,10 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_bfilter_residency_threshold",
                 "ep_bg_fetch_delay",
                 "ep_bucket_type",
+                "ep_chk_expel_enabled",
                 "ep_chk_max_items",
+                "ep_chk_max_size",
+                "ep_chk_mem_quota_percent",
                 "ep_chk_period",
                 "ep_chk_remover_stime",
                 "ep_collections_prototype_enabled",
@@ -6311,11 +6346,17 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_conflict_resolution_type",
                 "ep_connection_manager_interval",
                 "ep_couch_bucket",
+                "ep_couchstore_io_backend",
+                "ep_couchstore_io_uring_depth",
+                "ep_couchstore_io_uring_direct",
                 "ep_cursor_dropping_lower_mark",
                 "ep_cursor_dropping_upper_mark",
                 "ep_data_traffic_enabled",
                 "ep_dbname",
                 "ep_dcp_backfill_byte_limit",
+                "ep_dcp_backfill_bytes_per_sec",
+                "ep_dcp_backfill_max_scans",
+                "ep_dcp_backfill_share_scans",
                 "ep_dcp_conn_buffer_size",
                 "ep_dcp_conn_buffer_size_aggr_mem_threshold",
                 "ep_dcp_conn_buffer_size_aggressive_perc",
@@ -6328,29 +6369,43 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_dcp_idle_timeout",
                 "ep_dcp_noop_tx_interval",
                 "ep_dcp_producer_snapshot_marker_yield_limit",
+                "ep_dcp_producer_step_batch_size",
                 "ep_dcp_consumer_process_buffered_messages_yield_limit",
                 "ep_dcp_consumer_process_buffered_messages_batch_size",
                 "ep_dcp_scan_byte_limit",
                 "ep_dcp_scan_item_limit",
                 "ep_dcp_takeover_max_time",
+                "ep_dcp_takeover_stream_weight",
                 "ep_dcp_value_compression_enabled",
                 "ep_defragmenter_age_threshold",
                 "ep_defragmenter_chunk_duration",
                 "ep_defragmenter_enabled",
                 "ep_defragmenter_interval",
                 "ep_enable_chk_merge",
+                "ep_ephemeral_metadata_purge_age",
+                "ep_ephemeral_metadata_purge_chunk_duration",
+                "ep_ephemeral_metadata_purge_interval",
                 "ep_exp_pager_enabled",
                 "ep_exp_pager_initial_run_time",
                 "ep_exp_pager_stime",
                 "ep_failpartialwarmup",
                 "ep_flushall_enabled",
+                "ep_flusher_batch_defer_delay",
+                "ep_flusher_batch_defer_items",
+                "ep_flusher_batch_max_bytes",
+                "ep_flusher_batch_max_items",
+                "ep_flusher_commit_latency_target",
+                "ep_flushers_per_shard",
                 "ep_getl_default_timeout",
                 "ep_getl_max_timeout",
                 "ep_hlc_drift_ahead_threshold_us",
                 "ep_hlc_drift_behind_threshold_us",
+                "ep_ht_arena",
+                "ep_ht_layout",
                 "ep_ht_locks",
                 "ep_ht_size",
                 "ep_initfile",
+                "ep_inline_value_threshold",
                 "ep_item_eviction_policy",
                 "ep_item_num_based_new_chk",
                 "ep_keep_closed_chks",
@@ -6390,6 +6445,7 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_time_synchronization",
                 "ep_uuid",
                 "ep_vb0",
+                "ep_vb_mem_deletion_chunk_duration",
                 "ep_waitforwarmup",
                 "ep_warmup",
                 "ep_warmup_batch_size",
@@ -6455,6 +6511,8 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_alog_resident_ratio_threshold",
                 "ep_alog_sleep_time",
                 "ep_alog_task_time",
+                "ep_arena_mapped_bytes",
+                "ep_arena_used_bytes",
                 "ep_backend",
                 "ep_backfill_mem_threshold",
                 "ep_bfilter_enabled",
@@ -6470,7 +6528,14 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_blob_overhead",
                 "ep_bucket_priority",
                 "ep_bucket_type",
+                "ep_checkpoint_items_expelled",
+                "ep_checkpoint_mem_expelled",
+                "ep_checkpoint_memory",
+                "ep_checkpoint_memory_quota",
+                "ep_chk_expel_enabled",
                 "ep_chk_max_items",
+                "ep_chk_max_size",
+                "ep_chk_mem_quota_percent",
                 "ep_chk_period",
                 "ep_chk_persistence_remains",
                 "ep_chk_persistence_timeout",
@@ -6483,6 +6548,9 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_conflict_resolution_type",
                 "ep_connection_manager_interval",
                 "ep_couch_bucket",
+                "ep_couchstore_io_backend",
+                "ep_couchstore_io_uring_depth",
+                "ep_couchstore_io_uring_direct",
                 "ep_cursor_dropping_lower_mark",
                 "ep_cursor_dropping_lower_threshold",
                 "ep_cursor_dropping_upper_mark",
@@ -6491,6 +6559,9 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_data_traffic_enabled",
                 "ep_dbname",
                 "ep_dcp_backfill_byte_limit",
+                "ep_dcp_backfill_bytes_per_sec",
+                "ep_dcp_backfill_max_scans",
+                "ep_dcp_backfill_share_scans",
                 "ep_dcp_conn_buffer_size",
                 "ep_dcp_conn_buffer_size_aggr_mem_threshold",
                 "ep_dcp_conn_buffer_size_aggressive_perc",
@@ -6505,9 +6576,11 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_dcp_min_compression_ratio",
                 "ep_dcp_noop_tx_interval",
                 "ep_dcp_producer_snapshot_marker_yield_limit",
+                "ep_dcp_producer_step_batch_size",
                 "ep_dcp_scan_byte_limit",
                 "ep_dcp_scan_item_limit",
                 "ep_dcp_takeover_max_time",
+                "ep_dcp_takeover_stream_weight",
                 "ep_dcp_value_compression_enabled",
                 "ep_defragmenter_age_threshold",
                 "ep_defragmenter_chunk_duration",
@@ -6522,6 +6595,9 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_diskqueue_memory",
                 "ep_diskqueue_pending",
                 "ep_enable_chk_merge",
+                "ep_ephemeral_metadata_purge_age",
+                "ep_ephemeral_metadata_purge_chunk_duration",
+                "ep_ephemeral_metadata_purge_interval",
                 "ep_exp_pager_enabled",
                 "ep_exp_pager_initial_run_time",
                 "ep_exp_pager_stime",
@@ -6533,13 +6609,27 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_flush_all",
                 "ep_flush_duration_total",
                 "ep_flushall_enabled",
+                "ep_flusher_batch_defer_delay",
+                "ep_flusher_batch_defer_items",
+                "ep_flusher_batch_max_bytes",
+                "ep_flusher_batch_max_items",
+                "ep_flusher_commit_latency_target",
+                "ep_flushers_per_shard",
                 "ep_getl_default_timeout",
                 "ep_getl_max_timeout",
                 "ep_hlc_drift_ahead_threshold_us",
                 "ep_hlc_drift_behind_threshold_us",
+                "ep_ht_arena",
+                "ep_ht_layout",
                 "ep_ht_locks",
+                "ep_ht_resize_buckets_remaining",
+                "ep_ht_resizes_in_progress",
                 "ep_ht_size",
                 "ep_initfile",
+                "ep_inline_value_num",
+                "ep_inline_value_overhead_saved",
+                "ep_inline_value_saved_per_item",
+                "ep_inline_value_threshold",
                 "ep_io_compaction_read_bytes",
                 "ep_io_compaction_write_bytes",
                 "ep_io_total_read_bytes",
@@ -6638,9 +6728,14 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                 "ep_uuid",
                 "ep_value_size",
                 "ep_vb0",
+                "ep_vb_mem_deletion_chunk_duration",
                 "ep_vb_total",
                 "ep_vbucket_del",
                 "ep_vbucket_del_fail",
+                "ep_vbucket_mem_del_bytes_freed",
+                "ep_vbucket_mem_del_bytes_per_sec",
+                "ep_vbucket_mem_del_max_walltime",
+                "ep_vbucket_mem_del_walltime",
                 "ep_version",
                 "ep_waitforwarmup",
                 "ep_warmup",
@@ -6742,6 +6837,10 @@ static enum test_result test_mb19687_fixed(ENGINE_HANDLE* h,
                           "ep_item_commit_failed",
                           "ep_item_flush_expired",
                           "ep_item_flush_failed",
+                          "ep_flusher_batch_item_limit",
+                          "ep_flusher_batch_byte_limit",
+                          "ep_flusher_batches_limited",
+                          "ep_flusher_commit_latency_avg",
                           "ep_total_persisted",
                           "ep_uncommitted_items"});
 
@@ -6876,8 +6975,13 @@ static enum test_result test_mb19687_variable(ENGINE_HANDLE* h,
         {"memory",
             {
                 "bytes",
+                "ep_arena_mapped_bytes",
+                "ep_arena_used_bytes",
                 "ep_blob_num",
                 "ep_blob_overhead",
+                "ep_inline_value_num",
+                "ep_inline_value_overhead_saved",
+                "ep_inline_value_saved_per_item",
                 "ep_item_num",
                 "ep_kv_size",
                 "ep_max_size",
@@ -7478,6 +7582,11 @@ BaseTestCase testsuite_testcases[] = {
         // Transaction tests
         TestCase("multiple transactions", test_multiple_transactions,
                  test_setup, teardown, NULL, prepare_ep_bucket, cleanup),
+        TestCase("flusher batching deferral", test_batch_defer, test_setup,
+                 teardown,
+                 "flusher_batch_defer_delay=2000;"
+                 "flusher_batch_defer_items=10",
+                 prepare_ep_bucket, cleanup),
 
         // Returning meta tests
         TestCase("test set ret meta", test_set_ret_meta,
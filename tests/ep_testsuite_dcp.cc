@@ -2533,6 +2533,16 @@ static test_result test_dcp_value_compression(ENGINE_HANDLE *h,
             ENGINE_SUCCESS,
             "Failed to enable value compression");
 
+    const char* codecKey = "value_compression_codec";
+    checkeq(h1->dcp.control(h, cookie, ++opaque, codecKey, strlen(codecKey),
+                            "unknown", 7),
+            ENGINE_ENOTSUP,
+            "Expected an unknown value compression codec to be refused");
+    checkeq(h1->dcp.control(h, cookie, ++opaque, codecKey, strlen(codecKey),
+                            "snappy", 6),
+            ENGINE_SUCCESS,
+            "Failed to select the snappy value compression codec");
+
     uint64_t rollback = 0;
     checkeq(h1->dcp.stream_req(h, cookie, 0, opaque, 0, 0, end,
                                vb_uuid, 0, 0, &rollback,
@@ -5617,6 +5627,12 @@ static enum test_result test_set_dcp_param(ENGINE_HANDLE *h,
     func("dcp_consumer_process_buffered_messages_batch_size", 1000, true);
     func("dcp_consumer_process_buffered_messages_yield_limit", 0, false);
     func("dcp_consumer_process_buffered_messages_batch_size", 0, false);
+    func("dcp_producer_step_batch_size", 64, true);
+    func("dcp_producer_step_batch_size", 0, false);
+    func("dcp_takeover_stream_weight", 16, true);
+    func("dcp_takeover_stream_weight", 0, false);
+    func("dcp_backfill_max_scans", 4, true);
+    func("dcp_backfill_bytes_per_sec", 1048576, true);
     return SUCCESS;
 }
 
@@ -63,7 +63,7 @@ public:
         return nextCheckpointItem();
     }
 
-    const std::queue<DcpResponse*>& public_readyQ() {
+    const SpscQueue<DcpResponse*>& public_readyQ() {
         return readyQ;
     }
 
@@ -86,6 +86,11 @@ public:
     bool public_getPendingBackfill() const {
         return pendingBackfill;
     }
+
+    void public_scheduleBackfill(bool reschedule) {
+        std::lock_guard<std::mutex> lh(streamMutex);
+        scheduleBackfill_UNLOCKED(reschedule);
+    }
 };
 
 /* Mock of the PassiveStream class. Wraps the real PassiveStream, but exposes
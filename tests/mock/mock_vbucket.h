@@ -24,6 +24,8 @@
 #include "config.h"
 #include "vbucket.h"
 
+#include <platform/make_unique.h>
+
 class MockVBucket : public VBucket {
 public:
     MockVBucket(id_type i,
@@ -55,6 +57,7 @@ public:
                   nullptr,
                   config,
                   evictionPolicy,
+                  std::make_unique<StoredValueFactory>(st),
                   initState,
                   purgeSeqno,
                   maxCas) {
@@ -96,7 +99,7 @@ public:
         ItemMetaData metadata;
         metadata.revSeqno = v->getRevSeqno() + 1;
         return processSoftDelete(lh,
-                                 *v,
+                                 v,
                                  cas,
                                  metadata,
                                  VBQueueItemCtx(GenerateBySeqno::Yes,
@@ -0,0 +1,409 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+/*
+ * Unit tests for the BasicLinkedList class (the seqno ordered list of items
+ * of an ephemeral vbucket).
+ */
+
+#include "config.h"
+
+#include "hash_table.h"
+#include "item.h"
+#include "linked_list.h"
+#include "stats.h"
+#include "stored-value.h"
+
+#include "makestoreddockey.h"
+
+#include <platform/make_unique.h>
+
+#include <gtest/gtest.h>
+
+#include <limits>
+#include <vector>
+
+static const uint16_t vbid = 0;
+
+class BasicLinkedListTest : public ::testing::Test {
+public:
+    BasicLinkedListTest()
+        : ht(stats,
+             std::make_unique<OrderedStoredValueFactory>(stats),
+             /*size*/ 0,
+             /*locks*/ 1),
+          basicLL(std::make_unique<BasicLinkedList>(vbid, stats)) {
+    }
+
+protected:
+    /**
+     * Adds an item with the given key and seqno to the hash table and
+     * appends it to the list.
+     */
+    void addNewItem(const std::string& key, seqno_t seqno) {
+        StoredDocKey sKey = makeStoredDocKey(key);
+        Item item(sKey, 0, 0, key.data(), key.length());
+        item.setBySeqno(seqno);
+        EXPECT_EQ(MutationStatus::WasClean, ht.set(item));
+
+        OrderedStoredValue* osv = ht.find(sKey)->toOrderedStoredValue();
+        std::lock_guard<std::mutex> lg(sequenceLock);
+        basicLL->appendToList(lg, *osv);
+        basicLL->updateHighSeqno(lg, *osv);
+    }
+
+    /**
+     * Updates the item with the given key to the given seqno (in place),
+     * moving it to the end of the list.
+     */
+    void updateItem(const std::string& key, seqno_t seqno) {
+        OrderedStoredValue* osv =
+                ht.find(makeStoredDocKey(key))->toOrderedStoredValue();
+        std::lock_guard<std::mutex> lg(sequenceLock);
+        EXPECT_EQ(SequenceList::UpdateStatus::Success,
+                  basicLL->updateListElem(lg, *osv));
+        osv->setBySeqno(seqno);
+        basicLL->updateHighSeqno(lg, *osv);
+        basicLL->updateHighestDedupedSeqno(lg, *osv);
+    }
+
+    std::tuple<ENGINE_ERROR_CODE, SequenceList::RangeReadItems, seqno_t>
+    rangeRead(seqno_t start, seqno_t end) {
+        std::unique_lock<std::mutex> lh(sequenceLock);
+        return basicLL->rangeRead(lh, start, end);
+    }
+
+    std::unique_ptr<SequenceList::RangeIterator> makeRangeIterator(
+            seqno_t start, seqno_t end) {
+        std::unique_lock<std::mutex> lh(sequenceLock);
+        ENGINE_ERROR_CODE status;
+        std::unique_ptr<SequenceList::RangeIterator> itr;
+        std::tie(status, itr) = basicLL->makeRangeIterator(lh, start, end);
+        EXPECT_EQ(ENGINE_SUCCESS, status);
+        return itr;
+    }
+
+    /* Returns the seqno of the next item of itr, 0 once all are read */
+    seqno_t nextSeqno(SequenceList::RangeIterator& itr) {
+        auto result = itr.next();
+        EXPECT_EQ(ENGINE_SUCCESS, result.first);
+        return result.second ? result.second->getBySeqno() : 0;
+    }
+
+    /* Hands the item with the given key over to the list as a stale item */
+    void makeStale(const std::string& k) {
+        StoredDocKey key = makeStoredDocKey(k);
+        int bucketNum(0);
+        auto hbl = ht.getLockedBucket(key, &bucketNum);
+        StoredValue* released = ht.unlocked_release(hbl, key);
+        std::lock_guard<std::mutex> lg(sequenceLock);
+        basicLL->markItemStale(lg, released, /*replacement*/ nullptr);
+    }
+
+    /* Returns the seqnos of the items read in the range [start, end] */
+    std::vector<seqno_t> readSeqnos(seqno_t start, seqno_t end) {
+        ENGINE_ERROR_CODE status;
+        SequenceList::RangeReadItems items;
+        std::tie(status, items, std::ignore) = rangeRead(start, end);
+        EXPECT_EQ(ENGINE_SUCCESS, status);
+
+        std::vector<seqno_t> seqnos;
+        for (const auto& item : items) {
+            seqnos.push_back(item->getBySeqno());
+        }
+        return seqnos;
+    }
+
+    EPStats stats;
+
+    /* Hash table owning the OrderedStoredValues */
+    HashTable ht;
+
+    /* Lock the owner of a sequence list is expected to hold */
+    std::mutex sequenceLock;
+
+    std::unique_ptr<BasicLinkedList> basicLL;
+};
+
+TEST_F(BasicLinkedListTest, SetItems) {
+    const int numItems = 3;
+    for (int i = 1; i <= numItems; ++i) {
+        addNewItem("key" + std::to_string(i), i);
+    }
+
+    EXPECT_EQ(numItems, basicLL->getNumItems());
+    EXPECT_EQ(numItems, basicLL->getHighSeqno());
+    EXPECT_EQ((std::vector<seqno_t>{1, 2, 3}), readSeqnos(1, numItems));
+}
+
+TEST_F(BasicLinkedListTest, TestRangeRead) {
+    const int numItems = 5;
+    for (int i = 1; i <= numItems; ++i) {
+        addNewItem("key" + std::to_string(i), i);
+    }
+
+    EXPECT_EQ((std::vector<seqno_t>{2, 3, 4}), readSeqnos(2, 4));
+
+    /* An end beyond the high seqno is trimmed to the high seqno */
+    ENGINE_ERROR_CODE status;
+    SequenceList::RangeReadItems items;
+    seqno_t endSeqno;
+    std::tie(status, items, endSeqno) =
+            rangeRead(3, std::numeric_limits<seqno_t>::max());
+    EXPECT_EQ(ENGINE_SUCCESS, status);
+    EXPECT_EQ(3, items.size());
+    EXPECT_EQ(numItems, endSeqno);
+
+    /* The read range is reset once the read is done */
+    EXPECT_EQ(0, basicLL->getRangeReadBegin());
+    EXPECT_EQ(0, basicLL->getRangeReadEnd());
+}
+
+TEST_F(BasicLinkedListTest, TestRangeReadInvalidRange) {
+    addNewItem("key1", 1);
+    addNewItem("key2", 2);
+
+    /* start > end */
+    EXPECT_EQ(ENGINE_ERANGE, std::get<0>(rangeRead(2, 1)));
+    /* start must be positive */
+    EXPECT_EQ(ENGINE_ERANGE, std::get<0>(rangeRead(0, 2)));
+    /* start > highSeqno */
+    EXPECT_EQ(ENGINE_ERANGE, std::get<0>(rangeRead(3, 4)));
+}
+
+TEST_F(BasicLinkedListTest, UpdateMovesItemToTail) {
+    addNewItem("key1", 1);
+    addNewItem("key2", 2);
+    addNewItem("key3", 3);
+
+    updateItem("key1", 4);
+
+    EXPECT_EQ(3, basicLL->getNumItems());
+    EXPECT_EQ(4, basicLL->getHighSeqno());
+    EXPECT_EQ(4, basicLL->getHighestDedupedSeqno());
+    EXPECT_EQ((std::vector<seqno_t>{2, 3, 4}), readSeqnos(1, 4));
+
+    /* A read which ends before the deduplicated seqno is extended to it so
+       that key1 is not missing from the snapshot */
+    ENGINE_ERROR_CODE status;
+    SequenceList::RangeReadItems items;
+    seqno_t endSeqno;
+    std::tie(status, items, endSeqno) = rangeRead(1, 2);
+    EXPECT_EQ(ENGINE_SUCCESS, status);
+    EXPECT_EQ(3, items.size());
+    EXPECT_EQ(4, endSeqno);
+}
+
+TEST_F(BasicLinkedListTest, MarkStale) {
+    addNewItem("key1", 1);
+    addNewItem("key2", 2);
+    addNewItem("key3", 3);
+
+    /* Release key2 from the hash table and hand it over to the list */
+    const size_t htItems = ht.getNumItems();
+    {
+        StoredDocKey key = makeStoredDocKey("key2");
+        int bucketNum(0);
+        auto hbl = ht.getLockedBucket(key, &bucketNum);
+        StoredValue* released = ht.unlocked_release(hbl, key);
+        std::lock_guard<std::mutex> lg(sequenceLock);
+        basicLL->markItemStale(lg, released, /*replacement*/ nullptr);
+    }
+
+    EXPECT_EQ(htItems - 1, ht.getNumItems());
+    EXPECT_EQ(3, basicLL->getNumItems());
+    EXPECT_EQ(1, basicLL->getNumStaleItems());
+    EXPECT_NE(0, basicLL->getStaleMetadataBytes());
+    EXPECT_NE(0, basicLL->getStaleValueBytes());
+
+    /* An item removed without a replacement is not returned */
+    EXPECT_EQ((std::vector<seqno_t>{1, 3}), readSeqnos(1, 3));
+}
+
+TEST_F(BasicLinkedListTest, MarkStaleWithReplacement) {
+    addNewItem("key1", 1);
+    addNewItem("key2", 2);
+
+    /* Replace key1 by a copy, as an update does while a range read covers
+       the item, and give the copy a new seqno */
+    StoredDocKey key = makeStoredDocKey("key1");
+    {
+        int bucketNum(0);
+        auto hbl = ht.getLockedBucket(key, &bucketNum);
+        StoredValue* newSv;
+        StoredValue* oldSv;
+        std::tie(newSv, oldSv) =
+                ht.unlocked_replaceByCopy(hbl, *ht.unlocked_find(key,
+                                                                 bucketNum,
+                                                                 true,
+                                                                 false));
+        std::lock_guard<std::mutex> lg(sequenceLock);
+        basicLL->markItemStale(lg, oldSv, newSv);
+        basicLL->appendToList(lg, *newSv->toOrderedStoredValue());
+        newSv->setBySeqno(3);
+        basicLL->updateHighSeqno(lg, *newSv->toOrderedStoredValue());
+    }
+
+    EXPECT_EQ(3, basicLL->getNumItems());
+    EXPECT_EQ(1, basicLL->getNumStaleItems());
+
+    /* The stale version is only returned if its replacement is outside the
+       range being read */
+    EXPECT_EQ((std::vector<seqno_t>{1, 2}), readSeqnos(1, 2));
+    EXPECT_EQ((std::vector<seqno_t>{2, 3}), readSeqnos(1, 3));
+}
+
+TEST_F(BasicLinkedListTest, Clear) {
+    addNewItem("key1", 1);
+    addNewItem("key2", 2);
+    {
+        StoredDocKey key = makeStoredDocKey("key1");
+        int bucketNum(0);
+        auto hbl = ht.getLockedBucket(key, &bucketNum);
+        StoredValue* released = ht.unlocked_release(hbl, key);
+        std::lock_guard<std::mutex> lg(sequenceLock);
+        basicLL->markItemStale(lg, released, /*replacement*/ nullptr);
+    }
+
+    {
+        std::lock_guard<std::mutex> lg(sequenceLock);
+        basicLL->clear(lg);
+    }
+
+    EXPECT_EQ(0, basicLL->getNumItems());
+    EXPECT_EQ(0, basicLL->getNumStaleItems());
+    EXPECT_EQ(0, basicLL->getStaleMetadataBytes());
+    EXPECT_EQ(0, basicLL->getHighSeqno());
+}
+
+TEST_F(BasicLinkedListTest, PurgeTombstones) {
+    const int numItems = 4;
+    for (int i = 1; i <= numItems; ++i) {
+        addNewItem("key" + std::to_string(i), i);
+    }
+
+    /* Hand key2 and key3 over to the list as stale items */
+    for (const auto& k : {"key2", "key3"}) {
+        StoredDocKey key = makeStoredDocKey(k);
+        int bucketNum(0);
+        auto hbl = ht.getLockedBucket(key, &bucketNum);
+        StoredValue* released = ht.unlocked_release(hbl, key);
+        std::lock_guard<std::mutex> lg(sequenceLock);
+        basicLL->markItemStale(lg, released, /*replacement*/ nullptr);
+    }
+    EXPECT_EQ(2, basicLL->getNumStaleItems());
+
+    EXPECT_EQ(2, basicLL->purgeTombstones());
+
+    EXPECT_EQ(numItems - 2, basicLL->getNumItems());
+    EXPECT_EQ(0, basicLL->getNumStaleItems());
+    EXPECT_EQ(0, basicLL->getStaleMetadataBytes());
+    EXPECT_EQ((std::vector<seqno_t>{1, 4}), readSeqnos(1, numItems));
+
+    /* Nothing left to purge */
+    EXPECT_EQ(0, basicLL->purgeTombstones());
+}
+
+TEST_F(BasicLinkedListTest, PurgeTombstonesPausesAtDeadline) {
+    const int numItems = 200;
+    for (int i = 1; i <= numItems; ++i) {
+        addNewItem("key" + std::to_string(i), i);
+    }
+    for (int i = 2; i <= numItems; i += 2) {
+        makeStale("key" + std::to_string(i));
+    }
+    EXPECT_EQ(numItems / 2, basicLL->getNumStaleItems());
+
+    /* A passed deadline stops the walk at the first check, after 99 items */
+    bool paused = false;
+    EXPECT_EQ(49, basicLL->purgeTombstones(0, paused));
+    EXPECT_TRUE(paused);
+
+    /* The next purge resumes from where the previous one stopped */
+    EXPECT_EQ(50, basicLL->purgeTombstones(0, paused));
+    EXPECT_TRUE(paused);
+
+    EXPECT_EQ(1,
+              basicLL->purgeTombstones(std::numeric_limits<hrtime_t>::max(),
+                                       paused));
+    EXPECT_FALSE(paused);
+    EXPECT_EQ(0, basicLL->getNumStaleItems());
+    EXPECT_EQ(numItems / 2, basicLL->getNumItems());
+}
+
+TEST_F(BasicLinkedListTest, RangeIterator) {
+    const int numItems = 3;
+    for (int i = 1; i <= numItems; ++i) {
+        addNewItem("key" + std::to_string(i), i);
+    }
+
+    auto itr = makeRangeIterator(1, numItems);
+    ASSERT_TRUE(itr);
+    EXPECT_EQ(numItems, itr->getEnd());
+
+    /* Only one range read at a time */
+    EXPECT_EQ(ENGINE_TMPFAIL, std::get<0>(rangeRead(1, numItems)));
+
+    /* The items are read one at a time, and those already read can be moved
+       by writers */
+    EXPECT_EQ(1, nextSeqno(*itr));
+    EXPECT_EQ(2, nextSeqno(*itr));
+    EXPECT_EQ(2, basicLL->getRangeReadBegin());
+    updateItem("key1", 4);
+
+    /* key1 was moved beyond the snapshot */
+    EXPECT_EQ(3, nextSeqno(*itr));
+    EXPECT_EQ(0, nextSeqno(*itr));
+    EXPECT_EQ(0, basicLL->getRangeReadEnd());
+
+    itr.reset();
+    EXPECT_EQ((std::vector<seqno_t>{2, 3, 4}), readSeqnos(1, 4));
+}
+
+TEST_F(BasicLinkedListTest, PurgeTombstonesSkippedDuringRangeRead) {
+    addNewItem("key1", 1);
+    addNewItem("key2", 2);
+    makeStale("key2");
+
+    auto itr = makeRangeIterator(1, 2);
+    ASSERT_TRUE(itr);
+    EXPECT_EQ(1, nextSeqno(*itr));
+
+    /* The reader may be positioned on the stale item */
+    EXPECT_EQ(0, basicLL->purgeTombstones());
+    EXPECT_EQ(1, basicLL->getNumStaleItems());
+
+    itr.reset();
+    EXPECT_EQ(1, basicLL->purgeTombstones());
+}
+
+TEST_F(BasicLinkedListTest, ClearCancelsRangeIterator) {
+    addNewItem("key1", 1);
+    addNewItem("key2", 2);
+    makeStale("key2");
+
+    auto itr = makeRangeIterator(1, 2);
+    ASSERT_TRUE(itr);
+    EXPECT_EQ(1, nextSeqno(*itr));
+
+    {
+        std::lock_guard<std::mutex> lg(sequenceLock);
+        basicLL->clear(lg);
+    }
+    EXPECT_EQ(0, basicLL->getNumStaleItems());
+    EXPECT_EQ(ENGINE_TMPFAIL, itr->next().first);
+}
@@ -1000,6 +1000,88 @@ TYPED_TEST(CheckpointTest, CursorMovementReplicaMerge) {
                                      HasOperation(queue_op::checkpoint_start)));
 }
 
+// Collapsing closed checkpoints merges the older ones into the last closed
+// checkpoint; a cursor part-way through the latter must carry on from the
+// item it was at.
+TYPED_TEST(CheckpointTest, CollapseWithCursorInLastClosedCheckpoint) {
+    this->vbucket->setState(vbucket_state_replica);
+    this->checkpoint_config = CheckpointConfig(DEFAULT_CHECKPOINT_PERIOD,
+                                               MIN_CHECKPOINT_ITEMS,
+                                               /*numCheckpoints*/ 2,
+                                               /*itemBased*/ true,
+                                               /*keepClosed*/ false,
+                                               /*enableMerge*/ true,
+                                               /*persistenceEnabled*/ true);
+
+    for (unsigned int ii = 0; ii < MIN_CHECKPOINT_ITEMS; ii++) {
+        EXPECT_TRUE(this->queueNewItem("keyA_" + std::to_string(ii)));
+    }
+
+    // A slow cursor, keeping the first checkpoint referenced.
+    const std::string slow_cursor{DCP_CURSOR_PREFIX + std::to_string(1)};
+    this->manager->registerCursorBySeqno(
+            slow_cursor.c_str(), 0, MustSendCheckpointEnd::NO);
+
+    std::vector<queued_item> items;
+    this->manager->getAllItemsForCursor(CheckpointManager::pCursorName, items);
+    EXPECT_EQ(2, this->manager->createNewCheckpoint());
+    for (unsigned int ii = 0; ii < MIN_CHECKPOINT_ITEMS; ii++) {
+        EXPECT_TRUE(this->queueNewItem("keyB_" + std::to_string(ii)));
+    }
+
+    // A cursor part-way through the second checkpoint.
+    const std::string fast_cursor{DCP_CURSOR_PREFIX + std::to_string(2)};
+    this->manager->registerCursorBySeqno(
+            fast_cursor.c_str(), 0, MustSendCheckpointEnd::NO);
+    const auto midKey = makeStoredDocKey("keyB_4");
+    bool isLastMutationItem;
+    while (this->manager->nextItem(fast_cursor, isLastMutationItem)
+                   ->getKey() != midKey) {
+    }
+
+    // Move the persistence cursor into a third checkpoint, leaving the
+    // first two closed.
+    items.clear();
+    this->manager->getAllItemsForCursor(CheckpointManager::pCursorName, items);
+    EXPECT_EQ(3, this->manager->createNewCheckpoint());
+    items.clear();
+    this->manager->getAllItemsForCursor(CheckpointManager::pCursorName, items);
+    ASSERT_EQ(3, this->manager->getNumCheckpoints());
+
+    bool newCheckpointCreated;
+    this->manager->removeClosedUnrefCheckpoints(*this->vbucket,
+                                                newCheckpointCreated);
+    ASSERT_EQ(2, this->manager->getNumCheckpoints())
+            << "The closed checkpoints should have been collapsed";
+
+    // The fast cursor carries on after keyB_4.
+    items.clear();
+    this->manager->getAllItemsForCursor(fast_cursor.c_str(), items);
+    ASSERT_EQ(MIN_CHECKPOINT_ITEMS / 2 + 1, items.size());
+    for (unsigned int ii = 0; ii < MIN_CHECKPOINT_ITEMS / 2 - 1; ii++) {
+        EXPECT_EQ(makeStoredDocKey("keyB_" + std::to_string(ii + 5)),
+                  items[ii]->getKey());
+    }
+    EXPECT_EQ(queue_op::checkpoint_end,
+              items[MIN_CHECKPOINT_ITEMS / 2 - 1]->getOperation());
+    EXPECT_EQ(queue_op::checkpoint_start, items.back()->getOperation());
+
+    // The slow cursor reads the items of both collapsed checkpoints, in
+    // order.
+    items.clear();
+    this->manager->getAllItemsForCursor(slow_cursor.c_str(), items);
+    int64_t lastSeqno = 0;
+    size_t mutations = 0;
+    for (const auto& qi : items) {
+        if (!qi->isCheckPointMetaItem()) {
+            EXPECT_GT(qi->getBySeqno(), lastSeqno);
+            lastSeqno = qi->getBySeqno();
+            ++mutations;
+        }
+    }
+    EXPECT_EQ(2 * MIN_CHECKPOINT_ITEMS, mutations);
+}
+
 //
 // It's critical that the HLC (CAS) is ordered with seqno generation
 // otherwise XDCR may drop a newer bySeqno mutation because the CAS is not
@@ -1207,3 +1289,384 @@ TYPED_TEST(CheckpointTest,
     // Test - second item (duplicate key) should return false.
     EXPECT_FALSE(this->queueNewItem("key"));
 }
+
+// Cursors can be accessed through a handle, which stays valid while the
+// cursor is repositioned and expires once it is removed.
+TYPED_TEST(CheckpointTest, CursorHandle) {
+    const std::string dcp_cursor(DCP_CURSOR_PREFIX + std::to_string(1));
+    EXPECT_TRUE(this->manager->getCursorHandle(dcp_cursor).expired());
+
+    this->manager->registerCursorBySeqno(
+            dcp_cursor, 0, MustSendCheckpointEnd::NO);
+    auto handle = this->manager->getCursorHandle(dcp_cursor);
+    ASSERT_FALSE(handle.expired());
+
+    for (unsigned int ii = 0; ii < 10; ii++) {
+        EXPECT_TRUE(this->queueNewItem("key" + std::to_string(ii)));
+    }
+    EXPECT_EQ(10, this->manager->getNumItemsForCursor(handle));
+    EXPECT_EQ(this->manager->getNumItemsForCursor(dcp_cursor),
+              this->manager->getNumItemsForCursor(handle));
+
+    std::vector<queued_item> items;
+    this->manager->getAllItemsForCursor(handle, items);
+    EXPECT_EQ(11, items.size()); // checkpoint_start + 10 items
+    EXPECT_EQ(0, this->manager->getNumItemsForCursor(dcp_cursor));
+
+    // Repositioning the cursor keeps the handle valid.
+    this->manager->registerCursor(dcp_cursor,
+                                  this->manager->getOpenCheckpointId(),
+                                  /*alwaysFromBeginning*/ true,
+                                  MustSendCheckpointEnd::NO);
+    EXPECT_FALSE(handle.expired());
+    EXPECT_EQ(10, this->manager->getNumItemsForCursor(handle));
+
+    EXPECT_TRUE(this->manager->removeCursor(dcp_cursor));
+    EXPECT_TRUE(handle.expired());
+    EXPECT_EQ(0, this->manager->getNumItemsForCursor(handle));
+    items.clear();
+    auto range = this->manager->getAllItemsForCursor(handle, items);
+    EXPECT_TRUE(items.empty());
+    EXPECT_EQ(0, range.start);
+    EXPECT_EQ(0, range.end);
+}
+
+// Items which all cursors have read and which are persisted can be expelled
+// from the oldest checkpoint, even though it is still referenced.
+TYPED_TEST(CheckpointTest, ExpelCursorConsumedItems) {
+    const std::string dcp_cursor(DCP_CURSOR_PREFIX + std::to_string(1));
+    this->manager->registerCursorBySeqno(
+            dcp_cursor, 0, MustSendCheckpointEnd::NO);
+    for (unsigned int ii = 0; ii < 10; ii++) {
+        EXPECT_TRUE(this->queueNewItem("key" + std::to_string(ii)));
+    }
+    this->vbucket->setPersistenceSeqno(1010);
+
+    // Nothing was read yet.
+    size_t memoryFreed = 0;
+    EXPECT_EQ(0,
+              this->manager->expelUnreferencedCheckpointItems(*this->vbucket,
+                                                              memoryFreed));
+    EXPECT_EQ(0, memoryFreed);
+
+    std::vector<queued_item> items;
+    this->manager->getAllItemsForCursor(CheckpointManager::pCursorName, items);
+    items.clear();
+    this->manager->getAllItemsForCursor(dcp_cursor, items);
+    const size_t numItems = this->manager->getNumItems();
+
+    // Only persisted items are expelled.
+    this->vbucket->setPersistenceSeqno(1004);
+    EXPECT_EQ(4,
+              this->manager->expelUnreferencedCheckpointItems(*this->vbucket,
+                                                              memoryFreed));
+    EXPECT_GT(memoryFreed, 0);
+
+    // The item the cursors are at (key9) is kept.
+    this->vbucket->setPersistenceSeqno(1010);
+    EXPECT_EQ(5,
+              this->manager->expelUnreferencedCheckpointItems(*this->vbucket,
+                                                              memoryFreed));
+    EXPECT_EQ(numItems - 9, this->manager->getNumItems());
+    EXPECT_EQ(0,
+              this->manager->getNumItemsForCursor(
+                      CheckpointManager::pCursorName));
+    EXPECT_EQ(0, this->manager->getNumItemsForCursor(dcp_cursor));
+
+    // An expelled key is no longer de-duplicated.
+    EXPECT_TRUE(this->queueNewItem("key0"));
+    EXPECT_EQ(1, this->manager->getNumItemsForCursor(dcp_cursor));
+
+    // A new cursor can't read the expelled items from memory, so has to
+    // backfill them.
+    const std::string dcp_cursor2(DCP_CURSOR_PREFIX + std::to_string(2));
+    auto result = this->manager->registerCursorBySeqno(
+            dcp_cursor2, 0, MustSendCheckpointEnd::NO);
+    EXPECT_EQ(1010, result.first);
+    EXPECT_TRUE(result.second);
+    items.clear();
+    this->manager->getAllItemsForCursor(dcp_cursor2, items);
+    ASSERT_EQ(3, items.size()); // checkpoint_start, key9 and key0
+    EXPECT_EQ(1010, items.at(1)->getBySeqno());
+    EXPECT_EQ(1011, items.at(2)->getBySeqno());
+}
+
+// A new checkpoint is created once the open one reaches the maximum memory
+// allowed, whatever its number of items; the memory of all checkpoints is
+// accounted bucket-wide.
+TYPED_TEST(CheckpointTest, MemoryBasedCheckpointCreation) {
+    this->manager.reset();
+    const size_t baseMemUsage = this->global_stats.checkpointMemUsage->load();
+    this->createManager();
+    EXPECT_GT(this->global_stats.checkpointMemUsage->load(), baseMemUsage);
+
+    const std::string value(1024 * 1024, 'x');
+    auto queueLargeItem = [this, &value](const std::string& key) {
+        queued_item qi{new Item(makeStoredDocKey(key),
+                                /*flags*/ 0,
+                                /*exp*/ 0,
+                                value.data(),
+                                value.size())};
+        return this->manager->queueDirty(*this->vbucket,
+                                         qi,
+                                         GenerateBySeqno::Yes,
+                                         GenerateCas::Yes);
+    };
+
+    // De-duplicated items only account for their latest revision.
+    ASSERT_TRUE(queueLargeItem("key"));
+    const size_t memUsage = this->global_stats.checkpointMemUsage->load();
+    EXPECT_FALSE(queueLargeItem("key"));
+    EXPECT_EQ(memUsage, this->global_stats.checkpointMemUsage->load());
+
+    // 10 items of 1MB (plus overhead) exceed DEFAULT_CHECKPOINT_MAX_SIZE.
+    for (unsigned int ii = 1; ii < 10; ii++) {
+        ASSERT_TRUE(queueLargeItem("key" + std::to_string(ii)));
+    }
+    EXPECT_EQ(1, this->manager->getNumCheckpoints());
+    EXPECT_GE(this->global_stats.checkpointMemUsage->load() - baseMemUsage,
+              size_t(DEFAULT_CHECKPOINT_MAX_SIZE));
+
+    ASSERT_TRUE(queueLargeItem("key10"));
+    EXPECT_EQ(2, this->manager->getNumCheckpoints());
+    EXPECT_EQ(1, this->manager->getNumOpenChkItems());
+
+    this->manager.reset();
+    EXPECT_EQ(baseMemUsage, this->global_stats.checkpointMemUsage->load());
+}
+
+// A cursor lagging several closed checkpoints behind should get all of their
+// items, in order, followed by those of the open checkpoint.
+TYPED_TEST(CheckpointTest, ItemsForCursorAcrossClosedCheckpoints) {
+    this->checkpoint_config = CheckpointConfig(DEFAULT_CHECKPOINT_PERIOD,
+                                               MIN_CHECKPOINT_ITEMS,
+                                               /*numCheckpoints*/ 10,
+                                               /*itemBased*/ true,
+                                               /*keepClosed*/ false,
+                                               /*enableMerge*/ false,
+                                               /*persistenceEnabled*/ true);
+    this->createManager(0);
+
+    const size_t numCheckpoints = 4;
+    for (unsigned int ii = 0; ii < numCheckpoints * MIN_CHECKPOINT_ITEMS;
+         ii++) {
+        EXPECT_TRUE(this->queueNewItem("key" + std::to_string(ii)));
+    }
+    ASSERT_EQ(numCheckpoints, this->manager->getNumCheckpoints());
+
+    std::vector<queued_item> items;
+    auto range = this->manager->getAllItemsForCursor(
+            CheckpointManager::pCursorName, items);
+
+    // Each closed checkpoint contributes a checkpoint_start and a
+    // checkpoint_end item, the open one just a checkpoint_start.
+    EXPECT_EQ(numCheckpoints * MIN_CHECKPOINT_ITEMS + 2 * numCheckpoints - 1,
+              items.size());
+    int64_t lastSeqno = 0;
+    size_t mutations = 0;
+    for (const auto& qi : items) {
+        if (!qi->isCheckPointMetaItem()) {
+            EXPECT_GT(qi->getBySeqno(), lastSeqno);
+            lastSeqno = qi->getBySeqno();
+            ++mutations;
+        }
+    }
+    EXPECT_EQ(numCheckpoints * MIN_CHECKPOINT_ITEMS, mutations);
+    EXPECT_EQ(lastSeqno, range.end);
+    EXPECT_EQ(0, this->manager->getNumItemsForCursor(
+                         CheckpointManager::pCursorName));
+
+    // Nothing new to read.
+    items.clear();
+    this->manager->getAllItemsForCursor(CheckpointManager::pCursorName, items);
+    EXPECT_TRUE(items.empty());
+}
+
+// A limited read should stop at the first checkpoint boundary past the limit,
+// returning whole snapshots, until the cursor has caught up.
+TYPED_TEST(CheckpointTest, ItemsForCursorWithLimit) {
+    this->checkpoint_config = CheckpointConfig(DEFAULT_CHECKPOINT_PERIOD,
+                                               MIN_CHECKPOINT_ITEMS,
+                                               /*numCheckpoints*/ 10,
+                                               /*itemBased*/ true,
+                                               /*keepClosed*/ false,
+                                               /*enableMerge*/ false,
+                                               /*persistenceEnabled*/ true);
+    this->createManager(0);
+
+    const size_t numCheckpoints = 4;
+    for (unsigned int ii = 0; ii < numCheckpoints * MIN_CHECKPOINT_ITEMS;
+         ii++) {
+        EXPECT_TRUE(this->queueNewItem("key" + std::to_string(ii)));
+    }
+    ASSERT_EQ(numCheckpoints, this->manager->getNumCheckpoints());
+
+    // A single item limit still reads a whole (closed) checkpoint per call.
+    for (size_t chk = 0; chk < numCheckpoints - 1; chk++) {
+        std::vector<queued_item> items;
+        bool moreAvailable = false;
+        auto range = this->manager->getItemsForCursor(
+                CheckpointManager::pCursorName, items, 1, 0, moreAvailable);
+        EXPECT_TRUE(moreAvailable);
+        ASSERT_EQ(MIN_CHECKPOINT_ITEMS + 2, items.size());
+        EXPECT_EQ(queue_op::checkpoint_start, items.front()->getOperation());
+        EXPECT_EQ(queue_op::checkpoint_end, items.back()->getOperation());
+        // The range ends with the checkpoint's snapshot.
+        EXPECT_EQ(items[MIN_CHECKPOINT_ITEMS]->getBySeqno(), range.end);
+    }
+
+    // The open checkpoint is last.
+    std::vector<queued_item> items;
+    bool moreAvailable = true;
+    auto range = this->manager->getItemsForCursor(
+            CheckpointManager::pCursorName, items, 1, 0, moreAvailable);
+    EXPECT_FALSE(moreAvailable);
+    ASSERT_EQ(MIN_CHECKPOINT_ITEMS + 1, items.size());
+    EXPECT_EQ(items.back()->getBySeqno(), range.end);
+    EXPECT_EQ(0, this->manager->getNumItemsForCursor(
+                         CheckpointManager::pCursorName));
+}
+
+// Measure the rate at which front-end threads can queue items while DCP
+// cursors concurrently drain the checkpoints.
+TYPED_TEST(CheckpointTest, QueueDirtyWithConcurrentCursors) {
+    this->checkpoint_config = CheckpointConfig(DEFAULT_CHECKPOINT_PERIOD,
+                                               MIN_CHECKPOINT_ITEMS,
+                                               /*numCheckpoints*/ 10,
+                                               /*itemBased*/ true,
+                                               /*keepClosed*/ false,
+                                               /*enableMerge*/ false,
+                                               /*persistenceEnabled*/ true);
+    this->createManager();
+
+    const size_t n_set_threads = RUNNING_ON_VALGRIND ? NUM_SET_THREADS_VG :
+                                                       NUM_SET_THREADS;
+    const size_t n_dcp_threads = RUNNING_ON_VALGRIND ? NUM_TAP_THREADS_VG :
+                                                       NUM_TAP_THREADS;
+    const size_t n_items = RUNNING_ON_VALGRIND ? NUM_ITEMS_VG : 20000;
+
+    for (size_t i = 0; i < n_dcp_threads; ++i) {
+        ASSERT_TRUE(this->manager->registerCursor(
+                DCP_CURSOR_PREFIX + std::to_string(i),
+                1,
+                false,
+                MustSendCheckpointEnd::NO));
+    }
+
+    ThreadGate gate(n_set_threads + n_dcp_threads);
+    std::atomic<size_t> writersDone(0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < n_dcp_threads; ++i) {
+        threads.emplace_back([this, i, &gate, &writersDone, n_set_threads]() {
+            const std::string name(DCP_CURSOR_PREFIX + std::to_string(i));
+            gate.threadUp();
+            std::vector<queued_item> items;
+            bool done;
+            do {
+                done = writersDone.load() == n_set_threads;
+                items.clear();
+                this->manager->getAllItemsForCursor(name, items);
+                if (i == 0) {
+                    // Stand in for the flusher so checkpoints get removed.
+                    items.clear();
+                    this->manager->getAllItemsForCursor(
+                            CheckpointManager::pCursorName, items);
+                }
+                bool newCheckpointCreated;
+                this->manager->removeClosedUnrefCheckpoints(
+                        *this->vbucket, newCheckpointCreated);
+            } while (!done);
+        });
+    }
+
+    hrtime_t start = gethrtime();
+    for (size_t i = 0; i < n_set_threads; ++i) {
+        threads.emplace_back([this, i, &gate, &writersDone, n_items]() {
+            gate.threadUp();
+            for (size_t j = 0; j < n_items; ++j) {
+                queued_item qi(new Item(
+                        makeStoredDocKey("key-" + std::to_string(i) + "-" +
+                                         std::to_string(j)),
+                        this->vbucket->getId(),
+                        queue_op::set,
+                        0,
+                        0));
+                this->manager->queueDirty(*this->vbucket,
+                                          qi,
+                                          GenerateBySeqno::Yes,
+                                          GenerateCas::Yes);
+            }
+            ++writersDone;
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    hrtime_t end = gethrtime();
+
+    for (size_t i = 0; i < n_dcp_threads; ++i) {
+        EXPECT_EQ(0, this->manager->getNumItemsForCursor(
+                             DCP_CURSOR_PREFIX + std::to_string(i)));
+    }
+
+    double duration_s = (end - start) / double(1000 * 1000 * 1000);
+    RecordProperty("queue_dirty_per_sec",
+                   size_t(n_set_threads * n_items / duration_s));
+}
+
+// Measure the memory overhead per item of an open checkpoint (the keyIndex
+// and the queue), and the rate of queueing new and deduplicated items into
+// it from a single thread.
+TYPED_TEST(CheckpointTest, QueueDirtyMemOverhead) {
+    const size_t n_items = RUNNING_ON_VALGRIND ? NUM_ITEMS_VG :
+                                                 MAX_CHECKPOINT_ITEMS / 2;
+    this->checkpoint_config = CheckpointConfig(DEFAULT_CHECKPOINT_PERIOD,
+                                               MAX_CHECKPOINT_ITEMS,
+                                               /*numCheckpoints*/ 2,
+                                               /*itemBased*/ true,
+                                               /*keepClosed*/ false,
+                                               /*enableMerge*/ false,
+                                               /*persistenceEnabled*/ true);
+    this->createManager();
+
+    std::vector<queued_item> items;
+    for (size_t i = 0; i < n_items; ++i) {
+        items.emplace_back(new Item(makeStoredDocKey("key-" + std::to_string(i)),
+                                    this->vbucket->getId(),
+                                    queue_op::set,
+                                    0,
+                                    0));
+    }
+
+    const size_t initialOverhead = this->global_stats.memOverhead->load();
+    hrtime_t start = gethrtime();
+    for (const auto& qi : items) {
+        this->manager->queueDirty(
+                *this->vbucket, qi, GenerateBySeqno::Yes, GenerateCas::Yes);
+    }
+    hrtime_t end = gethrtime();
+    const size_t overhead =
+            this->global_stats.memOverhead->load() - initialOverhead;
+
+    // Queue new revisions of the same keys.
+    hrtime_t dedupStart = gethrtime();
+    for (size_t i = 0; i < n_items; ++i) {
+        queued_item qi(new Item(items[(i * 7919) % n_items]->getKey(),
+                                this->vbucket->getId(),
+                                queue_op::set,
+                                0,
+                                0));
+        this->manager->queueDirty(
+                *this->vbucket, qi, GenerateBySeqno::Yes, GenerateCas::Yes);
+    }
+    hrtime_t dedupEnd = gethrtime();
+
+    EXPECT_EQ(1, this->manager->getNumCheckpoints());
+    EXPECT_EQ(n_items + 1, this->manager->getNumOpenChkItems());
+
+    RecordProperty("mem_overhead_per_item", overhead / n_items);
+    RecordProperty("queue_dirty_per_sec",
+                   size_t(n_items * 1e9 / (end - start)));
+    RecordProperty("queue_dirty_dedup_per_sec",
+                   size_t(n_items * 1e9 / (dedupEnd - dedupStart)));
+}
@@ -0,0 +1,151 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "chunked_queue.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <vector>
+
+// Small chunks so the tests cross chunk boundaries.
+typedef ChunkedQueue<int, 4> Queue;
+
+static std::vector<int> contents(Queue& queue) {
+    return std::vector<int>(queue.begin(), queue.end());
+}
+
+TEST(ChunkedQueueTest, Empty) {
+    Queue queue;
+    EXPECT_TRUE(queue.empty());
+    EXPECT_EQ(0, queue.size());
+    EXPECT_TRUE(queue.begin() == queue.end());
+    EXPECT_TRUE(queue.rbegin() == queue.rend());
+}
+
+TEST(ChunkedQueueTest, PushBackAndIterate) {
+    Queue queue;
+    const size_t initialMemory = queue.getMemorySize();
+    for (int i = 0; i < 10; i++) {
+        queue.push_back(i);
+    }
+    EXPECT_EQ(10, queue.size());
+    EXPECT_EQ(9, queue.back());
+    EXPECT_EQ(std::vector<int>({0, 1, 2, 3, 4, 5, 6, 7, 8, 9}),
+              contents(queue));
+    EXPECT_EQ(std::vector<int>({9, 8, 7, 6, 5, 4, 3, 2, 1, 0}),
+              std::vector<int>(queue.rbegin(), queue.rend()));
+    EXPECT_EQ(3 * initialMemory, queue.getMemorySize());
+}
+
+TEST(ChunkedQueueTest, EraseKeepsPositions) {
+    Queue queue;
+    std::vector<Queue::iterator> positions;
+    for (int i = 0; i < 10; i++) {
+        queue.push_back(i);
+        positions.push_back(--queue.end());
+    }
+
+    // Dedup-style: append a new element, then erase an old one.
+    queue.push_back(10);
+    EXPECT_TRUE(positions[6] == queue.erase(positions[5]));
+    EXPECT_EQ(10, queue.size());
+    for (int i = 0; i < 10; i++) {
+        if (i != 5) {
+            EXPECT_EQ(i, *positions[i]);
+        }
+    }
+    Queue::iterator pos = positions[6];
+    EXPECT_EQ(4, *(--pos));
+    EXPECT_EQ(std::vector<int>({0, 1, 2, 3, 4, 6, 7, 8, 9, 10}),
+              contents(queue));
+
+    queue.pop_back();
+    EXPECT_EQ(9, queue.back());
+}
+
+TEST(ChunkedQueueTest, SpliceFrontKeepsPositions) {
+    Queue queue;
+    std::vector<Queue::iterator> positions;
+    for (int i = 0; i < 6; i++) {
+        queue.push_back(10 + i);
+        positions.push_back(--queue.end());
+    }
+    // Erase the head, as a checkpoint merge does with its first meta items.
+    queue.erase(queue.begin());
+    queue.erase(queue.begin());
+
+    Queue front;
+    for (int i = 0; i < 5; i++) {
+        front.push_back(i);
+    }
+    Queue::iterator frontLast = --front.end();
+    const size_t memory = queue.getMemorySize() + front.getMemorySize();
+
+    queue.splice_front(front);
+    EXPECT_TRUE(front.empty());
+    EXPECT_TRUE(front.begin() == front.end());
+    EXPECT_EQ(9, queue.size());
+    EXPECT_EQ(memory, queue.getMemorySize());
+    EXPECT_EQ(std::vector<int>({0, 1, 2, 3, 4, 12, 13, 14, 15}),
+              contents(queue));
+    EXPECT_EQ(std::vector<int>({15, 14, 13, 12, 4, 3, 2, 1, 0}),
+              std::vector<int>(queue.rbegin(), queue.rend()));
+    for (int i = 2; i < 6; i++) {
+        EXPECT_EQ(10 + i, *positions[i]);
+    }
+    EXPECT_EQ(12, *(++frontLast));
+    Queue::iterator pos = positions[2];
+    EXPECT_EQ(4, *(--pos));
+
+    // Both queues are still usable.
+    queue.push_back(16);
+    front.push_back(0);
+    EXPECT_EQ(16, queue.back());
+    EXPECT_EQ(std::vector<int>({0}), contents(front));
+
+    // Splicing an empty queue is a no-op.
+    Queue empty;
+    queue.splice_front(empty);
+    EXPECT_EQ(10, queue.size());
+}
+
+TEST(ChunkedQueueTest, FreesDeadChunks) {
+    Queue queue;
+    const size_t chunkMemory = queue.getMemorySize();
+    queue.push_back(0);
+
+    // Repeatedly replacing the last element (as a hot key would) must not
+    // grow the queue beyond a couple of chunks.
+    for (int i = 1; i < 100; i++) {
+        auto last = --queue.end();
+        queue.push_back(i);
+        queue.erase(last);
+        EXPECT_LE(queue.getMemorySize(), 2 * chunkMemory);
+    }
+    EXPECT_EQ(std::vector<int>({99}), contents(queue));
+}
+
+TEST(ChunkedQueueTest, ReleasesErasedElements) {
+    ChunkedQueue<std::shared_ptr<int>, 4> queue;
+    auto value = std::make_shared<int>(1);
+    queue.push_back(value);
+    queue.push_back(value);
+    EXPECT_EQ(3, value.use_count());
+    queue.erase(queue.begin());
+    EXPECT_EQ(2, value.use_count());
+}
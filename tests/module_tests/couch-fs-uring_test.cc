@@ -0,0 +1,190 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "config.h"
+
+#include "couch-kvstore/couch-fs-uring.h"
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+/* Run against both buffered and direct I/O. Where io_uring is not available
+ * the tests only check that no instance is created. */
+class IoUringFileOpsTest : public ::testing::TestWithParam<bool> {
+protected:
+    void SetUp() override {
+        std::remove(path);
+        ops = IoUringFileOps::create(8, GetParam());
+        if (!ops) {
+            std::cerr << "io_uring is not available, skipping" << std::endl;
+        }
+    }
+
+    void TearDown() override {
+        std::remove(path);
+    }
+
+    couch_file_handle open(int oflag) {
+        couch_file_handle handle = ops->constructor(&errinfo);
+        EXPECT_EQ(COUCHSTORE_SUCCESS, ops->open(&errinfo, &handle, path,
+                                                oflag));
+        return handle;
+    }
+
+    void close(couch_file_handle handle) {
+        EXPECT_EQ(COUCHSTORE_SUCCESS, ops->close(&errinfo, handle));
+        ops->destructor(handle);
+    }
+
+    /* Write through the ops, and to the expected contents. */
+    void write(couch_file_handle handle, cs_off_t offset, size_t length) {
+        std::vector<char> data(length);
+        for (size_t ii = 0; ii < length; ++ii) {
+            data[ii] = char(offset + ii * 7);
+        }
+        ASSERT_EQ(ssize_t(length), ops->pwrite(&errinfo, handle, data.data(),
+                                               length, offset));
+        if (contents.size() < offset + length) {
+            contents.resize(offset + length);
+        }
+        std::copy(data.begin(), data.end(), contents.begin() + offset);
+    }
+
+    /* Check the file reads as expected, in reads of the given size. */
+    void checkContents(couch_file_handle handle, size_t readSize) {
+        EXPECT_EQ(cs_off_t(contents.size()), ops->goto_eof(&errinfo, handle));
+        std::vector<char> buf(readSize);
+        for (size_t offset = 0; offset < contents.size(); offset += readSize) {
+            const size_t expected = std::min(readSize,
+                                             contents.size() - offset);
+            ASSERT_EQ(ssize_t(expected),
+                      ops->pread(&errinfo, handle, buf.data(), readSize,
+                                 offset))
+                    << "offset:" << offset;
+            ASSERT_TRUE(std::equal(buf.begin(), buf.begin() + expected,
+                                   contents.begin() + offset))
+                    << "offset:" << offset;
+        }
+    }
+
+    const char* path = "couch-fs-uring_test.couch";
+    std::shared_ptr<IoUringFileOps> ops;
+    couchstore_error_info_t errinfo;
+    std::vector<char> contents;
+};
+
+TEST_P(IoUringFileOpsTest, ReadsOwnWritesBeforeAndAfterSync) {
+    if (!ops) {
+        return;
+    }
+    auto handle = open(O_RDWR | O_CREAT);
+    write(handle, 0, 100);
+    write(handle, 100, 1024 * 1024 + 10);
+    // A header, after a padding gap.
+    write(handle, 1024 * 1024 + 4096, 4096);
+    write(handle, 1024 * 1024 + 8192, 50);
+    checkContents(handle, 4096);
+    checkContents(handle, 1000);
+
+    EXPECT_EQ(COUCHSTORE_SUCCESS, ops->sync(&errinfo, handle));
+    checkContents(handle, 4096);
+    write(handle, contents.size(), 3000);
+    checkContents(handle, 777);
+    close(handle);
+
+    // Direct I/O padding is gone once closed.
+    handle = open(O_RDONLY);
+    checkContents(handle, 4096);
+    checkContents(handle, 333);
+    close(handle);
+}
+
+TEST_P(IoUringFileOpsTest, AppendsAfterReopen) {
+    if (!ops) {
+        return;
+    }
+    auto handle = open(O_RDWR | O_CREAT);
+    write(handle, 0, 10);
+    EXPECT_EQ(COUCHSTORE_SUCCESS, ops->sync(&errinfo, handle));
+    close(handle);
+
+    handle = open(O_RDWR);
+    write(handle, 10, 5000);
+    checkContents(handle, 512);
+    close(handle);
+
+    handle = open(O_RDONLY);
+    checkContents(handle, 512);
+    close(handle);
+}
+
+TEST_P(IoUringFileOpsTest, Overwrite) {
+    if (!ops) {
+        return;
+    }
+    auto handle = open(O_RDWR | O_CREAT);
+    write(handle, 0, 300 * 1024);
+    write(handle, 100, 50);
+    write(handle, 299 * 1024, 2048);
+    checkContents(handle, 4096);
+    EXPECT_EQ(COUCHSTORE_SUCCESS, ops->sync(&errinfo, handle));
+    close(handle);
+
+    handle = open(O_RDONLY);
+    checkContents(handle, 4096);
+    close(handle);
+}
+
+TEST_P(IoUringFileOpsTest, ReadsFromReadahead) {
+    if (!ops) {
+        return;
+    }
+    auto handle = open(O_RDWR | O_CREAT);
+    write(handle, 0, 512 * 1024);
+    close(handle);
+
+    handle = open(O_RDONLY);
+    ops->readahead(path, {{5000, 100}, {200000, 300}, {200100, 9000}});
+
+    // Served from memory: the file is gone.
+    ASSERT_EQ(0, truncate(path, 0));
+    std::vector<char> buf(9000);
+    ASSERT_EQ(100, ops->pread(&errinfo, handle, buf.data(), 100, 5000));
+    EXPECT_TRUE(std::equal(buf.begin(), buf.begin() + 100,
+                           contents.begin() + 5000));
+    ASSERT_EQ(9000, ops->pread(&errinfo, handle, buf.data(), 9000, 200100));
+    EXPECT_TRUE(std::equal(buf.begin(), buf.end(),
+                           contents.begin() + 200100));
+
+    // Not read ahead.
+    EXPECT_EQ(0, ops->pread(&errinfo, handle, buf.data(), 100, 100000));
+
+    ops->clearReadahead();
+    EXPECT_EQ(0, ops->pread(&errinfo, handle, buf.data(), 100, 5000));
+    close(handle);
+}
+
+INSTANTIATE_TEST_CASE_P(BufferedAndDirect,
+                        IoUringFileOpsTest,
+                        ::testing::Bool(),
+                        [](const ::testing::TestParamInfo<bool>& info) {
+                            return info.param ? "Direct" : "Buffered";
+                        });
@@ -23,6 +23,8 @@
  */
 
 #include "connmap.h"
+#include "dcp/backfill.h"
+#include "dcp/backfill-manager.h"
 #include "dcp/dcpconnmap.h"
 #include "dcp/producer.h"
 #include "dcp/stream.h"
@@ -35,6 +37,8 @@
 
 #include <gtest/gtest.h>
 
+#include <map>
+
 /*
  * Mock of the DcpConnMap class.  Wraps the real DcpConnMap, but exposes
  * normally protected methods publically for test purposes.
@@ -272,6 +276,136 @@ TEST_F(StreamTest, test_mb18625) {
         << "Expected no more messages in the readyQ";
 }
 
+/*
+ * Stream tests against an ephemeral bucket; backfills of such a bucket are
+ * served from the in-memory sequence list instead of disk.
+ */
+class EphemeralStreamTest : public StreamTest {
+protected:
+    void SetUp() override {
+        config_string = "bucket_type=ephemeral";
+        StreamTest::SetUp();
+    }
+};
+
+TEST_F(EphemeralStreamTest, InMemoryBackfill) {
+    const int numItems = 3;
+    for (int i = 0; i < numItems; ++i) {
+        store_item(vbid, "key" + std::to_string(i), "value");
+    }
+
+    setup_dcp_stream();
+    MockActiveStream* mock_stream =
+            static_cast<MockActiveStream*>(stream.get());
+
+    // Drive the backfill by hand rather than via the BackfillManager task
+    mock_stream->public_setBackfillTaskRunning(true);
+    mock_stream->public_transitionState(STREAM_BACKFILLING);
+
+    std::unique_ptr<DCPBackfill> backfill =
+            vb0->createDCPBackfill(*engine, stream, 1, numItems);
+    EXPECT_FALSE(backfill->readsFromDisk())
+            << "An ephemeral vbucket should create an in-memory backfill";
+    while (backfill->run() != backfill_finished) {
+    }
+
+    std::unique_ptr<DcpResponse> response(
+            mock_stream->public_nextQueuedItem());
+    ASSERT_TRUE(response);
+    EXPECT_EQ(DcpEvent::SnapshotMarker, response->getEvent());
+
+    for (int seqno = 1; seqno <= numItems; ++seqno) {
+        response.reset(mock_stream->public_nextQueuedItem());
+        ASSERT_TRUE(response);
+        ASSERT_EQ(DcpEvent::Mutation, response->getEvent());
+        EXPECT_EQ(seqno,
+                  static_cast<MutationResponse*>(response.get())
+                          ->getBySeqno());
+    }
+}
+
+/*
+ * Ephemeral stream tests with a connection backfill buffer which holds a
+ * single item.
+ */
+class EphemeralStreamSmallBufferTest : public StreamTest {
+protected:
+    void SetUp() override {
+        config_string = "bucket_type=ephemeral;dcp_backfill_byte_limit=1";
+        StreamTest::SetUp();
+    }
+};
+
+/*
+ * An in-memory backfill only copies as many items as the connection's
+ * backfill buffer holds, and resumes from there once the buffer is drained.
+ */
+TEST_F(EphemeralStreamSmallBufferTest, InMemoryBackfillIsBounded) {
+    const int numItems = 3;
+    for (int i = 0; i < numItems; ++i) {
+        store_item(vbid, "key" + std::to_string(i), "value");
+    }
+
+    setup_dcp_stream();
+    MockActiveStream* mock_stream =
+            static_cast<MockActiveStream*>(stream.get());
+    mock_stream->public_setBackfillTaskRunning(true);
+    mock_stream->public_transitionState(STREAM_BACKFILLING);
+
+    std::unique_ptr<DCPBackfill> backfill =
+            vb0->createDCPBackfill(*engine, stream, 1, numItems);
+    ASSERT_EQ(backfill_success, backfill->run()); // create
+
+    std::unique_ptr<DcpResponse> response;
+    for (int seqno = 1; seqno <= numItems; ++seqno) {
+        ASSERT_EQ(backfill_success, backfill->run());
+
+        // Exactly one item was buffered by the run.
+        response.reset(mock_stream->public_nextQueuedItem());
+        if (seqno == 1) {
+            ASSERT_TRUE(response);
+            EXPECT_EQ(DcpEvent::SnapshotMarker, response->getEvent());
+            response.reset(mock_stream->public_nextQueuedItem());
+        }
+        ASSERT_TRUE(response);
+        ASSERT_EQ(DcpEvent::Mutation, response->getEvent());
+        auto* mutation = static_cast<MutationResponse*>(response.get());
+        EXPECT_EQ(seqno, mutation->getBySeqno());
+        EXPECT_FALSE(mock_stream->public_nextQueuedItem());
+
+        producer->recordBackfillManagerBytesSent(
+                mutation->getItem()->size());
+    }
+
+    EXPECT_EQ(backfill_success, backfill->run()); // complete
+    EXPECT_EQ(backfill_finished, backfill->run());
+}
+
+/*
+ * A backfill rescheduled after the stream's cursor was dropped reads up to
+ * the high seqno of an ephemeral vbucket, as nothing is ever persisted.
+ */
+TEST_F(EphemeralStreamTest, RescheduledBackfill) {
+    const int numItems = 3;
+    for (int i = 0; i < numItems; ++i) {
+        store_item(vbid, "key" + std::to_string(i), "value");
+    }
+
+    setup_dcp_stream();
+    MockActiveStream* mock_stream =
+            static_cast<MockActiveStream*>(stream.get());
+    EXPECT_EQ(uint64_t(numItems), vb0->getMaxBackfillSeqno(*engine));
+
+    mock_stream->public_transitionState(STREAM_BACKFILLING);
+    mock_stream->public_scheduleBackfill(/*reschedule*/true);
+    EXPECT_TRUE(mock_stream->public_isBackfillTaskRunning())
+            << "The rescheduled backfill should cover the in-memory items";
+    EXPECT_EQ(STREAM_BACKFILLING, mock_stream->getState());
+
+    // Required to ensure that the backfillMgr is deleted
+    producer->closeAllStreams();
+}
+
 class ConnectionTest : public DCPTest {
 protected:
     ENGINE_ERROR_CODE set_vb_state(uint16_t vbid, vbucket_state_t state) {
@@ -309,6 +443,33 @@ TEST_F(ConnectionTest, test_mb19955) {
     destroy_mock_cookie(cookie);
 }
 
+// Value compression can be turned off again on a connection.
+TEST_F(ConnectionTest, DisableValueCompression) {
+    const void* cookie = create_mock_cookie();
+    MockDcpProducer producer(*engine, cookie, "test_producer",
+                             /*notifyOnly*/false);
+    auto control = [&producer](const std::string& key,
+                               const std::string& value) {
+        return producer.control(0, key.data(), key.size(),
+                                value.data(), value.size());
+    };
+    EXPECT_FALSE(producer.isValueCodecNegotiated());
+
+    EXPECT_EQ(ENGINE_SUCCESS, control("enable_value_compression", "true"));
+    EXPECT_TRUE(producer.getValueCodec());
+    EXPECT_TRUE(producer.isValueCodecNegotiated());
+
+    EXPECT_EQ(ENGINE_SUCCESS, control("enable_value_compression", "false"));
+    EXPECT_FALSE(producer.getValueCodec());
+    EXPECT_FALSE(producer.isValueCodecNegotiated());
+
+    EXPECT_EQ(ENGINE_SUCCESS, control("value_compression_codec", "snappy"));
+    EXPECT_TRUE(producer.isValueCodecNegotiated());
+    EXPECT_EQ(ENGINE_SUCCESS, control("value_compression_codec", "none"));
+    EXPECT_FALSE(producer.isValueCodecNegotiated());
+    destroy_mock_cookie(cookie);
+}
+
 TEST_F(ConnectionTest, test_maybesendnoop_buffer_full) {
     const void* cookie = create_mock_cookie();
     // Create a Mock Dcp producer
@@ -447,6 +608,24 @@ TEST_F(ConnectionTest, test_deadConnections) {
         << "Dead connections still remain";
 }
 
+/*
+ * A producer still connected when the bucket is destroyed is released by
+ * the DcpConnMap before the backfill scheduler its backfill manager
+ * deregisters from (checked under ASan).
+ */
+TEST_F(ConnectionTest, ConnectedProducerOutlivedByBackfillScheduler) {
+    const void* cookie = create_mock_cookie();
+    dcp_producer_t producer = engine->getDcpConnMap().newProducer(
+            cookie, "test_producer", /*notifyOnly*/false);
+    EXPECT_NE(0, producer) << "producer is null";
+    engine->getDcpConnMap().shutdownAllConnections();
+    producer.reset();
+
+    // The engine (and the DcpConnMap still holding the producer) is
+    // destroyed by TearDown.
+    destroy_mock_cookie(cookie);
+}
+
 TEST_F(ConnectionTest, test_mb17042_duplicate_name_producer_connections) {
     MockDcpConnMap connMap(*engine);
     connMap.initialize(DCP_CONN_NOTIFIER);
@@ -990,3 +1169,112 @@ TEST_F(NotifyTest, test_mb19503_connmap_notify_paused) {
     notifyTest.connMap->notifyAllPausedConnections();
     EXPECT_EQ(1, notifyTest.getCallbacks());
 }
+
+// Without any charge the DcpReadyQueue is a plain FIFO.
+TEST(DcpReadyQueueTest, FifoWithoutCharges) {
+    DcpReadyQueue queue;
+    EXPECT_TRUE(queue.pushUnique(3));
+    EXPECT_TRUE(queue.pushUnique(1));
+    EXPECT_FALSE(queue.pushUnique(3));
+    EXPECT_TRUE(queue.pushUnique(2));
+    EXPECT_EQ(3, queue.size());
+
+    uint16_t vb;
+    for (uint16_t expected : {3, 1, 2}) {
+        ASSERT_TRUE(queue.popFront(vb));
+        EXPECT_EQ(expected, vb);
+        EXPECT_FALSE(queue.exists(vb));
+    }
+    EXPECT_FALSE(queue.popFront(vb));
+}
+
+// Two always-ready streams sending same sized messages share the connection
+// in proportion to their weights.
+TEST(DcpReadyQueueTest, WeightedFairShare) {
+    DcpReadyQueue queue;
+    const uint16_t takeoverVb = 0;
+    const uint16_t bulkVb = 1;
+    queue.pushUnique(bulkVb);
+    queue.pushUnique(takeoverVb);
+
+    std::map<uint16_t, size_t> sent;
+    for (int i = 0; i < 900; i++) {
+        uint16_t vb;
+        ASSERT_TRUE(queue.popFront(vb));
+        queue.charge(vb, 1024, vb == takeoverVb ? 8 : 1);
+        ++sent[vb];
+        queue.pushUnique(vb);
+    }
+    EXPECT_EQ(800, sent[takeoverVb]);
+    EXPECT_EQ(100, sent[bulkVb]);
+}
+
+// A replication backfill waiting for a scan slot gets it before any other
+// producer, even one which asked first.
+TEST_F(DCPTest, BackfillSchedulerReplicationFirst) {
+    BackfillScheduler scheduler(1, 0);
+    auto replication = std::make_shared<BackfillManager>(engine);
+    auto other = std::make_shared<BackfillManager>(engine);
+    double snooze = 0;
+
+    EXPECT_TRUE(scheduler.tryStartScan(
+            other, BackfillScheduler::Priority::Other, snooze));
+    EXPECT_FALSE(scheduler.tryStartScan(
+            replication, BackfillScheduler::Priority::Replication, snooze));
+    EXPECT_EQ(1, scheduler.getRunningScans());
+    EXPECT_EQ(1, scheduler.getWaitingManagers());
+
+    scheduler.scanCompleted();
+    EXPECT_FALSE(scheduler.tryStartScan(
+            other, BackfillScheduler::Priority::Other, snooze));
+    EXPECT_TRUE(scheduler.tryStartScan(
+            replication, BackfillScheduler::Priority::Replication, snooze));
+    EXPECT_EQ(1, scheduler.getWaitingManagers());
+
+    scheduler.scanCompleted();
+    EXPECT_TRUE(scheduler.tryStartScan(
+            other, BackfillScheduler::Priority::Other, snooze));
+    EXPECT_EQ(0, scheduler.getWaitingManagers());
+    scheduler.scanCompleted();
+}
+
+// A disk backfill holds its scan slot across its steps (here, waiting for
+// its range to be persisted) until it completes or is cancelled.
+TEST_F(StreamTest, BackfillHoldsScanSlotUntilComplete) {
+    setup_dcp_stream();
+    auto& scheduler = engine->getDcpConnMap().getBackfillScheduler();
+    auto manager = std::make_shared<BackfillManager>(engine);
+    double snooze = 0;
+    ASSERT_EQ(0, scheduler.getRunningScans());
+
+    DCPBackfillDisk backfill(engine, stream, 1, 1);
+    ASSERT_TRUE(scheduler.tryStartScan(
+            manager, BackfillScheduler::Priority::Other, snooze));
+    backfill.setScanSlot(
+            std::make_unique<BackfillScheduler::ScanSlot>(scheduler));
+    EXPECT_EQ(backfill_snooze, backfill.run());
+    EXPECT_TRUE(backfill.holdsScanSlot());
+    EXPECT_EQ(1, scheduler.getRunningScans());
+
+    backfill.cancel();
+    EXPECT_FALSE(backfill.holdsScanSlot());
+    EXPECT_EQ(0, scheduler.getRunningScans());
+}
+
+// Replication reads may overdraw the bytes-per-second budget by an item,
+// other reads must fit in what is left.
+TEST(BackfillSchedulerTest, ReadBudget) {
+    BackfillScheduler scheduler(0, 1000);
+    EXPECT_TRUE(scheduler.consumeBytes(600,
+                                       BackfillScheduler::Priority::Other));
+    EXPECT_FALSE(scheduler.consumeBytes(600,
+                                        BackfillScheduler::Priority::Other));
+    EXPECT_TRUE(scheduler.consumeBytes(
+            600, BackfillScheduler::Priority::Replication));
+    EXPECT_FALSE(scheduler.consumeBytes(
+            1, BackfillScheduler::Priority::Replication));
+
+    scheduler.setBytesPerSecond(0);
+    EXPECT_TRUE(scheduler.consumeBytes(1000000,
+                                       BackfillScheduler::Priority::Other));
+}
@@ -15,6 +15,7 @@
  *   limitations under the License.
  */
 
+#include "dcp/backfill.h"
 #include "dcp/dcpconnmap.h"
 #include "evp_store_test.h"
 #include "evp_store_single_threaded_test.h"
@@ -169,6 +170,156 @@ TEST_F(SingleThreadedEPStoreTest, test_mb22451) {
     producer->closeAllStreams();
 }
 
+/*
+ * Streams of different connections attached to the same SharedDiskScan each
+ * receive the items of their range from a single scan; a stream cannot
+ * attach to a scan which is past its start, and one needing more than the
+ * scan covers gets a follow-up backfill.
+ */
+TEST_F(SingleThreadedEPStoreTest, SharedDiskScan) {
+    setVBucketStateAndRunPersistTask(vbid, vbucket_state_active);
+    for (int ii = 0; ii < 3; ii++) {
+        store_item(vbid, makeStoredDocKey("key" + std::to_string(ii)),
+                   "value");
+    }
+    flush_vbucket_to_disk(vbid);
+
+    std::vector<dcp_producer_t> producers;
+    std::vector<stream_t> streams;
+    for (int ii = 0; ii < 4; ii++) {
+        producers.push_back(new MockDcpProducer(
+                *engine, cookie, "test_producer" + std::to_string(ii),
+                /*notifyOnly*/false));
+        streams.push_back(new MockActiveStream(
+                static_cast<EventuallyPersistentEngine*>(engine.get()),
+                producers.back(),
+                producers.back()->getName(),
+                /*flags*/0,
+                /*opaque*/0, vbid,
+                /*st_seqno*/0,
+                /*en_seqno*/~0,
+                /*vb_uuid*/0xabcd,
+                /*snap_start_seqno*/0,
+                /*snap_end_seqno*/~0));
+        auto* mock_stream = static_cast<MockActiveStream*>(
+                streams.back().get());
+        // Don't let the stream schedule a backfill of its own.
+        mock_stream->public_setBackfillTaskRunning(true);
+        mock_stream->public_transitionState(STREAM_BACKFILLING);
+    }
+
+    auto scan = std::make_shared<SharedDiskScan>(
+            *engine, vbid, ValueFilter::VALUES_DECOMPRESSED);
+    ASSERT_TRUE(scan->open(streams[0], 2, 3));
+    EXPECT_FALSE(scan->attach(streams[1], 1, 3))
+        << "attached to a scan past the stream's start";
+    EXPECT_TRUE(scan->attach(streams[2], 3, 3));
+    EXPECT_TRUE(scan->attach(streams[3], 2, 10));
+
+    EXPECT_EQ(SharedDiskScan::Status::Finished, scan->scan(streams[0].get()));
+    EXPECT_FALSE(scan->attach(streams[1], 3, 3));
+
+    // Snapshot marker and the items of the stream's range.
+    auto readyQSize = [&streams](int ii) {
+        return static_cast<MockActiveStream*>(streams[ii].get())
+                ->public_readyQ().size();
+    };
+    EXPECT_EQ(3, readyQSize(0));
+    EXPECT_EQ(0, readyQSize(1));
+    EXPECT_EQ(2, readyQSize(2));
+    EXPECT_EQ(3, readyQSize(3));
+
+    EXPECT_FALSE(static_cast<MockActiveStream*>(streams[0].get())
+                         ->public_getPendingBackfill());
+    EXPECT_TRUE(static_cast<MockActiveStream*>(streams[3].get())
+                        ->public_getPendingBackfill());
+
+    scan.reset();
+    for (auto& producer : producers) {
+        producer->closeAllStreams();
+    }
+}
+
+/*
+ * A stream of a shared scan whose connection's backfill buffer is full does
+ * not hold back the others: it is detached from the scan, and resumes on a
+ * scan of its own from the first item it did not receive.
+ */
+TEST_F(SingleThreadedEPStoreTest, SharedDiskScanDetachesBlockedReader) {
+    setVBucketStateAndRunPersistTask(vbid, vbucket_state_active);
+    for (int ii = 0; ii < 3; ii++) {
+        store_item(vbid, makeStoredDocKey("key" + std::to_string(ii)),
+                   "value");
+    }
+    flush_vbucket_to_disk(vbid);
+
+    std::vector<dcp_producer_t> producers;
+    std::vector<stream_t> streams;
+    for (int ii = 0; ii < 2; ii++) {
+        producers.push_back(new MockDcpProducer(
+                *engine, cookie, "test_producer" + std::to_string(ii),
+                /*notifyOnly*/false));
+        streams.push_back(new MockActiveStream(
+                static_cast<EventuallyPersistentEngine*>(engine.get()),
+                producers.back(),
+                producers.back()->getName(),
+                /*flags*/0,
+                /*opaque*/0, vbid,
+                /*st_seqno*/0,
+                /*en_seqno*/~0,
+                /*vb_uuid*/0xabcd,
+                /*snap_start_seqno*/0,
+                /*snap_end_seqno*/~0));
+        auto* mock_stream = static_cast<MockActiveStream*>(
+                streams.back().get());
+        mock_stream->public_setBackfillTaskRunning(true);
+        mock_stream->public_transitionState(STREAM_BACKFILLING);
+    }
+    auto readyQSize = [&streams](int ii) {
+        return static_cast<MockActiveStream*>(streams[ii].get())
+                ->public_readyQ().size();
+    };
+
+    // Fill the backfill buffer of the second connection.
+    const size_t bufferSize =
+            engine->getConfiguration().getDcpBackfillByteLimit();
+    ASSERT_TRUE(producers[1]->recordBackfillManagerBytesRead(bufferSize));
+
+    auto scan = std::make_shared<SharedDiskScan>(
+            *engine, vbid, ValueFilter::VALUES_DECOMPRESSED);
+    ASSERT_TRUE(scan->open(streams[0], 1, 3));
+    ASSERT_TRUE(scan->attach(streams[1], 1, 3));
+
+    // The first stream gets all its items (after its snapshot marker).
+    EXPECT_EQ(SharedDiskScan::Status::Finished, scan->scan(streams[0].get()));
+    EXPECT_EQ(4, readyQSize(0));
+    EXPECT_EQ(1, readyQSize(1));
+
+    uint64_t start = 0;
+    uint64_t end = 0;
+    EXPECT_EQ(SharedDiskScan::Status::Detached,
+              scan->scan(streams[1].get()));
+    ASSERT_TRUE(scan->takeDetached(streams[1].get(), start, end));
+    EXPECT_EQ(1, start);
+    EXPECT_EQ(3, end);
+
+    // Once its buffer drains the second stream gets its items from a scan
+    // of its own, without a second snapshot marker.
+    producers[1]->recordBackfillManagerBytesSent(bufferSize);
+    auto ownScan = std::make_shared<SharedDiskScan>(
+            *engine, vbid, ValueFilter::VALUES_DECOMPRESSED);
+    ASSERT_TRUE(ownScan->resume(streams[1], start, end));
+    EXPECT_EQ(SharedDiskScan::Status::Finished,
+              ownScan->scan(streams[1].get()));
+    EXPECT_EQ(4, readyQSize(1));
+
+    scan.reset();
+    ownScan.reset();
+    for (auto& producer : producers) {
+        producer->closeAllStreams();
+    }
+}
+
 /* Regression / reproducer test for MB-19695 - an exception is thrown
  * (and connection disconnected) if a couchstore file hasn't been re-created
  * yet when doTapVbTakeoverStats() is called as part of
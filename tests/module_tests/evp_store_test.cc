@@ -211,9 +211,9 @@ void EPBucketTest::flush_vbucket_to_disk(uint16_t vbid) {
      * a flushVBucket but in the case of forestdb, a commit is not
      * always called, hence call an explicit commit.
      */
-    uint16_t numShards = store->getVbMap().getNumShards();
+    KVShard* shard = store->getVbMap().getShardByVbId(vbid);
 
-    store->commit(vbid % numShards);
+    store->commit(shard->getId(), shard->getWriterId(vbid));
 }
 
 void EPBucketTest::delete_item(uint16_t vbid, const StoredDocKey& key) {
@@ -274,6 +274,64 @@ TEST_F(EPBucketTest, test_mb20751_deadlock_on_disconnect_delete) {
     frontend_thread_handling_disconnect.join();
 }
 
+class EPBucketWritersTest : public EPBucketTest {
+    void SetUp() override {
+        config_string += "flushers_per_shard=2";
+        EPBucketTest::SetUp();
+    }
+};
+
+// Vbuckets of one shard owned by different writers are persisted through
+// their writer's own KVStore.
+TEST_F(EPBucketWritersTest, FlushThroughOwnKVStore) {
+    const uint16_t otherVb = store->getVbMap().getNumShards();
+    KVShard* shard = store->getVbMap().getShardByVbId(vbid);
+    ASSERT_EQ(shard, store->getVbMap().getShardByVbId(otherVb));
+    ASSERT_EQ(2, shard->getNumWriters());
+    ASSERT_NE(shard->getWriterId(vbid), shard->getWriterId(otherVb));
+    EXPECT_NE(shard->getRWUnderlying(0), shard->getRWUnderlying(1));
+
+    for (auto vb : {vbid, otherVb}) {
+        store->setVBucketState(vb, vbucket_state_active, false);
+        store_item(vb, makeStoredDocKey("key"), "value");
+        flush_vbucket_to_disk(vb);
+    }
+
+    for (auto vb : {vbid, otherVb}) {
+        EXPECT_EQ(shard->getRWUnderlying(shard->getWriterId(vb)),
+                  store->getRWUnderlying(vb));
+        EXPECT_EQ(1, store->getRWUnderlying(vb)->getItemCount(vb));
+    }
+}
+
+// A vbucket owned by another writer than writer 0 of its shard is flushed
+// by its own flusher once notified, and its persistence is reported by the
+// stats snapshot.
+TEST_F(EPBucketWritersTest, OtherWriterFlushesOnNotify) {
+    const uint16_t otherVb = store->getVbMap().getNumShards();
+    KVShard* shard = store->getVbMap().getShardByVbId(otherVb);
+    ASSERT_EQ(1, shard->getWriterId(otherVb));
+    Flusher* flusher = shard->getFlusher(1);
+    ASSERT_EQ(flusher, store->getFlusher(otherVb));
+
+    // The flushers are not started by this fixture: drive writer 1's by hand.
+    ExTask task = new FlusherTask(engine.get(), flusher, shard->getId(), 1);
+    flusher->setTaskId(task->getId());
+    ASSERT_TRUE(flusher->step(task.get()));
+    ASSERT_STREQ("running", flusher->stateName());
+
+    // Storing the item notifies the flusher of the vbucket.
+    store->setVBucketState(otherVb, vbucket_state_active, false);
+    store_item(otherVb, makeStoredDocKey("key"), "value");
+    EXPECT_TRUE(flusher->step(task.get()));
+    EXPECT_EQ(1, store->getRWUnderlying(otherVb)->getItemCount(otherVb));
+
+    store->snapshotStats();
+    std::map<std::string, std::string> persisted;
+    store->getOneROUnderlying()->getPersistedStats(persisted);
+    EXPECT_EQ("1", persisted["ep_total_persisted"]);
+}
+
 class EPStoreEvictionTest : public EPBucketTest,
                              public ::testing::WithParamInterface<std::string> {
     void SetUp() override {
@@ -0,0 +1,98 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "flush_batch_controller.h"
+
+#include <gtest/gtest.h>
+
+using namespace std::chrono;
+
+static const size_t maxItems = 10000;
+static const size_t maxBytes = 64 * 1024 * 1024;
+
+TEST(FlushBatchControllerTest, DisabledWithoutTarget) {
+    FlushBatchController controller(milliseconds(0), maxItems, maxBytes);
+    EXPECT_EQ(0, controller.getItemLimit());
+    EXPECT_EQ(0, controller.getByteLimit());
+
+    // The latency average is maintained regardless.
+    controller.commitCompleted(microseconds(1000));
+    EXPECT_EQ(microseconds(1000), controller.getLatencyAverage());
+    controller.commitCompleted(microseconds(5000));
+    EXPECT_EQ(microseconds(2000), controller.getLatencyAverage());
+    EXPECT_EQ(0, controller.getItemLimit());
+}
+
+TEST(FlushBatchControllerTest, ShrinksAboveTarget) {
+    FlushBatchController controller(milliseconds(10), maxItems, maxBytes);
+    EXPECT_EQ(maxItems, controller.getItemLimit());
+    EXPECT_EQ(maxBytes, controller.getByteLimit());
+
+    // Twice the target: the limits halve.
+    controller.batchFlushed(false, seconds(0));
+    controller.commitCompleted(milliseconds(20));
+    EXPECT_EQ(maxItems / 2, controller.getItemLimit());
+    EXPECT_EQ(maxBytes / 2, controller.getByteLimit());
+
+    // Never below the minimums.
+    for (int ii = 0; ii < 100; ii++) {
+        controller.commitCompleted(seconds(1));
+    }
+    EXPECT_EQ(FlushBatchController::minItems, controller.getItemLimit());
+    EXPECT_EQ(FlushBatchController::minBytes, controller.getByteLimit());
+}
+
+TEST(FlushBatchControllerTest, GrowsBelowTargetOnlyWhenLimited) {
+    FlushBatchController controller(milliseconds(10), maxItems, maxBytes);
+    controller.commitCompleted(milliseconds(1));
+    EXPECT_EQ(maxItems, controller.getItemLimit());
+
+    // A spike takes the average just above the target.
+    controller.commitCompleted(milliseconds(41));
+    const size_t shrunk = controller.getItemLimit();
+    ASSERT_LT(shrunk, maxItems);
+
+    // Batches which were not cut short leave the limits alone.
+    controller.batchFlushed(false, seconds(0));
+    controller.commitCompleted(milliseconds(1));
+    EXPECT_EQ(shrunk, controller.getItemLimit());
+
+    // Grow back step by step, up to the max.
+    controller.batchFlushed(true, seconds(0));
+    controller.commitCompleted(milliseconds(1));
+    EXPECT_EQ(shrunk + maxItems / 32, controller.getItemLimit());
+    for (int ii = 0; ii < 100; ii++) {
+        controller.batchFlushed(true, seconds(0));
+        controller.commitCompleted(milliseconds(1));
+    }
+    EXPECT_EQ(maxItems, controller.getItemLimit());
+    EXPECT_EQ(maxBytes, controller.getByteLimit());
+    EXPECT_EQ(101, controller.getLimitedBatches());
+}
+
+// While the disk queue is aging, latency above the target does not shrink
+// the batches any further.
+TEST(FlushBatchControllerTest, AgingQueueHoldsLimits) {
+    FlushBatchController controller(milliseconds(100), maxItems, maxBytes);
+    controller.batchFlushed(true, seconds(1));
+    controller.commitCompleted(milliseconds(200));
+    EXPECT_EQ(maxItems, controller.getItemLimit());
+
+    // The age only counts until the next commit.
+    controller.commitCompleted(milliseconds(200));
+    EXPECT_LT(controller.getItemLimit(), maxItems);
+}
@@ -20,18 +20,24 @@
 #include <item.h>
 #include <kv_bucket.h>
 #include <platform/cb_malloc.h>
+#include <platform/make_unique.h>
 #include <signal.h>
 #include <stats.h>
 
 #include <algorithm>
+#include <atomic>
 #include <limits>
+#include <random>
+#include <thread>
 
+#include "../mock/mock_ephemeral_vb.h"
 #include "makestoreddockey.h"
 #include "threadtests.h"
 
 #include "programs/engine_testapp/mock_server.h"
 
 #include <gtest/gtest.h>
+#include <valgrind/valgrind.h>
 
 EPStats global_stats;
 
@@ -463,6 +469,63 @@ TEST_F(HashTableTest, ItemAge) {
     EXPECT_EQ(1, v->getValue()->getAge());
 }
 
+TEST_F(HashTableTest, InlineValues) {
+    global_stats.reset();
+    StoredValue::setInlineValueThreshold(16);
+    HashTable ht(global_stats, 5, 1);
+    size_t initialSize = global_stats.currentSize.load();
+
+    StoredDocKey key = makeStoredDocKey("counter");
+    Item item(key, 0, 0, "1", 1);
+    EXPECT_EQ(MutationStatus::WasClean, ht.set(item));
+
+    StoredValue* v(ht.find(key));
+    ASSERT_TRUE(v);
+    EXPECT_EQ(8, v->getInlineCapacity());
+    EXPECT_TRUE(v->isValueInline());
+    EXPECT_TRUE(v->isResident());
+    EXPECT_EQ("1", v->getValue()->to_s());
+    EXPECT_EQ(item.getValue()->length(), v->valuelen());
+
+    // Growing within the capacity stays inline...
+    Item item2(key, 0, 0, "1234", 4);
+    v->setValue(item2, ht);
+    EXPECT_TRUE(v->isValueInline());
+    EXPECT_EQ("1234", v->getValue()->to_s());
+
+    // ...beyond it the value moves to a Blob, and back when it shrinks.
+    Item item3(key, 0, 0, "12345678901234567890", 20);
+    v->setValue(item3, ht);
+    EXPECT_FALSE(v->isValueInline());
+    EXPECT_EQ(item3.getValue().get(), v->getValue().get());
+    v->setValue(item, ht);
+    EXPECT_TRUE(v->isValueInline());
+    EXPECT_EQ("1", v->getValue()->to_s());
+
+    // An item built from it has its own copy of the value.
+    std::unique_ptr<Item> copy(v->toItem(false, 0));
+    EXPECT_EQ("1", copy->getValue()->to_s());
+
+    // Values over the threshold are never inline.
+    StoredDocKey bigKey = makeStoredDocKey("big");
+    Item big(bigKey, 0, 0, "12345678901234567890", 20);
+    EXPECT_EQ(MutationStatus::WasClean, ht.set(big));
+    EXPECT_EQ(0, ht.find(bigKey)->getInlineCapacity());
+    EXPECT_FALSE(ht.find(bigKey)->isValueInline());
+
+    v->markClean();
+    EXPECT_TRUE(ht.unlocked_ejectItem(v, VALUE_ONLY));
+    EXPECT_FALSE(v->isValueInline());
+    EXPECT_FALSE(v->isResident());
+
+    ht.clear();
+    EXPECT_EQ(0, ht.memSize.load());
+    EXPECT_EQ(0, ht.cacheSize.load());
+    EXPECT_EQ(initialSize, global_stats.currentSize.load());
+
+    StoredValue::setInlineValueThreshold(0);
+}
+
 // Check not specifying results in the INITIAL_NRU_VALUE.
 TEST_F(HashTableTest, NRUDefault) {
     // Setup
@@ -499,6 +562,82 @@ TEST_F(HashTableTest, NRUMinimum) {
     EXPECT_EQ(MIN_NRU_VALUE, v->getNRUValue());
 }
 
+// Readers share a bucket; a writer waits for them to finish, and new
+// readers wait for the writer.
+TEST_F(HashTableTest, SharedBucketLock) {
+    HashTable h(global_stats, 5, 1);
+    auto keys = generateKeys(10);
+    storeMany(h, keys);
+
+    auto reader1 = h.getSharedLockedBucket(keys[0]);
+    EXPECT_TRUE(h.unlocked_find(reader1, keys[0]));
+    EXPECT_FALSE(h.unlocked_find(reader1, makeStoredDocKey("aMissingKey")));
+
+    // Another reader of the same lock stripe is not blocked.
+    std::atomic<bool> reader2Held(false);
+    std::atomic<bool> releaseReader2(false);
+    std::thread reader2([&h, &keys, &reader2Held, &releaseReader2]() {
+        auto lh = h.getSharedLockedBucket(keys[1]);
+        EXPECT_TRUE(h.unlocked_find(lh, keys[1]));
+        reader2Held = true;
+        while (!releaseReader2) {
+            std::this_thread::yield();
+        }
+    });
+    while (!reader2Held) {
+        std::this_thread::yield();
+    }
+
+    std::atomic<bool> deleted(false);
+    std::thread writer([&h, &keys, &deleted]() {
+        EXPECT_TRUE(del(h, keys[0]));
+        deleted = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_FALSE(deleted);
+
+    // A new reader waits for the pending writer.
+    std::atomic<bool> reader3Done(false);
+    std::thread reader3([&h, &keys, &deleted, &reader3Done]() {
+        auto lh = h.getSharedLockedBucket(keys[2]);
+        EXPECT_TRUE(deleted);
+        reader3Done = true;
+    });
+
+    reader1.unlock();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    // Still held by reader2 (all keys share the only lock stripe).
+    EXPECT_FALSE(deleted);
+    EXPECT_FALSE(reader3Done);
+    releaseReader2 = true;
+
+    reader2.join();
+    writer.join();
+    reader3.join();
+    EXPECT_TRUE(deleted);
+    EXPECT_TRUE(reader3Done);
+    EXPECT_FALSE(h.find(keys[0]));
+}
+
+// A thread holding a shared lock may not acquire another hash table lock,
+// which could deadlock against writers locking several stripes.
+TEST_F(HashTableTest, SharedBucketLockExcludesOtherLocks) {
+    HashTable h(global_stats, 5, 3);
+    auto keys = generateKeys(10);
+    storeMany(h, keys);
+
+    auto reader = h.getSharedLockedBucket(keys[0]);
+    int bucket_num;
+    EXPECT_THROW(h.getLockedBucket(keys[1], &bucket_num), std::logic_error);
+    EXPECT_THROW(h.getSharedLockedBucket(keys[1]), std::logic_error);
+    EXPECT_THROW(h.find(keys[1]), std::logic_error);
+
+    reader.unlock();
+    EXPECT_TRUE(h.find(keys[1]));
+    auto reader2 = h.getSharedLockedBucket(keys[1]);
+    EXPECT_TRUE(h.unlocked_find(reader2, keys[1]));
+}
+
 /* Test release from HT (but not deletion) of an (HT) element */
 TEST_F(HashTableTest, ReleaseItem) {
     /* Setup with 2 hash buckets and 1 lock */
@@ -526,12 +665,13 @@ TEST_F(HashTableTest, ReleaseItem) {
 
     /* Before removing the HT element, get its pointer as it must be deleted
        after the test */
-    std::unique_ptr<StoredValue> sv1(ht.find(removeKey1));
+    StoredValue* sv1 = ht.find(removeKey1);
 
     std::mutex fakeLock;
     std::unique_lock<std::mutex> htLock(fakeLock);
     ht.unlocked_release(htLock, removeKey1);
     EXPECT_EQ(numItems - 1, ht.getNumItems());
+    StoredValue::destroy(sv1);
 
     /* Remove the element added last. This is certainly the head element of a
        hash bucket */
@@ -540,8 +680,366 @@ TEST_F(HashTableTest, ReleaseItem) {
 
     /* Before removing the HT element, get its pointer as it must be deleted
        after the test */
-    std::unique_ptr<StoredValue> sv2(ht.find(removeKey2));
+    StoredValue* sv2 = ht.find(removeKey2);
 
     ht.unlocked_release(htLock, removeKey2);
     EXPECT_EQ(numItems - 2, ht.getNumItems());
+    StoredValue::destroy(sv2);
+}
+
+/* Create a HashTable of the given layout */
+static std::unique_ptr<HashTable> makeHashTable(HashTable::Layout layout,
+                                                size_t size,
+                                                size_t locks) {
+    return std::make_unique<HashTable>(
+            global_stats,
+            std::make_unique<StoredValueFactory>(global_stats),
+            size,
+            locks,
+            layout);
+}
+
+TEST_F(HashTableTest, BucketizedFind) {
+    /* 5 buckets for 1000 keys; every bucket index overflows */
+    auto h = makeHashTable(HashTable::Layout::Bucketized, 5, 1);
+    EXPECT_EQ(HashTable::Layout::Bucketized, h->getLayout());
+    testFind(*h);
+}
+
+TEST_F(HashTableTest, BucketizedDeletions) {
+    size_t initialSize = global_stats.currentSize.load();
+    auto h = makeHashTable(HashTable::Layout::Bucketized, 5, 1);
+    const int nkeys = 1000;
+
+    auto keys = generateKeys(nkeys);
+    storeMany(*h, keys);
+    EXPECT_EQ(nkeys, count(*h));
+
+    /* Delete every other key; the remaining ones must still be found (from
+       both the index and the overflowed part of the chains) */
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        EXPECT_TRUE(del(*h, keys[i]));
+    }
+    for (size_t i = 0; i < keys.size(); ++i) {
+        EXPECT_EQ(i % 2 == 1, h->find(keys[i]) != nullptr);
+    }
+
+    for (size_t i = 1; i < keys.size(); i += 2) {
+        EXPECT_TRUE(del(*h, keys[i]));
+    }
+    EXPECT_EQ(0, count(*h));
+    EXPECT_EQ(initialSize, global_stats.currentSize.load());
+}
+
+TEST_F(HashTableTest, BucketizedResize) {
+    auto h = makeHashTable(HashTable::Layout::Bucketized, 5, 3);
+
+    auto keys = generateKeys(1000);
+    storeMany(*h, keys);
+    verifyFound(*h, keys);
+
+    h->resize(6143);
+    EXPECT_EQ(6143, h->getSize());
+    verifyFound(*h, keys);
+
+    h->resize(47);
+    EXPECT_EQ(47, h->getSize());
+    verifyFound(*h, keys);
+
+    h->clear();
+    EXPECT_EQ(0, count(*h));
+    EXPECT_FALSE(h->find(keys.front()));
+}
+
+/**
+ * Resize h (of at least two resize steps worth of buckets) a step at a time,
+ * checking the items stay accessible and can be modified mid-resize.
+ */
+static void testIncrementalResize(HashTable& h) {
+    const size_t oldSize = h.getSize();
+    const size_t resizes = h.getNumResizes();
+
+    auto keys = generateKeys(5000);
+    storeMany(h, keys);
+
+    ASSERT_TRUE(h.startResize(6143));
+    EXPECT_TRUE(h.isResizing());
+    EXPECT_EQ(oldSize, h.getResizeBucketsRemaining());
+    // Only one resize at a time.
+    EXPECT_FALSE(h.startResize(12289));
+
+    ASSERT_TRUE(h.resizeStep());
+    EXPECT_TRUE(h.isResizing());
+    EXPECT_LT(h.getResizeBucketsRemaining(), oldSize);
+    EXPECT_EQ(oldSize, h.getSize());
+    EXPECT_EQ(resizes, h.getNumResizes());
+
+    // Items are found whichever array they currently live in, and can be
+    // added and removed.
+    verifyFound(h, keys);
+    auto newKeys = generateKeys(6000, 5000);
+    storeMany(h, newKeys);
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        EXPECT_TRUE(del(h, keys[i]));
+    }
+    verifyFound(h, newKeys);
+
+    // Visiting completes the resize first.
+    EXPECT_EQ(keys.size() / 2 + newKeys.size(), count(h));
+    EXPECT_FALSE(h.isResizing());
+    EXPECT_EQ(0, h.getResizeBucketsRemaining());
+    EXPECT_EQ(6143, h.getSize());
+    EXPECT_EQ(resizes + 1, h.getNumResizes());
+    EXPECT_FALSE(h.resizeStep());
+
+    for (size_t i = 0; i < keys.size(); i++) {
+        EXPECT_EQ(i % 2 != 0, h.find(keys[i]) != nullptr);
+    }
+    verifyFound(h, newKeys);
+}
+
+TEST_F(HashTableTest, IncrementalResize) {
+    HashTable h(global_stats, 3079, 3);
+    const size_t stalls = global_stats.htResizeStallHisto.total();
+    testIncrementalResize(h);
+    EXPECT_LT(stalls, global_stats.htResizeStallHisto.total());
+}
+
+TEST_F(HashTableTest, BucketizedIncrementalResize) {
+    auto h = makeHashTable(HashTable::Layout::Bucketized, 3079, 3);
+    testIncrementalResize(*h);
+}
+
+// Clearing a hash table mid-resize abandons the resize.
+TEST_F(HashTableTest, ClearDuringResize) {
+    HashTable h(global_stats, 3079, 3);
+    auto keys = generateKeys(1000);
+    storeMany(h, keys);
+
+    ASSERT_TRUE(h.startResize(6143));
+    ASSERT_TRUE(h.resizeStep());
+    h.clear();
+
+    EXPECT_FALSE(h.isResizing());
+    EXPECT_EQ(3079, h.getSize());
+    EXPECT_EQ(0, h.getNumItems());
+    EXPECT_FALSE(h.find(keys.front()));
+
+    storeMany(h, keys);
+    verifyFound(h, keys);
+}
+
+TEST_F(HashTableTest, ClearChunk) {
+    size_t initialSize = global_stats.currentSize.load();
+    HashTable h(global_stats, 3079, 3);
+    auto keys = generateKeys(1000);
+    storeMany(h, keys);
+
+    // Each chunk frees whole chains, so at least the requested number of
+    // items, then resumes where the previous one stopped.
+    EXPECT_FALSE(h.clearChunk(100));
+    const size_t remaining = h.getNumItems();
+    EXPECT_LE(remaining, 900);
+    EXPECT_GT(remaining, 0);
+
+    // A resize in progress is taken care of as well.
+    ASSERT_TRUE(h.startResize(6143));
+    ASSERT_TRUE(h.resizeStep());
+    ASSERT_TRUE(h.isResizing());
+    size_t chunks = 1;
+    while (!h.clearChunk(100)) {
+        ++chunks;
+    }
+    EXPECT_LT(chunks, 20);
+    EXPECT_FALSE(h.isResizing());
+    EXPECT_EQ(0, h.getNumItems());
+    EXPECT_EQ(0, h.getItemMemory());
+    EXPECT_EQ(initialSize, global_stats.currentSize.load());
+
+    // The table remains usable.
+    storeMany(h, keys);
+    verifyFound(h, keys);
+}
+
+// An ephemeral vbucket cleared in chunks first unlinks its sequence list, a
+// chunk at a time, and only then frees the items of its HashTable.
+TEST_F(HashTableTest, EphemeralVBucketClearChunk) {
+    CheckpointConfig checkpointConfig;
+    Configuration config;
+    MockEphemeralVBucket vb(0,
+                            vbucket_state_active,
+                            global_stats,
+                            checkpointConfig,
+                            /*kvshard*/ nullptr,
+                            /*lastSeqno*/ 0,
+                            /*lastSnapStart*/ 0,
+                            /*lastSnapEnd*/ 0,
+                            /*table*/ nullptr,
+                            /*newSeqnoCb*/ nullptr,
+                            config,
+                            VALUE_ONLY);
+    auto keys = generateKeys(1000);
+    for (const auto& key : keys) {
+        Item item(key, 0, 0, key.data(), key.size());
+        ASSERT_EQ(MutationStatus::WasClean, vb.public_processSet(item, 0));
+    }
+    ASSERT_EQ(1000, vb.getSeqListNumItems());
+
+    EXPECT_FALSE(vb.clearInMemoryItemsChunk(100));
+    EXPECT_EQ(900, vb.getSeqListNumItems());
+    EXPECT_EQ(1000, vb.ht.getNumItems());
+
+    size_t chunks = 1;
+    while (!vb.clearInMemoryItemsChunk(100)) {
+        ++chunks;
+    }
+    EXPECT_LT(chunks, 30);
+    EXPECT_EQ(0, vb.getSeqListNumItems());
+    EXPECT_EQ(0, vb.ht.getNumItems());
+}
+
+TEST_F(HashTableTest, LayoutFromString) {
+    EXPECT_EQ(HashTable::Layout::Chained,
+              HashTable::layoutFromString("chained"));
+    EXPECT_EQ(HashTable::Layout::Bucketized,
+              HashTable::layoutFromString("bucketized"));
+    EXPECT_THROW(HashTable::layoutFromString("unknown"),
+                 std::invalid_argument);
+}
+
+TEST_F(HashTableTest, ArenaAllocation) {
+    const size_t initialMapped = global_stats.arenaMappedBytes.load();
+    const size_t initialUsed = global_stats.arenaUsedBytes.load();
+    auto h = std::make_unique<HashTable>(
+            global_stats,
+            std::make_unique<StoredValueFactory>(global_stats),
+            5,
+            1,
+            HashTable::Layout::Chained,
+            true);
+    auto keys = generateKeys(100);
+    storeMany(*h, keys);
+    verifyFound(*h, keys);
+
+    StoredValue* v = h->find(keys[0]);
+    ASSERT_TRUE(v);
+    EXPECT_TRUE(v->isArenaAllocated());
+    EXPECT_LT(initialMapped, global_stats.arenaMappedBytes.load());
+    const size_t used = global_stats.arenaUsedBytes.load();
+    EXPECT_LT(initialUsed, used);
+
+    // A deleted object goes back to the arena's free list and is re-used.
+    EXPECT_TRUE(del(*h, keys[0]));
+    EXPECT_GT(used, global_stats.arenaUsedBytes.load());
+    store(*h, keys[0]);
+    EXPECT_EQ(used, global_stats.arenaUsedBytes.load());
+
+    // Clearing the table releases the arena as a whole.
+    h->clear();
+    EXPECT_EQ(0, h->getNumItems());
+    EXPECT_EQ(initialMapped, global_stats.arenaMappedBytes.load());
+    EXPECT_EQ(initialUsed, global_stats.arenaUsedBytes.load());
+}
+
+// Full eviction frees arena allocated StoredValues back to the arena.
+TEST_F(HashTableTest, ArenaFullEviction) {
+    const size_t initialUsed = global_stats.arenaUsedBytes.load();
+    auto h = std::make_unique<HashTable>(
+            global_stats,
+            std::make_unique<StoredValueFactory>(global_stats),
+            5,
+            1,
+            HashTable::Layout::Chained,
+            true);
+    auto keys = generateKeys(100);
+    storeMany(*h, keys);
+
+    for (const auto& key : keys) {
+        int bucket_num(0);
+        auto lh = h->getLockedBucket(key, &bucket_num);
+        StoredValue* v = h->unlocked_find(key,
+                                          bucket_num,
+                                          /*wantsDeleted*/ false,
+                                          /*trackReference*/ false);
+        ASSERT_TRUE(v);
+        ASSERT_TRUE(v->isArenaAllocated());
+        v->markClean();
+        EXPECT_TRUE(h->unlocked_ejectItem(v, FULL_EVICTION));
+        EXPECT_EQ(nullptr, v);
+    }
+    EXPECT_EQ(0, h->getNumItems());
+    EXPECT_EQ(initialUsed, global_stats.arenaUsedBytes.load());
+
+    // The freed objects are re-used.
+    storeMany(*h, keys);
+    verifyFound(*h, keys);
+    h->clear();
+    EXPECT_EQ(initialUsed, global_stats.arenaUsedBytes.load());
 }
+
+/*
+ * Microbenchmark of lookups for the different HashTable layouts. Lookups are
+ * done in a random order over a table larger than the CPU caches, sized as
+ * the HashtableResizer would size it, so they are dominated by memory
+ * latency.
+ */
+class HashTableBenchmarkTest
+        : public HashTableTest,
+          public ::testing::WithParamInterface<HashTable::Layout> {
+protected:
+    void SetUp() override {
+        // Use a large number for normal runs when measuring performance,
+        // but a very small number (enough for functional testing) when
+        // running under Valgrind.
+        const size_t itemCount = RUNNING_ON_VALGRIND ? 100 : 1000000;
+        ht = makeHashTable(GetParam(), 0, 0);
+        keys = generateKeys(itemCount);
+        storeMany(*ht, keys);
+        ht->resize();
+
+        missingKeys = generateKeys(2 * itemCount, itemCount);
+
+        std::mt19937 gen(12345);
+        std::shuffle(keys.begin(), keys.end(), gen);
+        std::shuffle(missingKeys.begin(), missingKeys.end(), gen);
+    }
+
+    /* Look up all the given keys, returning the lookup rate per second */
+    size_t benchmarkFind(const std::vector<StoredDocKey>& toFind,
+                         bool expectFound) {
+        size_t found = 0;
+        hrtime_t start = gethrtime();
+        for (const auto& key : toFind) {
+            int bucket_num(0);
+            auto lh = ht->getLockedBucket(key, &bucket_num);
+            if (ht->unlocked_find(key,
+                                  bucket_num,
+                                  /*wantsDeleted*/ false,
+                                  /*trackReference*/ false)) {
+                ++found;
+            }
+        }
+        hrtime_t end = gethrtime();
+        EXPECT_EQ(expectFound ? toFind.size() : 0, found);
+
+        double duration_s = (end - start) / double(1000 * 1000 * 1000);
+        return size_t(toFind.size() / duration_s);
+    }
+
+    std::unique_ptr<HashTable> ht;
+    std::vector<StoredDocKey> keys;
+    std::vector<StoredDocKey> missingKeys;
+};
+
+TEST_P(HashTableBenchmarkTest, FindHit) {
+    RecordProperty("lookups_per_sec", benchmarkFind(keys, true));
+}
+
+TEST_P(HashTableBenchmarkTest, FindMiss) {
+    RecordProperty("lookups_per_sec", benchmarkFind(missingKeys, false));
+}
+
+INSTANTIATE_TEST_CASE_P(Layouts,
+                        HashTableBenchmarkTest,
+                        ::testing::Values(HashTable::Layout::Chained,
+                                          HashTable::Layout::Bucketized), );
@@ -279,6 +279,87 @@ TEST(CouchKVStoreTest, StatsTest) {
     EXPECT_GE(io_total_write_bytes, io_write_bytes);
 }
 
+// Whether a saved document is an insert or an update is found while the
+// documents are saved, and the flush's disk reads are accounted.
+TEST(CouchKVStoreTest, SaveDocsReportsExistingDocs) {
+    std::string data_dir("/tmp/kvstore-test");
+    cb::io::rmrf(data_dir.c_str());
+
+    KVStoreConfig config(
+            1024, 4, data_dir, "couchdb", 0, false /*persistnamespace*/);
+    auto kvstore = setup_kv_store(config);
+
+    std::vector<bool> insertions;
+    CustomCallback<mutation_result> wc([&insertions](mutation_result result) {
+        EXPECT_EQ(1, result.first);
+        insertions.push_back(result.second);
+    });
+
+    kvstore->begin();
+    Item first(makeStoredDocKey("key1"), 0, 0, "value", 5);
+    kvstore->set(first, wc);
+    EXPECT_TRUE(kvstore->commit());
+
+    kvstore->begin();
+    Item update(makeStoredDocKey("key1"), 0, 0, "value2", 6);
+    kvstore->set(update, wc);
+    Item second(makeStoredDocKey("key2"), 0, 0, "value", 5);
+    kvstore->set(second, wc);
+    EXPECT_TRUE(kvstore->commit());
+
+    EXPECT_EQ(std::vector<bool>({true, false, true}), insertions);
+
+    std::map<std::string, std::string> stats;
+    kvstore->addStats(add_stat_callback, &stats);
+    ASSERT_EQ(1, stats.count("rw_0:io_flush_reads"));
+    ASSERT_EQ(1, stats.count("rw_0:io_flush_reads_per_item"));
+    EXPECT_GE(stod(stats["rw_0:io_flush_reads_per_item"]), 0);
+}
+
+// Documents persisted and BG fetched through the io_uring file I/O backend
+// (or the sync one it falls back to where io_uring is not available).
+TEST(CouchKVStoreTest, IoUringBackend) {
+    std::string data_dir("/tmp/kvstore-test");
+    cb::io::rmrf(data_dir.c_str());
+
+    KVStoreConfig config(
+            1024, 4, data_dir, "couchdb", 0, false /*persistnamespace*/);
+    config.setIoBackend("io_uring", 8, false);
+    auto kvstore = setup_kv_store(config);
+
+    std::vector<Item> items;
+    for (int ii = 0; ii < 50; ++ii) {
+        std::string key("key" + std::to_string(ii));
+        std::string value(100 + ii * 200, char('a' + ii % 26));
+        items.push_back(Item(makeStoredDocKey(key), 0, 0, value.data(),
+                             value.size(), nullptr, 0, 0, ii + 1));
+    }
+    WriteCallback wc;
+    kvstore->begin();
+    for (const auto& item : items) {
+        kvstore->set(item, wc);
+    }
+    EXPECT_TRUE(kvstore->commit());
+
+    vb_bgfetch_queue_t itms;
+    for (const auto& item : items) {
+        vb_bgfetch_item_ctx_t ctx;
+        ctx.isMetaOnly = false;
+        ctx.bgfetched_list.emplace_back(new VBucketBGFetchItem(nullptr, false));
+        itms[item.getKey()] = std::move(ctx);
+    }
+    kvstore->getMulti(0, itms);
+
+    for (const auto& item : items) {
+        auto& fetched = itms[item.getKey()].bgfetched_list.front()->value;
+        ASSERT_EQ(ENGINE_SUCCESS, fetched.getStatus());
+        EXPECT_EQ(std::string(item.getData(), item.getNBytes()),
+                  std::string(fetched.getValue()->getData(),
+                              fetched.getValue()->getNBytes()));
+        delete fetched.getValue();
+    }
+}
+
 // Verify the compaction stats returned from operations are accurate.
 TEST(CouchKVStoreTest, CompactStatsTest) {
     std::string data_dir("/tmp/kvstore-test");
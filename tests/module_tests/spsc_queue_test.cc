@@ -0,0 +1,97 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ *     Copyright 2017 Couchbase, Inc
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License");
+ *   you may not use this file except in compliance with the License.
+ *   You may obtain a copy of the License at
+ *
+ *       http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS,
+ *   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *   See the License for the specific language governing permissions and
+ *   limitations under the License.
+ */
+
+#include "spsc_queue.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <thread>
+
+// Small blocks so the tests cross block boundaries.
+typedef SpscQueue<int, 4> Queue;
+
+TEST(SpscQueueTest, Empty) {
+    Queue queue;
+    EXPECT_TRUE(queue.empty());
+    EXPECT_EQ(0, queue.size());
+}
+
+TEST(SpscQueueTest, Fifo) {
+    Queue queue;
+    for (int i = 0; i < 10; i++) {
+        queue.push(i);
+    }
+    EXPECT_EQ(10, queue.size());
+    for (int i = 0; i < 10; i++) {
+        ASSERT_FALSE(queue.empty());
+        EXPECT_EQ(i, queue.front());
+        queue.pop();
+    }
+    EXPECT_TRUE(queue.empty());
+
+    // Interleaved pushes and pops, across blocks.
+    for (int i = 0; i < 10; i++) {
+        queue.push(i);
+        queue.push(i + 100);
+        EXPECT_EQ(i, queue.front());
+        queue.pop();
+        EXPECT_EQ(i + 100, queue.front());
+        queue.pop();
+    }
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST(SpscQueueTest, ClearReleasesElements) {
+    SpscQueue<std::shared_ptr<int>, 4> queue;
+    auto value = std::make_shared<int>(1);
+    for (int i = 0; i < 6; i++) {
+        queue.push(value);
+    }
+    EXPECT_EQ(7, value.use_count());
+    queue.pop();
+    EXPECT_EQ(6, value.use_count());
+    queue.clear();
+    EXPECT_TRUE(queue.empty());
+    EXPECT_EQ(1, value.use_count());
+}
+
+// One thread pushing while another pops: every element must be received
+// once, in order.
+TEST(SpscQueueTest, ConcurrentProducerConsumer) {
+    Queue queue;
+    const int count = 100000;
+
+    std::thread producer([&queue, count]() {
+        for (int i = 0; i < count; i++) {
+            queue.push(i);
+        }
+    });
+
+    int expected = 0;
+    while (expected < count) {
+        if (queue.empty()) {
+            std::this_thread::yield();
+            continue;
+        }
+        EXPECT_EQ(expected, queue.front());
+        queue.pop();
+        ++expected;
+    }
+    producer.join();
+    EXPECT_TRUE(queue.empty());
+}